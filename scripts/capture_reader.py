@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+# Reader for the raw sensor capture file /capture.bin
+# Usage: capture_reader.py <capture file>            prints all records
+#        capture_reader.py <capture file> --nmea     writes the raw GPS bytes to stdout
+# As a module: for time_ms, kind, data in records(blob): ...
+# time_ms is the device millis() of the record, data depends on the kind:
+#   "time"  (millis, unix_s)
+#   "gps"   raw UART bytes
+#   "acc"   (x, y, z) in mg
+#   "batt"  (mv, percent)
+#   "mac"   (event, fields), see MAC_EVENTS
+
+import struct
+import sys
+
+KINDS = {0: "time", 1: "gps", 2: "acc", 3: "batt", 4: "mac"}
+MAC_EVENTS = {1: "tx", 2: "rx", 3: "joined", 4: "class"}
+
+
+def records(blob):
+    """Yield (time_ms, kind, data) for each record of a capture file"""
+    pos = 0
+    now = 0
+    while pos + 4 <= len(blob):
+        rtype, length, delta = struct.unpack_from("<BBH", blob, pos)
+        payload = blob[pos + 4:pos + 4 + length]
+        if len(payload) != length:
+            # Truncated record at the end of the file
+            break
+        pos += 4 + length
+        now = (now + delta) & 0xFFFFFFFF
+        kind = KINDS.get(rtype, "unknown")
+        if kind == "time":
+            millis, unix = struct.unpack("<II", payload)
+            now = millis
+            data = (millis, unix)
+        elif kind == "acc":
+            data = struct.unpack("<hhh", payload)
+        elif kind == "batt":
+            data = struct.unpack("<HH", payload)
+        elif kind == "mac":
+            event = MAC_EVENTS.get(payload[0], payload[0])
+            fields = payload[1:]
+            if event == "tx":
+                fields = {"port": fields[0], "len": fields[1]}
+            elif event == "rx":
+                port, size, rssi, snr = struct.unpack("<BBhb", fields)
+                fields = {"port": port, "len": size, "rssi": rssi, "snr": snr}
+            elif event == "class":
+                fields = {"class": "ABC"[fields[0]]}
+            data = (event, fields)
+        else:
+            data = payload
+        yield now, kind, data
+
+
+def nmea(blob):
+    """Raw GPS byte stream of a capture file, to replay into gpsPollStep()"""
+    return b"".join(data for _, kind, data in records(blob) if kind == "gps")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print("Usage: capture_reader.py <capture file> [--nmea]")
+        sys.exit(1)
+    with open(sys.argv[1], "rb") as file:
+        blob = file.read()
+    if "--nmea" in sys.argv:
+        sys.stdout.buffer.write(nmea(blob))
+        sys.exit(0)
+    for time_ms, kind, data in records(blob):
+        if kind == "gps":
+            data = data.decode("ascii", "replace").rstrip("\r\n")
+        print("%10d %-6s %s" % (time_ms, kind, data))
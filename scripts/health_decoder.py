@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+# Decoder for the health telemetry frame sent on FPort 10
+# Usage: health_decoder.py <payload as hex string>
+#        health_decoder.py 1020203c...
+# Since frame version 3 the counters and min/max/mean values cover the
+# interval since the previous health frame, older versions are totals
+# since the start of the device.
+
+import sys
+
+# Field name and number of bits, in frame order, MSB first
+FIELDS = [
+    ("version", 4),
+    ("join_tries", 8),
+    ("joins", 8),
+    ("send_ok", 12),
+    ("send_errors", 12),
+    ("last_send_error", 4),
+    ("gps_no_fix", 12),
+    ("gps_no_fix_streak_max", 8),
+    ("acc_wakes", 12),
+    ("ble_connects", 8),
+    ("downlinks", 8),
+    ("ttff_min_s", 8),
+    ("ttff_max_s", 8),
+    ("ttff_mean_s", 8),
+    ("wake_to_uplink_min_100ms", 8),
+    ("wake_to_uplink_max_100ms", 8),
+    ("wake_to_uplink_mean_100ms", 8),
+    ("batt_min_percent", 7),
+    ("batt_max_percent", 7),
+    ("batt_mean_percent", 7),
+    ("uptime_h", 12),
+    # Added in frame version 2
+    ("cn0_mean_dbhz", 6),
+    ("sats_in_view", 6),
+    ("fix_type", 2),
+]
+
+
+def decode(payload):
+    bits = "".join("{:08b}".format(b) for b in payload)
+    result = {}
+    pos = 0
+    for name, width in FIELDS:
+        if pos + width > len(bits):
+            break
+        result[name] = int(bits[pos:pos + width], 2)
+        pos += width
+    return result
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("Usage: health_decoder.py <payload hex>")
+        sys.exit(1)
+    for key, value in decode(bytes.fromhex(sys.argv[1])).items():
+        print("%-26s %d" % (key, value))
@@ -0,0 +1,35 @@
+# Static RAM report
+# Lists all symbols in .data and .bss sorted by size after the firmware is linked.
+# Used with "extra_scripts = post:scripts/ram_report.py" in platformio.ini
+Import("env")
+
+import subprocess
+
+
+def ram_report(source, target, env):
+    elf = str(target[0])
+    nm = env.subst("$CC").replace("gcc", "nm")
+    output = subprocess.check_output([nm, "--size-sort", "--reverse-sort", "--print-size", "--demangle", elf])
+
+    symbols = []
+    total = 0
+    for line in output.decode("utf-8", "ignore").splitlines():
+        parts = line.split(None, 3)
+        if len(parts) < 4:
+            continue
+        size = int(parts[1], 16)
+        kind = parts[2]
+        # b/B = .bss, d/D = .data
+        if kind in ("b", "B", "d", "D"):
+            symbols.append((size, kind.upper(), parts[3]))
+            total += size
+
+    print("")
+    print("Static RAM by symbol (.data and .bss), total %d bytes" % total)
+    print("-------------------------------------------------------")
+    for size, kind, name in symbols[:40]:
+        print("%7d %s %s" % (size, "data" if kind == "D" else "bss ", name))
+    print("")
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", ram_report)
@@ -11,6 +11,19 @@
 #include "main.h"
 
 void accIntHandler(void);
+void accAlarmHandler(void);
+
+/** LIS3DH registers of the second interrupt generator and the click engine */
+#define ACC_INT2_CFG 0x34
+#define ACC_INT2_SRC 0x35
+#define ACC_INT2_THS 0x36
+#define ACC_INT2_DURATION 0x37
+#define ACC_CLICK_CFG 0x38
+#define ACC_CLICK_SRC 0x39
+#define ACC_CLICK_THS 0x3A
+#define ACC_TIME_LIMIT 0x3B
+#define ACC_TIME_LATENCY 0x3C
+#define ACC_TIME_WINDOW 0x3D
 
 /** The LIS3DH sensor */
 LIS3DH accSensor(I2C_MODE, 0x18);
@@ -21,6 +34,14 @@ SemaphoreHandle_t loopEnable;
 /** Required for give semaphore from ISR */
 BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
+/** Time of the last motion interrupt */
+static volatile time_t lastAccInt = 0;
+
+/** Flag if an alarm interrupt is waiting to be handled */
+volatile bool accAlarmPending = false;
+/** Time of the alarm interrupt */
+volatile uint32_t accAlarmTime = 0;
+
 /**
  * @brief Initialize LIS3DH 3-axis 
  * acceleration sensor
@@ -30,10 +51,12 @@ BaseType_t xHigherPriorityTaskWoken = pdFALSE;
  */
 bool initACC(void)
 {
-	// Setup interrupt pin
+	// Setup interrupt pins
 	pinMode(INT1_PIN, INPUT);
+	pinMode(INT2_PIN, INPUT);
 
-	accSensor.settings.accelSampleRate = 10; //Hz.  Can be: 0,1,10,25,50,100,200,400,1600,5000 Hz
+	// Free fall and click need a faster sample rate than the motion wake up
+	accSensor.settings.accelSampleRate = 50; //Hz.  Can be: 0,1,10,25,50,100,200,400,1600,5000 Hz
 	accSensor.settings.accelRange = 2;		 //Max G force readable.  Can be: 2, 4, 8, 16
 
 	accSensor.settings.adcEnabled = 0;
@@ -42,8 +65,10 @@ bool initACC(void)
 	accSensor.settings.yAccelEnabled = 1;
 	accSensor.settings.zAccelEnabled = 1;
 
+	i2cAcquire(I2C_CLIENT_ACC);
 	if (accSensor.begin() != 0)
 	{
+		i2cRelease(I2C_CLIENT_ACC);
 		return false;
 	}
 
@@ -61,19 +86,40 @@ bool initACC(void)
 	dataToWrite |= 0x01; // 1 * 1/50 s = 20ms
 	accSensor.writeRegister(LIS3DH_INT1_DURATION, dataToWrite);
 
+	// Free fall on generator 2, all axes low at the same time
+	dataToWrite = 0;
+	dataToWrite |= 0x80;								  // AND combination
+	dataToWrite |= 0x10;								  // Z low
+	dataToWrite |= 0x04;								  // Y low
+	dataToWrite |= 0x01;								  // X low
+	accSensor.writeRegister(ACC_INT2_CFG, dataToWrite);
+	accSensor.writeRegister(ACC_INT2_THS, ACC_FREEFALL_THS / 16); // 16 mg per LSB at 2g range
+	accSensor.writeRegister(ACC_INT2_DURATION, ACC_FREEFALL_DURATION / 20); // 20 ms per LSB at 50 Hz
+
+	// Single click on all axes for shocks
+	accSensor.writeRegister(ACC_CLICK_CFG, 0x15);
+	accSensor.writeRegister(ACC_CLICK_THS, ACC_SHOCK_THS / 16);
+	accSensor.writeRegister(ACC_TIME_LIMIT, 0x05);	 // Max 100 ms above the threshold
+	accSensor.writeRegister(ACC_TIME_LATENCY, 0x0A); // 200 ms before the next click
+	accSensor.writeRegister(ACC_TIME_WINDOW, 0x00);	 // No double click
+
 	accSensor.readRegister(&dataToWrite, LIS3DH_CTRL_REG5);
-	dataToWrite &= 0xF3;									//Clear bits of interest
+	dataToWrite &= 0xF1;									//Clear bits of interest
 	dataToWrite |= 0x08;									//Latch interrupt (Cleared by reading int1_src)
+	dataToWrite |= 0x02;									//Latch interrupt 2 (Cleared by reading int2_src)
 	accSensor.writeRegister(LIS3DH_CTRL_REG5, dataToWrite); // Set interrupt to latching
 
 	dataToWrite = 0;
 	dataToWrite |= 0x40; //AOI1 event (Generator 1 interrupt on pin 1)
-	dataToWrite |= 0x20; //AOI2 event ()
 	accSensor.writeRegister(LIS3DH_CTRL_REG3, dataToWrite);
 
-	accSensor.writeRegister(LIS3DH_CTRL_REG6, 0x00); // No interrupt on pin 2
+	dataToWrite = 0;
+	dataToWrite |= 0x80; // Click interrupt on pin 2
+	dataToWrite |= 0x20; // AOI2 event (Generator 2 interrupt on pin 2)
+	accSensor.writeRegister(LIS3DH_CTRL_REG6, dataToWrite);
 
-	accSensor.writeRegister(LIS3DH_CTRL_REG2, 0x01); // Enable high pass filter
+	accSensor.writeRegister(LIS3DH_CTRL_REG2, 0x05); // Enable high pass filter for generator 1 and click
+	i2cRelease(I2C_CLIENT_ACC);
 
 	// Create the semaphore
 	loopEnable = xSemaphoreCreateBinary();
@@ -83,9 +129,11 @@ bool initACC(void)
 	xSemaphoreTake(loopEnable, (TickType_t)10);
 
 	clearAccInt();
+	accReadAlarm();
 
-	// Set the interrupt callback function
+	// Set the interrupt callback functions
 	attachInterrupt(INT1_PIN, accIntHandler, RISING);
+	attachInterrupt(INT2_PIN, accAlarmHandler, RISING);
 
 	return true;
 }
@@ -97,17 +145,62 @@ bool initACC(void)
  */
 void accIntHandler(void)
 {
+	powerCountWake(WAKE_ACC);
+	healthInc(HEALTH_ACC_WAKE);
+	lastAccInt = millis();
+	posCacheAccInt();
 	xSemaphoreGiveFromISR(loopEnable, &xHigherPriorityTaskWoken);
 }
 
+/**
+ * @brief ACC alarm interrupt handler
+ * @note Free fall or shock, wakes up the main loop
+ *
+ */
+void accAlarmHandler(void)
+{
+	powerCountWake(WAKE_ACC);
+	accAlarmTime = millis();
+	accAlarmPending = true;
+	xSemaphoreGiveFromISR(loopEnable, &xHigherPriorityTaskWoken);
+}
+
+/**
+ * @brief Read and clear the alarm sources
+ * @note A shock while the tracker is parked is reported as tamper
+ *
+ * @return uint8_t Alarm type, see ALARM_xxx definitions
+ */
+uint8_t accReadAlarm(void)
+{
+	uint8_t int2Src;
+	uint8_t clickSrc;
+	i2cAcquire(I2C_CLIENT_ACC);
+	accSensor.readRegister(&int2Src, ACC_INT2_SRC);
+	accSensor.readRegister(&clickSrc, ACC_CLICK_SRC);
+	i2cRelease(I2C_CLIENT_ACC);
+	if (int2Src & 0x40)
+	{
+		return ALARM_FREE_FALL;
+	}
+	if (clickSrc & 0x40)
+	{
+		return posCache.valid ? ALARM_TAMPER : ALARM_SHOCK;
+	}
+	return ALARM_NONE;
+}
+
 /**
  * @brief Clear ACC interrupt register to enable next wakeup
  * 
  */
 void clearAccInt(void)
 {
+	PROF_SCOPE(PROF_CLEAR_ACC_INT);
 	uint8_t dataRead;
+	i2cAcquire(I2C_CLIENT_ACC);
 	accSensor.readRegister(&dataRead, LIS3DH_INT1_SRC);
+	i2cRelease(I2C_CLIENT_ACC);
 	if (dataRead & 0x40)
 		Serial.printf("Interrupt Active 0x%X\n", dataRead);
 	if (dataRead & 0x20)
@@ -123,3 +216,42 @@ void clearAccInt(void)
 	if (dataRead & 0x01)
 		Serial.println("X low");
 }
+
+/**
+ * @brief Get the dynamic acceleration
+ * @note Deviation of the acceleration magnitude from 1g
+ *
+ * @return uint32_t Dynamic acceleration in mg
+ */
+uint32_t accDynamic(void)
+{
+	// Single precision float, done by the FPU
+	i2cAcquire(I2C_CLIENT_ACC);
+	float x = accSensor.readFloatAccelX();
+	float y = accSensor.readFloatAccelY();
+	float z = accSensor.readFloatAccelZ();
+	i2cRelease(I2C_CLIENT_ACC);
+#if CAPTURE
+	// Sample in mg
+	int16_t sample[3] = {(int16_t)(x * 1000.0F), (int16_t)(y * 1000.0F), (int16_t)(z * 1000.0F)};
+	captureAdd(CAPTURE_ACC, sample, 6);
+#endif
+	float magnitude = sqrtf(x * x + y * y + z * z);
+	return (uint32_t)(fabsf(magnitude - 1.0F) * 1000.0F);
+}
+
+/**
+ * @brief Check if the tracker is moving
+ * @note Moving if a motion interrupt occured recently
+ * or if the dynamic acceleration is above the threshold
+ *
+ * @return true if moving
+ */
+bool accIsMoving(void)
+{
+	if ((lastAccInt != 0) && ((millis() - lastAccInt) < ACC_MOVING_WINDOW))
+	{
+		return true;
+	}
+	return accDynamic() > ACC_MOVING_THRESHOLD;
+}
@@ -0,0 +1,217 @@
+/**
+ * @file alarm.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Shock, free fall and tamper alarms
+ * @version 0.1
+ * @date 2020-09-04
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The LIS3DH free fall and click engines are routed to INT2.
+ * An alarm wakes up the main loop, stops a running GPS acquisition and
+ * is sent before anything else as confirmed uplink, with the last fix
+ * instead of a new one. The alarm is delivered when the network server
+ * acknowledged the uplink, the result comes from the MAC with
+ * alarmAckResult(). If sending fails or the ACK is missing, it is
+ * retried every ALARM_RETRY_TIME ms up to ALARM_MAX_TRIES times.
+ * Over the BLE relay no ACK exists, a sent notification counts as
+ * delivered.
+ */
+#include "main.h"
+
+/** Alarm statistics */
+alarm_stats_s alarmStats;
+
+/** Type of the alarm that is sent */
+static uint8_t alarmType = ALARM_NONE;
+/** Send tries of the current alarm */
+static uint8_t alarmTries = 0;
+/** Timer for the send retries */
+static SoftwareTimer alarmRetry;
+/** Timer for the ACK timeout */
+static SoftwareTimer alarmAckTimeout;
+/** Flag if a confirmed uplink waits for the result of the MAC */
+static volatile bool alarmAckWait = false;
+/** Flag if the MAC reported the result */
+static volatile bool alarmAckDone = false;
+/** Result of the MAC, true if the network server acknowledged the uplink */
+static volatile bool alarmAcked = false;
+/** millis() of the last uplink of the alarm */
+static uint32_t alarmSendTime = 0;
+/** Time from the interrupt to the last uplink in ms */
+static uint32_t alarmTxLatency = 0;
+
+/**
+ * @brief Retry timer, wakes up the main loop
+ *
+ * @param unused Timer handle, not used
+ */
+static void alarmRetryTimer(TimerHandle_t unused)
+{
+	xSemaphoreGiveFromISR(loopEnable, &xHigherPriorityTaskWoken);
+}
+
+/**
+ * @brief Initialize the alarm retry timer
+ */
+void initAlarm(void)
+{
+	alarmRetry.begin(ALARM_RETRY_TIME, alarmRetryTimer, NULL, false);
+	alarmAckTimeout.begin(ALARM_ACK_TIMEOUT, alarmRetryTimer, NULL, false);
+}
+
+/**
+ * @brief Result of the confirmed alarm uplink
+ * @note Called from the LoRaWan callback after the MAC finished the
+ * uplink and its retransmissions
+ *
+ * @param acked true if the network server acknowledged the uplink
+ */
+void alarmAckResult(bool acked)
+{
+	if (!alarmAckWait)
+	{
+		return;
+	}
+	alarmAcked = acked;
+	alarmAckDone = true;
+	xSemaphoreGive(loopEnable);
+}
+
+/**
+ * @brief Create the alarm frame
+ * @note Layout (little endian)
+ * 		0 alarm type
+ * 		1..4 latitude of the last fix in 1/100000 degree
+ * 		5..8 longitude of the last fix in 1/100000 degree
+ * 		9..10 age of the last fix in minutes, 0xFFFF = no fix
+ * 		11 battery in %
+ * 		12..13 time from the interrupt to the uplink in ms
+ *
+ * @param buffer Buffer, must be at least ALARM_FRAME_LEN bytes
+ * @param latency Time since the interrupt in ms
+ * @return uint8_t Length of the frame
+ */
+static uint8_t alarmGetFrame(uint8_t *buffer, uint32_t latency)
+{
+	int32_t latitude = gpsFix.lat / (GEO_SCALE / GEO_PAYLOAD_SCALE);
+	int32_t longitude = gpsFix.lng / (GEO_SCALE / GEO_PAYLOAD_SCALE);
+	uint32_t age = 0xFFFF;
+	if (gpsStats.fixes != 0)
+	{
+		age = (millis() - gpsFixMillis) / 60000;
+		if (age > 0xFFFE)
+		{
+			age = 0xFFFE;
+		}
+	}
+	if (latency > 0xFFFF)
+	{
+		latency = 0xFFFF;
+	}
+	buffer[0] = alarmType;
+	memcpy(&buffer[1], &latitude, 4);
+	memcpy(&buffer[5], &longitude, 4);
+	buffer[9] = age;
+	buffer[10] = age >> 8;
+	buffer[11] = trackerData.batt;
+	buffer[12] = latency;
+	buffer[13] = latency >> 8;
+	return ALARM_FRAME_LEN;
+}
+
+/**
+ * @brief Finish a send try of the alarm
+ *
+ * @param delivered true if the alarm was acknowledged or relayed
+ */
+static void alarmTryDone(bool delivered)
+{
+	if (delivered)
+	{
+		alarmStats.lastLatency = alarmTxLatency;
+		if (alarmTxLatency > alarmStats.maxLatency)
+		{
+			alarmStats.maxLatency = alarmTxLatency;
+		}
+		alarmTries = 0;
+		accAlarmPending = false;
+	}
+	else if (alarmTries >= ALARM_MAX_TRIES)
+	{
+		if (alarmStats.failed != 0xFFFF)
+		{
+			alarmStats.failed++;
+		}
+		alarmTries = 0;
+		accAlarmPending = false;
+	}
+	else
+	{
+		alarmRetry.start();
+	}
+}
+
+/**
+ * @brief Handle a pending alarm
+ * @note Called from the main loop
+ */
+void alarmHandle(void)
+{
+	PROF_SCOPE(PROF_ALARM);
+	if (alarmAckWait)
+	{
+		if (!alarmAckDone && ((millis() - alarmSendTime) < ALARM_ACK_TIMEOUT))
+		{
+			// Woken up by something else, keep waiting for the MAC
+			return;
+		}
+		alarmAckTimeout.stop();
+		alarmAckWait = false;
+		bool acked = alarmAckDone && alarmAcked;
+		if (!acked && (alarmStats.noAck != 0xFFFF))
+		{
+			alarmStats.noAck++;
+		}
+		Serial.printf("Alarm %d try %d %s after %ld ms\n", alarmType, alarmTries,
+					  acked ? "acknowledged" : "not acknowledged", millis() - accAlarmTime);
+		alarmTryDone(acked);
+		return;
+	}
+
+	if (alarmTries == 0)
+	{
+		alarmType = accReadAlarm();
+		if (alarmType == ALARM_NONE)
+		{
+			accAlarmPending = false;
+			return;
+		}
+		if (alarmStats.count[alarmType] != 0xFFFF)
+		{
+			alarmStats.count[alarmType]++;
+		}
+	}
+
+	uint8_t frame[ALARM_FRAME_LEN];
+	uint32_t latency = millis() - accAlarmTime;
+	uint8_t len = alarmGetFrame(frame, latency);
+	bool needsAck = false;
+	alarmAckDone = false;
+	alarmAckWait = true;
+	int8_t error = sendAlarmFrame(frame, len, &needsAck);
+	alarmTries++;
+	Serial.printf("Alarm %d after %ld ms, try %d result %d\n", alarmType, latency, alarmTries, error);
+
+	if ((error == 0) && needsAck)
+	{
+		// Delivered when the ACK arrives
+		alarmTxLatency = latency;
+		alarmSendTime = millis();
+		alarmAckTimeout.start();
+		return;
+	}
+	alarmAckWait = false;
+	alarmTxLatency = latency;
+	alarmTryDone(error == 0);
+}
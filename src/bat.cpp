@@ -113,6 +113,11 @@ void initReadVBAT(void)
  */
 uint8_t readBatt(void)
 {
+	PROF_SCOPE(PROF_READ_BATT);
 	float vbat_mv = readVBAT();
+#if CAPTURE
+	uint16_t sample[2] = {(uint16_t)vbat_mv, mvToPercent(vbat_mv)};
+	captureAdd(CAPTURE_BATT, sample, 4);
+#endif
 	return mvToPercent(vbat_mv);
 }
@@ -21,11 +21,135 @@ BLEDfu bledfu;
  */
 BLEUart bleuart;
 
+/**
+ * @brief  Diagnostic service
+ * @note   Custom service, holds the status characteristics of the tracker
+ */
+BLEService diagService = BLEService("57A70000-9350-11ED-A1EB-0242AC120002");
+/**
+ * @brief  Power statistics characteristic
+ * @note   Sleep residency and wake source counters, see powerGetStats()
+ */
+BLECharacteristic powerStatsChar = BLECharacteristic("57A70001-9350-11ED-A1EB-0242AC120002");
+/**
+ * @brief  Memory statistics characteristic
+ * @note   Heap and task stack usage, see memGetStats()
+ */
+BLECharacteristic memStatsChar = BLECharacteristic("57A70002-9350-11ED-A1EB-0242AC120002");
+/**
+ * @brief  Link state characteristic
+ * @note   LoRaWan join state, address and last downlink quality, see lmhLinkState()
+ */
+BLECharacteristic linkStateChar = BLECharacteristic("57A70003-9350-11ED-A1EB-0242AC120002");
+/**
+ * @brief  Satellite statistics characteristic
+ * @note   Fix type, satellites in view and C/N0 histograms, see satGetStats()
+ */
+BLECharacteristic satStatsChar = BLECharacteristic("57A70004-9350-11ED-A1EB-0242AC120002");
+
+/**
+ * @brief  Relay service
+ * @note   The companion app forwards frames from this service to the backend
+ */
+BLEService relayService = BLEService("57A72000-9350-11ED-A1EB-0242AC120002");
+/**
+ * @brief  Relay uplink characteristic
+ * @note   Notifies FPort followed by the frame
+ */
+BLECharacteristic relayUpChar = BLECharacteristic("57A72001-9350-11ED-A1EB-0242AC120002");
+
 /**
  * @brief  Flag if BLE UART client is connected
  */
 bool bleUARTisConnected = false;
 
+/**
+ * @brief  Callback when data arrives on the BLE UART
+ * @note   Text commands
+ *         "mem" prints the memory statistics
+ *         "prof" prints the profiling histograms, "profclr" clears them
+ *         "pipe" prints the report pipeline latencies, "pipeclr" clears them
+ *         "cap" prints the capture statistics, "capon" starts a new
+ *         capture, "capoff" stops it
+ * @param  conn_handle: Connection handle id
+ */
+void bleuart_rx_callback(uint16_t conn_handle)
+{
+	(void)conn_handle;
+	char cmd[16];
+	int len = bleuart.read((uint8_t *)cmd, sizeof(cmd) - 1);
+	// Strip line endings
+	while ((len > 0) && ((cmd[len - 1] == '\n') || (cmd[len - 1] == '\r')))
+	{
+		len--;
+	}
+	cmd[len] = 0;
+
+	if (strcmp(cmd, "mem") == 0)
+	{
+		memPrint(true);
+	}
+	else if (strcmp(cmd, "i2c") == 0)
+	{
+		i2cPrint(true);
+	}
+	else if (strcmp(cmd, "i2cclr") == 0)
+	{
+		i2cReset();
+	}
+	else if (strcmp(cmd, "enc") == 0)
+	{
+		encPrint(true);
+	}
+	else if (strcmp(cmd, "classb") == 0)
+	{
+		classBPrint(true);
+	}
+	else if (strcmp(cmd, "pipe") == 0)
+	{
+		pipePrint(true);
+	}
+	else if (strcmp(cmd, "pipeclr") == 0)
+	{
+		pipeReset();
+	}
+	else if ((strcmp(cmd, "lns") == 0) || (strncmp(cmd, "lns ", 4) == 0))
+	{
+		// lns <ms> sets the location notification interval, lns prints it
+		if (cmd[3] == ' ')
+		{
+			lnsSetInterval(strtoul(&cmd[4], NULL, 10));
+		}
+		snprintf(dbgBuffer, 255, "LNS notify interval %ld ms\n", lnsNotifyInterval);
+		Serial.print(dbgBuffer);
+		bleuart.print(dbgBuffer);
+	}
+#if PROFILING
+	else if (strcmp(cmd, "prof") == 0)
+	{
+		profPrint(true);
+	}
+	else if (strcmp(cmd, "profclr") == 0)
+	{
+		profReset();
+	}
+#endif
+#if CAPTURE
+	else if (strcmp(cmd, "cap") == 0)
+	{
+		capturePrint(true);
+	}
+	else if (strcmp(cmd, "capon") == 0)
+	{
+		captureStart();
+	}
+	else if (strcmp(cmd, "capoff") == 0)
+	{
+		captureStop();
+	}
+#endif
+}
+
 /**
  * @brief  Initialize BLE server
  * @note   Initialize DFU and UART services
@@ -37,13 +161,18 @@ void initBLE(void)
 	// more SRAM required by SoftDevice
 	// Note: All config***() function must be called before begin()
 	Bluefruit.configPrphBandwidth(BANDWIDTH_MAX);
-	Bluefruit.configPrphConn(92, BLE_GAP_EVENT_LENGTH_MIN, 16, 16);
+	// Max MTU and longer connection events for the track log export
+	Bluefruit.configPrphConn(BLE_MAX_MTU, 6, 16, 16);
 
-	Bluefruit.begin(1, 0);
+	// Central role for the encounter scanner
+	Bluefruit.begin(1, 1);
 	// Set max power. Accepted values are: -40, -30, -20, -16, -12, -8, -4, 0, 4
+	// Lowered by the battery policy when the battery drains
 	Bluefruit.setTxPower(4);
 	Bluefruit.setName("LORA_RAK4631_TRACKER");
 
+	// Preferred connection interval, 30 to 100 ms
+	Bluefruit.Periph.setConnInterval(BLE_CONN_INTERVAL_MIN, BLE_CONN_INTERVAL_MAX);
 	Bluefruit.Periph.setConnectCallback(connect_callback);
 	Bluefruit.Periph.setDisconnectCallback(disconnect_callback);
 
@@ -52,6 +181,39 @@ void initBLE(void)
 
 	// Configure and Start BLE Uart Service
 	bleuart.begin();
+	bleuart.setRxCallback(bleuart_rx_callback);
+
+	// Configure and Start the diagnostic service
+	diagService.begin();
+	powerStatsChar.setProperties(CHR_PROPS_READ);
+	powerStatsChar.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	powerStatsChar.setMaxLen(POWER_STATS_LEN);
+	powerStatsChar.begin();
+	memStatsChar.setProperties(CHR_PROPS_READ);
+	memStatsChar.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	memStatsChar.setMaxLen(MEM_STATS_LEN);
+	memStatsChar.begin();
+	linkStateChar.setProperties(CHR_PROPS_READ);
+	linkStateChar.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	linkStateChar.setFixedLen(LINK_STATE_LEN);
+	linkStateChar.begin();
+	satStatsChar.setProperties(CHR_PROPS_READ);
+	satStatsChar.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	satStatsChar.setFixedLen(SAT_STATS_LEN);
+	satStatsChar.begin();
+
+	// Configure and Start the Location and Navigation and Battery services
+	initBLELns();
+
+	// Configure and Start the track log export service
+	initBLEExport();
+
+	// Configure and Start the relay service
+	relayService.begin();
+	relayUpChar.setProperties(CHR_PROPS_NOTIFY);
+	relayUpChar.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	relayUpChar.setMaxLen(TRACKER_DATA_LEN + 1);
+	relayUpChar.begin();
 
 	// Set up and start advertising
 	startAdv();
@@ -90,7 +252,12 @@ void connect_callback(uint16_t conn_handle)
 {
 	(void)conn_handle;
 	bleUARTisConnected = true;
+	powerCountWake(WAKE_BLE);
+	healthInc(HEALTH_BLE_CONNECT);
+	powerSave(false);
+	exportConnect(conn_handle);
 	Serial.println("BLE connected");
+	diagUpdate();
 }
 
 /**
@@ -103,5 +270,62 @@ void disconnect_callback(uint16_t conn_handle, uint8_t reason)
 	(void)conn_handle;
 	(void)reason;
 	bleUARTisConnected = false;
+	exportStop();
 	Serial.println("BLE disconnected");
+	powerSave(true);
+}
+
+/**
+ * @brief  Update the values of the diagnostic characteristics
+ * @note   Called on connect and on every wake up of the main loop
+ */
+void diagUpdate(void)
+{
+	uint8_t stats[MEM_STATS_LEN];
+	uint8_t len = powerGetStats(stats);
+	powerStatsChar.write(stats, len);
+	len = memGetStats(stats);
+	memStatsChar.write(stats, len);
+	len = lmhLinkState(stats);
+	linkStateChar.write(stats, len);
+	len = satGetStats(stats);
+	satStatsChar.write(stats, len);
 }
+
+/**
+ * @brief  Check if the BLE relay transport is available
+ * @return true if a central subscribed to the relay characteristic
+ */
+static bool bleRelayUp(void)
+{
+	return bleUARTisConnected && relayUpChar.notifyEnabled();
+}
+
+/**
+ * @brief  Send a frame to the companion app for relaying
+ * @param  port: FPort
+ * @param  buffer: Frame data
+ * @param  len: Length of the frame
+ * @return 0 on success, -1 if the frame does not fit into the MTU
+ * 		or the notification failed, the frame goes over LoRaWan then
+ */
+static int8_t bleRelaySend(uint8_t port, uint8_t *buffer, uint8_t len)
+{
+	uint8_t frame[TRACKER_DATA_LEN + 1];
+	if (len > TRACKER_DATA_LEN)
+	{
+		return -1;
+	}
+	// The default MTU of 23 leaves 20 bytes, the position frame needs 24
+	BLEConnection *conn = Bluefruit.Connection(Bluefruit.connHandle());
+	if ((conn == NULL) || (len + 1 > conn->getMtu() - 3))
+	{
+		return -1;
+	}
+	frame[0] = port;
+	memcpy(&frame[1], buffer, len);
+	return relayUpChar.notify(frame, len + 1) ? 0 : -1;
+}
+
+/** BLE relay transport, a notification costs a fraction of a LoRa uplink */
+transport_s bleRelayTransport = {"BLE relay", 1, bleRelayUp, bleRelaySend};
@@ -0,0 +1,350 @@
+/**
+ * @file bleExport.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief BLE bulk export of the track log
+ * @version 0.1
+ * @date 2020-08-14
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The track log is sent as a stream of binary blocks over
+ * notifications. The sender runs in its own low priority task.
+ * notify() blocks that task while the SoftDevice TX queue is full,
+ * the LoRa task and the main loop are not affected.
+ *
+ * Block layout (little endian)
+ * 	0..3 index of the first entry in the block
+ * 	4 number of entries
+ * 	5.. first entry uncompressed (16 bytes),
+ * 		following entries as zigzag varint deltas of
+ * 		time, lat, lng, alt followed by speed and hdop
+ * 	last 2 bytes CRC16-CCITT over the block
+ * With -DCAPTURE=1 the capture file can be sent instead, the blocks
+ * are created by captureReadBlock().
+ */
+#include "main.h"
+
+/** Export service */
+BLEService exportService = BLEService("57A71000-9350-11ED-A1EB-0242AC120002");
+/** Control characteristic, write 0x01 + uint32 start index to start, 0x02 to stop,
+ * 0x03 + uint32 file offset to send the capture file */
+BLECharacteristic exportCtrlChar = BLECharacteristic("57A71001-9350-11ED-A1EB-0242AC120002");
+/** Data characteristic, notifies the blocks */
+BLECharacteristic exportDataChar = BLECharacteristic("57A71002-9350-11ED-A1EB-0242AC120002");
+/** Status characteristic, result of the last export */
+BLECharacteristic exportStatusChar = BLECharacteristic("57A71003-9350-11ED-A1EB-0242AC120002");
+
+/** Export control commands */
+#define EXPORT_CMD_START 0x01
+#define EXPORT_CMD_STOP 0x02
+#define EXPORT_CMD_CAPTURE 0x03
+
+/** Worst case size of a delta compressed entry */
+#define EXPORT_MAX_DELTA_LEN 20
+/** Max size of a block, limited by the max MTU */
+#define EXPORT_MAX_BLOCK 244
+/** Min size of a track log block: header, first entry and CRC, needs an MTU of 26 or more */
+#define EXPORT_MIN_BLOCK (5 + sizeof(track_entry_s) + 2)
+
+/** Task handle of the export task */
+TaskHandle_t exportTaskHandle = NULL;
+/** Semaphore to start the export task */
+SemaphoreHandle_t exportStart;
+/** Index to start the export from */
+static volatile uint32_t exportIndex = 0;
+/** Block encoder of the running export */
+static uint16_t (*exportBlock)(uint8_t *buffer, uint16_t maxLen, uint32_t start, uint32_t *next) = exportEncodeBlock;
+/** Flag if the export is running */
+static volatile bool exportRunning = false;
+/** Connection handle of the central that started the export */
+static uint16_t exportConnHandle = BLE_CONN_HANDLE_INVALID;
+
+/**
+ * @brief CRC16-CCITT
+ *
+ * @param data Pointer to the data
+ * @param len Length of the data
+ * @return uint16_t CRC
+ */
+uint16_t crc16(const uint8_t *data, uint16_t len)
+{
+	uint16_t crc = 0xFFFF;
+	for (uint16_t idx = 0; idx < len; idx++)
+	{
+		crc ^= (uint16_t)data[idx] << 8;
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+/**
+ * @brief Write a signed value as zigzag varint
+ *
+ * @param buffer Buffer
+ * @param value Value
+ * @return uint8_t Number of bytes written
+ */
+static uint8_t putVarint(uint8_t *buffer, int32_t value)
+{
+	uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+	uint8_t len = 0;
+	while (zigzag >= 0x80)
+	{
+		buffer[len++] = (zigzag & 0x7F) | 0x80;
+		zigzag >>= 7;
+	}
+	buffer[len++] = zigzag;
+	return len;
+}
+
+/**
+ * @brief Encode a block of track entries
+ *
+ * @param buffer Buffer for the block
+ * @param maxLen Max length of the block
+ * @param start Index of the first entry
+ * @param next Returns the index of the first entry not in the block
+ * @return uint16_t Length of the block, 0 if no entries available
+ * 		or if maxLen is below EXPORT_MIN_BLOCK
+ */
+uint16_t exportEncodeBlock(uint8_t *buffer, uint16_t maxLen, uint32_t start, uint32_t *next)
+{
+	track_entry_s entry;
+	track_entry_s last;
+	uint16_t len = 5;
+	uint8_t count = 0;
+
+	// Skip entries that were overwritten already
+	if (start < trackLogFirst())
+	{
+		start = trackLogFirst();
+	}
+	*next = start;
+
+	if (maxLen < EXPORT_MIN_BLOCK)
+	{
+		// Not even the uncompressed first entry fits
+		return 0;
+	}
+
+	if (!trackLogGet(start, &last))
+	{
+		return 0;
+	}
+	memcpy(&buffer[len], &last, sizeof(track_entry_s));
+	len += sizeof(track_entry_s);
+	count++;
+
+	// Delta compressed entries while they fit for sure
+	while ((len + EXPORT_MAX_DELTA_LEN + 2 <= maxLen) && (count < 255))
+	{
+		if (!trackLogGet(start + count, &entry))
+		{
+			break;
+		}
+		len += putVarint(&buffer[len], entry.time - last.time);
+		len += putVarint(&buffer[len], entry.lat - last.lat);
+		len += putVarint(&buffer[len], entry.lng - last.lng);
+		len += putVarint(&buffer[len], entry.alt - last.alt);
+		buffer[len++] = entry.speed;
+		buffer[len++] = entry.hdop;
+		last = entry;
+		count++;
+	}
+
+	memcpy(&buffer[0], &start, 4);
+	buffer[4] = count;
+	uint16_t crc = crc16(buffer, len);
+	buffer[len++] = crc;
+	buffer[len++] = crc >> 8;
+
+	*next = start + count;
+	return len;
+}
+
+/**
+ * @brief Task that sends the track log
+ *
+ * @param pvParameters Not used
+ */
+void exportTask(void *pvParameters)
+{
+	(void)pvParameters;
+	uint8_t block[EXPORT_MAX_BLOCK];
+
+	while (true)
+	{
+		xSemaphoreTake(exportStart, portMAX_DELAY);
+
+		BLEConnection *conn = Bluefruit.Connection(exportConnHandle);
+		if (conn == NULL)
+		{
+			exportRunning = false;
+			continue;
+		}
+		uint16_t maxLen = conn->getMtu() - 3;
+		if (maxLen > EXPORT_MAX_BLOCK)
+		{
+			maxLen = EXPORT_MAX_BLOCK;
+		}
+
+		uint32_t index = exportIndex;
+		uint32_t bytesSent = 0;
+		uint32_t startTime = millis();
+
+		if ((exportBlock == exportEncodeBlock) && (maxLen < EXPORT_MIN_BLOCK))
+		{
+			// The status reports 0 bytes sent, the central has to request a larger MTU first
+			Serial.printf("Export needs an MTU of %d, got %d\n", (int)EXPORT_MIN_BLOCK + 3, maxLen + 3);
+			exportRunning = false;
+		}
+
+		while (exportRunning && conn->connected() && exportDataChar.notifyEnabled(exportConnHandle))
+		{
+			uint32_t next;
+			uint16_t len = exportBlock(block, maxLen, index, &next);
+			if (len == 0)
+			{
+				// All entries sent
+				break;
+			}
+			// Blocks while the SoftDevice TX queue is full
+			if (!exportDataChar.notify(exportConnHandle, block, len))
+			{
+				break;
+			}
+			bytesSent += len;
+			index = next;
+		}
+		exportRunning = false;
+
+		uint32_t duration = millis() - startTime;
+		uint32_t rate = duration != 0 ? (bytesSent * 1000) / (duration * 1024) : 0;
+		Serial.printf("Export %ld bytes in %ld ms, %ld KB/s, next index %ld\n", bytesSent, duration, rate, index);
+
+		// Status: next index, bytes sent, duration in ms
+		uint8_t status[12];
+		memcpy(&status[0], &index, 4);
+		memcpy(&status[4], &bytesSent, 4);
+		memcpy(&status[8], &duration, 4);
+		exportStatusChar.write(status, 12);
+		exportStatusChar.notify(exportConnHandle, status, 12);
+	}
+}
+
+/**
+ * @brief Callback for writes to the control characteristic
+ *
+ * @param conn_hdl Connection handle
+ * @param chr Pointer to the characteristic
+ * @param data Written data
+ * @param len Length of the data
+ */
+void exportCtrlCallback(uint16_t conn_hdl, BLECharacteristic *chr, uint8_t *data, uint16_t len)
+{
+	(void)chr;
+	if (len == 0)
+	{
+		return;
+	}
+	switch (data[0])
+	{
+	case EXPORT_CMD_START:
+		if (exportRunning)
+		{
+			break;
+		}
+		exportIndex = trackLogFirst();
+		if (len == 5)
+		{
+			// Resume from the given index
+			memcpy((void *)&exportIndex, &data[1], 4);
+		}
+		exportBlock = exportEncodeBlock;
+		exportConnHandle = conn_hdl;
+		exportRunning = true;
+		xSemaphoreGive(exportStart);
+		break;
+#if CAPTURE
+	case EXPORT_CMD_CAPTURE:
+		if (exportRunning)
+		{
+			break;
+		}
+		exportIndex = 0;
+		if (len == 5)
+		{
+			// Resume from the given file offset
+			memcpy((void *)&exportIndex, &data[1], 4);
+		}
+		exportBlock = captureReadBlock;
+		exportConnHandle = conn_hdl;
+		exportRunning = true;
+		xSemaphoreGive(exportStart);
+		break;
+#endif
+	case EXPORT_CMD_STOP:
+		exportRunning = false;
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Initialize the export service and the export task
+ * @note Must be called from initBLE() after Bluefruit.begin()
+ */
+void initBLEExport(void)
+{
+	exportService.begin();
+
+	exportCtrlChar.setProperties(CHR_PROPS_WRITE);
+	exportCtrlChar.setPermission(SECMODE_NO_ACCESS, SECMODE_OPEN);
+	exportCtrlChar.setMaxLen(5);
+	exportCtrlChar.setWriteCallback(exportCtrlCallback);
+	exportCtrlChar.begin();
+
+	exportDataChar.setProperties(CHR_PROPS_NOTIFY);
+	exportDataChar.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	exportDataChar.setMaxLen(EXPORT_MAX_BLOCK);
+	exportDataChar.begin();
+
+	exportStatusChar.setProperties(CHR_PROPS_READ | CHR_PROPS_NOTIFY);
+	exportStatusChar.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	exportStatusChar.setFixedLen(12);
+	exportStatusChar.begin();
+
+	exportStart = xSemaphoreCreateBinary();
+	xTaskCreate(exportTask, "EXP", 512, NULL, TASK_PRIO_LOW, &exportTaskHandle);
+}
+
+/**
+ * @brief Request the fastest link settings from the central
+ * @note 2M PHY, data length extension and the max MTU
+ *
+ * @param conn_handle Connection handle
+ */
+void exportConnect(uint16_t conn_handle)
+{
+	BLEConnection *conn = Bluefruit.Connection(conn_handle);
+	if (conn == NULL)
+	{
+		return;
+	}
+	conn->requestPHY();
+	conn->requestDataLengthUpdate();
+	conn->requestMtuExchange(BLE_MAX_MTU);
+}
+
+/**
+ * @brief Stop a running export
+ * @note Called when the central disconnects
+ */
+void exportStop(void)
+{
+	exportRunning = false;
+}
@@ -0,0 +1,144 @@
+/**
+ * @file bleLns.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief BLE Location and Navigation service
+ * @version 0.1
+ * @date 2020-08-12
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Position data is sent in binary format using the standard
+ * Location and Navigation service (0x1819) and the Location and Speed
+ * characteristic (0x2A67). Each new fix is sent as one notification.
+ * Battery level uses the standard Battery service.
+ */
+#include "main.h"
+
+/** Location and Navigation service UUID */
+#define UUID16_SVC_LNS 0x1819
+/** Location and Speed characteristic UUID */
+#define UUID16_CHR_LOCATION_SPEED 0x2A67
+/** LN Feature characteristic UUID */
+#define UUID16_CHR_LN_FEATURE 0x2A6A
+
+/** Location and Speed flags: speed, location and elevation present, position status (bits 7..8) ok */
+#define LNS_FLAGS (0x0001 | 0x0004 | 0x0008 | 0x0080)
+/** LN Feature: speed, location and elevation supported */
+#define LNS_FEATURES (0x00000001 | 0x00000004 | 0x00000008)
+
+/** Location and Navigation service */
+BLEService lnsService = BLEService(UUID16_SVC_LNS);
+/** Location and Speed characteristic */
+BLECharacteristic lnsLocationChar = BLECharacteristic(UUID16_CHR_LOCATION_SPEED);
+/** LN Feature characteristic */
+BLECharacteristic lnsFeatureChar = BLECharacteristic(UUID16_CHR_LN_FEATURE);
+/** Battery service */
+BLEBas blebas;
+
+/** Time of the last location notification */
+static time_t lastLnsNotify = 0;
+
+/** Minimum time between two location notifications in ms, changed with the BLE UART command lns */
+uint32_t lnsNotifyInterval = BLE_LNS_NOTIFY_INTERVAL;
+
+/**
+ * @brief Initialize the Location and Navigation and Battery services
+ * @note Must be called from initBLE() after Bluefruit.begin()
+ */
+void initBLELns(void)
+{
+	lnsService.begin();
+
+	lnsFeatureChar.setProperties(CHR_PROPS_READ);
+	lnsFeatureChar.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	lnsFeatureChar.setFixedLen(4);
+	lnsFeatureChar.begin();
+	lnsFeatureChar.write32(LNS_FEATURES);
+
+	lnsLocationChar.setProperties(CHR_PROPS_NOTIFY);
+	lnsLocationChar.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	lnsLocationChar.setMaxLen(LNS_LOCATION_LEN);
+	lnsLocationChar.begin();
+
+	blebas.begin();
+	blebas.write(battLevel);
+}
+
+/**
+ * @brief Encode a fix in the Location and Speed characteristic layout
+ *
+ * @param buffer Buffer, must be at least LNS_LOCATION_LEN bytes
+ * @param position Position
+ * @param altitude Altitude in cm
+ * @param speed Speed in cm/s
+ * @return uint8_t Number of bytes written
+ */
+uint8_t lnsEncode(uint8_t *buffer, const geo_coord_s &position, int32_t altitude, uint16_t speed)
+{
+	uint8_t idx = 0;
+	// Flags
+	buffer[idx++] = LNS_FLAGS & 0xFF;
+	buffer[idx++] = LNS_FLAGS >> 8;
+	// Instantaneous speed in 1/100 m/s
+	buffer[idx++] = speed;
+	buffer[idx++] = speed >> 8;
+	// Latitude and longitude in 1/10000000 degree
+	memcpy(&buffer[idx], &position.lat, 4);
+	idx += 4;
+	memcpy(&buffer[idx], &position.lng, 4);
+	idx += 4;
+	// Elevation in 1/100 m, sint24
+	buffer[idx++] = altitude;
+	buffer[idx++] = altitude >> 8;
+	buffer[idx++] = altitude >> 16;
+	return idx;
+}
+
+/**
+ * @brief Send a new fix as notification
+ * @note Skipped if no central subscribed or if the last
+ * notification is less than lnsNotifyInterval ms ago
+ *
+ * @param position Position
+ * @param altitude Altitude in cm
+ * @param speed Speed in cm/s
+ */
+void lnsUpdate(const geo_coord_s &position, int32_t altitude, uint16_t speed)
+{
+	if (!lnsLocationChar.notifyEnabled())
+	{
+		return;
+	}
+	if ((millis() - lastLnsNotify) < lnsNotifyInterval)
+	{
+		return;
+	}
+	lastLnsNotify = millis();
+
+	uint8_t buffer[LNS_LOCATION_LEN];
+	uint8_t len = lnsEncode(buffer, position, altitude, speed);
+	lnsLocationChar.notify(buffer, len);
+}
+
+/**
+ * @brief Set the minimum time between two location notifications
+ *
+ * @param interval Interval in ms, 0 to send every fix
+ */
+void lnsSetInterval(uint32_t interval)
+{
+	lnsNotifyInterval = interval;
+	// Allow the next fix to be sent right away
+	lastLnsNotify = millis() - interval;
+}
+
+/**
+ * @brief Update the battery level of the Battery service
+ *
+ * @param level Battery level in %
+ */
+void lnsBattery(uint8_t level)
+{
+	blebas.write(level);
+	blebas.notify(level);
+}
@@ -0,0 +1,388 @@
+/**
+ * @file capture.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Raw sensor capture to the internal flash
+ * @version 0.1
+ * @date 2020-09-09
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Only compiled with -DCAPTURE=1.
+ * Raw GPS bytes, accelerometer samples, battery readings and LoRaWan
+ * events are written as timestamped records into CAPTURE_FILE.
+ * Records are collected in one of two RAM buffers. The full buffer is
+ * written by a low priority task, the tasks that add records never
+ * wait for the flash. Buffers are written at most every
+ * CAPTURE_MIN_WRITE_GAP ms. If both buffers are full, records are
+ * dropped and counted.
+ *
+ * Record layout (little endian)
+ * 	0 type, see CAPTURE_xxx definitions
+ * 	1 length of the payload
+ * 	2..3 ms since the previous record
+ * 	4.. payload
+ * A CAPTURE_TIME record with the absolute time is written at the start
+ * and whenever the time since the previous record does not fit.
+ * The format is decoded by scripts/capture_reader.py.
+ */
+#include "main.h"
+
+#if CAPTURE
+
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+
+/** Record buffers, one is filled while the other one is written */
+static uint8_t capBuf[2][CAPTURE_BUF_SIZE];
+static uint16_t capLen[2] = {0, 0};
+/** Buffer that is filled */
+static uint8_t capFill = 0;
+/** Flag if the other buffer waits for the writer */
+static volatile bool capWriting = false;
+/** millis() of the last record */
+static uint32_t capLastTime = 0;
+
+/** GPS bytes collected for the next record */
+static uint8_t capGps[CAPTURE_GPS_CHUNK];
+static uint8_t capGpsLen = 0;
+
+/** Writer task */
+static TaskHandle_t captureTaskHandle = NULL;
+static SemaphoreHandle_t captureWrite;
+/** Timer to write partially filled buffers */
+static SoftwareTimer captureFlushTimer;
+
+/** Capture file */
+static File captureFile(InternalFS);
+
+/** Flag if the capture is running */
+volatile bool captureActive = false;
+
+/** Capture statistics */
+capture_stats_s captureStats;
+
+/**
+ * @brief Hand the filled buffer to the writer
+ * @note Must be called inside a critical section
+ *
+ * @return true if the buffers were swapped
+ */
+static bool captureSwap(void)
+{
+	if (capWriting || (capLen[capFill] == 0))
+	{
+		return false;
+	}
+	capWriting = true;
+	capFill ^= 1;
+	capLen[capFill] = 0;
+	return true;
+}
+
+/**
+ * @brief Append a record to the fill buffer
+ * @note Must be called inside a critical section
+ *
+ * @param type Record type
+ * @param data Payload
+ * @param len Length of the payload
+ * @param delta ms since the previous record
+ * @return true if the record was added
+ * @return false if the buffers are full
+ */
+static bool captureAppend(uint8_t type, const void *data, uint8_t len, uint16_t delta)
+{
+	if (capLen[capFill] + 4 + len > CAPTURE_BUF_SIZE)
+	{
+		if (!captureSwap())
+		{
+			return false;
+		}
+		xSemaphoreGive(captureWrite);
+	}
+	uint8_t *record = &capBuf[capFill][capLen[capFill]];
+	record[0] = type;
+	record[1] = len;
+	record[2] = delta;
+	record[3] = delta >> 8;
+	memcpy(&record[4], data, len);
+	capLen[capFill] += 4 + len;
+	return true;
+}
+
+/**
+ * @brief Add a record
+ *
+ * @param type Record type, see CAPTURE_xxx definitions
+ * @param data Payload
+ * @param len Length of the payload, max CAPTURE_GPS_CHUNK
+ */
+void captureAdd(uint8_t type, const void *data, uint8_t len)
+{
+	if (!captureActive)
+	{
+		return;
+	}
+	PROF_SCOPE(PROF_CAPTURE);
+	uint32_t now = millis();
+	taskENTER_CRITICAL();
+	uint32_t delta = now - capLastTime;
+	bool added = true;
+	if (delta > 0xFFFF)
+	{
+		// Absolute time: millis() and Unix time in s
+		uint32_t time[2] = {now, timeNow()};
+		added = captureAppend(CAPTURE_TIME, time, 8, 0);
+		delta = 0;
+	}
+	if (added)
+	{
+		added = captureAppend(type, data, len, delta);
+	}
+	if (added)
+	{
+		capLastTime = now;
+		captureStats.records++;
+		captureStats.bytes += 4 + len;
+	}
+	else
+	{
+		captureStats.dropped++;
+	}
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Add a byte received from the GPS module
+ * @note Bytes are collected up to the end of the sentence
+ *
+ * @param c Received byte
+ */
+void captureGpsByte(char c)
+{
+	if (!captureActive)
+	{
+		return;
+	}
+	capGps[capGpsLen++] = c;
+	if ((capGpsLen == CAPTURE_GPS_CHUNK) || (c == '\n'))
+	{
+		captureAdd(CAPTURE_GPS, capGps, capGpsLen);
+		capGpsLen = 0;
+	}
+}
+
+/**
+ * @brief Add a LoRaWan event
+ *
+ * @param event Event, see CAPTURE_MAC_xxx definitions
+ * @param data Event data
+ * @param len Length of the event data
+ */
+void captureMac(uint8_t event, const void *data, uint8_t len)
+{
+	uint8_t record[8];
+	record[0] = event;
+	if (len != 0)
+	{
+		memcpy(&record[1], data, len);
+	}
+	captureAdd(CAPTURE_MAC, record, len + 1);
+}
+
+/**
+ * @brief Timer to write partially filled buffers
+ *
+ * @param unused Timer handle, not used
+ */
+static void captureFlushTimerCb(TimerHandle_t unused)
+{
+	taskENTER_CRITICAL();
+	bool swapped = captureSwap();
+	taskEXIT_CRITICAL();
+	if (swapped)
+	{
+		xSemaphoreGive(captureWrite);
+	}
+}
+
+/**
+ * @brief Task that writes the buffers into the file
+ *
+ * @param pvParameters Not used
+ */
+static void captureTask(void *pvParameters)
+{
+	(void)pvParameters;
+	uint32_t lastWrite = 0;
+	while (true)
+	{
+		xSemaphoreTake(captureWrite, portMAX_DELAY);
+		if (!capWriting)
+		{
+			continue;
+		}
+		// Limit the write rate, records are dropped meanwhile
+		uint32_t sinceWrite = millis() - lastWrite;
+		if ((lastWrite != 0) && (sinceWrite < CAPTURE_MIN_WRITE_GAP))
+		{
+			delay(CAPTURE_MIN_WRITE_GAP - sinceWrite);
+		}
+
+		uint8_t buf = capFill ^ 1;
+		uint32_t start = millis();
+		{
+			PROF_SCOPE(PROF_CAPTURE_WRITE);
+			if (captureFile.open(CAPTURE_FILE, FILE_O_WRITE))
+			{
+				if (captureFile.size() + capLen[buf] > CAPTURE_MAX_SIZE)
+				{
+					Serial.println("Capture file full");
+					captureActive = false;
+				}
+				else
+				{
+					captureFile.seek(captureFile.size());
+					captureFile.write(capBuf[buf], capLen[buf]);
+					captureStats.fileSize = captureFile.size();
+				}
+				captureFile.close();
+			}
+		}
+		lastWrite = millis();
+		uint32_t duration = lastWrite - start;
+		captureStats.writes++;
+		if (duration > captureStats.maxWriteMs)
+		{
+			captureStats.maxWriteMs = duration;
+		}
+		capWriting = false;
+	}
+}
+
+/**
+ * @brief Initialize the writer task
+ */
+void initCapture(void)
+{
+	InternalFS.begin();
+	captureWrite = xSemaphoreCreateBinary();
+	captureFlushTimer.begin(CAPTURE_FLUSH_TIME, captureFlushTimerCb);
+	xTaskCreate(captureTask, "CAPT", 512, NULL, TASK_PRIO_LOW, &captureTaskHandle);
+}
+
+/**
+ * @brief Start a new capture
+ * @note Deletes the previous capture
+ */
+void captureStart(void)
+{
+	if (captureActive)
+	{
+		return;
+	}
+	while (capWriting)
+	{
+		delay(10);
+	}
+	InternalFS.remove(CAPTURE_FILE);
+	memset(&captureStats, 0, sizeof(captureStats));
+	taskENTER_CRITICAL();
+	capLen[0] = 0;
+	capLen[1] = 0;
+	capFill = 0;
+	capGpsLen = 0;
+	// Forces a CAPTURE_TIME record first
+	capLastTime = millis() - 0x10000;
+	captureActive = true;
+	taskEXIT_CRITICAL();
+	captureFlushTimer.start();
+	Serial.println("Capture started");
+}
+
+/**
+ * @brief Stop the capture
+ * @note Hands the last records to the writer
+ */
+void captureStop(void)
+{
+	captureActive = false;
+	captureFlushTimer.stop();
+	// Wait for the previous buffer, then write the last one
+	while (capWriting)
+	{
+		delay(10);
+	}
+	taskENTER_CRITICAL();
+	bool swapped = captureSwap();
+	taskEXIT_CRITICAL();
+	if (swapped)
+	{
+		xSemaphoreGive(captureWrite);
+	}
+	Serial.println("Capture stopped");
+}
+
+/**
+ * @brief Read a block of the capture file for the BLE export
+ * @note Layout (little endian)
+ * 		0..3 offset of the data in the file
+ * 		4.. file data
+ * 		last 2 bytes CRC16-CCITT over the block
+ *
+ * @param buffer Buffer for the block
+ * @param maxLen Max length of the block
+ * @param start Offset in the file
+ * @param next Returns the offset of the first byte not in the block
+ * @return uint16_t Length of the block, 0 at the end of the file
+ */
+uint16_t captureReadBlock(uint8_t *buffer, uint16_t maxLen, uint32_t start, uint32_t *next)
+{
+	*next = start;
+	File file(InternalFS);
+	if (!file.open(CAPTURE_FILE, FILE_O_READ))
+	{
+		return 0;
+	}
+	uint16_t len = 0;
+	if (file.seek(start))
+	{
+		len = file.read(&buffer[4], maxLen - 6);
+	}
+	file.close();
+	if (len == 0)
+	{
+		return 0;
+	}
+	memcpy(&buffer[0], &start, 4);
+	uint16_t crc = crc16(buffer, len + 4);
+	buffer[len + 4] = crc;
+	buffer[len + 5] = crc >> 8;
+	*next = start + len;
+	return len + 6;
+}
+
+/**
+ * @brief Print the capture statistics
+ *
+ * @param toBle true to print to the BLE UART as well
+ */
+void capturePrint(bool toBle)
+{
+	snprintf(dbgBuffer, 255, "Capture %s records %ld bytes %ld dropped %ld file %ld\n",
+			 captureActive ? "on" : "off", captureStats.records, captureStats.bytes,
+			 captureStats.dropped, captureStats.fileSize);
+	Serial.print(dbgBuffer);
+	if (toBle && bleUARTisConnected)
+	{
+		bleuart.print(dbgBuffer);
+	}
+	snprintf(dbgBuffer, 255, "Capture writes %ld max %ld ms\n", captureStats.writes, captureStats.maxWriteMs);
+	Serial.print(dbgBuffer);
+	if (toBle && bleUARTisConnected)
+	{
+		bleuart.print(dbgBuffer);
+	}
+}
+
+#endif
@@ -0,0 +1,339 @@
+/**
+ * @file classB.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Class B beacon synchronization
+ * @version 0.1
+ * @date 2020-09-05
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Class B needs a locked beacon before the device class can be
+ * switched. Beacons are sent at every multiple of 128 seconds GPS time.
+ * With a synced device clock the beacon search is started shortly before
+ * the next beacon instead of receiving for up to a full beacon period.
+ * The lock is checked by switching the MAC to class B every
+ * CLASSB_POLL_TIME ms, which only succeeds after the beacon was found.
+ * After CLASSB_RELOCK_INTERVAL (the beacon less operation time of the
+ * specification) the beacon is searched again. If the search fails, the
+ * device falls back to class A and retries with an increasing delay.
+ * Only compiled into the MAC calls with -DLORAMAC_CLASSB_ENABLED=1, the
+ * LoRaMac of the library must be built with class B support.
+ */
+#include "main.h"
+#include <LoRaWan-RAK4630.h>
+
+/** Class B statistics */
+classb_stats_s classBStats;
+
+/** Ping slot periodicity, a ping slot every 2^n seconds */
+static uint8_t pingPeriodicity = CLASSB_PING_PERIODICITY;
+/** Flag if the network was informed about the ping slot periodicity */
+static bool pingSlotAnnounced = false;
+/** millis() when the current state was entered */
+static uint32_t stateStart = 0;
+/** Delay before the next search after a failed search */
+static uint32_t retryTime = CLASSB_RETRY_TIME;
+/** Timer for the search start, the lock checks and the relock */
+static SoftwareTimer classBTimer;
+/** Flag if the class B timer expired */
+volatile bool classBPending = false;
+
+/**
+ * @brief Class B timer, wakes up the main loop
+ *
+ * @param unused Timer handle, not used
+ */
+static void classBTimerCb(TimerHandle_t unused)
+{
+	classBPending = true;
+	xSemaphoreGiveFromISR(loopEnable, &xHigherPriorityTaskWoken);
+}
+
+/**
+ * @brief Initialize the class B timer
+ */
+void initClassB(void)
+{
+	classBTimer.begin(CLASSB_POLL_TIME, classBTimerCb, NULL, false);
+}
+
+/**
+ * @brief Run the state machine after a delay
+ *
+ * @param delayMs Delay in ms
+ */
+static void classBSchedule(uint32_t delayMs)
+{
+	classBTimer.stop();
+	// setPeriod starts the timer as well
+	classBTimer.setPeriod(delayMs == 0 ? 1 : delayMs);
+}
+
+/**
+ * @brief Change the state
+ * @note Adds the time in class B to the statistics when the lock is left
+ *
+ * @param state New state, see CLASSB_xxx definitions
+ */
+static void classBSetState(uint8_t state)
+{
+	if (classBStats.state == CLASSB_LOCKED)
+	{
+		classBStats.lockedMs += millis() - stateStart;
+	}
+	classBStats.state = state;
+	stateStart = millis();
+}
+
+/**
+ * @brief Wait for the next beacon
+ * @note Without a synced clock the search starts immediately
+ */
+static void classBWaitBeacon(void)
+{
+	uint32_t delayMs = 0;
+	uint64_t gpsMs = timeGpsMs(millis());
+	if (gpsMs != 0)
+	{
+		uint32_t toBeacon = CLASSB_BEACON_PERIOD - (uint32_t)(gpsMs % CLASSB_BEACON_PERIOD);
+		if (toBeacon > CLASSB_SEARCH_LEAD)
+		{
+			delayMs = toBeacon - CLASSB_SEARCH_LEAD;
+		}
+		else
+		{
+			delayMs = toBeacon + CLASSB_BEACON_PERIOD - CLASSB_SEARCH_LEAD;
+		}
+	}
+	classBSetState(CLASSB_WAIT);
+	classBSchedule(delayMs);
+}
+
+#if LORAMAC_CLASSB_ENABLED
+/**
+ * @brief Start the beacon search in the MAC
+ * @note The ping slot periodicity is sent with an empty uplink if it
+ * was not announced yet
+ */
+static void classBStartSearch(void)
+{
+	MlmeReq_t mlmeReq;
+	if (!pingSlotAnnounced)
+	{
+		mlmeReq.Type = MLME_PING_SLOT_INFO;
+		mlmeReq.Req.PingSlotInfo.PingSlot.Fields.Periodicity = pingPeriodicity;
+		mlmeReq.Req.PingSlotInfo.PingSlot.Fields.RFU = 0;
+		if (LoRaMacMlmeRequest(&mlmeReq) == LORAMAC_STATUS_OK)
+		{
+			pingSlotAnnounced = true;
+			lmhSendEmpty();
+		}
+	}
+	mlmeReq.Type = MLME_BEACON_ACQUISITION;
+	LoRaMacMlmeRequest(&mlmeReq);
+}
+
+/**
+ * @brief Try to switch the MAC to class B
+ *
+ * @return true if the beacon is locked and the MAC is in class B
+ */
+static bool classBSwitch(void)
+{
+	MibRequestConfirm_t mibReq;
+	mibReq.Type = MIB_DEVICE_CLASS;
+	mibReq.Param.Class = CLASS_B;
+	return LoRaMacMibSetRequestConfirm(&mibReq) == LORAMAC_STATUS_OK;
+}
+#else
+static void classBStartSearch(void)
+{
+}
+
+static bool classBSwitch(void)
+{
+	return false;
+}
+#endif
+
+/**
+ * @brief Request a device class
+ * @note Class A and C are switched directly. Class B starts the beacon
+ * search, the device stays in class A until the beacon is locked
+ *
+ * @param devClass Requested class
+ */
+void loraClassRequest(uint8_t devClass)
+{
+	if (devClass != CLASS_B)
+	{
+		if (classBStats.state != CLASSB_OFF)
+		{
+			classBTimer.stop();
+			classBSetState(CLASSB_OFF);
+		}
+		lmh_class_request((DeviceClass_t)devClass);
+		return;
+	}
+
+#if LORAMAC_CLASSB_ENABLED
+	if (classBStats.state != CLASSB_OFF)
+	{
+		// Search or lock already running
+		return;
+	}
+	// Class B can only be entered from class A
+	lmh_class_request(CLASS_A);
+	retryTime = CLASSB_RETRY_TIME;
+	classBWaitBeacon();
+#else
+	Serial.println("Class B not supported, stay in class A");
+	lmh_class_request(CLASS_A);
+#endif
+}
+
+/**
+ * @brief Set the ping slot periodicity
+ * @note A running search or lock is restarted to announce the new periodicity
+ *
+ * @param periodicity Ping slot every 2^periodicity seconds, 0..7
+ */
+void classBSetPeriodicity(uint8_t periodicity)
+{
+	if ((periodicity > 7) || (periodicity == pingPeriodicity))
+	{
+		return;
+	}
+	pingPeriodicity = periodicity;
+	pingSlotAnnounced = false;
+	if (classBStats.state != CLASSB_OFF)
+	{
+		loraClassRequest(CLASS_A);
+		loraClassRequest(CLASS_B);
+	}
+}
+
+/**
+ * @brief Run the class B state machine
+ * @note Called from the main loop when the class B timer expired
+ */
+void classBHandle(void)
+{
+	classBPending = false;
+	switch (classBStats.state)
+	{
+	case CLASSB_WAIT:
+		// Beacon expected in CLASSB_SEARCH_LEAD ms
+		classBStartSearch();
+		if (classBStats.searches != 0xFFFF)
+		{
+			classBStats.searches++;
+		}
+		classBSetState(CLASSB_SEARCH);
+		classBSchedule(CLASSB_POLL_TIME);
+		break;
+
+	case CLASSB_SEARCH:
+	{
+		uint32_t searchTime = millis() - stateStart;
+		if (classBSwitch())
+		{
+			// The MAC receives continuously until the beacon is found
+			classBStats.lastSearchTime = searchTime;
+			classBStats.searchRxMs += searchTime;
+			if (classBStats.locks != 0xFFFF)
+			{
+				classBStats.locks++;
+			}
+			retryTime = CLASSB_RETRY_TIME;
+			classBSetState(CLASSB_LOCKED);
+			currentClass = CLASS_B;
+			Serial.printf("Beacon locked after %ld ms, ping slot every %d s\n", searchTime, 1 << pingPeriodicity);
+			// Uplinks carry the class B bit, the server knows the device is in class B
+			lmhSendEmpty();
+			classBSchedule(CLASSB_RELOCK_INTERVAL);
+		}
+		else if (searchTime > CLASSB_SEARCH_TIMEOUT)
+		{
+			classBStats.searchRxMs += searchTime;
+			if (classBStats.failed != 0xFFFF)
+			{
+				classBStats.failed++;
+			}
+			Serial.printf("No beacon, class A for %ld s\n", retryTime / 1000);
+			lmh_class_request(CLASS_A);
+			classBSetState(CLASSB_BACKOFF);
+			classBSchedule(retryTime);
+			retryTime *= 2;
+			if (retryTime > CLASSB_MAX_RETRY_TIME)
+			{
+				retryTime = CLASSB_MAX_RETRY_TIME;
+			}
+		}
+		else
+		{
+			classBSchedule(CLASSB_POLL_TIME);
+		}
+		break;
+	}
+
+	case CLASSB_LOCKED:
+		// Beacon less operation time is over, search the beacon again from class A
+		lmh_class_request(CLASS_A);
+		classBWaitBeacon();
+		break;
+
+	case CLASSB_BACKOFF:
+		classBWaitBeacon();
+		break;
+
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Count a downlink received in class B
+ */
+void classBDownlink(void)
+{
+	if ((currentClass == CLASS_B) && (classBStats.downlinks != 0xFFFF))
+	{
+		classBStats.downlinks++;
+	}
+}
+
+/**
+ * @brief Print the class B statistics
+ * @note The receive time is estimated from the search time, the number
+ * of ping slots and the number of beacons
+ *
+ * @param toBle true to print to the BLE UART as well
+ */
+void classBPrint(bool toBle)
+{
+	uint32_t lockedMs = classBStats.lockedMs;
+	if (classBStats.state == CLASSB_LOCKED)
+	{
+		lockedMs += millis() - stateStart;
+	}
+	uint32_t pingPeriod = 1000 << pingPeriodicity;
+	uint32_t rxMs = classBStats.searchRxMs +
+					(lockedMs / pingPeriod) * CLASSB_PING_WINDOW +
+					(lockedMs / CLASSB_BEACON_PERIOD) * CLASSB_BEACON_WINDOW;
+	snprintf(dbgBuffer, 255, "Class B state %d searches %d locks %d failed %d last search %ld ms\n",
+			 classBStats.state, classBStats.searches, classBStats.locks, classBStats.failed,
+			 classBStats.lastSearchTime);
+	Serial.print(dbgBuffer);
+	if (toBle && bleUARTisConnected)
+	{
+		bleuart.print(dbgBuffer);
+	}
+	snprintf(dbgBuffer, 255, "Class B %ld s, downlinks %d, max latency %ld s, RX %ld ms\n",
+			 lockedMs / 1000, classBStats.downlinks, pingPeriod / 1000, rxMs);
+	Serial.print(dbgBuffer);
+	if (toBle && bleUARTisConnected)
+	{
+		bleuart.print(dbgBuffer);
+	}
+}
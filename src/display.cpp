@@ -10,7 +10,10 @@
  * @note Writing to the display is done by adding new lines
  * to the display line buffer. If all available display lines
  * are used up, the display is scrolled up and the new line
- * is added at the bottom
+ * is added at the bottom.
+ * The frame buffer is sent one page (8 pixel rows) at a time and the
+ * I2C bus is released between the pages, so the accelerometer does not
+ * wait for a full frame buffer transfer.
  */
 #include "main.h"
 
@@ -20,8 +23,63 @@ char buffer[NUM_OF_LINES+1][32] = {0};
 /** Current line used */
 uint8_t currentLine = 0;
 
+/** Flag if the display is switched on */
+bool dispIsOn = true;
+
+/** Lock for the line buffer and the frame buffer */
+static SemaphoreHandle_t dispMutex = NULL;
+
+/** SSD1306 that sends the frame buffer page by page */
+class SSD1306Paged : public SSD1306Wire
+{
+public:
+	using SSD1306Wire::SSD1306Wire;
+
+	/**
+	 * @brief Send the frame buffer
+	 * @note Takes the I2C bus for each page
+	 */
+	void displayPaged(void)
+	{
+		uint8_t pages = height() / 8;
+		for (uint8_t page = 0; page < pages; page++)
+		{
+			i2cAcquire(I2C_CLIENT_DISPLAY);
+			pageCommand(COLUMNADDR);
+			pageCommand(0);
+			pageCommand(width() - 1);
+			pageCommand(PAGEADDR);
+			pageCommand(page);
+			pageCommand(page);
+			uint8_t *data = &buffer[page * width()];
+			for (uint16_t pos = 0; pos < width(); pos += 16)
+			{
+				Wire.beginTransmission(OLED_ADDRESS);
+				Wire.write(0x40);
+				Wire.write(&data[pos], 16);
+				Wire.endTransmission();
+			}
+			i2cRelease(I2C_CLIENT_DISPLAY);
+		}
+	}
+
+private:
+	/**
+	 * @brief Send a command byte
+	 *
+	 * @param command Command
+	 */
+	void pageCommand(uint8_t command)
+	{
+		Wire.beginTransmission(OLED_ADDRESS);
+		Wire.write(0x80);
+		Wire.write(command);
+		Wire.endTransmission();
+	}
+};
+
 /** Display class */
-SSD1306Wire display(0x3c, PIN_WIRE_SDA, PIN_WIRE_SCL, GEOMETRY_128_64);
+SSD1306Paged display(OLED_ADDRESS, PIN_WIRE_SDA, PIN_WIRE_SCL, GEOMETRY_128_64);
 
 /**
  * @brief Initialize the display
@@ -29,7 +87,8 @@ SSD1306Wire display(0x3c, PIN_WIRE_SDA, PIN_WIRE_SCL, GEOMETRY_128_64);
 void initDisplay(void)
 {
 	delay(500); // Give display reset some time
-	taskENTER_CRITICAL();
+	dispMutex = xSemaphoreCreateMutex();
+	i2cAcquire(I2C_CLIENT_DISPLAY);
 	display.setI2cAutoInit(true);
 	display.init();
 	display.displayOff();
@@ -38,8 +97,8 @@ void initDisplay(void)
 	display.flipScreenVertically();
 	display.setContrast(128);
 	display.setFont(ArialMT_Plain_10);
-	display.display();
-	taskEXIT_CRITICAL();
+	i2cRelease(I2C_CLIENT_DISPLAY);
+	display.displayPaged();
 }
 
 /**
@@ -47,7 +106,7 @@ void initDisplay(void)
  */
 void dispWriteHeader(void)
 {
-	taskENTER_CRITICAL();
+	xSemaphoreTake(dispMutex, portMAX_DELAY);
 	display.setFont(ArialMT_Plain_10);
 
 	// clear the status bar
@@ -61,8 +120,8 @@ void dispWriteHeader(void)
 
 	// draw divider line
 	display.drawLine(0, 11, 128, 11);
-	display.display();
-	taskEXIT_CRITICAL();
+	display.displayPaged();
+	xSemaphoreGive(dispMutex);
 }
 
 /**
@@ -72,7 +131,8 @@ void dispWriteHeader(void)
  */
 void dispAddLine(char *line)
 {
-	taskENTER_CRITICAL();
+	PROF_SCOPE(PROF_DISP_ADD_LINE);
+	xSemaphoreTake(dispMutex, portMAX_DELAY);
 	if (currentLine == NUM_OF_LINES)
 	{
 		// Display is full, shift text one line up
@@ -90,15 +150,16 @@ void dispAddLine(char *line)
 	}
 
 	dispShow();
-	taskEXIT_CRITICAL();
+	xSemaphoreGive(dispMutex);
 }
 
 /**
  * @brief Update display messages
- * 
+ * @note Called with the display lock taken
  */
 void dispShow(void)
 {
+	PROF_SCOPE(PROF_DISP_SHOW);
 	display.setColor(BLACK);
 	display.fillRect(0, STATUS_BAR_HEIGHT + 1, OLED_WIDTH, OLED_HEIGHT);
 
@@ -109,5 +170,37 @@ void dispShow(void)
 	{
 		display.drawString(0, (line * LINE_HEIGHT) + STATUS_BAR_HEIGHT + 1, buffer[line]);
 	}
-	display.display();
+	// Skip the I2C transfer while the display is off
+	if (dispIsOn)
+	{
+		display.displayPaged();
+	}
+}
+
+/**
+ * @brief Switch the display on or off
+ * @note The line buffer is still updated while the display is off
+ * and shown again when the display is switched on
+ *
+ * @param on true to switch the display on
+ */
+void dispPower(bool on)
+{
+	xSemaphoreTake(dispMutex, portMAX_DELAY);
+	dispIsOn = on;
+	i2cAcquire(I2C_CLIENT_DISPLAY);
+	if (on)
+	{
+		display.displayOn();
+	}
+	else
+	{
+		display.displayOff();
+	}
+	i2cRelease(I2C_CLIENT_DISPLAY);
+	if (on)
+	{
+		display.displayPaged();
+	}
+	xSemaphoreGive(dispMutex);
 }
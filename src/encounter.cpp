@@ -0,0 +1,305 @@
+/**
+ * @file encounter.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief BLE proximity scanner with encounter table
+ * @version 0.1
+ * @date 2020-09-08
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Every ENC_SCAN_PERIOD a passive scan runs for ENC_SCAN_TIME.
+ * A scan is postponed while a LoRaWan uplink and its RX windows are
+ * in progress. Advertisers above ENC_MIN_RSSI are kept in a fixed
+ * size table with ENC_BUCKETS buckets of ENC_WAYS entries. The bucket
+ * is selected by a hash of the address. If the bucket is full, the
+ * entry that was not seen for the longest time is evicted.
+ * An encounter is closed when the address was not seen for
+ * ENC_CLOSE_TIME. Closed encounters are sent in batches on ENC_PORT.
+ */
+#include "main.h"
+
+/** Encounter table */
+static enc_entry_s encTable[ENC_BUCKETS][ENC_WAYS];
+
+/** Entries in the last frame and their last seen time */
+static enc_entry_s *encSending[ENC_BATCH_SIZE];
+static uint32_t encSendingLast[ENC_BATCH_SIZE];
+static uint8_t encSendingNum = 0;
+
+/** Timer for the scans */
+static SoftwareTimer encScanTimer;
+
+/** Flag if a batch is waiting to be sent */
+volatile bool encPending = false;
+
+/** Scanner statistics */
+enc_stats_s encStats;
+
+/**
+ * @brief Hash of a BLE address
+ * @note FNV-1a
+ *
+ * @param addr 6 byte address
+ * @return uint32_t Hash
+ */
+static uint32_t encHash(const uint8_t *addr)
+{
+	uint32_t hash = 2166136261UL;
+	for (uint8_t idx = 0; idx < 6; idx++)
+	{
+		hash ^= addr[idx];
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+/**
+ * @brief Add an advertising report to the table
+ *
+ * @param addr 6 byte address
+ * @param rssi RSSI of the report
+ * @param now Uptime in s
+ */
+static void encInsert(const uint8_t *addr, int8_t rssi, uint32_t now)
+{
+	enc_entry_s *bucket = encTable[encHash(addr) % ENC_BUCKETS];
+	enc_entry_s *victim = NULL;
+	taskENTER_CRITICAL();
+	for (uint8_t way = 0; way < ENC_WAYS; way++)
+	{
+		enc_entry_s *entry = &bucket[way];
+		if (entry->used && (memcmp(entry->addr, addr, 6) == 0))
+		{
+			entry->lastSeen = now;
+			if (rssi > entry->maxRssi)
+			{
+				entry->maxRssi = rssi;
+			}
+			encStats.updates++;
+			taskEXIT_CRITICAL();
+			return;
+		}
+		// Prefer a free entry, otherwise the one not seen for the longest time
+		if ((victim == NULL) || (victim->used && (!entry->used || (entry->lastSeen < victim->lastSeen))))
+		{
+			victim = entry;
+		}
+	}
+	if (victim->used)
+	{
+		encStats.evicted++;
+	}
+	memcpy(victim->addr, addr, 6);
+	victim->firstSeen = now;
+	victim->lastSeen = now;
+	victim->maxRssi = rssi;
+	victim->used = true;
+	encStats.inserts++;
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Scan report callback
+ * @note Called by the BLE task for each advertising packet
+ *
+ * @param report Advertising report
+ */
+static void encScanCallback(ble_gap_evt_adv_report_t *report)
+{
+	encStats.reports++;
+	if (report->rssi >= ENC_MIN_RSSI)
+	{
+		encInsert(report->peer_addr.addr, report->rssi, millis() / 1000);
+	}
+	Bluefruit.Scanner.resume();
+}
+
+/**
+ * @brief Scan timer, starts a scan
+ * @note Postponed if a LoRaWan uplink is in progress
+ *
+ * @param unused Timer handle, not used
+ */
+static void encScanTimerCb(TimerHandle_t unused)
+{
+	uint32_t sinceTx = millis() - loraTxTime;
+	if ((loraTxTime != 0) && (sinceTx < ENC_LORA_GUARD))
+	{
+		encStats.postponed++;
+		encScanTimer.stop();
+		encScanTimer.setPeriod(ENC_LORA_GUARD - sinceTx + 1);
+		return;
+	}
+	encStats.scans++;
+	// Timeout in 10 ms units, the scan stops by itself
+	Bluefruit.Scanner.start(ENC_SCAN_TIME / 10);
+	encScanTimer.stop();
+	encScanTimer.setPeriod(ENC_SCAN_PERIOD);
+}
+
+/**
+ * @brief Initialize the scanner
+ * @note Needs the central role, Bluefruit.begin(1, 1)
+ */
+void initEncounter(void)
+{
+	Bluefruit.Scanner.setRxCallback(encScanCallback);
+	Bluefruit.Scanner.restartOnDisconnect(false);
+	// Passive scan, 30 ms window every 100 ms while scanning
+	Bluefruit.Scanner.setInterval(160, 48);
+	Bluefruit.Scanner.useActiveScan(false);
+	encScanTimer.begin(ENC_SCAN_PERIOD, encScanTimerCb);
+	encScanTimer.start();
+}
+
+/**
+ * @brief Check if a batch of closed encounters should be sent
+ * @note Called on each report cycle
+ */
+void encCheck(void)
+{
+	uint32_t now = millis() / 1000;
+	uint8_t closed = 0;
+	uint32_t oldest = now;
+	taskENTER_CRITICAL();
+	for (uint8_t bucket = 0; bucket < ENC_BUCKETS; bucket++)
+	{
+		for (uint8_t way = 0; way < ENC_WAYS; way++)
+		{
+			enc_entry_s *entry = &encTable[bucket][way];
+			if (entry->used && ((now - entry->lastSeen) >= ENC_CLOSE_TIME / 1000))
+			{
+				closed++;
+				if (entry->lastSeen < oldest)
+				{
+					oldest = entry->lastSeen;
+				}
+			}
+		}
+	}
+	taskEXIT_CRITICAL();
+	if ((closed >= ENC_BATCH_SIZE) || ((closed != 0) && ((now - oldest) >= ENC_MAX_DELAY / 1000)))
+	{
+		encPending = true;
+	}
+}
+
+/**
+ * @brief Create a batch of closed encounters
+ * @note Layout (little endian)
+ * 		0 flags, bit 0 set: times are Unix time, otherwise uptime
+ * 		1..4 base time in s, first seen of the oldest encounter
+ * 		then for each encounter ENC_BYTES bytes
+ * 		0..5 address
+ * 		6..7 first seen in s after the base time
+ * 		8 duration in 10 s
+ * 		9 max RSSI (int8)
+ * The entries are freed with encMarkSent()
+ *
+ * @param buffer Buffer, must be at least ENC_FRAME_LEN bytes
+ * @return uint8_t Length of the frame, 0 if there is no closed encounter
+ */
+uint8_t encGetFrame(uint8_t *buffer)
+{
+	uint32_t now = millis() / 1000;
+	encPending = false;
+	encSendingNum = 0;
+	uint32_t base = now;
+	taskENTER_CRITICAL();
+	for (uint8_t bucket = 0; (bucket < ENC_BUCKETS) && (encSendingNum < ENC_BATCH_SIZE); bucket++)
+	{
+		for (uint8_t way = 0; (way < ENC_WAYS) && (encSendingNum < ENC_BATCH_SIZE); way++)
+		{
+			enc_entry_s *entry = &encTable[bucket][way];
+			if (entry->used && ((now - entry->lastSeen) >= ENC_CLOSE_TIME / 1000))
+			{
+				encSendingLast[encSendingNum] = entry->lastSeen;
+				encSending[encSendingNum++] = entry;
+				if (entry->firstSeen < base)
+				{
+					base = entry->firstSeen;
+				}
+			}
+		}
+	}
+
+	uint8_t len = 5;
+	for (uint8_t idx = 0; idx < encSendingNum; idx++)
+	{
+		enc_entry_s *entry = encSending[idx];
+		uint32_t offset = entry->firstSeen - base;
+		uint32_t duration = (entry->lastSeen - entry->firstSeen) / 10;
+		offset = offset > 0xFFFF ? 0xFFFF : offset;
+		memcpy(&buffer[len], entry->addr, 6);
+		buffer[len + 6] = offset;
+		buffer[len + 7] = offset >> 8;
+		buffer[len + 8] = duration > 0xFF ? 0xFF : duration;
+		buffer[len + 9] = entry->maxRssi;
+		len += ENC_BYTES;
+	}
+	taskEXIT_CRITICAL();
+
+	if (encSendingNum == 0)
+	{
+		return 0;
+	}
+	uint32_t baseTime = base;
+	buffer[0] = 0;
+	if (timeStats.source != TIME_SRC_NONE)
+	{
+		baseTime = timeFromMillis(millis() - (now - base) * 1000) / 1000;
+		buffer[0] = 1;
+	}
+	memcpy(&buffer[1], &baseTime, 4);
+	return len;
+}
+
+/**
+ * @brief Free the encounters of the last frame
+ * @note Entries that were seen again meanwhile are kept
+ */
+void encMarkSent(void)
+{
+	taskENTER_CRITICAL();
+	for (uint8_t idx = 0; idx < encSendingNum; idx++)
+	{
+		if (encSending[idx]->lastSeen == encSendingLast[idx])
+		{
+			encSending[idx]->used = false;
+			encStats.sent++;
+		}
+	}
+	encSendingNum = 0;
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Print the scanner statistics
+ *
+ * @param toBle true to print to the BLE UART as well
+ */
+void encPrint(bool toBle)
+{
+	uint8_t used = 0;
+	for (uint8_t bucket = 0; bucket < ENC_BUCKETS; bucket++)
+	{
+		for (uint8_t way = 0; way < ENC_WAYS; way++)
+		{
+			used += encTable[bucket][way].used ? 1 : 0;
+		}
+	}
+	snprintf(dbgBuffer, 255, "Scans %ld postponed %ld reports %ld table %d/%d\n",
+			 encStats.scans, encStats.postponed, encStats.reports, used, ENC_BUCKETS * ENC_WAYS);
+	Serial.print(dbgBuffer);
+	if (toBle && bleUARTisConnected)
+	{
+		bleuart.print(dbgBuffer);
+	}
+	snprintf(dbgBuffer, 255, "Encounters new %ld updated %ld evicted %ld sent %ld\n",
+			 encStats.inserts, encStats.updates, encStats.evicted, encStats.sent);
+	Serial.print(dbgBuffer);
+	if (toBle && bleUARTisConnected)
+	{
+		bleuart.print(dbgBuffer);
+	}
+}
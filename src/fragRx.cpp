@@ -0,0 +1,725 @@
+/**
+ * @file fragRx.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief LoRaWan fragmented data block receiver
+ * @version 0.1
+ * @date 2020-08-28
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Implements the device side of the LoRaWan fragmented data block
+ * transport (TS004 v1.0) on FPort 201.
+ * The first NbFrag fragments are the uncoded data, the following
+ * fragments are the XOR of a pseudo random subset of the data
+ * fragments. Each coded fragment that carries new information about
+ * the missing fragments is reduced with the rows already known
+ * (online gaussian elimination). When there are as many rows as missing
+ * fragments, the missing fragments are solved by back substitution.
+ *
+ * The data block is reassembled in a file in the internal flash. RAM
+ * usage does not depend on the block size, the bit matrix is limited to
+ * FRAG_MAX_MISSING missing fragments.
+ * Fragments are decoded in a low priority task, the LoRa task only
+ * copies them into a queue. Session setup and delete go through the
+ * same queue, so the session never changes while a fragment is decoded.
+ */
+#include "main.h"
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+
+using namespace Adafruit_LittleFS_Namespace;
+
+/** Commands of the fragmentation package */
+#define FRAG_PACKAGE_VERSION 0x00
+#define FRAG_SESSION_STATUS 0x01
+#define FRAG_SESSION_SETUP 0x02
+#define FRAG_SESSION_DELETE 0x03
+#define FRAG_DATA_FRAGMENT 0x08
+
+/** Package identifier and version of the fragmentation package */
+#define FRAG_PACKAGE_ID 3
+#define FRAG_PACKAGE_VER 1
+
+/** File used to reassemble the data block */
+#define FRAG_FILE "/frag.bin"
+
+/** Number of fragments the queue between LoRa task and decoder can hold */
+#define FRAG_QUEUE_LEN 4
+
+/** Session commands and fragments copied from the LoRa task to the decoder task */
+struct frag_item_s
+{
+	uint8_t cmd;
+	uint16_t index;
+	uint8_t data[FRAG_MAX_SIZE];
+};
+
+/** Queue between LoRa task and decoder task */
+static QueueHandle_t fragQueue = NULL;
+/** Task handle of the decoder task */
+TaskHandle_t fragTaskHandle = NULL;
+
+/** File with the data block */
+static File fragFile(InternalFS);
+
+/** Fragmentation session */
+frag_session_s fragSession;
+
+/** Fragment indices (0 based) of the missing fragments, ascending */
+static uint16_t fragMissing[FRAG_MAX_MISSING];
+/** Upper triangular bit matrix over the missing fragments, row n starts with a 1 in column n */
+static uint8_t fragMatrix[FRAG_MAX_MISSING][FRAG_MAX_MISSING / 8];
+/** Flags which rows of the matrix are used */
+static uint8_t fragRowUsed[FRAG_MAX_MISSING / 8];
+/** Coefficients of the current coded fragment, one bit per data fragment */
+static uint8_t fragCoeff[FRAG_MAX_NB / 8];
+/** Line buffers, only used by the decoder task */
+static uint8_t fragLine[FRAG_MAX_SIZE];
+static uint8_t fragTemp[FRAG_MAX_SIZE];
+
+/** Answers to send on FRAG_PORT */
+static uint8_t fragAnswer[FRAG_ANSWER_LEN];
+static uint8_t fragAnswerLen = 0;
+/** Flag if answers are waiting to be sent */
+volatile bool fragPending = false;
+
+/**
+ * @brief Get a bit from a bit array
+ *
+ * @param bits Bit array
+ * @param idx Bit index
+ * @return true if the bit is set
+ */
+static inline bool getBit(const uint8_t *bits, uint16_t idx)
+{
+	return (bits[idx >> 3] >> (idx & 7)) & 1;
+}
+
+/**
+ * @brief Set a bit in a bit array
+ *
+ * @param bits Bit array
+ * @param idx Bit index
+ */
+static inline void setBit(uint8_t *bits, uint16_t idx)
+{
+	bits[idx >> 3] |= 1 << (idx & 7);
+}
+
+/**
+ * @brief XOR two lines
+ *
+ * @param dst Destination, dst ^= src
+ * @param src Source
+ * @param len Length in bytes
+ */
+static void xorLine(uint8_t *dst, const uint8_t *src, uint16_t len)
+{
+	for (uint16_t idx = 0; idx < len; idx++)
+	{
+		dst[idx] ^= src[idx];
+	}
+}
+
+/**
+ * @brief Read a fragment from the staging file
+ *
+ * @param index Fragment index, 0 based
+ * @param buffer Buffer for FRAG_MAX_SIZE bytes
+ */
+static void fragRead(uint16_t index, uint8_t *buffer)
+{
+	fragFile.seek((uint32_t)index * fragSession.fragSize);
+	fragFile.read(buffer, fragSession.fragSize);
+}
+
+/**
+ * @brief Write a fragment to the staging file
+ *
+ * @param index Fragment index, 0 based
+ * @param buffer Fragment data
+ */
+static void fragWrite(uint16_t index, const uint8_t *buffer)
+{
+	fragFile.seek((uint32_t)index * fragSession.fragSize);
+	fragFile.write(buffer, fragSession.fragSize);
+}
+
+/**
+ * @brief Position of a fragment in the missing list
+ *
+ * @param index Fragment index, 0 based
+ * @return int16_t Position in fragMissing, -1 if the fragment was received
+ */
+static int16_t fragMissingPos(uint16_t index)
+{
+	int16_t low = 0;
+	int16_t high = fragSession.missing - 1;
+	while (low <= high)
+	{
+		int16_t mid = (low + high) / 2;
+		if (fragMissing[mid] == index)
+		{
+			return mid;
+		}
+		if (fragMissing[mid] < index)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid - 1;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Mark the data fragments up to an index as missing
+ * @note Fragments are expected in ascending order, every data fragment
+ * between the last received one and index was lost
+ *
+ * @param index Fragment number (1 based) that was received
+ */
+static void fragMarkMissing(uint16_t index)
+{
+	for (uint16_t lost = fragSession.lastData + 1; lost < index; lost++)
+	{
+		if (fragSession.missing == FRAG_MAX_MISSING)
+		{
+			fragSession.status = FRAG_STATUS_NO_MEMORY;
+			return;
+		}
+		fragMissing[fragSession.missing++] = lost - 1;
+	}
+	fragSession.lastData = index;
+}
+
+/**
+ * @brief Pseudo random generator of the parity matrix, PRBS23
+ *
+ * @param value Last value
+ * @return int32_t Next value
+ */
+static int32_t fragPrbs23(int32_t value)
+{
+	int32_t b0 = value & 0x01;
+	int32_t b1 = (value & 0x20) >> 5;
+	return (value >> 1) + ((b0 ^ b1) << 22);
+}
+
+/**
+ * @brief Calculate the coefficients of a coded fragment
+ * @note Same generator as the server side, see TS004 chapter 12
+ *
+ * @param n Number of the coded fragment, 1 = first after the data fragments
+ * @param m Number of data fragments
+ */
+static void fragParityRow(uint16_t n, uint16_t m)
+{
+	memset(fragCoeff, 0, (m + 7) / 8);
+	// Power of 2 block sizes use a larger modulo
+	int32_t mTemp = ((m & (m - 1)) == 0) ? 1 : 0;
+	int32_t x = 1 + (1001 * (int32_t)n);
+	for (uint16_t nbCoeff = 0; nbCoeff < (m >> 1); nbCoeff++)
+	{
+		int32_t r = 1 << 16;
+		while (r >= m)
+		{
+			x = fragPrbs23(x);
+			r = x % (m + mTemp);
+		}
+		setBit(fragCoeff, r);
+	}
+}
+
+/**
+ * @brief Find the first set bit of a matrix row
+ *
+ * @param row Row bits
+ * @return int16_t Column of the first 1, -1 if the row is empty
+ */
+static int16_t fragFirstOne(const uint8_t *row)
+{
+	for (uint16_t col = 0; col < fragSession.missing; col++)
+	{
+		if (getBit(row, col))
+		{
+			return col;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Solve the missing fragments by back substitution
+ * @note All rows of the matrix are used, row n holds a 1 in column n and
+ * only columns > n otherwise
+ */
+static void fragSolve(void)
+{
+	for (int16_t row = fragSession.missing - 2; row >= 0; row--)
+	{
+		fragRead(fragMissing[row], fragLine);
+		for (uint16_t col = row + 1; col < fragSession.missing; col++)
+		{
+			if (getBit(fragMatrix[row], col))
+			{
+				// Row col is already solved
+				fragRead(fragMissing[col], fragTemp);
+				xorLine(fragLine, fragTemp, fragSession.fragSize);
+			}
+		}
+		fragWrite(fragMissing[row], fragLine);
+	}
+}
+
+/**
+ * @brief Add a coded fragment to the matrix
+ *
+ * @param index Fragment number, 1 based, > nbFrag
+ * @param data Fragment data
+ */
+static void fragAddCoded(uint16_t index, const uint8_t *data)
+{
+	uint8_t row[FRAG_MAX_MISSING / 8];
+	memset(row, 0, sizeof(row));
+	memcpy(fragLine, data, fragSession.fragSize);
+
+	// Remove the received data fragments, keep the missing ones as matrix row
+	fragParityRow(index - fragSession.nbFrag, fragSession.nbFrag);
+	for (uint16_t frag = 0; frag < fragSession.nbFrag; frag++)
+	{
+		if (!getBit(fragCoeff, frag))
+		{
+			continue;
+		}
+		int16_t pos = fragMissingPos(frag);
+		if (pos < 0)
+		{
+			fragRead(frag, fragTemp);
+			xorLine(fragLine, fragTemp, fragSession.fragSize);
+		}
+		else
+		{
+			setBit(row, pos);
+		}
+	}
+
+	// Reduce with the known rows until the first 1 is in a free row
+	int16_t first = fragFirstOne(row);
+	while ((first >= 0) && getBit(fragRowUsed, first))
+	{
+		xorLine(row, fragMatrix[first], sizeof(row));
+		fragRead(fragMissing[first], fragTemp);
+		xorLine(fragLine, fragTemp, fragSession.fragSize);
+		first = fragFirstOne(row);
+	}
+	if (first < 0)
+	{
+		// No new information
+		return;
+	}
+
+	memcpy(fragMatrix[first], row, sizeof(row));
+	setBit(fragRowUsed, first);
+	fragWrite(fragMissing[first], fragLine);
+	fragSession.rows++;
+
+	if (fragSession.rows == fragSession.missing)
+	{
+		fragSolve();
+		fragSession.status = FRAG_STATUS_DONE;
+	}
+}
+
+/**
+ * @brief Process a received fragment
+ *
+ * @param index Fragment number, 1 based
+ * @param data Fragment data
+ */
+static void fragProcess(uint16_t index, const uint8_t *data)
+{
+	if ((fragSession.status != FRAG_STATUS_ONGOING) || (index == 0))
+	{
+		return;
+	}
+	if (fragSession.received != 0x3FFF)
+	{
+		fragSession.received++;
+	}
+
+	if (index <= fragSession.nbFrag)
+	{
+		if (index <= fragSession.lastData)
+		{
+			// Duplicate or out of order, it is already counted as missing
+			return;
+		}
+		fragMarkMissing(index);
+		if (fragSession.status != FRAG_STATUS_ONGOING)
+		{
+			return;
+		}
+		fragWrite(index - 1, data);
+		if ((fragSession.missing == 0) && (index == fragSession.nbFrag))
+		{
+			fragSession.status = FRAG_STATUS_DONE;
+		}
+		return;
+	}
+
+	// Coded fragment, all data fragments that did not arrive are lost
+	if (fragSession.lastData < fragSession.nbFrag)
+	{
+		fragMarkMissing(fragSession.nbFrag + 1);
+	}
+	if (fragSession.status != FRAG_STATUS_ONGOING)
+	{
+		return;
+	}
+	if (fragSession.missing == 0)
+	{
+		fragSession.status = FRAG_STATUS_DONE;
+		return;
+	}
+	fragAddCoded(index, data);
+}
+
+/**
+ * @brief Add an answer to the answer buffer
+ *
+ * @param answer Answer data
+ * @param len Length of the answer
+ */
+static void fragQueueAnswer(const uint8_t *answer, uint8_t len)
+{
+	taskENTER_CRITICAL();
+	if (fragAnswerLen + len <= FRAG_ANSWER_LEN)
+	{
+		memcpy(&fragAnswer[fragAnswerLen], answer, len);
+		fragAnswerLen += len;
+		fragPending = true;
+	}
+	taskEXIT_CRITICAL();
+	xSemaphoreGive(loopEnable);
+}
+
+/**
+ * @brief Queue the session status answer
+ */
+static void fragStatusAnswer(void)
+{
+	uint8_t answer[5];
+	uint16_t receivedAndIndex = (fragSession.received & 0x3FFF) | ((uint16_t)fragSession.fragIndex << 14);
+	uint16_t needed = fragSession.missing - fragSession.rows;
+	answer[0] = FRAG_SESSION_STATUS;
+	answer[1] = receivedAndIndex;
+	answer[2] = receivedAndIndex >> 8;
+	answer[3] = needed > 255 ? 255 : needed;
+	answer[4] = fragSession.status == FRAG_STATUS_NO_MEMORY ? 0x01 : 0x00;
+	fragQueueAnswer(answer, 5);
+}
+
+/**
+ * @brief Hand a completed data block to the subsystem
+ * @note Default does nothing but print the block info, subsystems that
+ * receive data blocks override this function and read the block
+ * from the file
+ *
+ * @param descriptor Descriptor of the session, set by the server
+ * @param fileName File with the data block
+ * @param size Size of the block in bytes
+ */
+__attribute__((weak)) void fragBlockReceived(uint32_t descriptor, const char *fileName, uint32_t size)
+{
+	Serial.printf("Data block %08lX received, %ld bytes in %s\n", descriptor, size, fileName);
+}
+
+/**
+ * @brief Start a new session
+ *
+ * @param buffer FragSessionSetupReq payload without the command
+ * @return uint8_t Status bit mask of the answer, bit 0 encoding unsupported,
+ * 		bit 1 not enough memory, bit 2 FragSession index not supported,
+ * 		bit 3 wrong descriptor
+ */
+static uint8_t fragSetup(const uint8_t *buffer)
+{
+	uint8_t fragIndex = (buffer[0] >> 4) & 0x03;
+	uint16_t nbFrag = buffer[1] | (buffer[2] << 8);
+	uint8_t fragSize = buffer[3];
+	uint8_t control = buffer[4];
+	uint8_t status = fragIndex << 6;
+
+	if (((control >> 3) & 0x07) != 0)
+	{
+		// Only the parity matrix of TS004 is supported
+		status |= 0x01;
+	}
+	if ((fragSize == 0) || (fragSize > FRAG_MAX_SIZE) || (nbFrag == 0) || (nbFrag > FRAG_MAX_NB))
+	{
+		// The block does not fit into the fragment and parity buffers
+		status |= 0x02;
+	}
+	if (fragIndex != 0)
+	{
+		// Only one session
+		status |= 0x04;
+	}
+	if ((status & 0x0F) != 0)
+	{
+		return status;
+	}
+
+	if (fragFile)
+	{
+		fragFile.close();
+	}
+	InternalFS.remove(FRAG_FILE);
+	if (!fragFile.open(FRAG_FILE, FILE_O_WRITE))
+	{
+		// No space for the block in the flash
+		return status | 0x02;
+	}
+
+	memset(&fragSession, 0, sizeof(fragSession));
+	memset(fragRowUsed, 0, sizeof(fragRowUsed));
+	fragSession.fragIndex = fragIndex;
+	fragSession.nbFrag = nbFrag;
+	fragSession.fragSize = fragSize;
+	fragSession.padding = buffer[5];
+	fragSession.descriptor = buffer[6] | (buffer[7] << 8) | (buffer[8] << 16) | ((uint32_t)buffer[9] << 24);
+	fragSession.status = FRAG_STATUS_ONGOING;
+	fragSession.active = true;
+	Serial.printf("Fragmentation session %d fragments of %d bytes\n", nbFrag, fragSize);
+	return status;
+}
+
+/**
+ * @brief Delete the session
+ *
+ * @param param FragSessionDeleteReq parameter
+ * @return uint8_t Status of the answer
+ */
+static uint8_t fragDelete(uint8_t param)
+{
+	uint8_t status = param & 0x03;
+	if (!fragSession.active || ((param & 0x03) != fragSession.fragIndex))
+	{
+		// Session does not exist
+		return status | 0x04;
+	}
+	fragSession.active = false;
+	fragSession.status = FRAG_STATUS_NONE;
+	if (fragFile)
+	{
+		fragFile.close();
+	}
+	return status;
+}
+
+/**
+ * @brief Decoder task, processes the queued session commands and fragments
+ *
+ * @param pvParameters Unused
+ */
+void fragTask(void *pvParameters)
+{
+	(void)pvParameters;
+	frag_item_s item;
+	uint8_t answer[2];
+
+	while (true)
+	{
+		xQueueReceive(fragQueue, &item, portMAX_DELAY);
+		switch (item.cmd)
+		{
+		case FRAG_SESSION_SETUP:
+			answer[0] = FRAG_SESSION_SETUP;
+			answer[1] = fragSetup(item.data);
+			fragQueueAnswer(answer, 2);
+			break;
+
+		case FRAG_SESSION_DELETE:
+			answer[0] = FRAG_SESSION_DELETE;
+			answer[1] = fragDelete(item.data[0]);
+			fragQueueAnswer(answer, 2);
+			break;
+
+		case FRAG_DATA_FRAGMENT:
+		{
+			if (!fragSession.active || !fragFile)
+			{
+				break;
+			}
+			uint8_t lastStatus = fragSession.status;
+			fragProcess(item.index, item.data);
+			if ((lastStatus == FRAG_STATUS_ONGOING) && (fragSession.status != FRAG_STATUS_ONGOING))
+			{
+				if (fragSession.status == FRAG_STATUS_DONE)
+				{
+					uint32_t size = (uint32_t)fragSession.nbFrag * fragSession.fragSize - fragSession.padding;
+					fragFile.truncate(size);
+					fragFile.close();
+					fragBlockReceived(fragSession.descriptor, FRAG_FILE, size);
+				}
+				else
+				{
+					Serial.printf("Data block failed, more than %d fragments missing\n", FRAG_MAX_MISSING);
+				}
+				fragStatusAnswer();
+			}
+			break;
+		}
+
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Initialize the fragmentation receiver
+ */
+void initFrag(void)
+{
+	InternalFS.begin();
+	fragSession.active = false;
+	fragQueue = xQueueCreate(FRAG_QUEUE_LEN, sizeof(frag_item_s));
+	xTaskCreate(fragTask, "FRAG", 512, NULL, TASK_PRIO_LOW, &fragTaskHandle);
+}
+
+/**
+ * @brief Pass a command to the decoder task
+ *
+ * @param cmd Command
+ * @param index Fragment number, only used for fragments
+ * @param data Command parameters or fragment data
+ * @param len Length of the data
+ */
+static void fragQueueItem(uint8_t cmd, uint16_t index, const uint8_t *data, uint8_t len)
+{
+	frag_item_s item;
+	item.cmd = cmd;
+	item.index = index;
+	memcpy(item.data, data, len);
+	if (xQueueSend(fragQueue, &item, 0) != pdTRUE)
+	{
+		// Decoder too slow, a fragment is treated as lost
+		Serial.println("Fragment queue full");
+	}
+}
+
+/**
+ * @brief Handle a downlink on FRAG_PORT
+ * @note Called from the LoRa task, fragments are only queued.
+ * A downlink can hold several commands.
+ *
+ * @param buffer Downlink payload
+ * @param len Length of the payload
+ */
+void fragDownlink(uint8_t *buffer, uint8_t len)
+{
+	uint8_t pos = 0;
+	uint8_t answer[3];
+	while (pos < len)
+	{
+		uint8_t cmd = buffer[pos++];
+		switch (cmd)
+		{
+		case FRAG_PACKAGE_VERSION:
+			answer[0] = FRAG_PACKAGE_VERSION;
+			answer[1] = FRAG_PACKAGE_ID;
+			answer[2] = FRAG_PACKAGE_VER;
+			fragQueueAnswer(answer, 3);
+			break;
+
+		case FRAG_SESSION_STATUS:
+			if (pos + 1 > len)
+			{
+				return;
+			}
+			// Bit 0 = all participants answer, otherwise only the ones still missing fragments
+			if (fragSession.active && (((buffer[pos] >> 1) & 0x03) == fragSession.fragIndex) &&
+				((buffer[pos] & 0x01) || (fragSession.status != FRAG_STATUS_DONE)))
+			{
+				fragStatusAnswer();
+			}
+			pos += 1;
+			break;
+
+		case FRAG_SESSION_SETUP:
+			if (pos + 10 > len)
+			{
+				return;
+			}
+			fragQueueItem(FRAG_SESSION_SETUP, 0, &buffer[pos], 10);
+			pos += 10;
+			break;
+
+		case FRAG_SESSION_DELETE:
+			if (pos + 1 > len)
+			{
+				return;
+			}
+			fragQueueItem(FRAG_SESSION_DELETE, 0, &buffer[pos], 1);
+			pos += 1;
+			break;
+
+		case FRAG_DATA_FRAGMENT:
+		{
+			if (pos + 2 > len)
+			{
+				return;
+			}
+			uint16_t indexAndN = buffer[pos] | (buffer[pos + 1] << 8);
+			pos += 2;
+			if (!fragSession.active || ((indexAndN >> 14) != fragSession.fragIndex) ||
+				(pos + fragSession.fragSize > len))
+			{
+				// A fragment is always the last command
+				return;
+			}
+			fragQueueItem(FRAG_DATA_FRAGMENT, indexAndN & 0x3FFF, &buffer[pos], fragSession.fragSize);
+			return;
+		}
+
+		default:
+			// Unknown command, the rest of the payload can not be parsed
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Get the queued answers
+ *
+ * @param buffer Buffer, must be at least FRAG_ANSWER_LEN bytes
+ * @return uint8_t Length of the answers
+ */
+uint8_t fragGetAnswer(uint8_t *buffer)
+{
+	taskENTER_CRITICAL();
+	uint8_t len = fragAnswerLen;
+	memcpy(buffer, fragAnswer, len);
+	fragAnswerLen = 0;
+	fragPending = false;
+	taskEXIT_CRITICAL();
+	return len;
+}
+
+/**
+ * @brief Print the missing fragments of the current session
+ */
+void fragPrintStatus(void)
+{
+	Serial.printf("Fragments received %d, missing %d, solved rows %d, status %d\n",
+				  fragSession.received, fragSession.missing, fragSession.rows, fragSession.status);
+	for (uint16_t idx = 0; idx < fragSession.missing; idx++)
+	{
+		Serial.printf("%d ", fragMissing[idx] + 1);
+	}
+	Serial.println();
+}
@@ -0,0 +1,334 @@
+/**
+ * @file geo.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Fixed point geo coordinate functions
+ * @version 0.1
+ * @date 2020-08-05
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The Cortex-M4F has only a single precision FPU. All double
+ * calculations and printf float formatting are done in software.
+ * Coordinates are therefor kept as integer in 1/10000000 degree
+ * and all calculations and formatting are done with integers.
+ */
+#include "main.h"
+
+/** Millimeter per 1/10000000 degree latitude, multiplied by 1000 */
+#define GEO_MM_PER_E7_X1000 11132
+
+/** cos() of 0 to 90 degree in 1 degree steps, Q15 format */
+static const uint16_t cosTable[91] = {
+	32768, 32763, 32748, 32723, 32688, 32643, 32588, 32524, 32449, 32365,
+	32270, 32166, 32052, 31928, 31795, 31651, 31499, 31336, 31164, 30983,
+	30792, 30592, 30382, 30163, 29935, 29698, 29452, 29197, 28932, 28660,
+	28378, 28088, 27789, 27482, 27166, 26842, 26510, 26170, 25822, 25466,
+	25102, 24730, 24351, 23965, 23571, 23170, 22763, 22348, 21926, 21498,
+	21063, 20622, 20174, 19720, 19261, 18795, 18324, 17847, 17364, 16877,
+	16384, 15886, 15384, 14876, 14365, 13848, 13328, 12803, 12275, 11743,
+	11207, 10668, 10126, 9580, 9032, 8481, 7927, 7371, 6813, 6252,
+	5690, 5126, 4560, 3993, 3425, 2856, 2286, 1715, 1144, 572,
+	0};
+
+/**
+ * @brief Convert TinyGPS++ raw degrees into fixed point
+ * @note Uses the integer values TinyGPS++ parsed from the NMEA digits,
+ * no double conversion involved
+ *
+ * @param raw Raw degrees from TinyGPSLocation::rawLat() or rawLng()
+ * @return int32_t Coordinate in 1/10000000 degree
+ */
+int32_t geoFromRaw(const RawDegrees &raw)
+{
+	int32_t value = (int32_t)raw.deg * GEO_SCALE + (int32_t)(raw.billionths / 100);
+	return raw.negative ? -value : value;
+}
+
+/**
+ * @brief cos() of a latitude
+ *
+ * @param lat Latitude in 1/10000000 degree
+ * @return int32_t cos(lat) in Q15 format
+ */
+static int32_t geoCos(int32_t lat)
+{
+	if (lat < 0)
+	{
+		lat = -lat;
+	}
+	int32_t deg = lat / GEO_SCALE;
+	if (deg >= 90)
+	{
+		return 0;
+	}
+	int32_t frac = lat % GEO_SCALE;
+	int32_t c0 = cosTable[deg];
+	int32_t c1 = cosTable[deg + 1];
+	// Linear interpolation between the table entries
+	return c0 - (int32_t)(((int64_t)(c0 - c1) * frac) / GEO_SCALE);
+}
+
+/**
+ * @brief cos() of an angle
+ *
+ * @param angle Angle in 1/10 degree
+ * @return int32_t cos(angle) in Q15 format
+ */
+int32_t geoCosDeg10(int32_t angle)
+{
+	angle %= 3600;
+	if (angle < 0)
+	{
+		angle += 3600;
+	}
+	if (angle <= 900)
+	{
+		return geoCos(angle * (GEO_SCALE / 10));
+	}
+	if (angle <= 1800)
+	{
+		return -geoCos((1800 - angle) * (GEO_SCALE / 10));
+	}
+	if (angle <= 2700)
+	{
+		return -geoCos((angle - 1800) * (GEO_SCALE / 10));
+	}
+	return geoCos((3600 - angle) * (GEO_SCALE / 10));
+}
+
+/**
+ * @brief sin() of an angle
+ *
+ * @param angle Angle in 1/10 degree
+ * @return int32_t sin(angle) in Q15 format
+ */
+int32_t geoSinDeg10(int32_t angle)
+{
+	return geoCosDeg10(angle - 900);
+}
+
+/**
+ * @brief Integer square root
+ *
+ * @param value Input value
+ * @return uint32_t sqrt(value)
+ */
+static uint32_t geoSqrt(uint64_t value)
+{
+	uint64_t result = 0;
+	uint64_t bit = (uint64_t)1 << 62;
+
+	while (bit > value)
+	{
+		bit >>= 2;
+	}
+	while (bit != 0)
+	{
+		if (value >= result + bit)
+		{
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		}
+		else
+		{
+			result >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint32_t)result;
+}
+
+/**
+ * @brief Get the north and east offset between two coordinates
+ * @note Equirectangular projection, good enough for the
+ * short distances between two fixes
+ *
+ * @param from Start coordinate
+ * @param to End coordinate
+ * @param north Returns the offset to the north in mm
+ * @param east Returns the offset to the east in mm
+ */
+void geoOffset(const geo_coord_s &from, const geo_coord_s &to, int64_t *north, int64_t *east)
+{
+	int64_t dLat = (int64_t)to.lat - from.lat;
+	int64_t dLng = (int64_t)to.lng - from.lng;
+	// Wrap around at the date line
+	if (dLng > 180 * (int64_t)GEO_SCALE)
+	{
+		dLng -= 360 * (int64_t)GEO_SCALE;
+	}
+	else if (dLng < -180 * (int64_t)GEO_SCALE)
+	{
+		dLng += 360 * (int64_t)GEO_SCALE;
+	}
+	int32_t midLat = (int32_t)(((int64_t)from.lat + to.lat) / 2);
+
+	*north = dLat * GEO_MM_PER_E7_X1000 / 1000;
+	*east = ((dLng * GEO_MM_PER_E7_X1000 / 1000) * geoCos(midLat)) >> 15;
+}
+
+/**
+ * @brief Move a coordinate by a north and east offset
+ * @note Inverse of geoOffset()
+ *
+ * @param from Start coordinate
+ * @param north Offset to the north in mm
+ * @param east Offset to the east in mm
+ * @return geo_coord_s New coordinate
+ */
+geo_coord_s geoMove(const geo_coord_s &from, int64_t north, int64_t east)
+{
+	geo_coord_s to;
+	to.lat = from.lat + (int32_t)(north * 1000 / GEO_MM_PER_E7_X1000);
+	int32_t cosLat = geoCos(to.lat);
+	if (cosLat < 1)
+	{
+		cosLat = 1;
+	}
+	int64_t dLng = ((east * 1000 / GEO_MM_PER_E7_X1000) << 15) / cosLat;
+	to.lng = from.lng + (int32_t)dLng;
+	return to;
+}
+
+/**
+ * @brief Distance between two coordinates
+ *
+ * @param from Start coordinate
+ * @param to End coordinate
+ * @return uint32_t Distance in meter
+ */
+uint32_t geoDistance(const geo_coord_s &from, const geo_coord_s &to)
+{
+	int64_t north;
+	int64_t east;
+	geoOffset(from, to, &north, &east);
+	// Offsets in mm, scale down to cm to stay in 64 bit for the squares
+	north /= 10;
+	east /= 10;
+	return geoSqrt((uint64_t)(north * north) + (uint64_t)(east * east)) / 100;
+}
+
+/**
+ * @brief atan2() with integer math
+ * @note atan(x) ~ 45x + 15.64x(1-x) degree for 0 <= x <= 1,
+ * max error ~0.22 degree
+ *
+ * @param y Y value
+ * @param x X value
+ * @return uint16_t Angle in 1/10 degree, 0..3599,
+ * 0 is along the positive y axis, clockwise
+ */
+uint16_t geoAtan2(int64_t y, int64_t x)
+{
+	uint64_t ay = y < 0 ? -y : y;
+	uint64_t ax = x < 0 ? -x : x;
+	if ((ax == 0) && (ay == 0))
+	{
+		return 0;
+	}
+
+	// Ratio of the smaller to the larger value in Q15
+	int64_t ratio;
+	bool swapped = ax > ay;
+	if (swapped)
+	{
+		ratio = (int64_t)((ay << 15) / ax);
+	}
+	else
+	{
+		ratio = (int64_t)((ax << 15) / ay);
+	}
+	int32_t angle = (int32_t)((450 * ratio + ((156 * ratio * (32768 - ratio)) >> 15)) >> 15);
+
+	// Angle from the y axis in the first quadrant
+	if (swapped)
+	{
+		angle = 900 - angle;
+	}
+	// Map into the quadrant
+	if ((x >= 0) && (y < 0))
+	{
+		angle = 1800 - angle;
+	}
+	else if ((x < 0) && (y < 0))
+	{
+		angle = 1800 + angle;
+	}
+	else if ((x < 0) && (y >= 0))
+	{
+		angle = 3600 - angle;
+	}
+	return angle % 3600;
+}
+
+/**
+ * @brief Bearing from one coordinate to another
+ *
+ * @param from Start coordinate
+ * @param to End coordinate
+ * @return uint16_t Bearing in 1/10 degree, 0 = north, clockwise
+ */
+uint16_t geoBearing(const geo_coord_s &from, const geo_coord_s &to)
+{
+	int64_t north;
+	int64_t east;
+	geoOffset(from, to, &north, &east);
+	return geoAtan2(north, east);
+}
+
+/**
+ * @brief Format a fixed point value as decimal string
+ * @note Integer only replacement for printf("%.nf")
+ *
+ * @param buffer Buffer for the string, must hold at least 14 bytes
+ * @param value Fixed point value
+ * @param scale Scale of the value, e.g. 100000 for 1/100000
+ * @param decimals Number of decimals to print, max 9
+ * @return char* Pointer to the buffer
+ */
+char *geoFormat(char *buffer, int32_t value, uint32_t scale, uint8_t decimals)
+{
+	char *pos = buffer;
+	uint32_t absValue = value < 0 ? -(int64_t)value : value;
+	if (value < 0)
+	{
+		*pos++ = '-';
+	}
+
+	uint32_t intPart = absValue / scale;
+	uint32_t fracPart = absValue % scale;
+
+	// Integer part
+	char digits[10];
+	uint8_t numDigits = 0;
+	do
+	{
+		digits[numDigits++] = '0' + (intPart % 10);
+		intPart /= 10;
+	} while (intPart != 0);
+	while (numDigits != 0)
+	{
+		*pos++ = digits[--numDigits];
+	}
+
+	if (decimals != 0)
+	{
+		*pos++ = '.';
+		// Fraction digits, padded with zeros if the scale is too small
+		for (uint8_t idx = 0; idx < decimals; idx++)
+		{
+			if (scale > 1)
+			{
+				scale /= 10;
+				*pos++ = '0' + (fracPart / scale);
+				fracPart %= scale;
+			}
+			else
+			{
+				*pos++ = '0';
+			}
+		}
+	}
+	*pos = 0;
+	return buffer;
+}
@@ -13,12 +13,96 @@
 // The GPS object
 TinyGPSPlus myGPS;
 
-/** GPS polling function */
-bool pollGPS(void);
-
 /** Location data as byte array */
 tracker_data_s trackerData;
 
+/** Last valid position */
+geo_coord_s gpsFix = {0, 0};
+/** millis() of the last valid position */
+uint32_t gpsFixMillis = 0;
+
+/** Byte counters of the GPS UART */
+gps_stats_s gpsStats;
+
+/** Header of the current NMEA sentence, e.g. "$GPGGA" */
+static char nmeaHeader[7];
+/** Number of header bytes received */
+static uint8_t nmeaHeaderLen = 0;
+/** Flag if the current NMEA sentence is passed to the parser */
+static bool nmeaPass = false;
+
+/**
+ * @brief Check if a NMEA sentence type is used
+ *
+ * @param type Pointer to the 3 character sentence type, e.g. "GGA"
+ * @return true if the sentence should be parsed
+ */
+static bool nmeaWanted(const char *type)
+{
+	if ((type[0] == 'G') && (type[1] == 'G') && (type[2] == 'A'))
+	{
+		return true;
+	}
+	if ((type[0] == 'R') && (type[1] == 'M') && (type[2] == 'C'))
+	{
+		return true;
+	}
+	// Satellite statistics
+	if ((type[0] == 'G') && (type[1] == 'S') && ((type[2] == 'V') || (type[2] == 'A')))
+	{
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Feed one byte from the GPS module through the sentence filter
+ * @note Unused sentences are dropped before they reach TinyGPS++
+ *
+ * @param c Received byte
+ * @return true if a complete sentence was parsed
+ */
+static bool gpsFilterEncode(char c)
+{
+	gpsStats.bytesReceived++;
+
+	if (c == '$')
+	{
+		nmeaHeader[0] = c;
+		nmeaHeaderLen = 1;
+		nmeaPass = false;
+		return false;
+	}
+
+	if (nmeaHeaderLen != 0)
+	{
+		// Collect the header until the sentence type is known
+		nmeaHeader[nmeaHeaderLen++] = c;
+		if (nmeaHeaderLen < 6)
+		{
+			return false;
+		}
+		nmeaHeaderLen = 0;
+		nmeaPass = nmeaWanted(&nmeaHeader[3]);
+		if (!nmeaPass)
+		{
+			return false;
+		}
+		for (int idx = 0; idx < 5; idx++)
+		{
+			myGPS.encode(nmeaHeader[idx]);
+		}
+		gpsStats.bytesParsed += 5;
+	}
+
+	if (!nmeaPass)
+	{
+		return false;
+	}
+	gpsStats.bytesParsed++;
+	return myGPS.encode(c);
+}
+
 /**
  * @brief Initialize the GPS
  * 
@@ -37,78 +121,179 @@ void initGPS(void)
 	Serial1.begin(9600);
 	while (!Serial1)
 		;
+
+	// Switch off unused sentences and set the fix rate
+	initGPSConfig();
+
+	// Register the GSV and GSA fields
+	initSatStats();
 }
 
+/** State of a running GPS acquisition */
+struct gps_poll_s
+{
+	uint32_t start;
+	bool hasPos;
+	bool hasAlt;
+	bool hasSpeed;
+	bool hasHdop;
+	geo_coord_s position;
+	uint32_t positionMillis;
+	int32_t altitude;
+	int32_t altitudeCm;
+	uint16_t speed;
+	uint16_t speedCms;
+	uint8_t hdop;
+	int32_t hdopValue;
+	uint8_t endReason;
+};
+
+/** State of the running acquisition */
+static gps_poll_s gpsPoll;
+
 /**
- * @brief Check GPS module for position
- * 
- * @return true Valid position found
- * @return false No valid position
+ * @brief Start a GPS acquisition
+ * @note The acquisition is continued with gpsPollStep()
  */
-bool pollGPS(void)
+void gpsPollStart(void)
 {
-	time_t timeout = millis();
-	bool hasPos = false;
-	bool hasAlt = false;
-	bool hasTime = false;
-	bool hasSpeed = false;
-	bool hasHdop = false;
-	int64_t latitude = 0;
-	int64_t longitude = 0;
-	int32_t altitude = 0;
-	uint16_t speed = 0;
-	uint8_t hdop = 0;
+	memset(&gpsPoll, 0, sizeof(gpsPoll));
+	gpsPoll.start = millis();
+	gpsPoll.hdopValue = 9999;
+	gpsPoll.endReason = GPS_END_NONE;
+
+	acqStart();
 
 	digitalWrite(LED_BUILTIN, HIGH);
-	while ((millis() - timeout) < 10000)
+}
+
+/**
+ * @brief Process the bytes received from the GPS module
+ * @note Does not wait for new bytes
+ *
+ * @return true if the acquisition ended
+ */
+bool gpsPollStep(void)
+{
+	PROF_SCOPE(PROF_POLL_GPS);
+	while ((gpsPoll.endReason == GPS_END_NONE) && (Serial1.available() > 0))
 	{
-		while (Serial1.available() > 0)
+		// if (myGPS.encode(ss.read()))
+		char c = Serial1.read();
+#if CAPTURE
+		captureGpsByte(c);
+#endif
+		if (gpsFilterEncode(c))
 		{
-			// if (myGPS.encode(ss.read()))
-			if (myGPS.encode(Serial1.read()))
+			digitalToggle(LED_BUILTIN);
+			satStatsProcess();
+			// GGA updates position, altitude and HDOP together,
+			// check all of them after each sentence
+			if (myGPS.location.isUpdated() && myGPS.location.isValid())
 			{
-				digitalToggle(LED_BUILTIN);
-				if (myGPS.location.isUpdated() && myGPS.location.isValid())
-				{
-					hasPos = true;
-					latitude = myGPS.location.lat() * 100000;
-					longitude = myGPS.location.lng() * 100000;
-				}
-				else if (myGPS.altitude.isUpdated() && myGPS.altitude.isValid())
-				{
-					hasAlt = true;
-					altitude = myGPS.altitude.meters();
-				}
-				else if (myGPS.speed.isUpdated() && myGPS.speed.isValid())
-				{
-					hasSpeed = true;
-					speed = myGPS.speed.mps();
-				}
-				else if (myGPS.hdop.isUpdated() && myGPS.hdop.isValid())
-				{
-					hasHdop = true;
-					hdop = myGPS.hdop.hdop();
-				}
+				gpsPoll.hasPos = true;
+				gpsPoll.position.lat = geoFromRaw(myGPS.location.rawLat());
+				gpsPoll.position.lng = geoFromRaw(myGPS.location.rawLng());
+				gpsPoll.positionMillis = millis();
 			}
-			// if (hasPos && hasAlt && hasDate && hasTime && hasSpeed && hasHdop)
-			if (hasPos && hasAlt && hasSpeed && hasHdop && hasTime)
+			// RMC has date and time, sync the clock once a position is valid
+			if (gpsPoll.hasPos && myGPS.date.isUpdated())
 			{
-				break;
+				timeSyncGps(millis());
 			}
+			if (myGPS.altitude.isUpdated() && myGPS.altitude.isValid())
+			{
+				gpsPoll.hasAlt = true;
+				// value() is in cm
+				gpsPoll.altitudeCm = myGPS.altitude.value();
+				gpsPoll.altitude = gpsPoll.altitudeCm / 100;
+			}
+			if (myGPS.speed.isUpdated() && myGPS.speed.isValid())
+			{
+				gpsPoll.hasSpeed = true;
+				// value() is in 1/100 knots
+				gpsPoll.speedCms = (myGPS.speed.value() * 5144) / 10000;
+				gpsPoll.speed = gpsPoll.speedCms / 100;
+			}
+			if (myGPS.hdop.isUpdated() && myGPS.hdop.isValid())
+			{
+				gpsPoll.hasHdop = true;
+				// value() is in 1/100
+				gpsPoll.hdopValue = myGPS.hdop.value();
+				gpsPoll.hdop = gpsPoll.hdopValue / 100;
+			}
+			gpsPoll.endReason = acqCheck(gpsPoll.hasPos && gpsPoll.hasAlt && gpsPoll.hasSpeed && gpsPoll.hasHdop,
+									  gpsPoll.hdopValue, satInView());
 		}
-		if (hasPos && hasAlt && hasSpeed && hasHdop)
-		{
-			break;
-		}
 	}
+	if (gpsPoll.endReason == GPS_END_NONE)
+	{
+		// Check the budget even if the module is silent
+		gpsPoll.endReason = acqCheck(gpsPoll.hasPos && gpsPoll.hasAlt && gpsPoll.hasSpeed && gpsPoll.hasHdop,
+								  gpsPoll.hdopValue, satInView());
+	}
+	return gpsPoll.endReason != GPS_END_NONE;
+}
+
+/**
+ * @brief Abort the running acquisition
+ *
+ * @param reason End reason, see GPS_END_xxx definitions
+ */
+void gpsPollAbort(uint8_t reason)
+{
+	if (gpsPoll.endReason == GPS_END_NONE)
+	{
+		gpsPoll.endReason = reason;
+	}
+}
+
+/**
+ * @brief Finish the acquisition and encode the position
+ * @note Updates the fix, the track log, the motion vector, the trip
+ * and the position fields of trackerData
+ *
+ * @return true Valid position found
+ * @return false No valid position
+ */
+bool gpsPollFinish(void)
+{
+	uint8_t endReason = gpsPoll.endReason;
+	bool hasPos = gpsPoll.hasPos;
+	geo_coord_s position = gpsPoll.position;
+	uint32_t positionMillis = gpsPoll.positionMillis;
+	int32_t altitude = gpsPoll.altitude;
+	int32_t altitudeCm = gpsPoll.altitudeCm;
+	uint16_t speed = gpsPoll.speed;
+	uint16_t speedCms = gpsPoll.speedCms;
+	uint8_t hdop = gpsPoll.hdop;
+	int32_t hdopValue = gpsPoll.hdopValue;
+	time_t timeout = gpsPoll.start;
+
+	acqFinish(endReason);
 
 	digitalWrite(LED_BUILTIN, LOW);
-	delay(10);
+	healthGpsResult(hasPos, millis() - timeout);
 	Serial.println("GPS poll finished ");
 	if (hasPos && myGPS.location.isValid())
 	{
-		Serial.printf("Lat: %.4f Lon: %.4f\n", latitude/100000.0, longitude/100000.0);
-		Serial.printf("Alt: %.4f Speed: %.4f\n", altitude * 1.0, speed * 1.0);
+		gpsStats.fixes++;
+		Serial.printf("GPS bytes received %ld parsed %ld per fix %ld\n",
+					  gpsStats.bytesReceived, gpsStats.bytesParsed, gpsStats.bytesReceived / gpsStats.fixes);
+		char latStr[14];
+		char lngStr[14];
+		Serial.printf("Lat: %s Lon: %s\n", geoFormat(latStr, position.lat, GEO_SCALE, 4), geoFormat(lngStr, position.lng, GEO_SCALE, 4));
+		Serial.printf("Alt: %ld Speed: %d\n", altitude, speed);
+
+		gpsFix = position;
+		gpsFixMillis = positionMillis;
+		lnsUpdate(position, altitudeCm, speedCms);
+		trackLogAdd(position, altitude, speed, hdop);
+		motionUpdate(position, speedCms);
+		tripUpdate(position, speedCms, positionMillis);
+		posCacheStore(hdopValue, speedCms);
+		int32_t latitude = position.lat / (GEO_SCALE / GEO_PAYLOAD_SCALE);
+		int32_t longitude = position.lng / (GEO_SCALE / GEO_PAYLOAD_SCALE);
 
 		trackerData.lat_1 = latitude;
 		trackerData.lat_2 = latitude >> 8;
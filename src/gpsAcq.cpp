@@ -0,0 +1,233 @@
+/**
+ * @file gpsAcq.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief GPS acquisition controller
+ * @version 0.1
+ * @date 2020-08-21
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Decides how long a GPS acquisition waits for a fix.
+ * The wait budget is based on the recent time to first fix.
+ * Without a recent fix (cold start) the budget is longer.
+ * It is extended if enough satellites with usable signals are visible
+ * but no fix is available yet, and the acquisition is stopped early if
+ * no satellite is visible at all or the satellite signals are too weak
+ * (sky blocked, e.g. indoors). After the first fix, receiving continues while the
+ * HDOP is above the target and still improving.
+ */
+#include "main.h"
+
+/** Last time to first fix values in ms */
+static uint32_t ttffHistory[GPS_ACQ_HISTORY];
+/** Number of values in the history */
+static uint8_t ttffCount = 0;
+/** Next slot in the history */
+static uint8_t ttffNext = 0;
+/** Time of the last successful fix, 0 = never */
+static time_t lastFixTime = 0;
+
+/** Start time of the current acquisition */
+static time_t acqStartTime = 0;
+/** Wait budget of the current acquisition in ms */
+static uint32_t acqBudget = 0;
+/** Flag if the budget was extended already */
+static bool acqExtended = false;
+/** Flag if the current acquisition is a warm start */
+static bool acqWarm = false;
+/** Time of the first fix in the current acquisition */
+static time_t acqFixTime = 0;
+/** HDOP (x100) at the start of the current improvement window */
+static int32_t acqWindowHdop = 0;
+/** Start of the current improvement window */
+static time_t acqWindowStart = 0;
+
+/** Acquisition statistics */
+gps_acq_stats_s gpsAcqStats;
+
+/**
+ * @brief Start a new acquisition and calculate the wait budget
+ *
+ * @return uint32_t Wait budget in ms
+ */
+uint32_t acqStart(void)
+{
+	acqStartTime = millis();
+	acqExtended = false;
+	acqFixTime = 0;
+	acqWindowHdop = 0;
+	satStatsStart();
+
+	if ((ttffCount == 0) || (lastFixTime == 0) || ((millis() - lastFixTime) > GPS_ACQ_WARM_AGE))
+	{
+		// Cold start, the receiver needs the ephemeris first
+		acqBudget = gpsMaxTime * GPS_ACQ_COLD_FACTOR;
+		acqWarm = false;
+	}
+	else
+	{
+		acqWarm = true;
+		uint32_t sum = 0;
+		uint32_t maxTtff = 0;
+		for (uint8_t idx = 0; idx < ttffCount; idx++)
+		{
+			sum += ttffHistory[idx];
+			if (ttffHistory[idx] > maxTtff)
+			{
+				maxTtff = ttffHistory[idx];
+			}
+		}
+		// Twice the mean, but at least the slowest recent fix
+		acqBudget = (sum / ttffCount) * 2;
+		if (acqBudget < maxTtff)
+		{
+			acqBudget = maxTtff;
+		}
+		acqBudget += GPS_ACQ_MARGIN;
+		if (acqBudget > gpsMaxTime)
+		{
+			acqBudget = gpsMaxTime;
+		}
+	}
+	gpsAcqStats.lastBudget = acqBudget;
+	return acqBudget;
+}
+
+/**
+ * @brief Check if the acquisition should continue
+ * @note Called after every parsed sentence and periodically
+ *
+ * @param hasFix true if position, altitude, speed and HDOP are valid
+ * @param hdop Current HDOP x100
+ * @param satellites Number of satellites in view, see satInView()
+ * @return uint8_t GPS_END_NONE to continue, otherwise the reason to stop
+ */
+uint8_t acqCheck(bool hasFix, int32_t hdop, uint8_t satellites)
+{
+	time_t now = millis();
+	uint32_t elapsed = now - acqStartTime;
+
+	if (hasFix)
+	{
+		if (acqFixTime == 0)
+		{
+			acqFixTime = now;
+			acqWindowHdop = hdop;
+			acqWindowStart = now;
+		}
+		if (hdop <= GPS_ACQ_TARGET_HDOP)
+		{
+			return GPS_END_ACCURATE;
+		}
+		if ((now - acqWindowStart) >= GPS_ACQ_IMPROVE_TIME)
+		{
+			// Stop if the HDOP improved less than GPS_ACQ_IMPROVE_PERCENT in the window
+			if ((acqWindowHdop - hdop) * 100 < acqWindowHdop * GPS_ACQ_IMPROVE_PERCENT)
+			{
+				return GPS_END_PLATEAU;
+			}
+			acqWindowHdop = hdop;
+			acqWindowStart = now;
+		}
+		if (elapsed >= acqBudget)
+		{
+			// Budget is used up, but we have a fix
+			return GPS_END_PLATEAU;
+		}
+		return GPS_END_NONE;
+	}
+
+	// No fix yet
+	if (satSkyBlocked())
+	{
+		return GPS_END_SKY_BLOCKED;
+	}
+	if ((elapsed >= acqBudget / 2) && satHasGsv() && (satellites == 0))
+	{
+		return GPS_END_NO_SATS;
+	}
+	if (elapsed >= acqBudget)
+	{
+		if (!acqExtended && (satellites >= GPS_ACQ_MIN_SATS) && satSignalUsable())
+		{
+			// Enough satellites with usable signals, a fix should be close
+			acqExtended = true;
+			acqBudget += acqBudget / 2;
+			gpsAcqStats.lastBudget = acqBudget;
+			return GPS_END_NONE;
+		}
+		return GPS_END_TIMEOUT;
+	}
+	return GPS_END_NONE;
+}
+
+/**
+ * @brief Finish the acquisition and record the result
+ *
+ * @param reason Reason the acquisition ended
+ */
+void acqFinish(uint8_t reason)
+{
+	time_t now = millis();
+	gpsAcqStats.lastReason = reason;
+	gpsAcqStats.lastDuration = now - acqStartTime;
+	gpsAcqStats.lastWarm = acqWarm;
+	if (gpsAcqStats.endCount[reason] != 0xFFFF)
+	{
+		gpsAcqStats.endCount[reason]++;
+	}
+
+	if (acqFixTime != 0)
+	{
+		gpsAcqStats.lastAfterFix = now - acqFixTime;
+		ttffHistory[ttffNext] = acqFixTime - acqStartTime;
+		ttffNext = (ttffNext + 1) % GPS_ACQ_HISTORY;
+		if (ttffCount < GPS_ACQ_HISTORY)
+		{
+			ttffCount++;
+		}
+		lastFixTime = now;
+	}
+
+	Serial.printf("GPS acquisition ended: %s after %ld ms, budget %ld ms\n",
+				  acqReasonName(reason), gpsAcqStats.lastDuration, gpsAcqStats.lastBudget);
+}
+
+/**
+ * @brief Duration of the last acquisition as a warm start
+ * @note A cold start spends the time before the first fix on the
+ * ephemeris, a warm start at the same place only needs the time after it
+ *
+ * @return uint32_t Duration in ms
+ */
+uint32_t acqWarmTime(void)
+{
+	return gpsAcqStats.lastWarm ? gpsAcqStats.lastDuration : gpsAcqStats.lastAfterFix;
+}
+
+/**
+ * @brief Get a readable name of an end reason
+ *
+ * @param reason End reason
+ * @return const char* Name
+ */
+const char *acqReasonName(uint8_t reason)
+{
+	switch (reason)
+	{
+	case GPS_END_ACCURATE:
+		return "accurate";
+	case GPS_END_PLATEAU:
+		return "no improvement";
+	case GPS_END_TIMEOUT:
+		return "timeout";
+	case GPS_END_NO_SATS:
+		return "no satellites";
+	case GPS_END_SKY_BLOCKED:
+		return "sky blocked";
+	case GPS_END_ALARM:
+		return "alarm";
+	default:
+		return "none";
+	}
+}
@@ -0,0 +1,146 @@
+/**
+ * @file gpsCfg.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief u-blox GPS module configuration
+ * @version 0.1
+ * @date 2020-08-03
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The RAK1910 uses a u-blox MAX-7Q module. By default it sends
+ * GGA, GLL, GSA, GSV, RMC and VTG sentences every second. Only GGA
+ * (position, altitude, HDOP) and RMC (position, speed) are used for
+ * the fix, GSV and GSA only for the satellite statistics. GSV and GSA
+ * are reduced to every SAT_STATS_RATE fixes, the other sentences are
+ * switched off with UBX-CFG-MSG commands.
+ */
+#include "main.h"
+
+/** UBX message class for configuration messages */
+#define UBX_CLASS_CFG 0x06
+/** UBX-CFG-PRT port configuration */
+#define UBX_CFG_PRT 0x00
+/** UBX-CFG-MSG message rate configuration */
+#define UBX_CFG_MSG 0x01
+/** UBX-CFG-RATE navigation rate configuration */
+#define UBX_CFG_RATE 0x08
+
+/** UBX message class of the standard NMEA sentences */
+#define NMEA_CLASS 0xF0
+/** NMEA sentence IDs used in UBX-CFG-MSG */
+#define NMEA_GGA 0x00
+#define NMEA_GLL 0x01
+#define NMEA_GSA 0x02
+#define NMEA_GSV 0x03
+#define NMEA_RMC 0x04
+#define NMEA_VTG 0x05
+
+/**
+ * @brief Send a UBX command to the GPS module
+ *
+ * @param msgClass UBX message class
+ * @param msgId UBX message ID
+ * @param payload Pointer to the payload
+ * @param len Length of the payload
+ */
+void ubxSend(uint8_t msgClass, uint8_t msgId, uint8_t *payload, uint16_t len)
+{
+	uint8_t header[6] = {0xB5, 0x62, msgClass, msgId, (uint8_t)(len & 0xFF), (uint8_t)(len >> 8)};
+	uint8_t ckA = 0;
+	uint8_t ckB = 0;
+
+	// Fletcher checksum over class, ID, length and payload
+	for (int idx = 2; idx < 6; idx++)
+	{
+		ckA += header[idx];
+		ckB += ckA;
+	}
+	for (int idx = 0; idx < len; idx++)
+	{
+		ckA += payload[idx];
+		ckB += ckA;
+	}
+
+	Serial1.write(header, 6);
+	Serial1.write(payload, len);
+	Serial1.write(ckA);
+	Serial1.write(ckB);
+	Serial1.flush();
+	// Give the module time to process the command
+	delay(50);
+}
+
+/**
+ * @brief Set the output rate of a NMEA sentence on the UART
+ *
+ * @param nmeaId NMEA sentence ID
+ * @param rate Output every rate navigation solution, 0 = off
+ */
+void ubxSetNmeaRate(uint8_t nmeaId, uint8_t rate)
+{
+	uint8_t payload[3] = {NMEA_CLASS, nmeaId, rate};
+	ubxSend(UBX_CLASS_CFG, UBX_CFG_MSG, payload, 3);
+}
+
+/**
+ * @brief Set the navigation solution rate
+ *
+ * @param measRate Time between two measurements in ms
+ */
+void ubxSetFixRate(uint16_t measRate)
+{
+	uint8_t payload[6] = {(uint8_t)(measRate & 0xFF), (uint8_t)(measRate >> 8),
+						  0x01, 0x00,  // one measurement per navigation solution
+						  0x01, 0x00}; // align to GPS time
+	ubxSend(UBX_CLASS_CFG, UBX_CFG_RATE, payload, 6);
+}
+
+/**
+ * @brief Set the baud rate of the GPS module UART
+ * @note The module switches to the new baudrate immediately,
+ * Serial1 must be restarted with the new baud rate afterwards
+ *
+ * @param baud New baud rate
+ */
+void ubxSetBaud(uint32_t baud)
+{
+	uint8_t payload[20] = {0};
+	payload[0] = 0x01; // UART1
+	// 8N1
+	payload[4] = 0xD0;
+	payload[5] = 0x08;
+	payload[8] = baud;
+	payload[9] = baud >> 8;
+	payload[10] = baud >> 16;
+	payload[11] = baud >> 24;
+	// Input UBX + NMEA
+	payload[12] = 0x03;
+	// Output NMEA only
+	payload[14] = 0x02;
+	ubxSend(UBX_CLASS_CFG, UBX_CFG_PRT, payload, 20);
+}
+
+/**
+ * @brief Configure the GPS module output
+ * @note Switch off all not used NMEA sentences, reduce the satellite info,
+ * set the fix rate and optional change the baud rate
+ */
+void initGPSConfig(void)
+{
+	ubxSetNmeaRate(NMEA_GLL, 0);
+	ubxSetNmeaRate(NMEA_GSA, SAT_STATS_RATE);
+	ubxSetNmeaRate(NMEA_GSV, SAT_STATS_RATE);
+	ubxSetNmeaRate(NMEA_VTG, 0);
+	ubxSetNmeaRate(NMEA_GGA, 1);
+	ubxSetNmeaRate(NMEA_RMC, 1);
+
+	ubxSetFixRate(GPS_FIX_RATE);
+
+#if GPS_BAUD != 9600
+	ubxSetBaud(GPS_BAUD);
+	Serial1.end();
+	Serial1.begin(GPS_BAUD);
+	while (!Serial1)
+		;
+#endif
+}
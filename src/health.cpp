@@ -0,0 +1,278 @@
+/**
+ * @file health.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Device health counters and telemetry frame
+ * @version 0.1
+ * @date 2020-08-10
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Counters are saturating 16 bit values. Incrementing a counter
+ * is a single compare and store, it can be called from ISRs and from
+ * the LoRaWan callbacks.
+ * The health frame is sent on its own FPort every HEALTH_INTERVAL ms
+ * or when requested by a downlink on the same port. After the frame
+ * was sent, counters and accumulators start over, each frame covers
+ * the interval since the previous one.
+ */
+#include "main.h"
+
+/** Health counters */
+static volatile uint16_t healthCounters[HEALTH_NUM_COUNTERS];
+
+/** Min/max/mean accumulators */
+static health_acc_s healthAccs[HEALTH_NUM_ACCS];
+
+/** Current GPS no fix streak */
+static uint16_t noFixStreak = 0;
+
+/** Error code of the last failed send */
+static uint8_t lastSendError = 0;
+
+/** Time of the last wake up of the main loop */
+static time_t healthWakeTime = 0;
+
+/** Flag if a health frame should be sent */
+bool healthPending = false;
+
+/** Timer for the health frame */
+SoftwareTimer healthSending;
+
+/**
+ * @brief Timer callback to request a health frame
+ *
+ * @param unused
+ * 			Timer handle, not used
+ */
+void healthTimer(TimerHandle_t unused)
+{
+	(void)unused;
+	healthPending = true;
+}
+
+/**
+ * @brief Initialize the health counters and the send timer
+ */
+void initHealth(void)
+{
+	healthReset();
+	healthSending.begin(HEALTH_INTERVAL, healthTimer);
+	healthSending.start();
+}
+
+/**
+ * @brief Start a new interval
+ * @note Called after a health frame was sent. A running GPS no fix
+ * streak is kept and counted in the new interval.
+ */
+void healthReset(void)
+{
+	taskENTER_CRITICAL();
+	for (int idx = 0; idx < HEALTH_NUM_COUNTERS; idx++)
+	{
+		healthCounters[idx] = 0;
+	}
+	taskEXIT_CRITICAL();
+	healthCounters[HEALTH_GPS_NO_FIX_STREAK] = noFixStreak;
+	for (int idx = 0; idx < HEALTH_NUM_ACCS; idx++)
+	{
+		healthAccs[idx].min = 0xFFFFFFFF;
+		healthAccs[idx].max = 0;
+		healthAccs[idx].sum = 0;
+		healthAccs[idx].count = 0;
+	}
+	lastSendError = 0;
+}
+
+/**
+ * @brief Increment a health counter
+ * @note Saturates at 0xFFFF, safe to call from ISR
+ *
+ * @param counter Counter ID, see HEALTH_xxx definitions
+ */
+void healthInc(uint8_t counter)
+{
+	if (healthCounters[counter] != 0xFFFF)
+	{
+		healthCounters[counter]++;
+	}
+}
+
+/**
+ * @brief Add a value to a min/max/mean accumulator
+ *
+ * @param acc Accumulator ID, see HEALTH_ACC_xxx definitions
+ * @param value Value to add
+ */
+void healthAdd(uint8_t acc, uint32_t value)
+{
+	health_acc_s *entry = &healthAccs[acc];
+	if (value < entry->min)
+	{
+		entry->min = value;
+	}
+	if (value > entry->max)
+	{
+		entry->max = value;
+	}
+	if (entry->count != 0xFFFF)
+	{
+		entry->sum += value;
+		entry->count++;
+	}
+}
+
+/**
+ * @brief Record the result of a GPS acquisition
+ *
+ * @param hasFix true if a valid position was found
+ * @param duration Time of the acquisition in ms
+ */
+void healthGpsResult(bool hasFix, uint32_t duration)
+{
+	if (hasFix)
+	{
+		noFixStreak = 0;
+		healthAdd(HEALTH_ACC_TTFF, duration);
+	}
+	else
+	{
+		healthInc(HEALTH_GPS_NO_FIX);
+		if (noFixStreak != 0xFFFF)
+		{
+			noFixStreak++;
+		}
+		if (noFixStreak > healthCounters[HEALTH_GPS_NO_FIX_STREAK])
+		{
+			healthCounters[HEALTH_GPS_NO_FIX_STREAK] = noFixStreak;
+		}
+	}
+}
+
+/**
+ * @brief Record the result of a LoRaWan send request
+ * @note Called for every lmh_send(), frames sent over the BLE relay are not counted
+ *
+ * @param error Result of lmh_send(), 0 on success, negative on failure
+ */
+void healthSendResult(int8_t error)
+{
+	if (error == 0)
+	{
+		healthInc(HEALTH_SEND_OK);
+		healthAdd(HEALTH_ACC_WAKE_TO_UP, millis() - healthWakeTime);
+	}
+	else
+	{
+		healthInc(HEALTH_SEND_ERR);
+		lastSendError = error < 0 ? -error : error;
+	}
+}
+
+/**
+ * @brief Remember the time the main loop woke up
+ */
+void healthMarkWake(void)
+{
+	healthWakeTime = millis();
+}
+
+/** Bit writer state for the health frame */
+struct bit_writer_s
+{
+	uint8_t *buffer;
+	uint16_t bitPos;
+};
+
+/**
+ * @brief Append a value with a given number of bits, MSB first
+ * @note Values that do not fit are saturated
+ *
+ * @param writer Bit writer
+ * @param value Value
+ * @param bits Number of bits, max 32
+ */
+static void putBits(bit_writer_s *writer, uint32_t value, uint8_t bits)
+{
+	uint32_t maxValue = (bits == 32) ? 0xFFFFFFFF : ((1UL << bits) - 1);
+	if (value > maxValue)
+	{
+		value = maxValue;
+	}
+	for (int bit = bits - 1; bit >= 0; bit--)
+	{
+		uint16_t byteIdx = writer->bitPos >> 3;
+		uint8_t mask = 0x80 >> (writer->bitPos & 0x07);
+		if (value & (1UL << bit))
+		{
+			writer->buffer[byteIdx] |= mask;
+		}
+		else
+		{
+			writer->buffer[byteIdx] &= ~mask;
+		}
+		writer->bitPos++;
+	}
+}
+
+/**
+ * @brief Append min, max and mean of an accumulator
+ *
+ * @param writer Bit writer
+ * @param acc Accumulator ID
+ * @param divider Divider to convert the values into the frame unit
+ * @param bits Number of bits per value
+ */
+static void putAcc(bit_writer_s *writer, uint8_t acc, uint32_t divider, uint8_t bits)
+{
+	health_acc_s *entry = &healthAccs[acc];
+	if (entry->count == 0)
+	{
+		putBits(writer, 0, bits);
+		putBits(writer, 0, bits);
+		putBits(writer, 0, bits);
+		return;
+	}
+	putBits(writer, entry->min / divider, bits);
+	putBits(writer, entry->max / divider, bits);
+	putBits(writer, (uint32_t)(entry->sum / entry->count) / divider, bits);
+}
+
+/**
+ * @brief Create the bit packed health frame
+ * @note Layout, MSB first, see README.md
+ *
+ * @param buffer Buffer, must be at least HEALTH_FRAME_LEN bytes
+ * @return uint8_t Length of the frame
+ */
+uint8_t healthGetFrame(uint8_t *buffer)
+{
+	bit_writer_s writer = {buffer, 0};
+	memset(buffer, 0, HEALTH_FRAME_LEN);
+
+	putBits(&writer, HEALTH_FRAME_VERSION, 4);
+	putBits(&writer, healthCounters[HEALTH_JOIN_TRY], 8);
+	putBits(&writer, healthCounters[HEALTH_JOINED], 8);
+	putBits(&writer, healthCounters[HEALTH_SEND_OK], 12);
+	putBits(&writer, healthCounters[HEALTH_SEND_ERR], 12);
+	putBits(&writer, lastSendError, 4);
+	putBits(&writer, healthCounters[HEALTH_GPS_NO_FIX], 12);
+	putBits(&writer, healthCounters[HEALTH_GPS_NO_FIX_STREAK], 8);
+	putBits(&writer, healthCounters[HEALTH_ACC_WAKE], 12);
+	putBits(&writer, healthCounters[HEALTH_BLE_CONNECT], 8);
+	putBits(&writer, healthCounters[HEALTH_DOWNLINK], 8);
+	// Time to first fix in seconds
+	putAcc(&writer, HEALTH_ACC_TTFF, 1000, 8);
+	// Wake up to uplink in 100 ms
+	putAcc(&writer, HEALTH_ACC_WAKE_TO_UP, 100, 8);
+	// Battery in %
+	putAcc(&writer, HEALTH_ACC_BATT, 1, 7);
+	// Uptime in hours
+	putBits(&writer, millis() / 3600000, 12);
+	// Mean C/N0 in dBHz, satellites in view and fix type
+	putBits(&writer, satMeanCn0(), 6);
+	putBits(&writer, satStats.inView[SAT_GPS] + satStats.inView[SAT_GLONASS], 6);
+	putBits(&writer, satStats.fixType, 2);
+
+	return (writer.bitPos + 7) / 8;
+}
@@ -0,0 +1,153 @@
+/**
+ * @file i2cBus.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Shared I2C bus arbitration
+ * @version 0.1
+ * @date 2020-09-06
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The OLED and the LIS3DH share Wire. Wire runs on the TWIM
+ * peripheral with EasyDMA, each transfer blocks the calling task until
+ * the DMA transfer is done. Each client takes the bus for its
+ * transactions. A client that waits for the bus lets clients with a
+ * higher priority (lower client ID) go first, the accelerometer is served
+ * before the display. Large display updates are split into pages, so
+ * accelerometer reads get the bus between two pages.
+ */
+#include "main.h"
+
+/** Bus lock */
+static SemaphoreHandle_t i2cMutex = NULL;
+/** Number of tasks waiting for the bus per client */
+static volatile uint8_t i2cWaiting[I2C_NUM_CLIENTS] = {0};
+/** micros() when the current owner got the bus */
+static uint32_t i2cOwnerStart = 0;
+/** millis() of the last statistics reset */
+static uint32_t i2cStatsStart = 0;
+
+/** Bus statistics */
+i2c_stats_s i2cStats;
+
+/** Names of the clients, same order as I2C_CLIENT_xxx */
+static const char *i2cNames[I2C_NUM_CLIENTS] = {"ACC", "OLED"};
+
+/**
+ * @brief Create the bus lock
+ * @note Must be called before the first client uses the bus
+ */
+void initI2C(void)
+{
+	i2cMutex = xSemaphoreCreateMutex();
+	i2cStatsStart = millis();
+}
+
+/**
+ * @brief Check if a client with a higher priority waits for the bus
+ *
+ * @param client Client ID, see I2C_CLIENT_xxx definitions
+ * @return true if a higher priority client waits
+ */
+static bool i2cHigherWaiting(uint8_t client)
+{
+	for (uint8_t idx = 0; idx < client; idx++)
+	{
+		if (i2cWaiting[idx] != 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Take the bus
+ * @note Blocks until the bus is free and no higher priority client waits.
+ * Not allowed in interrupt handlers.
+ *
+ * @param client Client ID, see I2C_CLIENT_xxx definitions
+ */
+void i2cAcquire(uint8_t client)
+{
+	uint32_t start = micros();
+	taskENTER_CRITICAL();
+	i2cWaiting[client]++;
+	taskEXIT_CRITICAL();
+
+	while (true)
+	{
+		xSemaphoreTake(i2cMutex, portMAX_DELAY);
+		if (!i2cHigherWaiting(client))
+		{
+			break;
+		}
+		// Hand the bus to the higher priority client
+		xSemaphoreGive(i2cMutex);
+		delay(1);
+	}
+
+	taskENTER_CRITICAL();
+	i2cWaiting[client]--;
+	taskEXIT_CRITICAL();
+
+	i2cOwnerStart = micros();
+	uint32_t wait = i2cOwnerStart - start;
+	i2c_client_stats_s *stats = &i2cStats.client[client];
+	stats->transactions++;
+	stats->waitUs += wait;
+	if (wait > stats->maxWaitUs)
+	{
+		stats->maxWaitUs = wait;
+	}
+}
+
+/**
+ * @brief Release the bus
+ *
+ * @param client Client ID, see I2C_CLIENT_xxx definitions
+ */
+void i2cRelease(uint8_t client)
+{
+	i2cStats.client[client].busyUs += micros() - i2cOwnerStart;
+	xSemaphoreGive(i2cMutex);
+}
+
+/**
+ * @brief Clear the statistics
+ */
+void i2cReset(void)
+{
+	xSemaphoreTake(i2cMutex, portMAX_DELAY);
+	memset(&i2cStats, 0, sizeof(i2cStats));
+	i2cStatsStart = millis();
+	xSemaphoreGive(i2cMutex);
+}
+
+/**
+ * @brief Print the statistics
+ * @note Wait times and bus utilization per client since the last reset
+ *
+ * @param toBle true to print to the BLE UART as well
+ */
+void i2cPrint(bool toBle)
+{
+	uint32_t elapsedMs = millis() - i2cStatsStart;
+	if (elapsedMs == 0)
+	{
+		elapsedMs = 1;
+	}
+	for (uint8_t client = 0; client < I2C_NUM_CLIENTS; client++)
+	{
+		i2c_client_stats_s stats = i2cStats.client[client];
+		uint32_t meanWait = stats.transactions == 0 ? 0 : (uint32_t)(stats.waitUs / stats.transactions);
+		// busy us / (elapsed ms * 1000) in 0.1%
+		uint32_t util = (uint32_t)(stats.busyUs / elapsedMs);
+		snprintf(dbgBuffer, 255, "I2C %s n %ld wait mean %ld us max %ld us, bus %ld.%ld%%\n",
+				 i2cNames[client], stats.transactions, meanWait, stats.maxWaitUs, util / 10, util % 10);
+		Serial.print(dbgBuffer);
+		if (toBle && bleUARTisConnected)
+		{
+			bleuart.print(dbgBuffer);
+		}
+	}
+}
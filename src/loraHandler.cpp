@@ -11,6 +11,38 @@
 #include "main.h"
 #include <LoRaWan-RAK4630.h>
 
+// Device keys can be set in loraKeys.h (not in the repository, see loraKeys.example.h)
+// or with build flags, e.g. -DNODE_DEVICE_EUI="{0x00,0x0D,...}"
+#if __has_include("loraKeys.h")
+#include "loraKeys.h"
+#endif
+#ifndef NODE_DEVICE_EUI
+#define NODE_DEVICE_EUI {0x00, 0x0D, 0x75, 0xE6, 0x56, 0x4D, 0xC1, 0xF5}
+#endif
+#ifndef NODE_APP_EUI
+#define NODE_APP_EUI {0x70, 0xB3, 0xD5, 0x7E, 0xD0, 0x02, 0x01, 0xE1}
+#endif
+#ifndef NODE_APP_KEY
+#define NODE_APP_KEY {0x2B, 0x84, 0xE0, 0xB0, 0x9B, 0x68, 0xE5, 0xCB, 0x42, 0x17, 0x6F, 0xE7, 0x53, 0xDC, 0xEE, 0x79}
+#endif
+#ifndef NODE_DEV_ADDR
+#define NODE_DEV_ADDR 0x26021FB5
+#endif
+#ifndef NODE_NWS_KEY
+#define NODE_NWS_KEY {0x32, 0x3D, 0x15, 0x5A, 0x00, 0x0D, 0xF3, 0x35, 0x30, 0x7A, 0x16, 0xDA, 0x0C, 0x9D, 0xF5, 0x3F}
+#endif
+#ifndef NODE_APPS_KEY
+#define NODE_APPS_KEY {0x3F, 0x6A, 0x66, 0x45, 0x9D, 0x5E, 0xDC, 0xA6, 0x3C, 0xBC, 0x46, 0x19, 0xCD, 0x61, 0xA1, 0x1E}
+#endif
+/** true for OTAA, false for ABP */
+#ifndef NODE_OTAA
+#define NODE_OTAA true
+#endif
+/** LoRaWan region */
+#ifndef NODE_REGION
+#define NODE_REGION LORAMAC_REGION_AS923
+#endif
+
 /** Software timer to switch off the LED after sending a LoRaWan package */
 SoftwareTimer ledTicker;
 
@@ -34,8 +66,14 @@ static void lorawan_has_joined_handler(void);
 static void lorawan_rx_handler(lmh_app_data_t *app_data);
 /** LoRaWan callback after class change request finished */
 static void lorawan_confirm_class_handler(DeviceClass_t Class);
+/** LoRaWan callback when the join failed */
+static void lorawan_join_failed_handler(void);
+/** LoRaWan callback after an unconfirmed uplink finished */
+static void lorawan_unconf_finished_handler(void);
+/** LoRaWan callback after a confirmed uplink finished */
+static void lorawan_conf_finished_handler(bool result);
 /** LoRaWan Function to send a package */
-void sendLoRaFrame(void);
+int8_t sendLoRaFrame(void);
 
 /**@brief Structure containing LoRaWan parameters, needed for lmh_init()
  * 
@@ -52,27 +90,59 @@ static lmh_param_t lora_param_init = {LORAWAN_ADR_OFF, DR_3, LORAWAN_PUBLIC_NETW
 
 /** Structure containing LoRaWan callback functions, needed for lmh_init() */
 static lmh_callback_t lora_callbacks = {lorawanBattLevel, BoardGetUniqueId, BoardGetRandomSeed,
-										lorawan_rx_handler, lorawan_has_joined_handler, lorawan_confirm_class_handler};
+										lorawan_rx_handler, lorawan_has_joined_handler, lorawan_confirm_class_handler,
+										lorawan_join_failed_handler, lorawan_unconf_finished_handler, lorawan_conf_finished_handler};
 
 /** Device EUI required for OTAA network join */
-uint8_t nodeDeviceEUI[8] = {0x00, 0x0D, 0x75, 0xE6, 0x56, 0x4D, 0xC1, 0xF5};
+uint8_t nodeDeviceEUI[8] = NODE_DEVICE_EUI;
 /** Application EUI required for network join */
-uint8_t nodeAppEUI[8] = {0x70, 0xB3, 0xD5, 0x7E, 0xD0, 0x02, 0x01, 0xE1};
+uint8_t nodeAppEUI[8] = NODE_APP_EUI;
 /** Application key required for network join */
-uint8_t nodeAppKey[16] = {0x2B, 0x84, 0xE0, 0xB0, 0x9B, 0x68, 0xE5, 0xCB, 0x42, 0x17, 0x6F, 0xE7, 0x53, 0xDC, 0xEE, 0x79};
+uint8_t nodeAppKey[16] = NODE_APP_KEY;
 /** Device address required for ABP network join */
-uint32_t nodeDevAddr = 0x26021FB5;
+uint32_t nodeDevAddr = NODE_DEV_ADDR;
 /** Network session key required for ABP network join */
-uint8_t nodeNwsKey[16] = {0x32, 0x3D, 0x15, 0x5A, 0x00, 0x0D, 0xF3, 0x35, 0x30, 0x7A, 0x16, 0xDA, 0x0C, 0x9D, 0xF5, 0x3F};
+uint8_t nodeNwsKey[16] = NODE_NWS_KEY;
 /** Application session key required for ABP network join */
-uint8_t nodeAppsKey[16] = {0x3F, 0x6A, 0x66, 0x45, 0x9D, 0x5E, 0xDC, 0xA6, 0x3C, 0xBC, 0x46, 0x19, 0xCD, 0x61, 0xA1, 0x1E};
+uint8_t nodeAppsKey[16] = NODE_APPS_KEY;
 
 /** Flag whether to use OTAA or ABP network join method */
-bool doOTAA = true;
+bool doOTAA = NODE_OTAA;
 
 /** LoRa error code */
 uint32_t err_code;
 
+/** RSSI of the last downlink */
+int16_t lastRssi = 0;
+/** SNR of the last downlink */
+int8_t lastSnr = 0;
+/** Current device class */
+uint8_t currentClass = CLASS_A;
+
+/** millis() of the last LoRaWan uplink */
+uint32_t loraTxTime = 0;
+
+/**
+ * @brief Send the application data
+ * @note Remembers the time of the uplink, other radio users keep away from
+ * the TX and the RX windows
+ *
+ * @param type Confirmed or unconfirmed uplink
+ * @return lmh_error_status Result of lmh_send()
+ */
+static lmh_error_status loraSend(lmh_confirm type)
+{
+	loraTxTime = millis();
+#if CAPTURE
+	uint8_t event[2] = {m_lora_app_data.port, m_lora_app_data.buffsize};
+	captureMac(CAPTURE_MAC_TX, event, 2);
+#endif
+	lmh_error_status error = lmh_send(&m_lora_app_data, type);
+	// Only LoRaWan uplinks are counted, BLE relay sends are not
+	healthSendResult(error);
+	return error;
+}
+
 /**
  * @brief LED off function
  */
@@ -113,7 +183,7 @@ uint8_t initLoRaHandler(void)
 	lmh_setDevAddr(nodeDevAddr);
 
 	// Initialize LoRaWan
-	err_code = lmh_init(&lora_callbacks, lora_param_init, doOTAA, CLASS_A, LORAMAC_REGION_AS923);
+	err_code = lmh_init(&lora_callbacks, lora_param_init, doOTAA, CLASS_A, NODE_REGION);
 	if (err_code != 0)
 	{
 		return 2;
@@ -141,6 +211,7 @@ uint8_t initLoRaHandler(void)
 
 	// Start Join procedure
 	Serial.println("Start network join request");
+	healthInc(HEALTH_JOIN_TRY);
 	lmh_join();
 
 	ledTicker.begin(1000, ledOff, NULL, false);
@@ -153,6 +224,11 @@ uint8_t initLoRaHandler(void)
  */
 static void lorawan_has_joined_handler(void)
 {
+	PROF_SCOPE(PROF_LORA_JOINED);
+	healthInc(HEALTH_JOINED);
+#if CAPTURE
+	captureMac(CAPTURE_MAC_JOINED, NULL, 0);
+#endif
 
 	if (doOTAA)
 	{
@@ -173,7 +249,43 @@ static void lorawan_has_joined_handler(void)
 			bleuart.println("ABP joined");
 		}
 	}
-	lmh_class_request(CLASS_C);
+	loraClassRequest(policyDeviceClass());
+}
+
+/**
+ * @brief LoRa function for handling a failed join
+ * @note Called after JOINREQ_NBTRIALS join requests without answer,
+ * start over with the next join request
+ */
+static void lorawan_join_failed_handler(void)
+{
+	Serial.println("Join failed, retry");
+	if (bleUARTisConnected)
+	{
+		bleuart.println("Join failed, retry");
+	}
+	healthInc(HEALTH_JOIN_TRY);
+	lmh_join();
+}
+
+/**
+ * @brief LoRa function called after an unconfirmed uplink and its RX windows
+ */
+static void lorawan_unconf_finished_handler(void)
+{
+}
+
+/**
+ * @brief LoRa function called after a confirmed uplink, its RX windows
+ * and the MAC retransmissions
+ * @note Only the alarm frame is sent confirmed
+ *
+ * @param result true if the network server acknowledged the uplink
+ */
+static void lorawan_conf_finished_handler(bool result)
+{
+	Serial.printf("Confirmed uplink %s\n", result ? "acknowledged" : "not acknowledged");
+	alarmAckResult(result);
 }
 
 /**
@@ -183,9 +295,21 @@ static void lorawan_has_joined_handler(void)
  */
 static void lorawan_rx_handler(lmh_app_data_t *app_data)
 {
+	PROF_SCOPE(PROF_LORA_RX);
+	powerCountWake(WAKE_LORA);
+	healthInc(HEALTH_DOWNLINK);
+	classBDownlink();
+	lastRssi = app_data->rssi;
+	lastSnr = app_data->snr;
+#if CAPTURE
+	uint8_t event[5] = {app_data->port, app_data->buffsize, (uint8_t)app_data->rssi, (uint8_t)(app_data->rssi >> 8), (uint8_t)app_data->snr};
+	captureMac(CAPTURE_MAC_RX, event, 5);
+#endif
 	Serial.printf("LoRa Packet received on port %d, size:%d, rssi:%d, snr:%d\n",
 				  app_data->port, app_data->buffsize, app_data->rssi, app_data->snr);
-	char nullTerm[app_data->buffsize + 2] = {0};
+	// Static, a VLA on the LoRa task stack has no upper bound
+	static char nullTerm[LORAWAN_APP_DATA_BUFF_SIZE + 2];
+	memset(nullTerm, 0, sizeof(nullTerm));
 
 	if (bleUARTisConnected)
 	{
@@ -204,32 +328,69 @@ static void lorawan_rx_handler(lmh_app_data_t *app_data)
 	sprintf(dbgBuffer, "DWN RSSI %d, SNR %d\n", app_data->rssi, app_data->snr);
 	dispAddLine(dbgBuffer);
 
+	if (app_data->port != 3)
+	{
+		policyDownlink(0xFF);
+	}
+
 	switch (app_data->port)
 	{
 	case 3:
-		// Port 3 switches the class
-		if (app_data->buffsize == 1)
+		// Port 3 switches the class, a second byte sets the class B ping slot periodicity
+		if (app_data->buffsize == 2)
+		{
+			classBSetPeriodicity(app_data->buffer[1]);
+		}
+		if ((app_data->buffsize == 1) || (app_data->buffsize == 2))
 		{
 			switch (app_data->buffer[0])
 			{
 			case 0:
-				lmh_class_request(CLASS_A);
+				policyDownlink(CLASS_A);
+				loraClassRequest(CLASS_A);
 				break;
 
 			case 1:
-				lmh_class_request(CLASS_B);
+				policyDownlink(CLASS_B);
+				loraClassRequest(CLASS_B);
 				break;
 
 			case 2:
-				lmh_class_request(CLASS_C);
+				policyDownlink(CLASS_C);
+				loraClassRequest(CLASS_C);
 				break;
 
 			default:
+				policyDownlink(0xFF);
 				break;
 			}
 		}
 		break;
 
+	case HEALTH_PORT:
+		// Health port requests a health frame
+		// 1 byte payload = new interval in minutes, 0 = only send now
+		if (app_data->buffsize == 1)
+		{
+			if (app_data->buffer[0] != 0)
+			{
+				healthSending.setPeriod(app_data->buffer[0] * 60000);
+			}
+		}
+		healthPending = true;
+		xSemaphoreGive(loopEnable);
+		break;
+
+	case TIME_PORT:
+		// Clock synchronization package
+		timeDownlink(app_data->buffer, app_data->buffsize);
+		break;
+
+	case FRAG_PORT:
+		// Fragmented data block transport, fragments are decoded in the fragmentation task
+		fragDownlink(app_data->buffer, app_data->buffsize);
+		break;
+
 	case LORAWAN_APP_PORT:
 		// YOUR_JOB: Take action on received data
 		for (int i = 0; i <= app_data->buffsize; i++)
@@ -238,7 +399,7 @@ static void lorawan_rx_handler(lmh_app_data_t *app_data)
 		}
 		Serial.println();
 
-		snprintf(nullTerm, app_data->buffsize + 1, (const char *)app_data->buffer);
+		snprintf(nullTerm, sizeof(nullTerm), "%.*s", app_data->buffsize, (const char *)app_data->buffer);
 		Serial.printf(">>%s<<\n", nullTerm);
 
 		if (bleUARTisConnected)
@@ -265,6 +426,12 @@ static void lorawan_rx_handler(lmh_app_data_t *app_data)
  */
 static void lorawan_confirm_class_handler(DeviceClass_t Class)
 {
+	PROF_SCOPE(PROF_LORA_CLASS);
+	currentClass = Class;
+#if CAPTURE
+	uint8_t event = Class;
+	captureMac(CAPTURE_MAC_CLASS, &event, 1);
+#endif
 	Serial.printf("switch to class %c done\n", "ABC"[Class]);
 
 	if (bleUARTisConnected)
@@ -272,72 +439,105 @@ static void lorawan_confirm_class_handler(DeviceClass_t Class)
 		bleuart.printf("switch to class %c done\n", "ABC"[Class]);
 	}
 	// Informs the server that switch has occurred ASAP
+	lmhSendEmpty();
+	xSemaphoreGive(loopEnable);
+}
+
+/**
+ * @brief Send an empty uplink
+ * @note Carries pending MAC commands and the class to the server
+ */
+void lmhSendEmpty(void)
+{
 	m_lora_app_data.buffsize = 0;
 	m_lora_app_data.port = LORAWAN_APP_PORT;
-	lmh_send(&m_lora_app_data, LMH_UNCONFIRMED_MSG);
-	xSemaphoreGive(loopEnable);
+	loraSend(LMH_UNCONFIRMED_MSG);
 }
 
 /**
  * @brief Send a LoRaWan package
- * 
+ * @note The result is printed with printLoRaFrame()
+ *
+ * @return int8_t Result of the transport, LMH_ERROR if no transport is up
  */
-void sendLoRaFrame(void)
+int8_t sendLoRaFrame(void)
 {
-	if (lmh_join_status_get() != LMH_SET)
+	PROF_SCOPE(PROF_SEND_LORA);
+	if (!transportAnyUp())
 	{
-		//Not joined, try again later
+		//Not joined and no BLE relay, try again later
 		Serial.println("Did not join network, skip sending frame");
 		if (bleUARTisConnected)
 		{
 			bleuart.println("Did not join network, skip sending frame");
 		}
-		return;
+		return LMH_ERROR;
 	}
 
 	// Switch on the indicator lights
 	digitalWrite(LED_BUILTIN, HIGH);
 
-	m_lora_app_data.port = LORAWAN_APP_PORT;
+	motionEncode();
+	uint16_t timestamp = timeEncodeFix(gpsFixMillis);
+	trackerData.ts_1 = timestamp;
+	trackerData.ts_2 = timestamp >> 8;
+	uint16_t seq = transportNextSeq();
+	trackerData.seq_1 = seq;
+	trackerData.seq_2 = seq >> 8;
 
-	memcpy(m_lora_app_data_buffer, (const void *)&trackerData, TRACKER_DATA_LEN);
-	m_lora_app_data.buffsize = TRACKER_DATA_LEN; // TRACKER_DATA_LEN;
+	int8_t error = transportSend(LORAWAN_APP_PORT, (uint8_t *)&trackerData, TRACKER_DATA_LEN);
+	if (error == 0)
+	{
+		motionMarkSent();
+		posCacheMarkSent(seq);
+	}
 
-	lmh_error_status error = lmh_send(&m_lora_app_data, LMH_UNCONFIRMED_MSG);
+	// Start the timer to switch off the indicator LED
+	ledTicker.start();
+	return error;
+}
 
-	sprintf(dbgBuffer, "UP Lat %.4f Lon %.4f Alt %d Pr %d B %u%%\n",
-			(trackerData.lat_1 | trackerData.lat_2 << 8 | trackerData.lat_3 << 16 | trackerData.lat_4 << 24 | (trackerData.lat_4 & 0x80 ? 0xFF << 24 : 0)) / 100000.0,
-			(trackerData.lng_1 | trackerData.lng_2 << 8 | trackerData.lng_3 << 16 | trackerData.lng_4 << 24 | (trackerData.lng_4 & 0x80 ? 0xFF << 24 : 0)) / 100000.0,
-			(trackerData.alt_1 | trackerData.alt_2 << 8 | (trackerData.alt_2 & 0x80 ? 0xFF << 16 : 0)),
-			trackerData.hdop,
-			trackerData.batt);
+/**
+ * @brief Print a sent position frame on Serial, display and BLE UART
+ *
+ * @param error Result of sendLoRaFrame()
+ * @param data Copy of the sent frame
+ */
+void printLoRaFrame(int8_t error, const tracker_data_s &data)
+{
+	int32_t latitude = (int32_t)(data.lat_1 | data.lat_2 << 8 | data.lat_3 << 16 | (uint32_t)data.lat_4 << 24);
+	int32_t longitude = (int32_t)(data.lng_1 | data.lng_2 << 8 | data.lng_3 << 16 | (uint32_t)data.lng_4 << 24);
+	int16_t altitude = (int16_t)(data.alt_1 | data.alt_2 << 8);
+	char latStr[14];
+	char lngStr[14];
+	geoFormat(latStr, latitude, GEO_PAYLOAD_SCALE, 4);
+	geoFormat(lngStr, longitude, GEO_PAYLOAD_SCALE, 4);
+
+	sprintf(dbgBuffer, "UP Lat %s Lon %s Alt %d Pr %d B %u%%\n",
+			latStr, lngStr, altitude, data.hdop, data.batt);
 	Serial.print(dbgBuffer);
 	if (error == LMH_SUCCESS)
 	{
-		sprintf(dbgBuffer, "UP Lat %.6f\n",
-				(trackerData.lat_1 | trackerData.lat_2 << 8 | trackerData.lat_3 << 16 | trackerData.lat_4 << 24 | (trackerData.lat_4 & 0x80 ? 0xFF << 24 : 0)) / 100000.0);
+		sprintf(dbgBuffer, "UP Lat %s\n", geoFormat(latStr, latitude, GEO_PAYLOAD_SCALE, 5));
 		dispAddLine(dbgBuffer);
 		if (bleUARTisConnected)
 		{
 			bleuart.printf(dbgBuffer);
 		}
-		sprintf(dbgBuffer, "UP Lon %.6f\n",
-				(trackerData.lng_1 | trackerData.lng_2 << 8 | trackerData.lng_3 << 16 | trackerData.lng_4 << 24 | (trackerData.lng_4 & 0x80 ? 0xFF << 24 : 0)) / 100000.0);
+		sprintf(dbgBuffer, "UP Lon %s\n", geoFormat(lngStr, longitude, GEO_PAYLOAD_SCALE, 5));
 		dispAddLine(dbgBuffer);
 		if (bleUARTisConnected)
 		{
 			bleuart.printf(dbgBuffer);
 		}
-		sprintf(dbgBuffer, "UP Alt %d Pr %d\n",
-				(trackerData.alt_1 | trackerData.alt_2 << 8 | (trackerData.alt_2 & 0x80 ? 0xFF << 16 : 0)),
-				trackerData.hdop);
+		sprintf(dbgBuffer, "UP Alt %d Pr %d\n", altitude, data.hdop);
 		dispAddLine(dbgBuffer);
 		if (bleUARTisConnected)
 		{
 			bleuart.printf(dbgBuffer);
 		}
 		sprintf(dbgBuffer, "UP B %u%%\n",
-				trackerData.batt);
+				data.batt);
 		dispAddLine(dbgBuffer);
 		if (bleUARTisConnected)
 		{
@@ -354,9 +554,232 @@ void sendLoRaFrame(void)
 			bleuart.printf("UP result %d\n", error);
 		}
 	}
+}
 
-	// Start the timer to switch off the indicator LED
-	ledTicker.start();
+/**
+ * @brief Check if the LoRaWan transport is available
+ *
+ * @return true if joined to the network
+ */
+static bool loraTransportUp(void)
+{
+	return lmh_join_status_get() == LMH_SET;
+}
+
+/**
+ * @brief Send a frame over LoRaWan
+ *
+ * @param port FPort
+ * @param buffer Frame data
+ * @param len Length of the frame
+ * @return int8_t Result of lmh_send()
+ */
+static int8_t loraTransportSend(uint8_t port, uint8_t *buffer, uint8_t len)
+{
+	m_lora_app_data.port = port;
+	memcpy(m_lora_app_data_buffer, buffer, len);
+	m_lora_app_data.buffsize = len;
+	return loraSend(LMH_UNCONFIRMED_MSG);
+}
+
+/** LoRaWan transport, uplinks cost much more energy than BLE notifications */
+transport_s loraTransport = {"LoRaWan", 100, loraTransportUp, loraTransportSend};
+
+/**
+ * @brief Send the health telemetry frame
+ *
+ */
+void sendHealthFrame(void)
+{
+	healthPending = false;
+	if (lmh_join_status_get() != LMH_SET)
+	{
+		return;
+	}
+
+	m_lora_app_data.port = HEALTH_PORT;
+	m_lora_app_data.buffsize = healthGetFrame(m_lora_app_data_buffer);
+
+	lmh_error_status error = loraSend(LMH_UNCONFIRMED_MSG);
+	if (error == LMH_SUCCESS)
+	{
+		// The next frame covers the next interval
+		healthReset();
+	}
+	Serial.printf("Health frame result %d\n", error);
+	if (bleUARTisConnected)
+	{
+		bleuart.printf("Health frame result %d\n", error);
+	}
+}
+
+/**
+ * @brief Send the policy transition frame
+ *
+ */
+void sendPolicyFrame(void)
+{
+	policyPending = false;
+	if (lmh_join_status_get() != LMH_SET)
+	{
+		return;
+	}
+
+	m_lora_app_data.port = POLICY_PORT;
+	m_lora_app_data.buffsize = policyGetFrame(m_lora_app_data_buffer);
+
+	lmh_error_status error = loraSend(LMH_UNCONFIRMED_MSG);
+	Serial.printf("Policy frame result %d\n", error);
+	if (bleUARTisConnected)
+	{
+		bleuart.printf("Policy frame result %d\n", error);
+	}
+}
+
+/**
+ * @brief Send an alarm frame
+ * @note Confirmed uplink over LoRaWan, over the BLE relay if not joined
+ *
+ * @param buffer Alarm frame
+ * @param len Length of the frame
+ * @param needsAck Returns true if the frame was sent confirmed, the result
+ * 		arrives later with alarmAckResult()
+ * @return int8_t 0 on success, error code otherwise
+ */
+int8_t sendAlarmFrame(uint8_t *buffer, uint8_t len, bool *needsAck)
+{
+	int8_t error;
+	*needsAck = false;
+	if (lmh_join_status_get() == LMH_SET)
+	{
+		m_lora_app_data.port = ALARM_PORT;
+		memcpy(m_lora_app_data_buffer, buffer, len);
+		m_lora_app_data.buffsize = len;
+		error = loraSend(LMH_CONFIRMED_MSG);
+		*needsAck = true;
+	}
+	else if (transportAnyUp())
+	{
+		error = transportSend(ALARM_PORT, buffer, len);
+	}
+	else
+	{
+		return -1;
+	}
+	if (bleUARTisConnected)
+	{
+		bleuart.printf("Alarm result %d\n", error);
+	}
+	return error;
+}
+
+/**
+ * @brief Send the heartbeat for the cached position
+ * @note If the cached fix was not sent yet, the full position is sent
+ *
+ */
+void sendHeartbeatFrame(void)
+{
+	uint8_t frame[POS_HEARTBEAT_LEN];
+	uint8_t len = posCacheHeartbeat(frame);
+	if (len == 0)
+	{
+		printLoRaFrame(sendLoRaFrame(), trackerData);
+		return;
+	}
+	if (!transportAnyUp())
+	{
+		return;
+	}
+
+	int8_t error = transportSend(POS_HEARTBEAT_PORT, frame, len);
+	Serial.printf("Heartbeat unchanged since uplink %d result %d\n", posCache.sentSeq, error);
+	if (bleUARTisConnected)
+	{
+		bleuart.printf("Heartbeat result %d\n", error);
+	}
+}
+
+/**
+ * @brief Send the summary of the last trip
+ */
+void sendTripFrame(void)
+{
+	uint8_t frame[TRIP_FRAME_LEN];
+	uint8_t len = tripGetFrame(frame);
+	if (!transportAnyUp())
+	{
+		return;
+	}
+
+	int8_t error = transportSend(TRIP_PORT, frame, len);
+	Serial.printf("Trip summary %d bytes result %d\n", len, error);
+	if (bleUARTisConnected)
+	{
+		bleuart.printf("Trip result %d\n", error);
+	}
+}
+
+/**
+ * @brief Send a batch of closed encounters
+ */
+void sendEncounterFrame(void)
+{
+	uint8_t frame[ENC_FRAME_LEN];
+	uint8_t len = encGetFrame(frame);
+	if ((len == 0) || !transportAnyUp())
+	{
+		return;
+	}
+
+	int8_t error = transportSend(ENC_PORT, frame, len);
+	if (error == 0)
+	{
+		encMarkSent();
+	}
+	Serial.printf("Encounters %d bytes result %d\n", len, error);
+	if (bleUARTisConnected)
+	{
+		bleuart.printf("Encounter result %d\n", error);
+	}
+}
+
+/**
+ * @brief Send the requests and answers of the clock synchronization package
+ *
+ */
+void sendTimeFrame(void)
+{
+	if (lmh_join_status_get() != LMH_SET)
+	{
+		return;
+	}
+
+	m_lora_app_data.port = TIME_PORT;
+	m_lora_app_data.buffsize = timeGetAnswer(m_lora_app_data_buffer);
+
+	lmh_error_status error = loraSend(LMH_UNCONFIRMED_MSG);
+	Serial.printf("Time frame result %d\n", error);
+}
+
+/**
+ * @brief Send the answers of the fragmentation package
+ *
+ */
+void sendFragFrame(void)
+{
+	if (lmh_join_status_get() != LMH_SET)
+	{
+		fragPending = false;
+		return;
+	}
+
+	m_lora_app_data.port = FRAG_PORT;
+	m_lora_app_data.buffsize = fragGetAnswer(m_lora_app_data_buffer);
+
+	lmh_error_status error = loraSend(LMH_UNCONFIRMED_MSG);
+	Serial.printf("Fragmentation answer result %d\n", error);
+	fragPrintStatus();
 }
 
 /**
@@ -386,3 +809,27 @@ uint32_t lmhAddress(void)
 {
 	return lmh_getDevAddr();
 }
+
+/**
+ * @brief Get the link state
+ * @note Layout
+ * 		0 joined (0/1)
+ * 		1 device class (0 = A, 1 = B, 2 = C)
+ * 		2..5 device address, little endian
+ * 		6..7 RSSI of last downlink, little endian
+ * 		8 SNR of last downlink
+ *
+ * @param buffer Buffer, must be at least LINK_STATE_LEN bytes
+ * @return uint8_t Number of bytes written
+ */
+uint8_t lmhLinkState(uint8_t *buffer)
+{
+	uint32_t devAddr = lmhJoined() ? lmh_getDevAddr() : 0;
+	buffer[0] = lmhJoined() ? 1 : 0;
+	buffer[1] = currentClass;
+	memcpy(&buffer[2], &devAddr, 4);
+	buffer[6] = lastRssi;
+	buffer[7] = lastRssi >> 8;
+	buffer[8] = lastSnr;
+	return LINK_STATE_LEN;
+}
@@ -0,0 +1,25 @@
+/**
+ * @file loraKeys.example.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Example for the device keys
+ * @version 0.1
+ * @date 2020-08-31
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Copy this file to loraKeys.h and enter the keys of your device.
+ * loraKeys.h is not added to the repository.
+ * Keys that are not defined here use the defaults from loraHandler.cpp.
+ */
+#define NODE_DEVICE_EUI {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
+#define NODE_APP_EUI {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
+#define NODE_APP_KEY {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
+
+// ABP
+// #define NODE_OTAA false
+// #define NODE_DEV_ADDR 0x00000000
+// #define NODE_NWS_KEY {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
+// #define NODE_APPS_KEY {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
+
+// Region, e.g. LORAMAC_REGION_EU868
+// #define NODE_REGION LORAMAC_REGION_AS923
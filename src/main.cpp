@@ -23,7 +23,7 @@ bool msgJoined = false;
 bool initMsg = false;
 
 /** Timer since last position message was sent */
-time_t lastPosSend = 0;
+uint32_t lastPosSend = 0;
 /** Timer for delayed sending to keep duty cycle */
 SoftwareTimer delayedSending;
 /** Timer for periodic sending */
@@ -54,6 +54,7 @@ void setup()
 	digitalWrite(34, HIGH);
 	delay(2000);
 
+	initI2C();
 	initDisplay();
 	dispWriteHeader();
 
@@ -76,6 +77,15 @@ void setup()
 	}
 
 	digitalWrite(LED_BUILTIN, LOW);
+
+	// Start the sleep and wake statistics
+	initPower();
+
+#if PROFILING
+	// Start the cycle counter for the profiling scopes
+	initProf();
+#endif
+
 	Serial.println("=====================================");
 	Serial.println("RAK4631 LoRaWan tracker");
 	Serial.println("=====================================");
@@ -84,6 +94,9 @@ void setup()
 	dispAddLine((char *)"Init BLE");
 	initBLE();
 
+	// Start the scans for other tags and beacons
+	initEncounter();
+
 	pinMode(37, OUTPUT);
 	digitalWrite(37, HIGH);
 
@@ -133,10 +146,39 @@ void setup()
 		Serial.println("dbgBuffer");
 	}
 
+	// Start the stack and heap monitor
+	initMem();
+
+	// Start the health counters
+	initHealth();
+
+	// Start the fragmented data block receiver
+	initFrag();
+
+#if CAPTURE
+	// Prepare the raw sensor capture, started with "capon" over BLE UART
+	initCapture();
+#endif
+
+	// Prepare the alarm retries
+	initAlarm();
+
+	// Prepare the class B beacon search
+	initClassB();
+
 	// Prepare timers
-	delayedSending.begin(10000, sendDelayed, NULL, false);
+	delayedSending.begin(SCHED_MIN_REPORT_GAP, sendDelayed, NULL, false);
 	periodicSending.begin(60000, sendPeriodic);
 	periodicSending.start();
+
+	// Start the battery policy, sets report interval, GPS timeout and BLE TX power
+	initPolicy(readBatt());
+
+	// Switch off Serial, display and fast advertising until a central connects
+	if (!bleUARTisConnected)
+	{
+		powerSave(true);
+	}
 }
 
 /**
@@ -148,6 +190,7 @@ void setup()
  */
 void sendDelayed(TimerHandle_t unused)
 {
+	powerCountWake(WAKE_TIMER_DELAYED);
 	xSemaphoreGiveFromISR(loopEnable, &xHigherPriorityTaskWoken);
 }
 
@@ -160,12 +203,27 @@ void sendDelayed(TimerHandle_t unused)
  */
 void sendPeriodic(TimerHandle_t unused)
 {
-	if ((millis() - lastPosSend) > 10000)
+	if (schedPeriodicWake(schedClock(), lastPosSend))
 	{
+		powerCountWake(WAKE_TIMER_PERIODIC);
 		xSemaphoreGiveFromISR(loopEnable, &xHigherPriorityTaskWoken);
 	}
 }
 
+/**
+ * @brief Restart the delayed sending timer
+ *
+ */
+static void rearmDelayed(void)
+{
+	delayedSending.stop();
+	delayedSending.start();
+	if (schedStats.rearms != 0xFFFF)
+	{
+		schedStats.rearms++;
+	}
+}
+
 /**
  * @brief Arduino main loop
  * @note This loop is repeatedly called
@@ -173,17 +231,20 @@ void sendPeriodic(TimerHandle_t unused)
  */
 void loop()
 {
-	if (xSemaphoreTake(loopEnable, portMAX_DELAY) == pdTRUE)
+	// Wake up regularly while a report is in the pipeline
+	TickType_t wait = pipeBusy() ? pdMS_TO_TICKS(PIPE_STEP_TIME) : portMAX_DELAY;
+	if (xSemaphoreTake(loopEnable, wait) == pdTRUE)
 	{
+		healthMarkWake();
 		Serial.println("Got semaphore");
 		if (bleUARTisConnected)
 		{
 			bleuart.println("Got semaphore");
 		}
 		clearAccInt();
-		if (lmhJoined())
+		if (transportAnyUp())
 		{
-			if (!msgJoined)
+			if (!msgJoined && lmhJoined())
 			{
 				msgJoined = true;
 				sprintf(dbgBuffer, "OTAA addr %08lX\n", lmhAddress());
@@ -195,54 +256,95 @@ void loop()
 				}
 				initMsg = true;
 			}
-			if (((millis() - lastPosSend) > 10000) || initMsg)
+			sched_input_s input = {true, lmhJoined(), accAlarmPending, healthPending, policyPending, timePending,
+								   fragPending, encPending, classBPending, initMsg, schedClock(), lastPosSend};
+			uint8_t action = schedNextAction(&input);
+			if (schedStats.actions[action] != 0xFFFF)
 			{
+				schedStats.actions[action]++;
+			}
+			switch (action)
+			{
+			case SCHED_ALARM:
+				// Alarm bypasses everything else
+				pipeAlarm();
+				alarmHandle();
+				if (!accAlarmPending)
+				{
+					// The alarm took the wake ups meanwhile, the position follows with the delayed timer
+					rearmDelayed();
+				}
+				break;
+
+			case SCHED_HEALTH:
+				// Send the health frame now, the position follows with the delayed timer
+				sendHealthFrame();
+				rearmDelayed();
+				break;
+
+			case SCHED_POLICY:
+				// Report the policy transition, the position follows with the delayed timer
+				sendPolicyFrame();
+				rearmDelayed();
+				break;
+
+			case SCHED_TIME:
+				// Request or answer of the clock synchronization, the position follows with the delayed timer
+				sendTimeFrame();
+				rearmDelayed();
+				break;
+
+			case SCHED_FRAG:
+				// Answer the fragmentation session, the position follows with the delayed timer
+				sendFragFrame();
+				rearmDelayed();
+				break;
+
+			case SCHED_ENC:
+				// Send the closed encounters, the position follows with the delayed timer
+				sendEncounterFrame();
+				rearmDelayed();
+				break;
+
+			case SCHED_CLASSB:
+				// Beacon search and lock checks, the position follows with the delayed timer
+				classBHandle();
+				rearmDelayed();
+				break;
+
+			case SCHED_REPORT:
 				initMsg = false;
 				Serial.println("More than 10 seconds since last position message, send now");
 				if (bleUARTisConnected)
 				{
 					bleuart.println("More than 10 seconds since last position message, send now");
 				}
-				lastPosSend = millis();
-				if (pollGPS())
-				{
-					Serial.println("Valid GPS position");
-					if (bleUARTisConnected)
-					{
-						bleuart.println("Valid GPS position");
-					}
-				}
-				else
+				// The report runs in the pipeline, the loop keeps handling events meanwhile.
+				// Skip the GPS acquisition while the tracker is parked
+				if (pipeStart(posCacheValid()))
 				{
-					Serial.println("No valid GPS position");
-					if (bleUARTisConnected)
-					{
-						bleuart.println("No valid GPS position");
-					}
+					lastPosSend = schedClock();
 				}
+				break;
 
-				// Get battery level
-				battLevel = readBatt();
-				trackerData.batt = battLevel;
-				// coords[9] = battLevel;
-
-				// Send the location information
-				sendLoRaFrame();
-			}
-			else
-			{
+			default:
 				Serial.println("Less than 10 seconds since last position message, send delayed");
-				delayedSending.stop();
-				delayedSending.start();
+				rearmDelayed();
+				break;
 			}
 		}
 		else
 		{
 			Serial.println("Did not join network yet!");
 		}
+		diagUpdate();
+
 		// Take the semaphore. Will be given back from the interrupt callback function
-		xSemaphoreTake(loopEnable, (TickType_t)10);
+		// Keep it if an alarm came in meanwhile
+		if (!accAlarmPending)
+		{
+			xSemaphoreTake(loopEnable, (TickType_t)10);
+		}
 	}
-
-	delay(10);
+	pipeStep();
 }
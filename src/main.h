@@ -17,8 +17,64 @@ extern char dbgBuffer[];
 extern uint8_t wakeReason;
 extern BaseType_t xHigherPriorityTaskWoken;
 
+// Power functions
+/** Enable switching peripherals off when no BLE central is connected */
+#ifndef POWER_SAVE
+#define POWER_SAVE 1
+#endif
+#define WAKE_NONE 0
+#define WAKE_ACC 1
+#define WAKE_TIMER_PERIODIC 2
+#define WAKE_TIMER_DELAYED 3
+#define WAKE_LORA 4
+#define WAKE_BLE 5
+#define WAKE_NUM_SOURCES 6
+struct power_stats_s
+{
+	/** Ticks spent in tickless sleep */
+	uint32_t sleepTicks;
+	uint32_t idleEntries;
+	uint16_t wakeCount[WAKE_NUM_SOURCES];
+	/** Number of tickless sleeps */
+	uint32_t sleeps;
+	/** Ticks the scheduler expected to sleep, more than sleepTicks if interrupts woke up the MCU early */
+	uint32_t expectedTicks;
+};
+#define POWER_STATS_LEN (18 + 2 * WAKE_NUM_SOURCES)
+void initPower(void);
+void powerCountWake(uint8_t source);
+uint8_t powerResidency(void);
+void powerSave(bool enable);
+uint8_t powerGetStats(uint8_t *buffer);
+extern power_stats_s powerStats;
+extern bool powerSaveActive;
+
+// Shared I2C bus
+#define I2C_CLIENT_ACC 0
+#define I2C_CLIENT_DISPLAY 1
+#define I2C_NUM_CLIENTS 2
+struct i2c_client_stats_s
+{
+	uint32_t transactions;
+	uint64_t waitUs;
+	uint32_t maxWaitUs;
+	uint64_t busyUs;
+};
+struct i2c_stats_s
+{
+	i2c_client_stats_s client[I2C_NUM_CLIENTS];
+};
+void initI2C(void);
+void i2cAcquire(uint8_t client);
+void i2cRelease(uint8_t client);
+void i2cReset(void);
+void i2cPrint(bool toBle);
+extern i2c_stats_s i2cStats;
+
 // Display functions
 #include "nRF_SSD1306Wire.h"
+/** I2C address of the display */
+#define OLED_ADDRESS 0x3c
 /** Width of the display in pixel */
 #define OLED_WIDTH 128
 /** Height of the display in pixel */
@@ -33,21 +89,197 @@ void initDisplay(void);
 void dispAddLine(char *line);
 void dispShow(void);
 void dispWriteHeader(void);
+void dispPower(bool on);
 
 // ACC functions
 #include <SparkFunLIS3DH.h>
 #define INT1_PIN 21
+/** Second interrupt of the LIS3DH, WB_IO4 */
+#ifndef INT2_PIN
+#define INT2_PIN 4
+#endif
+/** Time after a motion interrupt the tracker is seen as moving in ms */
+#define ACC_MOVING_WINDOW 30000
+/** Dynamic acceleration that counts as moving in mg */
+#define ACC_MOVING_THRESHOLD 50
 bool initACC(void);
 void clearAccInt(void);
+uint32_t accDynamic(void);
+bool accIsMoving(void);
+uint8_t accReadAlarm(void);
 extern SemaphoreHandle_t loopEnable;
+extern volatile bool accAlarmPending;
+extern volatile uint32_t accAlarmTime;
+
+// Alarms
+/** Free fall threshold in mg, all axes below */
+#ifndef ACC_FREEFALL_THS
+#define ACC_FREEFALL_THS 350
+#endif
+/** Min free fall duration in ms */
+#ifndef ACC_FREEFALL_DURATION
+#define ACC_FREEFALL_DURATION 100
+#endif
+/** Shock threshold in mg */
+#ifndef ACC_SHOCK_THS
+#define ACC_SHOCK_THS 1500
+#endif
+#define ALARM_NONE 0
+#define ALARM_SHOCK 1
+#define ALARM_FREE_FALL 2
+#define ALARM_TAMPER 3
+#define ALARM_NUM_TYPES 4
+/** FPort of the alarm frame */
+#define ALARM_PORT 14
+#define ALARM_FRAME_LEN 14
+/** Time between two send tries in ms */
+#define ALARM_RETRY_TIME 2000
+/** Max number of send tries */
+#define ALARM_MAX_TRIES 5
+/** Max time from the confirmed uplink to the result of the MAC in ms, covers the MAC retransmissions:
+ * JOINREQ_NBTRIALS (8) transmissions, each with RX2 after 2 s and ACK_TIMEOUT of up to 3 s */
+#define ALARM_ACK_TIMEOUT 60000
+struct alarm_stats_s
+{
+	uint16_t count[ALARM_NUM_TYPES];
+	uint16_t failed;
+	/** Confirmed uplinks without ACK */
+	uint16_t noAck;
+	uint32_t lastLatency;
+	uint32_t maxLatency;
+};
+void initAlarm(void);
+void alarmHandle(void);
+void alarmAckResult(bool acked);
+extern alarm_stats_s alarmStats;
 
 // GPS functions
 #include "TinyGPS++.h"
 #include <SoftwareSerial.h>
+/** Baud rate of the GPS module UART, the module starts with 9600 */
+#ifndef GPS_BAUD
+#define GPS_BAUD 9600
+#endif
+/** Time between two GPS fixes in ms */
+#ifndef GPS_FIX_RATE
+#define GPS_FIX_RATE 1000
+#endif
 void initGPS(void);
-bool pollGPS(void);
+void gpsPollStart(void);
+bool gpsPollStep(void);
+void gpsPollAbort(uint8_t reason);
+bool gpsPollFinish(void);
+void initGPSConfig(void);
+void ubxSetNmeaRate(uint8_t nmeaId, uint8_t rate);
+struct gps_stats_s
+{
+	uint32_t bytesReceived;
+	uint32_t bytesParsed;
+	uint32_t fixes;
+};
+extern gps_stats_s gpsStats;
+extern TinyGPSPlus myGPS;
 // extern byte coords[];
 
+// GPS acquisition controller
+/** Number of time to first fix values used for the budget */
+#define GPS_ACQ_HISTORY 8
+/** Max age of the last fix for a warm start in ms */
+#define GPS_ACQ_WARM_AGE 7200000
+/** Cold start budget as multiple of gpsMaxTime */
+#define GPS_ACQ_COLD_FACTOR 4
+/** Margin added to the warm start budget in ms */
+#define GPS_ACQ_MARGIN 2000
+/** Target HDOP x100 */
+#define GPS_ACQ_TARGET_HDOP 150
+/** Window to check the HDOP improvement in ms */
+#define GPS_ACQ_IMPROVE_TIME 2000
+/** Min HDOP improvement in % per window to keep receiving */
+#define GPS_ACQ_IMPROVE_PERCENT 10
+/** Satellites required to extend the budget once */
+#define GPS_ACQ_MIN_SATS 4
+#define GPS_END_NONE 0
+#define GPS_END_ACCURATE 1
+#define GPS_END_PLATEAU 2
+#define GPS_END_TIMEOUT 3
+#define GPS_END_NO_SATS 4
+#define GPS_END_SKY_BLOCKED 5
+#define GPS_END_ALARM 6
+#define GPS_END_NUM 7
+struct gps_acq_stats_s
+{
+	uint8_t lastReason;
+	uint32_t lastDuration;
+	uint32_t lastBudget;
+	uint16_t endCount[GPS_END_NUM];
+	/** Flag if the last acquisition was a warm start */
+	bool lastWarm;
+	/** Time from the first fix to the end of the last acquisition with a fix in ms */
+	uint32_t lastAfterFix;
+};
+uint32_t acqStart(void);
+uint8_t acqCheck(bool hasFix, int32_t hdop, uint8_t satellites);
+void acqFinish(uint8_t reason);
+uint32_t acqWarmTime(void);
+const char *acqReasonName(uint8_t reason);
+extern gps_acq_stats_s gpsAcqStats;
+
+// Satellite statistics
+/** GSV and GSA are sent every SAT_STATS_RATE fixes */
+#ifndef SAT_STATS_RATE
+#define SAT_STATS_RATE 5
+#endif
+#define SAT_GPS 0
+#define SAT_GLONASS 1
+#define SAT_NUM_CONST 2
+/** C/N0 histogram, SAT_CN0_BINS bins of SAT_CN0_BIN_WIDTH dBHz */
+#define SAT_CN0_BINS 6
+#define SAT_CN0_BIN_WIDTH 10
+/** Sky is blocked if no satellite reaches this C/N0 in dBHz ... */
+#define SAT_BLOCKED_CN0 20
+/** ... within this time in ms */
+#define SAT_BLOCKED_TIME 20000
+struct sat_stats_s
+{
+	uint8_t fixType;
+	uint8_t inView[SAT_NUM_CONST];
+	uint8_t maxCn0[SAT_NUM_CONST];
+	uint8_t cn0Hist[SAT_NUM_CONST][SAT_CN0_BINS];
+};
+#define SAT_STATS_LEN (1 + SAT_NUM_CONST * (2 + SAT_CN0_BINS))
+void initSatStats(void);
+void satStatsProcess(void);
+void satStatsStart(void);
+uint8_t satInView(void);
+bool satSkyBlocked(void);
+bool satHasGsv(void);
+bool satSignalUsable(void);
+uint8_t satMeanCn0(void);
+uint8_t satGetStats(uint8_t *buffer);
+extern sat_stats_s satStats;
+
+// Fixed point geo functions
+/** Coordinates are stored in 1/10000000 degree */
+#define GEO_SCALE 10000000
+/** Coordinates in the LoRaWan payload are in 1/100000 degree */
+#define GEO_PAYLOAD_SCALE 100000
+struct geo_coord_s
+{
+	int32_t lat;
+	int32_t lng;
+};
+int32_t geoFromRaw(const RawDegrees &raw);
+void geoOffset(const geo_coord_s &from, const geo_coord_s &to, int64_t *north, int64_t *east);
+uint32_t geoDistance(const geo_coord_s &from, const geo_coord_s &to);
+uint16_t geoAtan2(int64_t y, int64_t x);
+uint16_t geoBearing(const geo_coord_s &from, const geo_coord_s &to);
+char *geoFormat(char *buffer, int32_t value, uint32_t scale, uint8_t decimals);
+int32_t geoCosDeg10(int32_t angle);
+int32_t geoSinDeg10(int32_t angle);
+geo_coord_s geoMove(const geo_coord_s &from, int64_t north, int64_t east);
+extern geo_coord_s gpsFix;
+extern uint32_t gpsFixMillis;
+
 // Battery functions
 /** Definition of the Analog input that is connected to the battery voltage divider */
 #define PIN_VBAT A0
@@ -70,14 +302,316 @@ void initBLE();
 void startAdv(void);
 void connect_callback(uint16_t conn_handle);
 void disconnect_callback(uint16_t conn_handle, uint8_t reason);
+void diagUpdate(void);
 extern bool bleUARTisConnected;
 extern BLEUart bleuart;
 
+// BLE Location and Navigation service
+/** Minimum time between two location notifications in ms */
+#ifndef BLE_LNS_NOTIFY_INTERVAL
+#define BLE_LNS_NOTIFY_INTERVAL 1000
+#endif
+/** Preferred connection interval in units of 1.25 ms */
+#define BLE_CONN_INTERVAL_MIN 24
+#define BLE_CONN_INTERVAL_MAX 80
+/** Length of the Location and Speed characteristic */
+#define LNS_LOCATION_LEN 15
+/** Length of the link state characteristic */
+#define LINK_STATE_LEN 9
+void initBLELns(void);
+uint8_t lnsEncode(uint8_t *buffer, const geo_coord_s &position, int32_t altitude, uint16_t speed);
+void lnsUpdate(const geo_coord_s &position, int32_t altitude, uint16_t speed);
+void lnsBattery(uint8_t level);
+void lnsSetInterval(uint32_t interval);
+extern uint32_t lnsNotifyInterval;
+
+// BLE track log export
+/** Max MTU requested from the central */
+#define BLE_MAX_MTU 247
+void initBLEExport(void);
+void exportConnect(uint16_t conn_handle);
+void exportStop(void);
+uint16_t exportEncodeBlock(uint8_t *buffer, uint16_t maxLen, uint32_t start, uint32_t *next);
+uint16_t crc16(const uint8_t *data, uint16_t len);
+
+// Track log
+/** Number of positions kept in the track log */
+#ifndef TRACK_LOG_SIZE
+#define TRACK_LOG_SIZE 512
+#endif
+struct track_entry_s
+{
+	uint32_t time;
+	int32_t lat;
+	int32_t lng;
+	int16_t alt;
+	uint8_t speed;
+	uint8_t hdop;
+};
+void trackLogAdd(const geo_coord_s &position, int16_t altitude, uint8_t speed, uint8_t hdop);
+uint32_t trackLogFirst(void);
+uint32_t trackLogEnd(void);
+bool trackLogGet(uint32_t index, track_entry_s *entry);
+
+// Profiling
+/** Enable the profiling scopes, compiled out by default */
+#ifndef PROFILING
+#define PROFILING 0
+#endif
+#define PROF_POLL_GPS 0
+#define PROF_SEND_LORA 1
+#define PROF_DISP_ADD_LINE 2
+#define PROF_DISP_SHOW 3
+#define PROF_CLEAR_ACC_INT 4
+#define PROF_READ_BATT 5
+#define PROF_LORA_RX 6
+#define PROF_LORA_JOINED 7
+#define PROF_LORA_CLASS 8
+#define PROF_ALARM 9
+#define PROF_CAPTURE 10
+#define PROF_CAPTURE_WRITE 11
+#define PROF_NUM_SITES 12
+/** One bucket per power of 2 CPU cycles */
+#define PROF_BUCKETS 32
+#if PROFILING
+struct prof_site_s
+{
+	uint32_t count;
+	uint32_t max;
+	uint64_t total;
+	uint16_t bucket[PROF_BUCKETS];
+};
+void initProf(void);
+void profReset(void);
+void profRecord(uint8_t site, uint32_t cycles);
+void profPrint(bool toBle);
+void profGetSite(uint8_t site, prof_site_s *entry);
+/** Measures the CPU cycles from construction to the end of the scope */
+class ProfScope
+{
+public:
+	ProfScope(uint8_t site) : _site(site), _start(DWT->CYCCNT) {}
+	~ProfScope() { profRecord(_site, DWT->CYCCNT - _start); }
+
+private:
+	uint8_t _site;
+	uint32_t _start;
+};
+#define PROF_CONCAT2(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT2(a, b)
+#define PROF_SCOPE(site) ProfScope PROF_CONCAT(profScope, __LINE__)(site)
+#else
+#define PROF_SCOPE(site)
+#endif
+
+// Memory monitor functions
+/** Time between two memory samples in ms */
+#define MEM_SAMPLE_TIME 60000
+/** Max number of tasks that are monitored
+ * loop, IDLE, Tmr Svc, usbd, BLE, Callback, LORA, EXP, FRAG, CAPT and headroom */
+#ifndef MEM_MAX_TASKS
+#define MEM_MAX_TASKS 16
+#endif
+struct mem_task_s
+{
+	char name[9];
+	uint16_t freeStack;
+};
+struct mem_stats_s
+{
+	uint32_t heapFree;
+	uint32_t heapMinFree;
+	uint8_t numTasks;
+	mem_task_s task[MEM_MAX_TASKS];
+	/** Samples skipped because more than MEM_MAX_TASKS tasks were running */
+	uint16_t truncated;
+	/** Number of tasks running at the last skipped sample */
+	uint8_t tasksSeen;
+};
+#define MEM_STATS_LEN (9 + 10 * MEM_MAX_TASKS)
+void initMem(void);
+void memSample(void);
+void memPrint(bool toBle);
+uint8_t memGetStats(uint8_t *buffer);
+extern mem_stats_s memStats;
+
+// Health telemetry functions
+/** FPort of the health frame */
+#define HEALTH_PORT 10
+/** Time between two health frames in ms */
+#ifndef HEALTH_INTERVAL
+#define HEALTH_INTERVAL 3600000
+#endif
+/** Version of the health frame layout */
+#define HEALTH_FRAME_VERSION 3
+/** Max length of the health frame */
+#define HEALTH_FRAME_LEN 24
+#define HEALTH_JOIN_TRY 0
+#define HEALTH_JOINED 1
+#define HEALTH_SEND_OK 2
+#define HEALTH_SEND_ERR 3
+#define HEALTH_GPS_NO_FIX 4
+#define HEALTH_GPS_NO_FIX_STREAK 5
+#define HEALTH_ACC_WAKE 6
+#define HEALTH_BLE_CONNECT 7
+#define HEALTH_DOWNLINK 8
+#define HEALTH_NUM_COUNTERS 9
+#define HEALTH_ACC_TTFF 0
+#define HEALTH_ACC_WAKE_TO_UP 1
+#define HEALTH_ACC_BATT 2
+#define HEALTH_NUM_ACCS 3
+struct health_acc_s
+{
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint16_t count;
+};
+void initHealth(void);
+void healthReset(void);
+void healthInc(uint8_t counter);
+void healthAdd(uint8_t acc, uint32_t value);
+void healthGpsResult(bool hasFix, uint32_t duration);
+void healthSendResult(int8_t error);
+void healthMarkWake(void);
+uint8_t healthGetFrame(uint8_t *buffer);
+extern bool healthPending;
+extern SoftwareTimer healthSending;
+
+// Scheduling decisions of the main loop
+/** Min time between two position reports in ms */
+#define SCHED_MIN_REPORT_GAP 10000
+#define SCHED_NOT_JOINED 0
+#define SCHED_HEALTH 1
+#define SCHED_POLICY 2
+#define SCHED_TIME 3
+#define SCHED_FRAG 4
+#define SCHED_REPORT 5
+#define SCHED_DELAY 6
+#define SCHED_ALARM 7
+#define SCHED_CLASSB 8
+#define SCHED_ENC 9
+#define SCHED_NUM_ACTIONS 10
+struct sched_input_s
+{
+	bool anyUp;
+	bool joined;
+	bool alarmPending;
+	bool healthPending;
+	bool policyPending;
+	bool timePending;
+	bool fragPending;
+	bool encPending;
+	bool classBPending;
+	bool initMsg;
+	uint32_t now;
+	uint32_t lastReport;
+};
+struct sched_stats_s
+{
+	uint16_t actions[SCHED_NUM_ACTIONS];
+	uint16_t rearms;
+};
+bool schedReportDue(uint32_t now, uint32_t lastReport, bool initMsg);
+uint8_t schedNextAction(const sched_input_s *input);
+bool schedPeriodicWake(uint32_t now, uint32_t lastReport);
+extern uint32_t (*schedClock)(void);
+extern sched_stats_s schedStats;
+/** Time of the last position report, set when the report is started and when its frame is sent */
+extern uint32_t lastPosSend;
+
+// Time service
+/** FPort of the clock synchronization package */
+#define TIME_PORT 202
+/** Min time between two GPS syncs for the drift estimate in ms */
+#define TIME_DRIFT_MIN_INTERVAL 3600000
+/** Network time is requested if there was no GPS time for this time in ms */
+#ifndef TIME_NET_SYNC_INTERVAL
+#define TIME_NET_SYNC_INTERVAL 86400000
+#endif
+/** Max size of the queued requests and answers */
+#define TIME_ANSWER_LEN 16
+#define TIME_SRC_NONE 0
+#define TIME_SRC_GPS 1
+#define TIME_SRC_NETWORK 2
+struct time_stats_s
+{
+	uint8_t source;
+	uint32_t lastSync;
+	uint32_t lastRequest;
+	int32_t lastError;
+	int32_t driftPpm;
+	uint16_t syncs;
+};
+uint64_t timeFromMillis(uint32_t ms);
+uint64_t timeGpsMs(uint32_t ms);
+uint32_t timeNow(void);
+void timeSyncGps(uint32_t atMillis);
+void timeCheckSync(void);
+void timeDownlink(uint8_t *buffer, uint8_t len);
+uint8_t timeGetAnswer(uint8_t *buffer);
+uint16_t timeEncodeFix(uint32_t fixMillis);
+extern time_stats_s timeStats;
+extern volatile bool timePending;
+
+// LoRaWan fragmented data block receiver
+/** FPort of the fragmentation package */
+#define FRAG_PORT 201
+/** Max number of data fragments of a block */
+#ifndef FRAG_MAX_NB
+#define FRAG_MAX_NB 1024
+#endif
+/** Max size of a fragment */
+#define FRAG_MAX_SIZE 50
+/** Max number of lost data fragments that can be recovered, multiple of 8 */
+#ifndef FRAG_MAX_MISSING
+#define FRAG_MAX_MISSING 48
+#endif
+/** Max size of the queued answers */
+#define FRAG_ANSWER_LEN 16
+#define FRAG_STATUS_NONE 0
+#define FRAG_STATUS_ONGOING 1
+#define FRAG_STATUS_DONE 2
+#define FRAG_STATUS_NO_MEMORY 3
+struct frag_session_s
+{
+	bool active;
+	uint8_t fragIndex;
+	uint16_t nbFrag;
+	uint8_t fragSize;
+	uint8_t padding;
+	uint32_t descriptor;
+	uint8_t status;
+	uint16_t received;
+	uint16_t lastData;
+	uint16_t missing;
+	uint16_t rows;
+};
+void initFrag(void);
+void fragDownlink(uint8_t *buffer, uint8_t len);
+uint8_t fragGetAnswer(uint8_t *buffer);
+void fragPrintStatus(void);
+void fragBlockReceived(uint32_t descriptor, const char *fileName, uint32_t size);
+extern frag_session_s fragSession;
+extern volatile bool fragPending;
+
 // LoRaWan functions
 uint8_t initLoRaHandler(void);
-void sendLoRaFrame(void);
+int8_t sendLoRaFrame(void);
+void sendHealthFrame(void);
+void sendPolicyFrame(void);
+void sendFragFrame(void);
+void sendHeartbeatFrame(void);
+void sendTripFrame(void);
+void sendEncounterFrame(void);
+void sendTimeFrame(void);
+int8_t sendAlarmFrame(uint8_t *buffer, uint8_t len, bool *needsAck);
+void lmhSendEmpty(void);
 bool lmhJoined(void);
 uint32_t lmhAddress(void);
+uint8_t lmhLinkState(uint8_t *buffer);
+extern uint8_t currentClass;
+extern uint32_t loraTxTime;
 struct tracker_data_s
 {
 	uint8_t lat_1; // 1
@@ -94,6 +628,399 @@ struct tracker_data_s
 	uint8_t batt; // 12
 	uint8_t sp_1; // 13
 	uint8_t sp_2; // 14
+	uint8_t seq_1; // 15
+	uint8_t seq_2; // 16
+	uint8_t hd_1; // 17
+	uint8_t hd_2; // 18
+	uint8_t spc_1; // 19
+	uint8_t spc_2; // 20
+	int8_t acc; // 21
+	uint8_t ts_1; // 22
+	uint8_t ts_2; // 23
 };
 extern tracker_data_s trackerData;
-#define TRACKER_DATA_LEN 14 // sizeof(trackerData)
+#define TRACKER_DATA_LEN 23 // sizeof(trackerData)
+void printLoRaFrame(int8_t error, const tracker_data_s &data);
+
+// Report pipeline
+/** Max time the main loop sleeps while a report is in the pipeline in ms */
+#define PIPE_STEP_TIME 10
+#define PIPE_ACQ 0
+#define PIPE_ENC 1
+#define PIPE_TX 2
+#define PIPE_POST 3
+#define PIPE_NUM_STAGES 4
+#define PIPE_FRAME_NONE 0
+#define PIPE_FRAME_POSITION 1
+#define PIPE_FRAME_HEARTBEAT 2
+#define PIPE_FRAME_TRIP 3
+struct pipe_report_s
+{
+	bool used;
+	/** millis() when the report started */
+	uint32_t start;
+	/** millis() when the report entered its current stage */
+	uint32_t stageStart;
+	/** Step within the stage */
+	uint8_t step;
+	bool useCache;
+	bool hasPos;
+	bool battSampled;
+	uint8_t battLevel;
+	uint8_t frame;
+	int8_t error;
+	/** Copy of the sent position frame */
+	tracker_data_s data;
+};
+struct pipe_latency_s
+{
+	uint32_t count;
+	uint32_t totalMs;
+	uint32_t maxMs;
+};
+struct pipe_stats_s
+{
+	pipe_latency_s stage[PIPE_NUM_STAGES];
+	pipe_latency_s endToEnd;
+	/** Reports started while the previous one was still in the pipeline */
+	uint32_t overlapped;
+	/** Report wake ups during a running acquisition */
+	uint32_t merged;
+};
+bool pipeStart(bool useCache);
+bool pipeBusy(void);
+void pipeAlarm(void);
+void pipeStep(void);
+void pipeReset(void);
+void pipePrint(bool toBle);
+extern pipe_stats_s pipeStats;
+
+// Motion vector and dead reckoning
+/** Min distance between two fixes to update the heading in m */
+#define MOTION_MIN_DISTANCE 5
+/** Max time between two fixes to calculate the acceleration in ms */
+#define MOTION_MAX_FIX_GAP 120000
+/** Max drift of the extrapolated position before an uplink is sent in m */
+#ifndef MOTION_DR_TOLERANCE
+#define MOTION_DR_TOLERANCE 50
+#endif
+/** Max time without uplink in ms */
+#define MOTION_DR_MAX_SKIP 900000
+struct motion_state_s
+{
+	geo_coord_s position;
+	/** Time of the fix in ms */
+	uint32_t time;
+	/** Heading in 1/10 degree */
+	uint16_t heading;
+	/** Speed in cm/s */
+	uint16_t speed;
+	/** Acceleration in cm/s^2 */
+	int32_t accel;
+};
+struct motion_stats_s
+{
+	uint16_t sent;
+	uint16_t skipped;
+};
+geo_coord_s motionPredict(const motion_state_s &state, uint32_t elapsed);
+void motionUpdate(const geo_coord_s &position, uint16_t speed);
+bool motionShouldSend(void);
+void motionMarkSent(void);
+void motionEncode(void);
+extern motion_state_s motionNow;
+extern motion_stats_s motionStats;
+
+// Trip segmentation
+/** Send only trip summaries instead of periodic positions */
+#ifndef TRIP_MODE
+#define TRIP_MODE 0
+#endif
+/** Min speed of a moving fix in cm/s */
+#define TRIP_MOVING_SPEED 200
+/** Consecutive moving fixes that start a trip */
+#define TRIP_START_FIXES 2
+/** Standstill time that ends a trip in ms */
+#ifndef TRIP_END_IDLE
+#define TRIP_END_IDLE 300000
+#endif
+/** Min distance between two fixes at standstill that is counted in m */
+#define TRIP_MIN_STEP 20
+/** Max number of path points in the summary, at least 2 */
+#ifndef TRIP_PATH_POINTS
+#define TRIP_PATH_POINTS 8
+#endif
+/** Initial min distance between two path points in m */
+#define TRIP_PATH_SPACING 250
+/** FPort of the trip summary */
+#define TRIP_PORT 15
+#define TRIP_FRAME_LEN (29 + 4 * TRIP_PATH_POINTS)
+struct trip_s
+{
+	bool active;
+	geo_coord_s start;
+	uint32_t startMillis;
+	geo_coord_s end;
+	uint32_t endMillis;
+	/** Distance in m */
+	uint32_t distance;
+	/** Max speed in cm/s */
+	uint16_t maxSpeed;
+	uint32_t idleMs;
+	/** millis() when the current stop started, 0 while moving */
+	uint32_t stopMillis;
+	geo_coord_s path[TRIP_PATH_POINTS];
+	uint8_t pathLen;
+	uint32_t pathSpacing;
+};
+struct trip_stats_s
+{
+	uint16_t trips;
+	uint32_t distance;
+	uint16_t suppressed;
+};
+void tripUpdate(const geo_coord_s &position, uint16_t speed, uint32_t fixMillis);
+bool tripCheck(void);
+bool tripActive(void);
+uint8_t tripGetFrame(uint8_t *buffer);
+extern trip_stats_s tripStats;
+
+// Last known position cache
+/** Max HDOP x100 of a fix that is cached */
+#define POS_CACHE_MAX_HDOP 500
+/** Max speed in cm/s of a fix that is cached */
+#define POS_CACHE_MAX_SPEED 100
+/** Max age of the cached fix in ms */
+#define POS_CACHE_MAX_AGE 21600000
+/** Motion energy of an accelerometer interrupt in mg */
+#define POS_CACHE_INT_ENERGY 100
+/** Motion energy in mg that invalidates the cache */
+#ifndef POS_CACHE_MAX_ENERGY
+#define POS_CACHE_MAX_ENERGY 300
+#endif
+/** FPort of the heartbeat */
+#define POS_HEARTBEAT_PORT 13
+#define POS_HEARTBEAT_LEN 5
+struct pos_cache_s
+{
+	bool valid;
+	uint32_t fixTime;
+	uint32_t fixNum;
+	int32_t hdop;
+	uint32_t energy;
+	bool sentValid;
+	uint16_t sentSeq;
+	uint32_t hits;
+	uint32_t gpsSavedMs;
+	/** Acquisition time of the cached fix as a warm start in ms */
+	uint32_t acqMs;
+};
+void posCacheStore(int32_t hdop, uint16_t speed);
+void posCacheAccInt(void);
+bool posCacheValid(void);
+void posCacheUsed(void);
+void posCacheMarkSent(uint16_t seq);
+uint8_t posCacheHeartbeat(uint8_t *buffer);
+extern pos_cache_s posCache;
+
+// Battery policy
+#define POLICY_FULL 0
+#define POLICY_MEDIUM 1
+#define POLICY_LOW 2
+#define POLICY_CRITICAL 3
+#define POLICY_NUM_LEVELS 4
+/** Battery % above the threshold required to step up a level */
+#define POLICY_HYSTERESIS 5
+/** Step down to class B if no downlink was received for 6 hours */
+#define POLICY_DOWNLINK_IDLE_B 21600000
+/** Step down to class A if no downlink was received for 24 hours */
+#define POLICY_DOWNLINK_IDLE_A 86400000
+/** FPort for policy transition reports */
+#define POLICY_PORT 12
+#define POLICY_FRAME_LEN 5
+struct policy_level_s
+{
+	uint8_t minBattery;
+	uint8_t devClass;
+	uint32_t reportInterval;
+	uint32_t gpsTimeout;
+	int8_t bleTxPower;
+};
+void initPolicy(uint8_t battery);
+void policyUpdate(uint8_t battery);
+void policyDownlink(uint8_t requestedClass);
+uint8_t policyDeviceClass(void);
+uint8_t policyGetFrame(uint8_t *buffer);
+extern uint8_t policyLevel;
+extern bool policyPending;
+extern uint32_t gpsMaxTime;
+extern SoftwareTimer periodicSending;
+
+// Class B beacon synchronization
+/** Enable class B, the LoRaMac of the library must support it */
+#ifndef LORAMAC_CLASSB_ENABLED
+#define LORAMAC_CLASSB_ENABLED 0
+#endif
+/** Ping slot periodicity, a ping slot every 2^n seconds, 0..7 */
+#ifndef CLASSB_PING_PERIODICITY
+#define CLASSB_PING_PERIODICITY 3
+#endif
+/** Beacon period in ms */
+#define CLASSB_BEACON_PERIOD 128000
+/** Start of the beacon search before the expected beacon in ms */
+#define CLASSB_SEARCH_LEAD 1000
+/** Max time of a beacon search in ms */
+#define CLASSB_SEARCH_TIMEOUT 150000
+/** Time between two lock checks during the search in ms */
+#define CLASSB_POLL_TIME 2000
+/** Time in class B before the beacon is searched again in ms */
+#define CLASSB_RELOCK_INTERVAL 7200000
+/** Delay after the first failed search in ms, doubled after each failure */
+#define CLASSB_RETRY_TIME 600000
+#define CLASSB_MAX_RETRY_TIME 14400000
+/** Estimated receive time of a ping slot and of a beacon in ms */
+#define CLASSB_PING_WINDOW 30
+#define CLASSB_BEACON_WINDOW 50
+#define CLASSB_OFF 0
+#define CLASSB_WAIT 1
+#define CLASSB_SEARCH 2
+#define CLASSB_LOCKED 3
+#define CLASSB_BACKOFF 4
+struct classb_stats_s
+{
+	uint8_t state;
+	uint16_t searches;
+	uint16_t locks;
+	uint16_t failed;
+	uint16_t downlinks;
+	uint32_t lastSearchTime;
+	uint32_t searchRxMs;
+	uint32_t lockedMs;
+};
+void initClassB(void);
+void loraClassRequest(uint8_t devClass);
+void classBSetPeriodicity(uint8_t periodicity);
+void classBHandle(void);
+void classBDownlink(void);
+void classBPrint(bool toBle);
+extern classb_stats_s classBStats;
+extern volatile bool classBPending;
+
+// BLE encounter scanner
+/** Time between two scans in ms */
+#ifndef ENC_SCAN_PERIOD
+#define ENC_SCAN_PERIOD 60000
+#endif
+/** Duration of a scan in ms */
+#define ENC_SCAN_TIME 3000
+/** No scan within this time after a LoRaWan uplink in ms, covers RX1 and RX2 */
+#define ENC_LORA_GUARD 4000
+/** Min RSSI of an advertiser that is logged */
+#ifndef ENC_MIN_RSSI
+#define ENC_MIN_RSSI -80
+#endif
+/** An encounter ends if the address was not seen for this time in ms */
+#define ENC_CLOSE_TIME (3 * ENC_SCAN_PERIOD)
+/** Max time a closed encounter waits for the batch in ms */
+#define ENC_MAX_DELAY 900000
+/** Encounter table size */
+#define ENC_BUCKETS 16
+#define ENC_WAYS 4
+/** FPort of the encounter batches */
+#define ENC_PORT 16
+/** Bytes per encounter in the batch */
+#define ENC_BYTES 10
+#define ENC_BATCH_SIZE 5
+#define ENC_FRAME_LEN (5 + ENC_BYTES * ENC_BATCH_SIZE)
+struct enc_entry_s
+{
+	uint8_t addr[6];
+	bool used;
+	int8_t maxRssi;
+	/** Uptime in s */
+	uint32_t firstSeen;
+	uint32_t lastSeen;
+};
+struct enc_stats_s
+{
+	uint32_t scans;
+	uint32_t postponed;
+	uint32_t reports;
+	uint32_t inserts;
+	uint32_t updates;
+	uint32_t evicted;
+	uint32_t sent;
+};
+void initEncounter(void);
+void encCheck(void);
+uint8_t encGetFrame(uint8_t *buffer);
+void encMarkSent(void);
+void encPrint(bool toBle);
+extern enc_stats_s encStats;
+extern volatile bool encPending;
+
+// Raw sensor capture
+/** Enable the capture, compiled out by default */
+#ifndef CAPTURE
+#define CAPTURE 0
+#endif
+/** Capture file in the internal flash */
+#define CAPTURE_FILE "/capture.bin"
+/** Max size of the capture file, the capture stops when it is full */
+#ifndef CAPTURE_MAX_SIZE
+#define CAPTURE_MAX_SIZE 16384
+#endif
+/** Size of each of the two record buffers */
+#define CAPTURE_BUF_SIZE 512
+/** Min time between two writes to the flash in ms */
+#define CAPTURE_MIN_WRITE_GAP 1000
+/** Max time records stay in the RAM buffer in ms */
+#define CAPTURE_FLUSH_TIME 10000
+/** Max number of GPS bytes in one record */
+#define CAPTURE_GPS_CHUNK 64
+#define CAPTURE_TIME 0
+#define CAPTURE_GPS 1
+#define CAPTURE_ACC 2
+#define CAPTURE_BATT 3
+#define CAPTURE_MAC 4
+#define CAPTURE_MAC_TX 1
+#define CAPTURE_MAC_RX 2
+#define CAPTURE_MAC_JOINED 3
+#define CAPTURE_MAC_CLASS 4
+struct capture_stats_s
+{
+	uint32_t records;
+	uint32_t bytes;
+	uint32_t dropped;
+	uint32_t writes;
+	uint32_t maxWriteMs;
+	uint32_t fileSize;
+};
+#if CAPTURE
+void initCapture(void);
+void captureStart(void);
+void captureStop(void);
+void captureAdd(uint8_t type, const void *data, uint8_t len);
+void captureGpsByte(char c);
+void captureMac(uint8_t event, const void *data, uint8_t len);
+uint16_t captureReadBlock(uint8_t *buffer, uint16_t maxLen, uint32_t start, uint32_t *next);
+void capturePrint(bool toBle);
+extern capture_stats_s captureStats;
+extern volatile bool captureActive;
+#endif
+
+// Uplink transports
+struct transport_s
+{
+	const char *name;
+	/** Relative energy cost of one uplink */
+	uint8_t energyCost;
+	bool (*isUp)(void);
+	int8_t (*send)(uint8_t port, uint8_t *buffer, uint8_t len);
+};
+bool transportAnyUp(void);
+uint16_t transportNextSeq(void);
+int8_t transportSend(uint8_t port, uint8_t *buffer, uint8_t len);
+extern transport_s loraTransport;
+extern transport_s bleRelayTransport;
+extern transport_s *lastTransport;
@@ -0,0 +1,138 @@
+/**
+ * @file mem.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Task stack and heap usage monitor
+ * @version 0.1
+ * @date 2020-08-07
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Samples the stack high water mark of all tasks and the heap
+ * usage periodically. The stack high water mark is the minimum free
+ * stack a task ever had, in words.
+ */
+#include "main.h"
+
+/** Last memory sample */
+mem_stats_s memStats;
+
+/** Timer for periodic sampling */
+SoftwareTimer memSampling;
+
+/**
+ * @brief Timer callback for periodic sampling
+ *
+ * @param unused
+ * 			Timer handle, not used
+ */
+void memSampleTimer(TimerHandle_t unused)
+{
+	(void)unused;
+	memSample();
+}
+
+/**
+ * @brief Initialize the memory monitor
+ */
+void initMem(void)
+{
+	memset(&memStats, 0, sizeof(mem_stats_s));
+	memStats.heapMinFree = 0xFFFFFFFF;
+	memSample();
+	memSampling.begin(MEM_SAMPLE_TIME, memSampleTimer);
+	memSampling.start();
+}
+
+/**
+ * @brief Sample stack high water marks and heap usage
+ */
+void memSample(void)
+{
+	memStats.heapFree = dbgHeapFree();
+	if (memStats.heapFree < memStats.heapMinFree)
+	{
+		memStats.heapMinFree = memStats.heapFree;
+	}
+
+#if configUSE_TRACE_FACILITY == 1
+	// Static to keep it off the timer task stack
+	static TaskStatus_t taskStatus[MEM_MAX_TASKS];
+	UBaseType_t numTasks = uxTaskGetSystemState(taskStatus, MEM_MAX_TASKS, NULL);
+	if (numTasks == 0)
+	{
+		// More tasks than MEM_MAX_TASKS, keep the old values and count the skipped sample
+		if (memStats.truncated != 0xFFFF)
+		{
+			memStats.truncated++;
+		}
+		memStats.tasksSeen = uxTaskGetNumberOfTasks();
+		return;
+	}
+	memStats.numTasks = numTasks;
+	for (UBaseType_t idx = 0; idx < numTasks; idx++)
+	{
+		snprintf(memStats.task[idx].name, sizeof(memStats.task[idx].name), "%s", taskStatus[idx].pcTaskName);
+		memStats.task[idx].freeStack = taskStatus[idx].usStackHighWaterMark * sizeof(StackType_t);
+	}
+#endif
+}
+
+/**
+ * @brief Print the last memory sample
+ *
+ * @param toBle true to print to the BLE UART as well
+ */
+void memPrint(bool toBle)
+{
+	Serial.printf("Heap free %ld min %ld\n", memStats.heapFree, memStats.heapMinFree);
+	if (toBle && bleUARTisConnected)
+	{
+		bleuart.printf("Heap free %ld min %ld\n", memStats.heapFree, memStats.heapMinFree);
+	}
+	if (memStats.truncated != 0)
+	{
+		// The task list is from an older sample
+		Serial.printf("%d samples skipped, %d tasks > MEM_MAX_TASKS\n", memStats.truncated, memStats.tasksSeen);
+		if (toBle && bleUARTisConnected)
+		{
+			bleuart.printf("%d samples skipped, %d tasks > MEM_MAX_TASKS\n", memStats.truncated, memStats.tasksSeen);
+		}
+	}
+	for (int idx = 0; idx < memStats.numTasks; idx++)
+	{
+		Serial.printf("%-8s stack free %d\n", memStats.task[idx].name, memStats.task[idx].freeStack);
+		if (toBle && bleUARTisConnected)
+		{
+			bleuart.printf("%-8s stack free %d\n", memStats.task[idx].name, memStats.task[idx].freeStack);
+		}
+	}
+}
+
+/**
+ * @brief Write the last memory sample into a buffer
+ * @note Layout (little endian)
+ * 		0..3 heap free bytes
+ * 		4..7 minimum ever heap free bytes
+ * 		8 number of tasks
+ * 		then for each task 8 bytes name and 2 bytes free stack in bytes
+ *
+ * @param buffer Buffer, must be at least MEM_STATS_LEN bytes
+ * @return uint8_t Number of bytes written
+ */
+uint8_t memGetStats(uint8_t *buffer)
+{
+	uint8_t idx = 0;
+	memcpy(&buffer[idx], &memStats.heapFree, 4);
+	idx += 4;
+	memcpy(&buffer[idx], &memStats.heapMinFree, 4);
+	idx += 4;
+	buffer[idx++] = memStats.numTasks;
+	for (int task = 0; task < memStats.numTasks; task++)
+	{
+		memcpy(&buffer[idx], memStats.task[task].name, 8);
+		idx += 8;
+		buffer[idx++] = memStats.task[task].freeStack;
+		buffer[idx++] = memStats.task[task].freeStack >> 8;
+	}
+	return idx;
+}
@@ -0,0 +1,180 @@
+/**
+ * @file motion.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Motion vector and dead reckoning
+ * @version 0.1
+ * @date 2020-08-24
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Heading, speed and acceleration are calculated from consecutive
+ * GPS fixes. The accelerometer is used to detect standstill, then
+ * speed and acceleration are forced to 0.
+ * The motion vector is sent with every position, so the backend can
+ * extrapolate the position between two uplinks.
+ * The tracker runs the same extrapolation (motionPredict()) and only
+ * sends a new position if the real position drifted more than
+ * MOTION_DR_TOLERANCE from the extrapolated one.
+ */
+#include "main.h"
+
+/** Motion state calculated from the last fixes */
+motion_state_s motionNow;
+
+/** Motion state of the last uplink, used by the backend to extrapolate */
+static motion_state_s motionSent;
+
+/** Flag if a motion state was ever sent */
+static bool motionSentValid = false;
+
+/** Flag if a previous fix is available */
+static bool motionHasLast = false;
+
+/** Dead reckoning statistics */
+motion_stats_s motionStats;
+
+/**
+ * @brief Extrapolate a position from a motion state
+ * @note Same model as used by the backend:
+ * distance = v * t + a * t^2 / 2 along the heading,
+ * the distance does not go backwards if the tracker slows down
+ *
+ * @param state Motion state at the time of the fix
+ * @param elapsed Time since the fix in ms
+ * @return geo_coord_s Extrapolated position
+ */
+geo_coord_s motionPredict(const motion_state_s &state, uint32_t elapsed)
+{
+	// Distance in mm, speed in cm/s, acceleration in cm/s^2
+	int64_t t = elapsed;
+	int64_t distance = ((int64_t)state.speed * t) / 100 + ((int64_t)state.accel * t * t) / 200000;
+	if (state.accel < 0)
+	{
+		// Stop at standstill, v + a * t = 0
+		int64_t tStop = ((int64_t)state.speed * 1000) / -state.accel;
+		if (t > tStop)
+		{
+			distance = ((int64_t)state.speed * tStop) / 100 + ((int64_t)state.accel * tStop * tStop) / 200000;
+		}
+	}
+	if (distance < 0)
+	{
+		distance = 0;
+	}
+	int64_t north = (distance * geoCosDeg10(state.heading)) >> 15;
+	int64_t east = (distance * geoSinDeg10(state.heading)) >> 15;
+	return geoMove(state.position, north, east);
+}
+
+/**
+ * @brief Update the motion state with a new fix
+ *
+ * @param position New position
+ * @param speed Speed from the GPS in cm/s
+ */
+void motionUpdate(const geo_coord_s &position, uint16_t speed)
+{
+	time_t now = millis();
+	bool moving = accIsMoving();
+
+	if (motionHasLast)
+	{
+		uint32_t dt = now - motionNow.time;
+		uint32_t distance = geoDistance(motionNow.position, position);
+
+		// Heading is only meaningful if the tracker moved
+		if (moving && (distance >= MOTION_MIN_DISTANCE))
+		{
+			motionNow.heading = geoBearing(motionNow.position, position);
+		}
+		if (!moving)
+		{
+			speed = 0;
+		}
+		int32_t accel = 0;
+		if (moving && (dt > 0) && (dt < MOTION_MAX_FIX_GAP))
+		{
+			accel = (((int32_t)speed - motionNow.speed) * 1000) / (int32_t)dt;
+		}
+		motionNow.accel = accel;
+	}
+	motionNow.position = position;
+	motionNow.speed = speed;
+	motionNow.time = now;
+	motionHasLast = true;
+}
+
+/**
+ * @brief Check if the position must be sent
+ * @note Returns false if the backend extrapolation is still within
+ * MOTION_DR_TOLERANCE and the last uplink is less than
+ * MOTION_DR_MAX_SKIP ms ago
+ *
+ * @return true if the position should be sent
+ */
+bool motionShouldSend(void)
+{
+	if (!motionSentValid || !motionHasLast)
+	{
+		return true;
+	}
+	uint32_t elapsed = motionNow.time - motionSent.time;
+	if (elapsed > MOTION_DR_MAX_SKIP)
+	{
+		return true;
+	}
+	geo_coord_s predicted = motionPredict(motionSent, elapsed);
+	uint32_t drift = geoDistance(predicted, motionNow.position);
+	if (drift > MOTION_DR_TOLERANCE)
+	{
+		Serial.printf("DR drift %ld m, send\n", drift);
+		return true;
+	}
+	Serial.printf("DR drift %ld m, skip\n", drift);
+	if (motionStats.skipped != 0xFFFF)
+	{
+		motionStats.skipped++;
+	}
+	return false;
+}
+
+/**
+ * @brief Remember the motion state that was sent
+ * @note Called after a successful uplink
+ */
+void motionMarkSent(void)
+{
+	motionSent = motionNow;
+	// Use the values with the resolution the backend gets
+	motionSent.position.lat = (motionNow.position.lat / (GEO_SCALE / GEO_PAYLOAD_SCALE)) * (GEO_SCALE / GEO_PAYLOAD_SCALE);
+	motionSent.position.lng = (motionNow.position.lng / (GEO_SCALE / GEO_PAYLOAD_SCALE)) * (GEO_SCALE / GEO_PAYLOAD_SCALE);
+	motionSent.accel = trackerData.acc * 10;
+	motionSentValid = true;
+	if (motionStats.sent != 0xFFFF)
+	{
+		motionStats.sent++;
+	}
+}
+
+/**
+ * @brief Write the motion vector into the tracker data
+ */
+void motionEncode(void)
+{
+	uint16_t heading = motionNow.heading;
+	uint16_t speed = motionNow.speed;
+	int32_t accel = motionNow.accel / 10;
+	if (accel > 127)
+	{
+		accel = 127;
+	}
+	if (accel < -128)
+	{
+		accel = -128;
+	}
+	trackerData.hd_1 = heading;
+	trackerData.hd_2 = heading >> 8;
+	trackerData.spc_1 = speed;
+	trackerData.spc_2 = speed >> 8;
+	trackerData.acc = (int8_t)accel;
+}
@@ -0,0 +1,211 @@
+/**
+ * @file policy.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Battery aware power policy
+ * @version 0.1
+ * @date 2020-08-19
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The policy level is selected from the filtered battery level.
+ * Each level sets the LoRaWan device class, the reporting interval,
+ * the GPS acquisition timeout and the BLE TX power.
+ * To avoid toggling, a level is only left upwards if the battery
+ * is POLICY_HYSTERESIS % above the threshold of the higher level.
+ * If no downlink was received for a long time, the device class is
+ * stepped down independent of the battery, the server does not use it.
+ */
+#include "main.h"
+#include <LoRaWan-RAK4630.h>
+
+/** Settings for each policy level */
+static const policy_level_s policyLevels[POLICY_NUM_LEVELS] = {
+	// min battery, class, report interval, GPS timeout, BLE TX power
+	{50, CLASS_C, 60000, 10000, 4},	 // POLICY_FULL
+	{30, CLASS_B, 120000, 8000, 0},	 // POLICY_MEDIUM
+	{15, CLASS_A, 300000, 6000, -8}, // POLICY_LOW
+	{0, CLASS_A, 900000, 4000, -20}, // POLICY_CRITICAL
+};
+
+/** Current policy level */
+uint8_t policyLevel = POLICY_FULL;
+
+/** Device class requested by the policy */
+static uint8_t policyClass = CLASS_C;
+
+/** Flag if the server requested a device class */
+static bool serverOverride = false;
+
+/** Filtered battery level in 1/16 % */
+static uint16_t battFiltered = 0;
+
+/** Time of the last downlink */
+static time_t lastDownlink = 0;
+
+/** Flag if a policy transition should be reported */
+bool policyPending = false;
+
+/** Max time of the GPS acquisition in ms */
+uint32_t gpsMaxTime = 10000;
+
+/**
+ * @brief Get the device class allowed by the downlink activity
+ *
+ * @return uint8_t Highest useful device class
+ */
+static uint8_t policyDownlinkClass(void)
+{
+	time_t idle = millis() - lastDownlink;
+	if (idle > POLICY_DOWNLINK_IDLE_A)
+	{
+		return CLASS_A;
+	}
+	if (idle > POLICY_DOWNLINK_IDLE_B)
+	{
+		return CLASS_B;
+	}
+	return CLASS_C;
+}
+
+/**
+ * @brief Apply the settings of the current policy level
+ *
+ * @param levelChanged true if the level changed since the last call
+ */
+static void policyApply(bool levelChanged)
+{
+	const policy_level_s *level = &policyLevels[policyLevel];
+
+	if (levelChanged)
+	{
+		periodicSending.setPeriod(level->reportInterval);
+		gpsMaxTime = level->gpsTimeout;
+		Bluefruit.setTxPower(level->bleTxPower);
+		serverOverride = false;
+	}
+
+	if (serverOverride)
+	{
+		return;
+	}
+
+	// Class C > class B > class A, use the lower one
+	uint8_t newClass = level->devClass;
+	uint8_t downlinkClass = policyDownlinkClass();
+	if (downlinkClass < newClass)
+	{
+		newClass = downlinkClass;
+	}
+	if ((newClass != policyClass) && lmhJoined())
+	{
+		policyClass = newClass;
+		loraClassRequest(newClass);
+	}
+}
+
+/**
+ * @brief Initialize the policy with the current battery level
+ *
+ * @param battery Battery level in %
+ */
+void initPolicy(uint8_t battery)
+{
+	battFiltered = battery * 16;
+	lastDownlink = millis();
+	policyLevel = POLICY_CRITICAL;
+	for (uint8_t idx = 0; idx < POLICY_NUM_LEVELS; idx++)
+	{
+		if (battery >= policyLevels[idx].minBattery)
+		{
+			policyLevel = idx;
+			break;
+		}
+	}
+	policyClass = policyLevels[policyLevel].devClass;
+	policyApply(true);
+}
+
+/**
+ * @brief Update the policy with a new battery reading
+ *
+ * @param battery Battery level in %
+ */
+void policyUpdate(uint8_t battery)
+{
+	// Exponential filter, 1/8 of the new value
+	battFiltered = battFiltered - (battFiltered >> 3) + ((battery * 16) >> 3);
+	uint8_t filtered = battFiltered / 16;
+
+	uint8_t newLevel = policyLevel;
+	// Step down as soon as the battery is below the threshold
+	while ((newLevel < POLICY_CRITICAL) && (filtered < policyLevels[newLevel].minBattery))
+	{
+		newLevel++;
+	}
+	// Step up only with hysteresis
+	while ((newLevel > POLICY_FULL) && (filtered >= policyLevels[newLevel - 1].minBattery + POLICY_HYSTERESIS))
+	{
+		newLevel--;
+	}
+
+	bool levelChanged = newLevel != policyLevel;
+	if (levelChanged)
+	{
+		Serial.printf("Policy level %d -> %d, battery %d%%\n", policyLevel, newLevel, filtered);
+		if (bleUARTisConnected)
+		{
+			bleuart.printf("Policy level %d -> %d, battery %d%%\n", policyLevel, newLevel, filtered);
+		}
+		policyLevel = newLevel;
+		policyPending = true;
+	}
+	policyApply(levelChanged);
+}
+
+/**
+ * @brief Record a downlink and the class requested by the server
+ *
+ * @param requestedClass Device class requested with a port 3 downlink, 0xFF if none
+ */
+void policyDownlink(uint8_t requestedClass)
+{
+	lastDownlink = millis();
+	if (requestedClass != 0xFF)
+	{
+		// Server request overrides the policy until the next level change
+		policyClass = requestedClass;
+		serverOverride = true;
+	}
+}
+
+/**
+ * @brief Device class selected by the policy
+ *
+ * @return uint8_t Device class
+ */
+uint8_t policyDeviceClass(void)
+{
+	return policyClass;
+}
+
+/**
+ * @brief Create the policy transition frame
+ * @note Layout
+ * 		0 policy level
+ * 		1 filtered battery in %
+ * 		2 device class
+ * 		3..4 report interval in s, little endian
+ *
+ * @param buffer Buffer, must be at least POLICY_FRAME_LEN bytes
+ * @return uint8_t Length of the frame
+ */
+uint8_t policyGetFrame(uint8_t *buffer)
+{
+	uint16_t interval = policyLevels[policyLevel].reportInterval / 1000;
+	buffer[0] = policyLevel;
+	buffer[1] = battFiltered / 16;
+	buffer[2] = policyClass;
+	buffer[3] = interval;
+	buffer[4] = interval >> 8;
+	return POLICY_FRAME_LEN;
+}
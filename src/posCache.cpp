@@ -0,0 +1,150 @@
+/**
+ * @file posCache.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Last known position cache
+ * @version 0.1
+ * @date 2020-09-01
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Keeps the last good fix. While the tracker does not move, the
+ * cached fix is used instead of a new GPS acquisition and only a short
+ * heartbeat "unchanged since uplink N" is sent.
+ * Motion energy invalidates the cache. Each accelerometer interrupt
+ * adds POS_CACHE_INT_ENERGY, each sample of the dynamic acceleration
+ * above ACC_MOVING_THRESHOLD adds its value in mg. A single bump does
+ * not invalidate the cache, repeated motion does.
+ */
+#include "main.h"
+
+/** Position cache */
+pos_cache_s posCache;
+
+/** Accelerometer interrupts since the last check */
+static volatile uint16_t posCacheInts = 0;
+
+/**
+ * @brief Store a new fix
+ * @note The fix itself is in gpsFix and trackerData
+ *
+ * @param hdop HDOP x100 of the fix
+ * @param speed Speed of the fix in cm/s
+ */
+void posCacheStore(int32_t hdop, uint16_t speed)
+{
+	posCache.fixTime = millis();
+	posCache.fixNum = gpsStats.fixes;
+	posCache.hdop = hdop;
+	posCache.acqMs = acqWarmTime();
+	posCache.energy = 0;
+	posCacheInts = 0;
+	// Only accurate fixes taken at standstill are reused
+	posCache.valid = (hdop <= POS_CACHE_MAX_HDOP) && (speed <= POS_CACHE_MAX_SPEED);
+	// The new fix was not sent yet
+	posCache.sentValid = false;
+}
+
+/**
+ * @brief Count an accelerometer interrupt
+ * @note Called from the interrupt handler
+ */
+void posCacheAccInt(void)
+{
+	if (posCacheInts != 0xFFFF)
+	{
+		posCacheInts++;
+	}
+}
+
+/**
+ * @brief Check if the cached fix can be used
+ * @note Adds the motion since the last check to the motion energy
+ *
+ * @return true if the tracker did not move since the fix
+ */
+bool posCacheValid(void)
+{
+	if (!posCache.valid)
+	{
+		return false;
+	}
+
+	uint16_t ints = posCacheInts;
+	posCacheInts = 0;
+	posCache.energy += (uint32_t)ints * POS_CACHE_INT_ENERGY;
+	uint32_t dynamic = accDynamic();
+	if (dynamic > ACC_MOVING_THRESHOLD)
+	{
+		posCache.energy += dynamic;
+	}
+
+	if (posCache.energy > POS_CACHE_MAX_ENERGY)
+	{
+		Serial.printf("Motion energy %ld, position cache invalid\n", posCache.energy);
+		posCache.valid = false;
+		return false;
+	}
+	if ((millis() - posCache.fixTime) > POS_CACHE_MAX_AGE)
+	{
+		Serial.println("Cached position too old");
+		posCache.valid = false;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Count a report that used the cached fix
+ * @note Called only when the report was started without a GPS acquisition
+ */
+void posCacheUsed(void)
+{
+	posCache.hits++;
+	// The tracker did not move, a new acquisition would take as long as the one of the cached fix.
+	// It lasts at least one pipeline step
+	posCache.gpsSavedMs += posCache.acqMs > PIPE_STEP_TIME ? posCache.acqMs : PIPE_STEP_TIME;
+}
+
+/**
+ * @brief Remember the uplink that carried the cached fix
+ *
+ * @param seq Uplink sequence number
+ */
+void posCacheMarkSent(uint16_t seq)
+{
+	if (gpsStats.fixes == posCache.fixNum)
+	{
+		posCache.sentSeq = seq;
+		posCache.sentValid = true;
+	}
+}
+
+/**
+ * @brief Create the heartbeat frame
+ * @note Layout (little endian)
+ * 		0..1 sequence number of the uplink with the position
+ * 		2..3 age of the fix in minutes
+ * 		4 battery in %
+ *
+ * @param buffer Buffer, must be at least POS_HEARTBEAT_LEN bytes
+ * @return uint8_t Length of the frame, 0 if the cached fix was not sent yet
+ */
+uint8_t posCacheHeartbeat(uint8_t *buffer)
+{
+	if (!posCache.sentValid)
+	{
+		return 0;
+	}
+	uint32_t age = (millis() - posCache.fixTime) / 60000;
+	if (age > 0xFFFF)
+	{
+		age = 0xFFFF;
+	}
+	buffer[0] = posCache.sentSeq;
+	buffer[1] = posCache.sentSeq >> 8;
+	buffer[2] = age;
+	buffer[3] = age >> 8;
+	buffer[4] = trackerData.batt;
+	return POS_HEARTBEAT_LEN;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file power.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Low power handling, sleep residency and wake source statistics
+ * @version 0.1
+ * @date 2020-08-01
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The MCU goes into System ON sleep from the FreeRTOS idle task
+ * (tickless idle). The trace macros traceLOW_POWER_IDLE_BEGIN() and
+ * traceLOW_POWER_IDLE_END() around portSUPPRESS_TICKS_AND_SLEEP() in
+ * tasks.c are set in platformio.ini to call powerSleepBegin() and
+ * powerSleepEnd(). The port steps the tick count by the time the MCU
+ * really slept, the tick difference between both calls is the sleep
+ * time. The time other tasks run is not counted.
+ */
+#ifndef traceLOW_POWER_IDLE_BEGIN
+#warning "traceLOW_POWER_IDLE_BEGIN() is not set, the sleep time is not measured"
+#endif
+
+#include "main.h"
+
+#if configUSE_TICKLESS_IDLE == 0
+#warning "Tickless idle is disabled, the MCU will wake up on every tick"
+#endif
+
+/** Last wake up reason, see WAKE_xxx definitions */
+uint8_t wakeReason = WAKE_NONE;
+
+/** Sleep residency and wake source counters */
+power_stats_s powerStats;
+
+/** Flag if the peripherals are switched to low power mode */
+bool powerSaveActive = false;
+
+/** Tick count when the MCU went to sleep */
+static volatile TickType_t sleepStartTick = 0;
+
+/** Tick count when the statistics were started */
+static TickType_t statsStartTick = 0;
+
+/**
+ * @brief Initialize the power statistics
+ *
+ */
+void initPower(void)
+{
+	memset(&powerStats, 0, sizeof(power_stats_s));
+	statsStartTick = xTaskGetTickCount();
+}
+
+/**
+ * @brief FreeRTOS idle callback
+ * @note Called every time the idle task runs.
+ * 		Keep it short, it runs on the idle task stack.
+ */
+extern "C" void rtos_idle_callback(void)
+{
+	powerStats.idleEntries++;
+}
+
+/**
+ * @brief Called by traceLOW_POWER_IDLE_BEGIN() before tickless sleep
+ * @note Runs in the idle task with the scheduler suspended
+ *
+ * @param expectedIdle Ticks until the next task is due to run
+ */
+extern "C" void powerSleepBegin(TickType_t expectedIdle)
+{
+	sleepStartTick = xTaskGetTickCount();
+	powerStats.expectedTicks += expectedIdle;
+}
+
+/**
+ * @brief Called by traceLOW_POWER_IDLE_END() after tickless sleep
+ * @note The tick count was stepped by the slept time already
+ */
+extern "C" void powerSleepEnd(void)
+{
+	powerStats.sleepTicks += xTaskGetTickCount() - sleepStartTick;
+	powerStats.sleeps++;
+}
+
+/**
+ * @brief Record a wake up source
+ * @note Safe to call from ISR and timer callbacks
+ *
+ * @param source Wake up source, see WAKE_xxx definitions
+ */
+void powerCountWake(uint8_t source)
+{
+	wakeReason = source;
+	if (source < WAKE_NUM_SOURCES)
+	{
+		if (powerStats.wakeCount[source] != 0xFFFF)
+		{
+			powerStats.wakeCount[source]++;
+		}
+	}
+}
+
+/**
+ * @brief Get the sleep residency since start
+ *
+ * @return uint8_t Percentage of time spent in System ON sleep
+ */
+uint8_t powerResidency(void)
+{
+	TickType_t total = xTaskGetTickCount() - statsStartTick;
+	if (total == 0)
+	{
+		return 0;
+	}
+	return (uint8_t)(((uint64_t)powerStats.sleepTicks * 100) / total);
+}
+
+/**
+ * @brief Switch peripherals into low power mode or back
+ * @note In low power mode Serial is stopped, the OLED is switched off
+ * 		and BLE advertising runs only with the slow interval.
+ * 		Used when no BLE central is connected.
+ *
+ * @param enable true to enter low power mode, false to leave it
+ */
+void powerSave(bool enable)
+{
+#if POWER_SAVE > 0
+	if (enable == powerSaveActive)
+	{
+		return;
+	}
+	powerSaveActive = enable;
+
+	if (enable)
+	{
+		Serial.println("Entering low power mode");
+		Serial.flush();
+		Serial.end();
+		dispPower(false);
+		// Use the slow interval for fast mode as well
+		Bluefruit.Advertising.setInterval(244, 244);
+	}
+	else
+	{
+		Serial.begin(115200);
+		dispPower(true);
+		Bluefruit.Advertising.setInterval(32, 244);
+		Serial.println("Leaving low power mode");
+	}
+#else
+	(void)enable;
+#endif
+}
+
+/**
+ * @brief Write power statistics into a buffer
+ * @note Layout (little endian)
+ * 		0..3 sleep ticks
+ * 		4..7 idle entries
+ * 		8 sleep residency in %
+ * 		9 last wake reason
+ * 		10.. one uint16_t counter per wake source
+ * 		then uint32 number of tickless sleeps and uint32 expected idle ticks
+ *
+ * @param buffer Buffer, must be at least POWER_STATS_LEN bytes
+ * @return uint8_t Number of bytes written
+ */
+uint8_t powerGetStats(uint8_t *buffer)
+{
+	uint8_t idx = 0;
+	memcpy(&buffer[idx], (const void *)&powerStats.sleepTicks, 4);
+	idx += 4;
+	memcpy(&buffer[idx], (const void *)&powerStats.idleEntries, 4);
+	idx += 4;
+	buffer[idx++] = powerResidency();
+	buffer[idx++] = wakeReason;
+	for (int source = 0; source < WAKE_NUM_SOURCES; source++)
+	{
+		buffer[idx++] = powerStats.wakeCount[source];
+		buffer[idx++] = powerStats.wakeCount[source] >> 8;
+	}
+	memcpy(&buffer[idx], (const void *)&powerStats.sleeps, 4);
+	idx += 4;
+	memcpy(&buffer[idx], (const void *)&powerStats.expectedTicks, 4);
+	idx += 4;
+	return idx;
+}
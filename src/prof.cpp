@@ -0,0 +1,133 @@
+/**
+ * @file prof.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Scoped profiling with latency histograms
+ * @version 0.1
+ * @date 2020-08-30
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Only compiled with -DPROFILING=1.
+ * PROF_SCOPE(site) reads the DWT cycle counter when the scope is entered
+ * and adds the elapsed cycles to the histogram of the site when it is
+ * left. Each histogram has one bucket per power of 2 cycles.
+ * The cycle counter stops while the MCU sleeps, time spent in delay()
+ * or waiting for a semaphore is not counted.
+ */
+#include "main.h"
+
+#if PROFILING
+
+/** Names of the profiling sites, same order as PROF_xxx */
+static const char *profNames[PROF_NUM_SITES] = {
+	"pollGPS", "sendLoRaFrame", "dispAddLine", "dispShow", "clearAccInt",
+	"readBatt", "loraRx", "loraJoined", "loraClass", "alarm", "capture",
+	"captureWrite"};
+
+/** Histograms of all sites */
+static prof_site_s profSites[PROF_NUM_SITES];
+
+/**
+ * @brief Start the DWT cycle counter
+ */
+void initProf(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	profReset();
+}
+
+/**
+ * @brief Clear all histograms
+ */
+void profReset(void)
+{
+	taskENTER_CRITICAL();
+	memset(profSites, 0, sizeof(profSites));
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Add a measurement to the histogram of a site
+ *
+ * @param site Site ID, see PROF_xxx definitions
+ * @param cycles Elapsed CPU cycles
+ */
+void profRecord(uint8_t site, uint32_t cycles)
+{
+	// Bucket n holds 2^n <= cycles < 2^(n+1)
+	uint8_t bucket = cycles == 0 ? 0 : 31 - __builtin_clz(cycles);
+	taskENTER_CRITICAL();
+	prof_site_s *entry = &profSites[site];
+	if (entry->bucket[bucket] != 0xFFFF)
+	{
+		entry->bucket[bucket]++;
+	}
+	entry->count++;
+	entry->total += cycles;
+	if (cycles > entry->max)
+	{
+		entry->max = cycles;
+	}
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Get a copy of the histogram of a site
+ *
+ * @param site Site ID, see PROF_xxx definitions
+ * @param entry Copy of the histogram, times in CPU cycles
+ */
+void profGetSite(uint8_t site, prof_site_s *entry)
+{
+	taskENTER_CRITICAL();
+	*entry = profSites[site];
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Print the histograms
+ * @note Times are in us, buckets with count 0 are skipped
+ *
+ * @param toBle true to print to the BLE UART as well
+ */
+void profPrint(bool toBle)
+{
+	uint32_t cyclesPerUs = SystemCoreClock / 1000000;
+	for (int site = 0; site < PROF_NUM_SITES; site++)
+	{
+		prof_site_s entry;
+		taskENTER_CRITICAL();
+		entry = profSites[site];
+		taskEXIT_CRITICAL();
+		if (entry.count == 0)
+		{
+			continue;
+		}
+		uint32_t mean = (uint32_t)(entry.total / entry.count) / cyclesPerUs;
+		snprintf(dbgBuffer, 255, "%s n %ld mean %ld us max %ld us\n",
+				 profNames[site], entry.count, mean, entry.max / cyclesPerUs);
+		Serial.print(dbgBuffer);
+		if (toBle && bleUARTisConnected)
+		{
+			bleuart.print(dbgBuffer);
+		}
+		for (int bucket = 0; bucket < PROF_BUCKETS; bucket++)
+		{
+			if (entry.bucket[bucket] == 0)
+			{
+				continue;
+			}
+			snprintf(dbgBuffer, 255, "  >= %ld us: %d\n",
+					 ((uint32_t)1 << bucket) / cyclesPerUs, entry.bucket[bucket]);
+			Serial.print(dbgBuffer);
+			if (toBle && bleUARTisConnected)
+			{
+				bleuart.print(dbgBuffer);
+			}
+		}
+	}
+}
+
+#endif
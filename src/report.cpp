@@ -0,0 +1,397 @@
+/**
+ * @file report.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Pipelined report cycle
+ * @version 0.1
+ * @date 2020-09-10
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note A position report passes four stages:
+ * 	acquisition: GPS warm-up and fix, the battery is sampled while the GPS UART is idle
+ * 	encoding: battery, policy, time, encounters, trip and the decision which frame is sent
+ * 	transmission: hands the frame to the transport
+ * 	reporting: Serial, display and BLE UART output of the result
+ * Each stage holds one report and is a small state machine that never
+ * waits. pipeStep() runs one step of each stage, the main loop calls it
+ * every PIPE_STEP_TIME ms while a report is in the pipeline and keeps
+ * handling other frames in between. An alarm stops the acquisition,
+ * the report continues with the position found so far. The next acquisition
+ * starts as soon as the previous report left the acquisition stage.
+ * trackerData is shared, a fix is only encoded after the previous
+ * report was sent.
+ */
+#include "main.h"
+
+/** Reports in the pipeline, one per stage */
+static pipe_report_s pipeSlots[PIPE_NUM_STAGES];
+
+/** millis() of the last statistics reset */
+static uint32_t pipeStatsStart = 0;
+
+/** Pipeline statistics */
+pipe_stats_s pipeStats;
+
+/** Names of the stages, same order as PIPE_xxx */
+static const char *pipeNames[PIPE_NUM_STAGES] = {"acq", "enc", "tx", "post"};
+
+/**
+ * @brief Add a latency to the statistics
+ *
+ * @param latency Statistics
+ * @param ms Latency in ms
+ */
+static void pipeAddLatency(pipe_latency_s *latency, uint32_t ms)
+{
+	latency->count++;
+	latency->totalMs += ms;
+	if (ms > latency->maxMs)
+	{
+		latency->maxMs = ms;
+	}
+}
+
+/**
+ * @brief Move a report to the next stage
+ *
+ * @param stage Current stage of the report
+ * @return true if the report was moved
+ * @return false if the next stage is still busy
+ */
+static bool pipeAdvance(uint8_t stage)
+{
+	if ((stage != PIPE_POST) && pipeSlots[stage + 1].used)
+	{
+		return false;
+	}
+	uint32_t now = millis();
+	pipe_report_s *report = &pipeSlots[stage];
+	pipeAddLatency(&pipeStats.stage[stage], now - report->stageStart);
+	if (stage == PIPE_POST)
+	{
+		pipeAddLatency(&pipeStats.endToEnd, now - report->start);
+		report->used = false;
+		return true;
+	}
+	pipeSlots[stage + 1] = *report;
+	pipeSlots[stage + 1].stageStart = now;
+	pipeSlots[stage + 1].step = 0;
+	report->used = false;
+	return true;
+}
+
+/**
+ * @brief Start a new report
+ *
+ * @param useCache true to use the cached position instead of the GPS
+ * @return true if the report was started
+ * @return false if an acquisition is already running
+ */
+bool pipeStart(bool useCache)
+{
+	if (pipeSlots[PIPE_ACQ].used)
+	{
+		pipeStats.merged++;
+		return false;
+	}
+	if (pipeBusy())
+	{
+		pipeStats.overlapped++;
+	}
+	pipe_report_s *report = &pipeSlots[PIPE_ACQ];
+	memset(report, 0, sizeof(pipe_report_s));
+	report->used = true;
+	report->start = millis();
+	report->stageStart = report->start;
+	report->useCache = useCache;
+	if (useCache)
+	{
+		posCacheUsed();
+	}
+	else
+	{
+		gpsPollStart();
+	}
+	return true;
+}
+
+/**
+ * @brief Stop a running acquisition because of an alarm
+ * @note The alarm is sent with the last fix, the GPS is not needed anymore
+ */
+void pipeAlarm(void)
+{
+	pipe_report_s *report = &pipeSlots[PIPE_ACQ];
+	if (report->used && !report->useCache && (report->step == 0))
+	{
+		gpsPollAbort(GPS_END_ALARM);
+	}
+}
+
+/**
+ * @brief Check if a report is in the pipeline
+ *
+ * @return true if any stage holds a report
+ */
+bool pipeBusy(void)
+{
+	for (uint8_t stage = 0; stage < PIPE_NUM_STAGES; stage++)
+	{
+		if (pipeSlots[stage].used)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Acquisition stage
+ * @note Step 0 reads the GPS, step 1 waits until trackerData is free
+ */
+static void pipeAcqStep(void)
+{
+	pipe_report_s *report = &pipeSlots[PIPE_ACQ];
+	if (report->step == 0)
+	{
+		bool done = report->useCache || gpsPollStep();
+		// Sample the battery between two NMEA bursts, or when the GPS is not read anymore
+		if (!report->battSampled && (done || (Serial1.available() == 0)))
+		{
+			report->battLevel = readBatt();
+			report->battSampled = true;
+		}
+		if (!done || !report->battSampled)
+		{
+			return;
+		}
+		report->step = 1;
+	}
+	// The fix is written into trackerData, wait until the previous report was sent
+	if (pipeSlots[PIPE_ENC].used || pipeSlots[PIPE_TX].used)
+	{
+		return;
+	}
+	if (!report->useCache)
+	{
+		report->hasPos = gpsPollFinish();
+	}
+	pipeAdvance(PIPE_ACQ);
+}
+
+/**
+ * @brief Encoding stage
+ * @note Step 0 prepares the frame, step 1 waits for the transmission stage
+ */
+static void pipeEncStep(void)
+{
+	pipe_report_s *report = &pipeSlots[PIPE_ENC];
+	if (report->step == 0)
+	{
+		battLevel = report->battLevel;
+		trackerData.batt = battLevel;
+		healthAdd(HEALTH_ACC_BATT, battLevel);
+		lnsBattery(battLevel);
+		policyUpdate(battLevel);
+		// Request the network time if GPS time is not available
+		timeCheckSync();
+		// Queue the closed encounters
+		encCheck();
+
+		bool tripEnded = tripCheck();
+#if TRIP_MODE
+		// Only the trip summaries are sent
+		report->frame = tripEnded ? PIPE_FRAME_TRIP : PIPE_FRAME_NONE;
+		if (!tripEnded && (tripStats.suppressed != 0xFFFF))
+		{
+			tripStats.suppressed++;
+		}
+#else
+		(void)tripEnded;
+		// Send the location information, unless the backend can extrapolate it
+		if (report->useCache)
+		{
+			report->frame = PIPE_FRAME_HEARTBEAT;
+		}
+		else if (motionShouldSend())
+		{
+			report->frame = PIPE_FRAME_POSITION;
+		}
+		else
+		{
+			report->frame = PIPE_FRAME_NONE;
+		}
+#endif
+		report->step = 1;
+	}
+	pipeAdvance(PIPE_ENC);
+}
+
+/**
+ * @brief Transmission stage
+ * @note Step 0 sends the frame, step 1 waits for the reporting stage
+ */
+static void pipeTxStep(void)
+{
+	pipe_report_s *report = &pipeSlots[PIPE_TX];
+	if (report->step == 0)
+	{
+		switch (report->frame)
+		{
+		case PIPE_FRAME_POSITION:
+			report->error = sendLoRaFrame();
+			report->data = trackerData;
+			break;
+		case PIPE_FRAME_HEARTBEAT:
+			sendHeartbeatFrame();
+			break;
+		case PIPE_FRAME_TRIP:
+			sendTripFrame();
+			break;
+		default:
+			break;
+		}
+		if (report->frame != PIPE_FRAME_NONE)
+		{
+			// The report gap counts from the uplink, the acquisition time differs from report to report
+			lastPosSend = schedClock();
+		}
+		report->step = 1;
+	}
+	pipeAdvance(PIPE_TX);
+}
+
+/**
+ * @brief Reporting stage
+ * @note One message per step, the display updates of a report do not
+ * delay the next acquisition
+ */
+static void pipePostStep(void)
+{
+	pipe_report_s *report = &pipeSlots[PIPE_POST];
+	switch (report->step)
+	{
+	case 0:
+		if (report->useCache)
+		{
+			Serial.printf("Stationary, use fix %ld, GPS time saved %ld s\n",
+						  posCache.fixNum, posCache.gpsSavedMs / 1000);
+			if (bleUARTisConnected)
+			{
+				bleuart.println("Stationary, use cached fix");
+			}
+		}
+		else if (report->hasPos)
+		{
+			Serial.println("Valid GPS position");
+			if (bleUARTisConnected)
+			{
+				bleuart.println("Valid GPS position");
+			}
+		}
+		else
+		{
+			Serial.println("No valid GPS position");
+			if (bleUARTisConnected)
+			{
+				bleuart.println("No valid GPS position");
+			}
+		}
+		report->step = 1;
+		break;
+
+	case 1:
+		if (report->frame == PIPE_FRAME_POSITION)
+		{
+			printLoRaFrame(report->error, report->data);
+		}
+#if TRIP_MODE
+		else if (report->frame == PIPE_FRAME_NONE)
+		{
+			Serial.printf("Trip mode, %s, skip sending\n", tripActive() ? "on a trip" : "no trip");
+		}
+#else
+		else if (report->frame == PIPE_FRAME_NONE)
+		{
+			Serial.println("Position within dead reckoning tolerance, skip sending");
+			if (bleUARTisConnected)
+			{
+				bleuart.println("Position within dead reckoning tolerance, skip sending");
+			}
+		}
+#endif
+		report->step = 2;
+		break;
+
+	default:
+		pipeAdvance(PIPE_POST);
+		break;
+	}
+}
+
+/**
+ * @brief Run one step of each stage
+ * @note The stages are run from the last to the first, a stage that
+ * finishes a report frees its slot for the previous stage
+ */
+void pipeStep(void)
+{
+	if (pipeSlots[PIPE_POST].used)
+	{
+		pipePostStep();
+	}
+	if (pipeSlots[PIPE_TX].used)
+	{
+		pipeTxStep();
+	}
+	if (pipeSlots[PIPE_ENC].used)
+	{
+		pipeEncStep();
+	}
+	if (pipeSlots[PIPE_ACQ].used)
+	{
+		pipeAcqStep();
+	}
+}
+
+/**
+ * @brief Clear the statistics
+ */
+void pipeReset(void)
+{
+	memset(&pipeStats, 0, sizeof(pipeStats));
+	pipeStatsStart = millis();
+}
+
+/**
+ * @brief Print the statistics
+ * @note Latency per stage, end to end latency and reports per hour
+ * since the last reset
+ *
+ * @param toBle true to print to the BLE UART as well
+ */
+void pipePrint(bool toBle)
+{
+	for (uint8_t stage = 0; stage < PIPE_NUM_STAGES; stage++)
+	{
+		pipe_latency_s latency = pipeStats.stage[stage];
+		snprintf(dbgBuffer, 255, "Pipe %s n %ld mean %ld max %ld ms\n", pipeNames[stage], latency.count,
+				 latency.count == 0 ? 0 : latency.totalMs / latency.count, latency.maxMs);
+		Serial.print(dbgBuffer);
+		if (toBle && bleUARTisConnected)
+		{
+			bleuart.print(dbgBuffer);
+		}
+	}
+	pipe_latency_s latency = pipeStats.endToEnd;
+	uint32_t elapsedMs = millis() - pipeStatsStart;
+	uint32_t perHour = elapsedMs == 0 ? 0 : (uint32_t)(((uint64_t)latency.count * 3600000) / elapsedMs);
+	snprintf(dbgBuffer, 255, "Pipe total n %ld mean %ld max %ld ms, %ld/h, overlapped %ld merged %ld\n",
+			 latency.count, latency.count == 0 ? 0 : latency.totalMs / latency.count, latency.maxMs,
+			 perHour, pipeStats.overlapped, pipeStats.merged);
+	Serial.print(dbgBuffer);
+	if (toBle && bleUARTisConnected)
+	{
+		bleuart.print(dbgBuffer);
+	}
+}
@@ -0,0 +1,253 @@
+/**
+ * @file satStats.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Satellite and constellation statistics
+ * @version 0.1
+ * @date 2020-08-26
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Uses TinyGPS++ custom fields to get the satellites in view and
+ * their C/N0 from the GSV sentences and the fix type from the GSA
+ * sentences. The GPS module sends GSV and GSA only every
+ * SAT_STATS_RATE fixes to keep the UART load low.
+ * C/N0 values are collected in a histogram per constellation. When a
+ * histogram is full, all bins are halved, older values fade out.
+ */
+#include "main.h"
+
+/** Talker IDs of the constellations */
+static const char *talkerGSV[SAT_NUM_CONST] = {"GPGSV", "GLGSV"};
+
+/** Message number, field 2 of GSV */
+static TinyGPSCustom gsvMsgNum[SAT_NUM_CONST];
+
+/** Satellites in view, field 3 of GSV */
+static TinyGPSCustom gsvInView[SAT_NUM_CONST];
+
+/** C/N0 of the up to 4 satellites in a GSV message, fields 7, 11, 15 and 19 */
+static TinyGPSCustom gsvCn0[SAT_NUM_CONST][4];
+
+/** Fix type, field 2 of GSA, GPS only and multi constellation */
+static TinyGPSCustom gsaFixGP;
+static TinyGPSCustom gsaFixGN;
+
+/** Satellite statistics */
+sat_stats_s satStats;
+
+/** Highest C/N0 seen since the acquisition started */
+static uint8_t acqMaxCn0 = 0;
+/** Flag if a GSV sentence was received since the acquisition started */
+static bool acqHasGsv = false;
+/** Start time of the acquisition */
+static time_t satAcqStart = 0;
+
+/**
+ * @brief Register the custom fields with the parser
+ * @note Done at runtime, the order of static constructors
+ * between myGPS and the custom fields is not defined
+ */
+void initSatStats(void)
+{
+	for (uint8_t constellation = 0; constellation < SAT_NUM_CONST; constellation++)
+	{
+		gsvMsgNum[constellation].begin(myGPS, talkerGSV[constellation], 2);
+		gsvInView[constellation].begin(myGPS, talkerGSV[constellation], 3);
+		for (uint8_t sat = 0; sat < 4; sat++)
+		{
+			gsvCn0[constellation][sat].begin(myGPS, talkerGSV[constellation], 7 + sat * 4);
+		}
+	}
+	gsaFixGP.begin(myGPS, "GPGSA", 2);
+	gsaFixGN.begin(myGPS, "GNGSA", 2);
+}
+
+/**
+ * @brief Add a C/N0 value to the histogram of a constellation
+ *
+ * @param constellation Constellation index
+ * @param cn0 C/N0 in dBHz
+ */
+static void satAddCn0(uint8_t constellation, uint8_t cn0)
+{
+	uint8_t bin = cn0 / SAT_CN0_BIN_WIDTH;
+	if (bin >= SAT_CN0_BINS)
+	{
+		bin = SAT_CN0_BINS - 1;
+	}
+	uint8_t *hist = satStats.cn0Hist[constellation];
+	if (hist[bin] == 0xFF)
+	{
+		// Histogram full, halve all bins
+		for (uint8_t idx = 0; idx < SAT_CN0_BINS; idx++)
+		{
+			hist[idx] >>= 1;
+		}
+	}
+	hist[bin]++;
+	if (cn0 > satStats.maxCn0[constellation])
+	{
+		satStats.maxCn0[constellation] = cn0;
+	}
+	if (cn0 > acqMaxCn0)
+	{
+		acqMaxCn0 = cn0;
+	}
+}
+
+/**
+ * @brief Check the custom fields after a parsed sentence
+ * @note Only fields that were updated are read
+ */
+void satStatsProcess(void)
+{
+	for (uint8_t constellation = 0; constellation < SAT_NUM_CONST; constellation++)
+	{
+		if (!gsvInView[constellation].isUpdated())
+		{
+			continue;
+		}
+		satStats.inView[constellation] = atoi(gsvInView[constellation].value());
+		acqHasGsv = true;
+		// TinyGPS++ commits all custom fields of a sentence, the fields
+		// missing in the last message of a cycle keep old values
+		int32_t inMsg = satStats.inView[constellation] - (atoi(gsvMsgNum[constellation].value()) - 1) * 4;
+		for (uint8_t sat = 0; sat < 4; sat++)
+		{
+			if (gsvCn0[constellation][sat].isUpdated() && (sat < inMsg))
+			{
+				const char *value = gsvCn0[constellation][sat].value();
+				// Empty field = satellite not tracked
+				if (value[0] != 0)
+				{
+					satAddCn0(constellation, atoi(value));
+				}
+			}
+		}
+	}
+	if (gsaFixGP.isUpdated())
+	{
+		satStats.fixType = atoi(gsaFixGP.value());
+	}
+	if (gsaFixGN.isUpdated())
+	{
+		satStats.fixType = atoi(gsaFixGN.value());
+	}
+}
+
+/**
+ * @brief Start a new acquisition
+ */
+void satStatsStart(void)
+{
+	acqMaxCn0 = 0;
+	acqHasGsv = false;
+	satAcqStart = millis();
+	for (uint8_t constellation = 0; constellation < SAT_NUM_CONST; constellation++)
+	{
+		satStats.maxCn0[constellation] = 0;
+		satStats.inView[constellation] = 0;
+	}
+}
+
+/**
+ * @brief Satellites in view of all constellations
+ * @note From the GSV sentences of the current acquisition, 0 until the
+ * first GSV sentence was received
+ *
+ * @return uint8_t Number of satellites in view
+ */
+uint8_t satInView(void)
+{
+	uint8_t inView = 0;
+	for (uint8_t constellation = 0; constellation < SAT_NUM_CONST; constellation++)
+	{
+		inView += satStats.inView[constellation];
+	}
+	return inView;
+}
+
+/**
+ * @brief Check if the sky is blocked
+ * @note True if GSV data was received for at least SAT_BLOCKED_TIME ms
+ * and no satellite had a C/N0 of SAT_BLOCKED_CN0 or better
+ *
+ * @return true if no usable signal is received
+ */
+bool satSkyBlocked(void)
+{
+	if (!acqHasGsv || ((millis() - satAcqStart) < SAT_BLOCKED_TIME))
+	{
+		return false;
+	}
+	return acqMaxCn0 < SAT_BLOCKED_CN0;
+}
+
+/**
+ * @brief Check if GSV data was received since the acquisition started
+ * @note Without GSV data the number of satellites in view is not known,
+ * the module sends GSV only every SAT_STATS_RATE fixes
+ *
+ * @return true if satInView() is valid
+ */
+bool satHasGsv(void)
+{
+	return acqHasGsv;
+}
+
+/**
+ * @brief Check if a satellite with a usable signal was seen
+ * @note Unlike satSkyBlocked() it does not wait SAT_BLOCKED_TIME ms
+ *
+ * @return true if a satellite had a C/N0 of SAT_BLOCKED_CN0 or better
+ */
+bool satSignalUsable(void)
+{
+	return acqHasGsv && (acqMaxCn0 >= SAT_BLOCKED_CN0);
+}
+
+/**
+ * @brief Mean C/N0 from the histograms
+ *
+ * @return uint8_t Mean C/N0 in dBHz, 0 if no values
+ */
+uint8_t satMeanCn0(void)
+{
+	uint32_t sum = 0;
+	uint32_t count = 0;
+	for (uint8_t constellation = 0; constellation < SAT_NUM_CONST; constellation++)
+	{
+		for (uint8_t bin = 0; bin < SAT_CN0_BINS; bin++)
+		{
+			// Use the middle of the bin
+			sum += satStats.cn0Hist[constellation][bin] * (bin * SAT_CN0_BIN_WIDTH + SAT_CN0_BIN_WIDTH / 2);
+			count += satStats.cn0Hist[constellation][bin];
+		}
+	}
+	return count != 0 ? sum / count : 0;
+}
+
+/**
+ * @brief Write the satellite statistics into a buffer
+ * @note Layout
+ * 		0 fix type (1 = none, 2 = 2D, 3 = 3D)
+ * 		then for each constellation (GPS, GLONASS)
+ * 		satellites in view, max C/N0 of the last acquisition
+ * 		and SAT_CN0_BINS histogram bins
+ *
+ * @param buffer Buffer, must be at least SAT_STATS_LEN bytes
+ * @return uint8_t Number of bytes written
+ */
+uint8_t satGetStats(uint8_t *buffer)
+{
+	uint8_t idx = 0;
+	buffer[idx++] = satStats.fixType;
+	for (uint8_t constellation = 0; constellation < SAT_NUM_CONST; constellation++)
+	{
+		buffer[idx++] = satStats.inView[constellation];
+		buffer[idx++] = satStats.maxCn0[constellation];
+		memcpy(&buffer[idx], satStats.cn0Hist[constellation], SAT_CN0_BINS);
+		idx += SAT_CN0_BINS;
+	}
+	return idx;
+}
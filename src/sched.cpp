@@ -0,0 +1,112 @@
+/**
+ * @file sched.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Scheduling decisions of the main loop
+ * @version 0.1
+ * @date 2020-09-03
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The decisions what the main loop does on a wake up are pure
+ * functions of their input. The time comes from schedClock, which is
+ * millis() on the device and can be replaced by a virtual clock to
+ * replay event traces.
+ */
+#include "main.h"
+
+/**
+ * @brief Default clock
+ *
+ * @return uint32_t millis()
+ */
+static uint32_t schedMillis(void)
+{
+	return millis();
+}
+
+/** Clock used by the scheduling decisions */
+uint32_t (*schedClock)(void) = schedMillis;
+
+/** Scheduling statistics, counted by the main loop */
+sched_stats_s schedStats;
+
+/**
+ * @brief Check if a position report is due
+ *
+ * @param now Current time in ms
+ * @param lastReport Time of the last report in ms
+ * @param initMsg true if the first report after the join is pending
+ * @return true if the position should be reported now
+ */
+bool schedReportDue(uint32_t now, uint32_t lastReport, bool initMsg)
+{
+	return ((now - lastReport) > SCHED_MIN_REPORT_GAP) || initMsg;
+}
+
+/**
+ * @brief Decide what the main loop does on this wake up
+ * @note Alarms go first. Pending frames are sent before the position, the position
+ * follows with the delayed timer. No side effects, the caller counts the
+ * actions in schedStats
+ *
+ * @param input State of the tracker
+ * @return uint8_t Action, see SCHED_xxx definitions
+ */
+uint8_t schedNextAction(const sched_input_s *input)
+{
+	uint8_t action;
+	if (!input->anyUp)
+	{
+		action = SCHED_NOT_JOINED;
+	}
+	else if (input->alarmPending)
+	{
+		// Alarms bypass the report gap
+		action = SCHED_ALARM;
+	}
+	else if (input->healthPending && input->joined)
+	{
+		action = SCHED_HEALTH;
+	}
+	else if (input->policyPending && input->joined)
+	{
+		action = SCHED_POLICY;
+	}
+	else if (input->timePending && input->joined)
+	{
+		action = SCHED_TIME;
+	}
+	else if (input->fragPending && input->joined)
+	{
+		action = SCHED_FRAG;
+	}
+	else if (input->encPending && input->joined)
+	{
+		action = SCHED_ENC;
+	}
+	else if (input->classBPending && input->joined)
+	{
+		action = SCHED_CLASSB;
+	}
+	else if (schedReportDue(input->now, input->lastReport, input->initMsg))
+	{
+		action = SCHED_REPORT;
+	}
+	else
+	{
+		action = SCHED_DELAY;
+	}
+	return action;
+}
+
+/**
+ * @brief Check if the periodic timer should wake up the main loop
+ *
+ * @param now Current time in ms
+ * @param lastReport Time of the last report in ms
+ * @return true if the loop should run
+ */
+bool schedPeriodicWake(uint32_t now, uint32_t lastReport)
+{
+	return (now - lastReport) > SCHED_MIN_REPORT_GAP;
+}
@@ -0,0 +1,324 @@
+/**
+ * @file timeSvc.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Device clock disciplined by GPS and network time
+ * @version 0.1
+ * @date 2020-09-02
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The device clock is the time of the last sync plus the millis()
+ * elapsed since then. millis() runs from the 32.768 kHz RTC crystal.
+ * The crystal error is estimated from two syncs that are at least
+ * TIME_DRIFT_MIN_INTERVAL apart and removed from the elapsed time.
+ * The clock is synced from the RMC sentence of a GPS fix. Without GPS
+ * time for TIME_NET_SYNC_INTERVAL, the time is requested from the
+ * network with the clock synchronization package (TS003 v1.0) on
+ * FPort 202.
+ */
+#include "main.h"
+
+/** Commands of the clock synchronization package */
+#define TIME_PACKAGE_VERSION 0x00
+#define TIME_APP_TIME 0x01
+
+/** Package identifier and version of the clock synchronization package */
+#define TIME_PACKAGE_ID 1
+#define TIME_PACKAGE_VER 1
+
+/** Seconds between the Unix epoch and the GPS epoch */
+#define TIME_GPS_EPOCH 315964800
+/** Leap seconds between GPS time and UTC */
+#define TIME_LEAP_SECONDS 18
+
+/** Max estimated crystal error in ppm */
+#define TIME_MAX_DRIFT 500
+
+/** Unix time in ms at the last sync */
+static uint64_t syncEpochMs = 0;
+/** millis() at the last sync */
+static uint32_t syncMillis = 0;
+/** Token of the last AppTimeReq */
+static uint8_t timeToken = 0;
+
+/** Time service statistics */
+time_stats_s timeStats;
+
+/** Answers to send on TIME_PORT */
+static uint8_t timeAnswer[TIME_ANSWER_LEN];
+static uint8_t timeAnswerLen = 0;
+/** Flag if a time request or answer is waiting to be sent */
+volatile bool timePending = false;
+
+/**
+ * @brief Milliseconds since the last sync, corrected by the estimated drift
+ *
+ * @param now millis() value
+ * @return uint32_t Corrected elapsed time in ms
+ */
+static uint32_t timeElapsed(uint32_t now)
+{
+	int64_t elapsed = (uint32_t)(now - syncMillis);
+	return (uint32_t)(elapsed - (elapsed * timeStats.driftPpm) / 1000000);
+}
+
+/**
+ * @brief Convert a millis() value into Unix time
+ *
+ * @param ms millis() value
+ * @return uint64_t Unix time in ms, 0 if the clock was never synced
+ */
+uint64_t timeFromMillis(uint32_t ms)
+{
+	if (timeStats.source == TIME_SRC_NONE)
+	{
+		return 0;
+	}
+	return syncEpochMs + timeElapsed(ms);
+}
+
+/**
+ * @brief Convert a millis() value into GPS time
+ *
+ * @param ms millis() value
+ * @return uint64_t ms since the GPS epoch, 0 if the clock was never synced
+ */
+uint64_t timeGpsMs(uint32_t ms)
+{
+	if (timeStats.source == TIME_SRC_NONE)
+	{
+		return 0;
+	}
+	return timeFromMillis(ms) - (uint64_t)TIME_GPS_EPOCH * 1000 + TIME_LEAP_SECONDS * 1000;
+}
+
+/**
+ * @brief Current Unix time
+ *
+ * @return uint32_t Unix time in seconds, 0 if the clock was never synced
+ */
+uint32_t timeNow(void)
+{
+	return timeFromMillis(millis()) / 1000;
+}
+
+/**
+ * @brief Days since 1970-01-01
+ * @note Integer only civil calendar conversion
+ *
+ * @param year Year, e.g. 2020
+ * @param month Month 1..12
+ * @param day Day 1..31
+ * @return int32_t Days since 1970-01-01
+ */
+static int32_t timeDays(int32_t year, uint32_t month, uint32_t day)
+{
+	year -= month <= 2;
+	int32_t era = (year >= 0 ? year : year - 399) / 400;
+	uint32_t yoe = (uint32_t)(year - era * 400);
+	uint32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int32_t)doe - 719468;
+}
+
+/**
+ * @brief Set the clock
+ * @note Updates the drift estimate if the last sync is long enough ago
+ *
+ * @param epochMs Unix time in ms
+ * @param atMillis millis() at that time
+ * @param source Source of the time, see TIME_SRC_xxx definitions
+ */
+static void timeSet(uint64_t epochMs, uint32_t atMillis, uint8_t source)
+{
+	if (timeStats.source != TIME_SRC_NONE)
+	{
+		uint32_t elapsed = atMillis - syncMillis;
+		int64_t error = (int64_t)timeFromMillis(atMillis) - (int64_t)epochMs;
+		timeStats.lastError = error;
+		// Only GPS time is accurate enough for the drift estimate
+		if ((source == TIME_SRC_GPS) && (timeStats.source == TIME_SRC_GPS) && (elapsed >= TIME_DRIFT_MIN_INTERVAL))
+		{
+			// Residual error of the already corrected clock
+			int32_t ppm = (int32_t)((error * 1000000) / elapsed);
+			int32_t drift = timeStats.driftPpm + ppm / 2;
+			if (drift > TIME_MAX_DRIFT)
+			{
+				drift = TIME_MAX_DRIFT;
+			}
+			if (drift < -TIME_MAX_DRIFT)
+			{
+				drift = -TIME_MAX_DRIFT;
+			}
+			timeStats.driftPpm = drift;
+		}
+		else if (elapsed < TIME_DRIFT_MIN_INTERVAL)
+		{
+			// Keep the old reference for the next drift estimate
+			if (source == timeStats.source)
+			{
+				return;
+			}
+		}
+	}
+	syncEpochMs = epochMs;
+	syncMillis = atMillis;
+	timeStats.source = source;
+	timeStats.lastSync = atMillis;
+	if (timeStats.syncs != 0xFFFF)
+	{
+		timeStats.syncs++;
+	}
+}
+
+/**
+ * @brief Sync the clock from the GPS date and time
+ * @note Called when a RMC sentence with valid date and time was parsed
+ *
+ * @param atMillis millis() when the sentence was received
+ */
+void timeSyncGps(uint32_t atMillis)
+{
+	if (!myGPS.date.isValid() || !myGPS.time.isValid() || (myGPS.date.year() < 2020))
+	{
+		return;
+	}
+	int64_t seconds = (int64_t)timeDays(myGPS.date.year(), myGPS.date.month(), myGPS.date.day()) * 86400 +
+					  myGPS.time.hour() * 3600 + myGPS.time.minute() * 60 + myGPS.time.second();
+	timeSet(seconds * 1000 + myGPS.time.centisecond() * 10, atMillis, TIME_SRC_GPS);
+}
+
+/**
+ * @brief Add an answer to the answer buffer
+ *
+ * @param answer Answer data
+ * @param len Length of the answer
+ */
+static void timeQueueAnswer(const uint8_t *answer, uint8_t len)
+{
+	taskENTER_CRITICAL();
+	if (timeAnswerLen + len <= TIME_ANSWER_LEN)
+	{
+		memcpy(&timeAnswer[timeAnswerLen], answer, len);
+		timeAnswerLen += len;
+		timePending = true;
+	}
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Request the network time if the GPS did not deliver the time recently
+ * @note Called on every report cycle
+ */
+void timeCheckSync(void)
+{
+	if ((timeStats.source == TIME_SRC_GPS) && ((millis() - timeStats.lastSync) < TIME_NET_SYNC_INTERVAL))
+	{
+		return;
+	}
+	if ((timeStats.lastRequest != 0) && ((millis() - timeStats.lastRequest) < TIME_NET_SYNC_INTERVAL))
+	{
+		return;
+	}
+	timeStats.lastRequest = millis();
+	timeToken = (timeToken + 1) & 0x0F;
+	// AppTimeReq, device time in GPS seconds and the token, answer required
+	uint32_t gpsTime = timeNow() - TIME_GPS_EPOCH + TIME_LEAP_SECONDS;
+	uint8_t request[6];
+	request[0] = TIME_APP_TIME;
+	request[1] = gpsTime;
+	request[2] = gpsTime >> 8;
+	request[3] = gpsTime >> 16;
+	request[4] = gpsTime >> 24;
+	request[5] = timeToken | 0x10;
+	timeQueueAnswer(request, 6);
+}
+
+/**
+ * @brief Handle a downlink on TIME_PORT
+ *
+ * @param buffer Downlink payload
+ * @param len Length of the payload
+ */
+void timeDownlink(uint8_t *buffer, uint8_t len)
+{
+	uint8_t pos = 0;
+	uint8_t answer[3];
+	while (pos < len)
+	{
+		uint8_t cmd = buffer[pos++];
+		switch (cmd)
+		{
+		case TIME_PACKAGE_VERSION:
+			answer[0] = TIME_PACKAGE_VERSION;
+			answer[1] = TIME_PACKAGE_ID;
+			answer[2] = TIME_PACKAGE_VER;
+			timeQueueAnswer(answer, 3);
+			xSemaphoreGive(loopEnable);
+			break;
+
+		case TIME_APP_TIME:
+		{
+			// AppTimeAns, time correction in seconds and the token
+			if (pos + 5 > len)
+			{
+				return;
+			}
+			int32_t correction = (int32_t)(buffer[pos] | (buffer[pos + 1] << 8) | (buffer[pos + 2] << 16) | ((uint32_t)buffer[pos + 3] << 24));
+			uint8_t token = buffer[pos + 4] & 0x0F;
+			pos += 5;
+			if (token != timeToken)
+			{
+				break;
+			}
+			uint32_t now = millis();
+			int64_t epochMs = (int64_t)timeFromMillis(now) + (int64_t)correction * 1000;
+			timeSet(epochMs, now, TIME_SRC_NETWORK);
+			Serial.printf("Network time correction %ld s\n", correction);
+			break;
+		}
+
+		default:
+			// Unknown command, the rest of the payload can not be parsed
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Get the queued requests and answers
+ *
+ * @param buffer Buffer, must be at least TIME_ANSWER_LEN bytes
+ * @return uint8_t Length
+ */
+uint8_t timeGetAnswer(uint8_t *buffer)
+{
+	taskENTER_CRITICAL();
+	uint8_t len = timeAnswerLen;
+	memcpy(buffer, timeAnswer, len);
+	timeAnswerLen = 0;
+	timePending = false;
+	taskEXIT_CRITICAL();
+	return len;
+}
+
+/**
+ * @brief Compact timestamp of a fix
+ * @note Bit 15 set: bits 0..14 are the Unix time of the fix in 2 s,
+ * modulo 32768 (18 hour window, the backend adds the upper bits from the
+ * receive time).
+ * Bit 15 clear: clock not synced, bits 0..14 are the age of the fix at
+ * the time of the uplink in seconds.
+ *
+ * @param fixMillis millis() of the fix
+ * @return uint16_t Timestamp
+ */
+uint16_t timeEncodeFix(uint32_t fixMillis)
+{
+	if (timeStats.source != TIME_SRC_NONE)
+	{
+		return 0x8000 | ((timeFromMillis(fixMillis) / 2000) & 0x7FFF);
+	}
+	uint32_t age = (millis() - fixMillis) / 1000;
+	return age > 0x7FFF ? 0x7FFF : age;
+}
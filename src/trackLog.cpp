@@ -0,0 +1,90 @@
+/**
+ * @file trackLog.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Track history of the last positions
+ * @version 0.1
+ * @date 2020-08-14
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The track log is a ring buffer in RAM. Each entry has a running
+ * index that keeps counting when old entries are overwritten, so a
+ * reader can resume a download with the index of the last entry it got.
+ */
+#include "main.h"
+
+/** Ring buffer with the track entries */
+static track_entry_s trackLog[TRACK_LOG_SIZE];
+
+/** Number of entries ever written, index of the next entry */
+static volatile uint32_t trackLogCount = 0;
+
+/**
+ * @brief Add a position to the track log
+ *
+ * @param position Position
+ * @param altitude Altitude in m
+ * @param speed Speed in m/s
+ * @param hdop HDOP
+ */
+void trackLogAdd(const geo_coord_s &position, int16_t altitude, uint8_t speed, uint8_t hdop)
+{
+	// Unix time if the clock is synced, otherwise the uptime
+	uint32_t now = timeNow();
+	if (now == 0)
+	{
+		now = millis() / 1000;
+	}
+	taskENTER_CRITICAL();
+	track_entry_s *entry = &trackLog[trackLogCount % TRACK_LOG_SIZE];
+	entry->time = now;
+	entry->lat = position.lat;
+	entry->lng = position.lng;
+	entry->alt = altitude;
+	entry->speed = speed;
+	entry->hdop = hdop;
+	trackLogCount++;
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Index of the oldest entry still in the log
+ *
+ * @return uint32_t Index of the oldest entry
+ */
+uint32_t trackLogFirst(void)
+{
+	return trackLogCount > TRACK_LOG_SIZE ? trackLogCount - TRACK_LOG_SIZE : 0;
+}
+
+/**
+ * @brief Index of the next entry that will be written
+ *
+ * @return uint32_t Index after the newest entry
+ */
+uint32_t trackLogEnd(void)
+{
+	return trackLogCount;
+}
+
+/**
+ * @brief Get an entry from the track log
+ *
+ * @param index Running index of the entry
+ * @param entry Returns the entry
+ * @return true if the entry is still in the log
+ * @return false if the entry was overwritten or does not exist yet
+ */
+bool trackLogGet(uint32_t index, track_entry_s *entry)
+{
+	bool result = false;
+	// The main loop might write the same slot at the same time
+	taskENTER_CRITICAL();
+	if ((index >= trackLogFirst()) && (index < trackLogCount))
+	{
+		*entry = trackLog[index % TRACK_LOG_SIZE];
+		result = true;
+	}
+	taskEXIT_CRITICAL();
+	return result;
+}
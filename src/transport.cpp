@@ -0,0 +1,103 @@
+/**
+ * @file transport.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Uplink transport selection
+ * @version 0.1
+ * @date 2020-08-17
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note A frame can be sent over LoRaWan or over BLE to the companion
+ * app, which relays it to the backend. The transport that is up and
+ * has the lowest energy cost is used first. If sending fails, the next
+ * transport is tried. Every frame carries a sequence number, so the
+ * backend can drop frames that arrive over both paths.
+ */
+#include "main.h"
+
+/** Available transports, the order is only used if the costs are equal */
+static transport_s *transports[] = {&bleRelayTransport, &loraTransport};
+
+/** Number of transports */
+#define NUM_TRANSPORTS (sizeof(transports) / sizeof(transports[0]))
+
+/** Sequence number of the next uplink */
+static uint16_t uplinkSeq = 0;
+
+/** Transport used for the last uplink */
+transport_s *lastTransport = NULL;
+
+/**
+ * @brief Check if any transport is available
+ *
+ * @return true if at least one transport is up
+ */
+bool transportAnyUp(void)
+{
+	for (uint8_t idx = 0; idx < NUM_TRANSPORTS; idx++)
+	{
+		if (transports[idx]->isUp())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Get the next uplink sequence number
+ *
+ * @return uint16_t Sequence number
+ */
+uint16_t transportNextSeq(void)
+{
+	return uplinkSeq++;
+}
+
+/**
+ * @brief Send a frame over the cheapest available transport
+ * @note If the send fails, the other transports are tried
+ * in order of their energy cost
+ *
+ * @param port FPort of the frame
+ * @param buffer Frame data
+ * @param len Length of the frame
+ * @return int8_t 0 on success, error code of the last tried transport otherwise
+ */
+int8_t transportSend(uint8_t port, uint8_t *buffer, uint8_t len)
+{
+	int8_t result = -1;
+	bool tried[NUM_TRANSPORTS] = {false};
+	lastTransport = NULL;
+
+	for (uint8_t attempt = 0; attempt < NUM_TRANSPORTS; attempt++)
+	{
+		// Find the cheapest transport that is up and not tried yet
+		int8_t best = -1;
+		for (uint8_t idx = 0; idx < NUM_TRANSPORTS; idx++)
+		{
+			if (tried[idx] || !transports[idx]->isUp())
+			{
+				continue;
+			}
+			if ((best < 0) || (transports[idx]->energyCost < transports[best]->energyCost))
+			{
+				best = idx;
+			}
+		}
+		if (best < 0)
+		{
+			break;
+		}
+
+		tried[best] = true;
+		result = transports[best]->send(port, buffer, len);
+		Serial.printf("Send over %s result %d\n", transports[best]->name, result);
+		if (result == 0)
+		{
+			lastTransport = transports[best];
+			return 0;
+		}
+	}
+	return result;
+}
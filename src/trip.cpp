@@ -0,0 +1,290 @@
+/**
+ * @file trip.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Trip segmentation with trip summaries
+ * @version 0.1
+ * @date 2020-09-07
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note A trip starts after TRIP_START_FIXES consecutive fixes with
+ * at least TRIP_MOVING_SPEED. It ends when the tracker stood still for
+ * TRIP_END_IDLE, either from the GPS speed or, without fixes, from the
+ * accelerometer. Shorter stops are counted as idle time of the trip.
+ * Distance, speeds and idle time are accumulated with each fix, the
+ * memory does not grow with the length of the trip. The path is kept as
+ * up to TRIP_PATH_POINTS points with a min spacing. When the path is
+ * full, every second point is dropped and the spacing is doubled.
+ * With -DTRIP_MODE=1 only the trip summaries are sent, the periodic
+ * position uplinks are suppressed.
+ */
+#include "main.h"
+
+/** Current trip */
+static trip_s trip;
+
+/** Consecutive moving fixes while no trip is active */
+static uint8_t tripMovingFixes = 0;
+/** Position and time of the first moving fix */
+static geo_coord_s tripCandidate;
+static uint32_t tripCandidateMillis = 0;
+/** Position and time of the last fix */
+static geo_coord_s tripLastFix;
+static uint32_t tripLastFixMillis = 0;
+
+/** Summary of the last finished trip */
+static uint8_t tripFrame[TRIP_FRAME_LEN];
+static uint8_t tripFrameLen = 0;
+
+/** Trip statistics */
+trip_stats_s tripStats;
+
+/**
+ * @brief Add a point to the simplified path
+ * @note Points closer than the current spacing to the last point are skipped
+ *
+ * @param position Position
+ */
+static void tripPathAdd(const geo_coord_s &position)
+{
+	if ((trip.pathLen != 0) && (geoDistance(trip.path[trip.pathLen - 1], position) < trip.pathSpacing))
+	{
+		return;
+	}
+	if (trip.pathLen == TRIP_PATH_POINTS)
+	{
+		// Keep every second point and double the spacing
+		uint8_t kept = 0;
+		for (uint8_t idx = 0; idx < TRIP_PATH_POINTS; idx += 2)
+		{
+			trip.path[kept++] = trip.path[idx];
+		}
+		trip.pathLen = kept;
+		trip.pathSpacing *= 2;
+		if (geoDistance(trip.path[trip.pathLen - 1], position) < trip.pathSpacing)
+		{
+			return;
+		}
+	}
+	trip.path[trip.pathLen++] = position;
+}
+
+/**
+ * @brief Start a new trip at the first moving fix
+ */
+static void tripStart(void)
+{
+	memset(&trip, 0, sizeof(trip));
+	trip.active = true;
+	trip.start = tripCandidate;
+	trip.startMillis = tripCandidateMillis;
+	trip.end = tripCandidate;
+	trip.endMillis = tripCandidateMillis;
+	trip.pathSpacing = TRIP_PATH_SPACING;
+	tripPathAdd(tripCandidate);
+	Serial.println("Trip started");
+}
+
+/**
+ * @brief Update the trip with a new fix
+ * @note Called for each valid fix
+ *
+ * @param position Position of the fix
+ * @param speed Speed in cm/s
+ * @param fixMillis millis() of the fix
+ */
+void tripUpdate(const geo_coord_s &position, uint16_t speed, uint32_t fixMillis)
+{
+	bool moving = speed >= TRIP_MOVING_SPEED;
+
+	if (!trip.active)
+	{
+		if (!moving)
+		{
+			tripMovingFixes = 0;
+		}
+		else
+		{
+			if (tripMovingFixes == 0)
+			{
+				tripCandidate = position;
+				tripCandidateMillis = fixMillis;
+			}
+			tripMovingFixes++;
+			if (tripMovingFixes >= TRIP_START_FIXES)
+			{
+				tripStart();
+				tripLastFix = tripCandidate;
+			}
+		}
+	}
+
+	if (trip.active)
+	{
+		uint32_t step = geoDistance(tripLastFix, position);
+		// GPS jitter while standing adds up, only count real movement
+		if (moving || (step >= TRIP_MIN_STEP))
+		{
+			trip.distance += step;
+			tripLastFix = position;
+		}
+		if (speed > trip.maxSpeed)
+		{
+			trip.maxSpeed = speed;
+		}
+		if (moving)
+		{
+			if (trip.stopMillis != 0)
+			{
+				trip.idleMs += fixMillis - trip.stopMillis;
+				trip.stopMillis = 0;
+			}
+			trip.end = position;
+			trip.endMillis = fixMillis;
+			tripPathAdd(position);
+		}
+		else if (trip.stopMillis == 0)
+		{
+			trip.stopMillis = fixMillis;
+		}
+	}
+	else
+	{
+		tripLastFix = position;
+	}
+	tripLastFixMillis = fixMillis;
+}
+
+/**
+ * @brief Create the summary frame of the current trip
+ * @note Layout (little endian)
+ * 		0..3 start latitude in 1/100000 degree
+ * 		4..7 start longitude in 1/100000 degree
+ * 		8..11 end latitude in 1/100000 degree
+ * 		12..15 end longitude in 1/100000 degree
+ * 		16..19 start time, Unix time in s, 0 if the clock is not synced
+ * 		20..21 duration in 10 s
+ * 		22..23 distance in 10 m
+ * 		24 max speed in km/h
+ * 		25 average speed in km/h
+ * 		26..27 idle time in 10 s
+ * 		28 number of path points n
+ * 		29.. n times latitude and longitude (int16) in 1/10000 degree,
+ * 		relative to the previous point, the first one to the start
+ */
+static void tripEncode(void)
+{
+	uint8_t *buffer = tripFrame;
+	int32_t value;
+	value = trip.start.lat / (GEO_SCALE / GEO_PAYLOAD_SCALE);
+	memcpy(&buffer[0], &value, 4);
+	value = trip.start.lng / (GEO_SCALE / GEO_PAYLOAD_SCALE);
+	memcpy(&buffer[4], &value, 4);
+	value = trip.end.lat / (GEO_SCALE / GEO_PAYLOAD_SCALE);
+	memcpy(&buffer[8], &value, 4);
+	value = trip.end.lng / (GEO_SCALE / GEO_PAYLOAD_SCALE);
+	memcpy(&buffer[12], &value, 4);
+	uint32_t startTime = timeFromMillis(trip.startMillis) / 1000;
+	memcpy(&buffer[16], &startTime, 4);
+
+	uint32_t duration = (trip.endMillis - trip.startMillis) / 1000;
+	uint32_t duration10 = duration / 10 > 0xFFFF ? 0xFFFF : duration / 10;
+	buffer[20] = duration10;
+	buffer[21] = duration10 >> 8;
+	uint32_t distance10 = trip.distance / 10 > 0xFFFF ? 0xFFFF : trip.distance / 10;
+	buffer[22] = distance10;
+	buffer[23] = distance10 >> 8;
+	// cm/s to km/h = * 36 / 1000
+	uint32_t maxKmh = (trip.maxSpeed * 36) / 1000;
+	buffer[24] = maxKmh > 0xFF ? 0xFF : maxKmh;
+	uint32_t avgKmh = duration == 0 ? 0 : (trip.distance * 36) / (duration * 10);
+	buffer[25] = avgKmh > 0xFF ? 0xFF : avgKmh;
+	uint32_t idle10 = trip.idleMs / 10000 > 0xFFFF ? 0xFFFF : trip.idleMs / 10000;
+	buffer[26] = idle10;
+	buffer[27] = idle10 >> 8;
+
+	uint8_t len = 29;
+	uint8_t points = 0;
+	geo_coord_s previous = trip.start;
+	// The first path point is the start
+	for (uint8_t idx = 1; idx < trip.pathLen; idx++)
+	{
+		int32_t dLat = (trip.path[idx].lat - previous.lat) / (GEO_SCALE / 10000);
+		int32_t dLng = (trip.path[idx].lng - previous.lng) / (GEO_SCALE / 10000);
+		dLat = constrain(dLat, -32768, 32767);
+		dLng = constrain(dLng, -32768, 32767);
+		buffer[len++] = dLat;
+		buffer[len++] = dLat >> 8;
+		buffer[len++] = dLng;
+		buffer[len++] = dLng >> 8;
+		// Continue from the rounded point, the errors do not add up
+		previous.lat += dLat * (GEO_SCALE / 10000);
+		previous.lng += dLng * (GEO_SCALE / 10000);
+		points++;
+	}
+	buffer[28] = points;
+	tripFrameLen = len;
+}
+
+/**
+ * @brief Check if the current trip ended
+ * @note Called on each report cycle. Without fixes (parked tracker,
+ * no GPS reception) the stop is taken from the accelerometer.
+ *
+ * @return true if a trip ended and the summary is ready
+ */
+bool tripCheck(void)
+{
+	if (!trip.active)
+	{
+		return false;
+	}
+	uint32_t stopSince = trip.stopMillis;
+	if (stopSince == 0)
+	{
+		if (accIsMoving())
+		{
+			return false;
+		}
+		// Moving at the last fix, no fix since then and no motion
+		stopSince = tripLastFixMillis;
+	}
+	if ((millis() - stopSince) < TRIP_END_IDLE)
+	{
+		return false;
+	}
+
+	trip.active = false;
+	tripMovingFixes = 0;
+	tripEncode();
+	if (tripStats.trips != 0xFFFF)
+	{
+		tripStats.trips++;
+	}
+	tripStats.distance += trip.distance;
+	Serial.printf("Trip ended, %ld m in %ld s, idle %ld s\n", trip.distance,
+				  (trip.endMillis - trip.startMillis) / 1000, trip.idleMs / 1000);
+	return true;
+}
+
+/**
+ * @brief Get the summary of the last finished trip
+ *
+ * @param buffer Buffer, must be at least TRIP_FRAME_LEN bytes
+ * @return uint8_t Length of the summary
+ */
+uint8_t tripGetFrame(uint8_t *buffer)
+{
+	memcpy(buffer, tripFrame, tripFrameLen);
+	return tripFrameLen;
+}
+
+/**
+ * @brief Check if a trip is running
+ *
+ * @return true if a trip is active
+ */
+bool tripActive(void)
+{
+	return trip.active;
+}
@@ -0,0 +1,172 @@
+/**
+ * @file benchBattery.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Full discharge of the battery with and without the power policy
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The activity of each policy level is measured with random one
+ * hour traces through the replay: sleep residency, time on air, receive
+ * windows and the device class. A current model turns it into the mean
+ * current of the level. The discharge is integrated in steps of one
+ * hour, the policy level follows the battery level with the thresholds
+ * of policy.cpp. Without the policy the tracker stays at the full power
+ * level until the battery is empty. The currents are datasheet values
+ * of the nRF52840, SX1262 and the GPS module. The firmware keeps the GPS
+ * module powered, its current is the same for all levels.
+ */
+#include "replay.h"
+#include <LoRaWan-RAK4630.h>
+
+/** Firmware time of a trace in ms */
+#define BENCH_DURATION 3600000
+/** Traces per policy level */
+#define BENCH_TRACES 8
+
+/** Battery capacity in mAh */
+#define BATT_CAPACITY_MAH 2000.0
+/** Sleep current of MCU, radio and accelerometer in mA */
+#define SLEEP_MA 0.03
+/** MCU running in mA */
+#define RUN_MA 3.3
+/** Radio TX at 14 dBm in mA */
+#define TX_MA 45.0
+/** Radio RX in mA */
+#define RX_MA 5.3
+/** Length of a class A receive window in ms */
+#define RX_WINDOW_MS 30.0
+/** GPS module tracking in mA */
+#define GPS_MA 20.0
+
+/** Battery voltages inside the policy levels */
+static const uint16_t levelMv[POLICY_NUM_LEVELS] = {4100, 3800, 3700, 3550};
+static const char *levelNames[POLICY_NUM_LEVELS] = {"full", "medium", "low", "critical"};
+/** Min battery level in % of the policy levels, see policyLevels in policy.cpp */
+static const uint8_t levelMin[POLICY_NUM_LEVELS] = {50, 30, 15, 0};
+
+/** Mean currents of a level in mA */
+struct level_current_s
+{
+	double mcu;
+	double tx;
+	double rx;
+	double total;
+	uint8_t devClass;
+	double uplinksPerHour;
+};
+
+/**
+ * @brief Mean current of a policy level
+ */
+static level_current_s measure(uint8_t level, bool *ok)
+{
+	level_current_s current;
+	memset(&current, 0, sizeof(current));
+	double durationMs = (double)BENCH_DURATION * BENCH_TRACES;
+	double residency = 0.0;
+	double airtimeMs = 0.0;
+	double rxWindows = 0.0;
+	for (uint64_t seed = 1; seed <= BENCH_TRACES; seed++)
+	{
+		replay_trace_s trace = replayRandomTrace(seed, BENCH_DURATION);
+		trace.battMv = levelMv[level];
+		replay_result_s result = replayRun(trace);
+		*ok = *ok && result.ok && (result.policyLevel == level);
+		residency += result.residency / 1000.0 / BENCH_TRACES;
+		airtimeMs += result.airtimeUs / 1000.0;
+		rxWindows += result.rxWindows;
+		current.uplinksPerHour += (double)result.uplinks / BENCH_TRACES;
+		current.devClass = result.devClass;
+	}
+	current.mcu = residency * SLEEP_MA + (1.0 - residency) * RUN_MA;
+	current.tx = airtimeMs / durationMs * TX_MA;
+	switch (current.devClass)
+	{
+	case CLASS_C:
+		// Receives on RX2 whenever it does not transmit
+		current.rx = (1.0 - airtimeMs / durationMs) * RX_MA;
+		break;
+	case CLASS_B:
+		// Ping slots and beacons on top of the class A windows
+		current.rx = ((double)CLASSB_PING_WINDOW / (1000 << CLASSB_PING_PERIODICITY) +
+					  (double)CLASSB_BEACON_WINDOW / CLASSB_BEACON_PERIOD) *
+						 RX_MA +
+					 rxWindows * RX_WINDOW_MS / durationMs * RX_MA;
+		break;
+	default:
+		current.rx = rxWindows * RX_WINDOW_MS / durationMs * RX_MA;
+		break;
+	}
+	current.total = current.mcu + current.tx + current.rx + GPS_MA;
+	return current;
+}
+
+/**
+ * @brief Discharge the battery in steps of one hour
+ *
+ * @param currents Mean current per level
+ * @param policy true to follow the battery level, false to stay at full power
+ * @param hours Hours per level, updated
+ * @return double Battery life in days
+ */
+static double discharge(const level_current_s *currents, bool policy, double *hours)
+{
+	double charge = BATT_CAPACITY_MAH;
+	double elapsed = 0.0;
+	while (charge > 0.0)
+	{
+		double percent = charge * 100.0 / BATT_CAPACITY_MAH;
+		uint8_t level = POLICY_CRITICAL;
+		for (uint8_t idx = 0; policy && (idx < POLICY_NUM_LEVELS); idx++)
+		{
+			if (percent >= levelMin[idx])
+			{
+				level = idx;
+				break;
+			}
+		}
+		if (!policy)
+		{
+			level = POLICY_FULL;
+		}
+		double step = charge >= currents[level].total ? 1.0 : charge / currents[level].total;
+		charge -= currents[level].total * step;
+		hours[level] += step;
+		elapsed += step;
+	}
+	return elapsed / 24.0;
+}
+
+int main(void)
+{
+	const char *classNames[] = {"A", "B", "C"};
+	level_current_s currents[POLICY_NUM_LEVELS];
+	bool ok = true;
+	printf("%-8s %5s %9s %8s %8s %8s %8s %9s\n", "level", "class", "uplinks/h", "MCU mA", "TX mA", "RX mA", "GPS mA",
+		   "total mA");
+	for (uint8_t level = 0; level < POLICY_NUM_LEVELS; level++)
+	{
+		currents[level] = measure(level, &ok);
+		const level_current_s &current = currents[level];
+		printf("%-8s %5s %9.1f %8.3f %8.3f %8.3f %8.3f %9.3f\n", levelNames[level],
+			   classNames[current.devClass < 3 ? current.devClass : 0], current.uplinksPerHour, current.mcu,
+			   current.tx, current.rx, GPS_MA, current.total);
+	}
+
+	double hoursPolicy[POLICY_NUM_LEVELS] = {0};
+	double hoursFull[POLICY_NUM_LEVELS] = {0};
+	double daysPolicy = discharge(currents, true, hoursPolicy);
+	double daysFull = discharge(currents, false, hoursFull);
+	printf("%.0f mAh, without the policy %.2f days, with the policy %.2f days, gained %.2f days (%.1f %%)\n",
+		   BATT_CAPACITY_MAH, daysFull, daysPolicy, daysPolicy - daysFull,
+		   daysFull > 0.0 ? (daysPolicy - daysFull) * 100.0 / daysFull : 0.0);
+	printf("hours per level with the policy:");
+	for (uint8_t level = 0; level < POLICY_NUM_LEVELS; level++)
+	{
+		printf(" %s %.1f", levelNames[level], hoursPolicy[level]);
+	}
+	printf("\n");
+	return !ok || (daysPolicy < daysFull);
+}
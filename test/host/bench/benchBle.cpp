@@ -0,0 +1,175 @@
+/**
+ * @file benchBle.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Throughput of the LNS notifications against the BLE UART text lines
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The text path sends the four lines the old sendLoRaFrame() printed
+ * to the BLE UART for every fix. BLEUart::write() of the Bluefruit library
+ * splits each print into notifications of MTU - 3 bytes on its TX
+ * characteristic, the bench does the same on a stand-in characteristic.
+ * Both paths go through the TX queue and the connection events of the
+ * SoftDevice model with the connection settings of initBLE(). Fixes/s is
+ * the sustained rate on the virtual clock with a full TX queue, the host
+ * time covers formatting and encoding only.
+ */
+#include "sim.h"
+#include "main.h"
+#include <chrono>
+
+/** Fixes per run */
+#define BENCH_FIXES 2000
+
+extern BLECharacteristic lnsLocationChar;
+
+/** TX characteristic of the BLE UART */
+static BLECharacteristic uartTxd = BLECharacteristic("6E400003-B5A3-F393-E0A9-E50E24DCCA9E");
+
+/** Result of one path */
+struct path_result_s
+{
+	double bytesPerFix;
+	double notifyPerFix;
+	double fixesPerSec;
+	double hostNs;
+};
+
+/**
+ * @brief Print like BLEUart::write(), notifications of at most MTU - 3 bytes
+ */
+static void uartPrint(const char *text)
+{
+	uint16_t max = Bluefruit.Connection(0)->getMtu() - 3;
+	uint16_t len = strlen(text);
+	while (len != 0)
+	{
+		uint16_t send = len < max ? len : max;
+		uartTxd.notify(text, send);
+		text += send;
+		len -= send;
+	}
+}
+
+/**
+ * @brief Position of fix number idx, a slow drive to the north east
+ */
+static geo_coord_s fixPosition(uint32_t idx)
+{
+	geo_coord_s position = {356895000 + (int32_t)idx * 137, 1396917000 + (int32_t)idx * 211};
+	return position;
+}
+
+/**
+ * @brief Old text lines of a fix, see sendLoRaFrame() before the LNS service
+ */
+static void textFix(uint32_t idx, bool send)
+{
+	char line[64];
+	geo_coord_s position = fixPosition(idx);
+	snprintf(line, sizeof(line), "UP Lat %.6f\n", position.lat / 10000000.0);
+	if (send)
+	{
+		uartPrint(line);
+	}
+	snprintf(line, sizeof(line), "UP Lon %.6f\n", position.lng / 10000000.0);
+	if (send)
+	{
+		uartPrint(line);
+	}
+	snprintf(line, sizeof(line), "UP Alt %d Pr %d\n", 40 + (int)(idx % 7), 90);
+	if (send)
+	{
+		uartPrint(line);
+	}
+	snprintf(line, sizeof(line), "UP B %u%%\n", 87);
+	if (send)
+	{
+		uartPrint(line);
+	}
+}
+
+/**
+ * @brief LNS notification of a fix
+ */
+static void lnsFix(uint32_t idx, bool send)
+{
+	if (send)
+	{
+		lnsUpdate(fixPosition(idx), 4000 + (int32_t)(idx % 7) * 100, 1389);
+		return;
+	}
+	uint8_t buffer[LNS_LOCATION_LEN];
+	volatile uint8_t len = lnsEncode(buffer, fixPosition(idx), 4000 + (int32_t)(idx % 7) * 100, 1389);
+	(void)len;
+}
+
+/**
+ * @brief Send BENCH_FIXES fixes over one path
+ *
+ * @param fix Path, sends the fix if the flag is set, else only formats it
+ * @param chr Characteristic the path notifies on
+ */
+static path_result_s runPath(void (*fix)(uint32_t, bool), BLECharacteristic &chr)
+{
+	path_result_s result;
+	auto hostStart = std::chrono::steady_clock::now();
+	for (uint32_t idx = 0; idx < BENCH_FIXES; idx++)
+	{
+		fix(idx, false);
+	}
+	result.hostNs =
+		std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - hostStart).count() / BENCH_FIXES;
+
+	uint32_t count = chr.notifyCount;
+	uint32_t bytes = chr.notifyBytes;
+	uint64_t start = simNowUs();
+	for (uint32_t idx = 0; idx < BENCH_FIXES; idx++)
+	{
+		fix(idx, true);
+	}
+	double seconds = (simNowUs() - start) / 1000000.0;
+	result.bytesPerFix = (double)(chr.notifyBytes - bytes) / BENCH_FIXES;
+	result.notifyPerFix = (double)(chr.notifyCount - count) / BENCH_FIXES;
+	result.fixesPerSec = seconds > 0.0 ? BENCH_FIXES / seconds : 0.0;
+	// Empty the TX queue before the next run
+	simRun(1000);
+	return result;
+}
+
+int main(void)
+{
+	simSeed(1);
+	// Connection settings of initBLE()
+	Bluefruit.configPrphConn(BLE_MAX_MTU, 6, 16, 16);
+	Bluefruit.Periph.setConnInterval(BLE_CONN_INTERVAL_MIN, BLE_CONN_INTERVAL_MAX);
+	initBLELns();
+	uartTxd.begin();
+	lnsSetInterval(0);
+
+	bool ok = true;
+	const uint16_t mtus[] = {23, BLE_MAX_MTU};
+	printf("%-6s %4s %10s %10s %9s %8s\n", "path", "MTU", "bytes/fix", "notif/fix", "fixes/s", "host ns");
+	for (uint16_t mtu : mtus)
+	{
+		simBleConnect(mtu);
+		simRun(100);
+		Bluefruit.Connection(0)->requestMtuExchange(mtu);
+		path_result_s text = runPath(textFix, uartTxd);
+		path_result_s lns = runPath(lnsFix, lnsLocationChar);
+		printf("%-6s %4u %10.1f %10.2f %9.1f %8.1f\n", "text", mtu, text.bytesPerFix, text.notifyPerFix,
+			   text.fixesPerSec, text.hostNs);
+		printf("%-6s %4u %10.1f %10.2f %9.1f %8.1f\n", "LNS", mtu, lns.bytesPerFix, lns.notifyPerFix, lns.fixesPerSec,
+			   lns.hostNs);
+		printf("MTU %u: LNS sends %.1fx the fixes/s with %.1f %% of the bytes\n", mtu,
+			   text.fixesPerSec > 0.0 ? lns.fixesPerSec / text.fixesPerSec : 0.0,
+			   text.bytesPerFix > 0.0 ? lns.bytesPerFix * 100.0 / text.bytesPerFix : 0.0);
+		// One notification per fix, always more fixes/s than the text lines
+		ok = ok && (lns.notifyPerFix == 1.0) && (lns.fixesPerSec > text.fixesPerSec);
+		simBleDisconnect();
+		simRun(100);
+	}
+	return !ok;
+}
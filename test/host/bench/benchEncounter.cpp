@@ -0,0 +1,201 @@
+/**
+ * @file benchEncounter.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Insert and lookup cost of the encounter table at capacity and bytes per encounter
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The advertising reports go straight to the scan callback of the
+ * firmware, like the BLE task calls it, without the scanner model. The
+ * table is full before the timing starts: lookups are reports of
+ * addresses in the table, inserts are new addresses that evict an entry.
+ * The reference is a flat table of the same size that is searched from
+ * the start for every report, with the same eviction. The host times only
+ * show the direction.
+ */
+#include "sim.h"
+#include "main.h"
+#include <chrono>
+#include <vector>
+
+/** Reports per run */
+#define BENCH_REPORTS 1000000
+/** Entries of the table */
+#define BENCH_CAPACITY (ENC_BUCKETS * ENC_WAYS)
+
+/** Reference table without buckets */
+static enc_entry_s flatTable[BENCH_CAPACITY];
+
+/**
+ * @brief Insert into the reference table, linear search
+ */
+static void flatInsert(const uint8_t *addr, int8_t rssi, uint32_t now)
+{
+	enc_entry_s *victim = NULL;
+	for (uint16_t idx = 0; idx < BENCH_CAPACITY; idx++)
+	{
+		enc_entry_s *entry = &flatTable[idx];
+		if (entry->used && (memcmp(entry->addr, addr, 6) == 0))
+		{
+			entry->lastSeen = now;
+			if (rssi > entry->maxRssi)
+			{
+				entry->maxRssi = rssi;
+			}
+			return;
+		}
+		if ((victim == NULL) || (victim->used && (!entry->used || (entry->lastSeen < victim->lastSeen))))
+		{
+			victim = entry;
+		}
+	}
+	memcpy(victim->addr, addr, 6);
+	victim->firstSeen = now;
+	victim->lastSeen = now;
+	victim->maxRssi = rssi;
+	victim->used = true;
+}
+
+/**
+ * @brief Bucket of an address, FNV-1a like the table uses
+ */
+static uint8_t bucketOf(const uint8_t *addr)
+{
+	uint32_t hash = 2166136261UL;
+	for (uint8_t idx = 0; idx < 6; idx++)
+	{
+		hash ^= addr[idx];
+		hash *= 16777619UL;
+	}
+	return hash % ENC_BUCKETS;
+}
+
+/** Address of a report */
+struct bench_addr_s
+{
+	uint8_t addr[6];
+};
+
+/**
+ * @brief Random address
+ */
+static bench_addr_s randomAddr(void)
+{
+	bench_addr_s addr;
+	for (uint8_t idx = 0; idx < 6; idx++)
+	{
+		addr.addr[idx] = simRandomRange(256);
+	}
+	return addr;
+}
+
+/**
+ * @brief Host time in ns per report of the scan callback
+ */
+static double timeFirmware(const std::vector<bench_addr_s> &reports)
+{
+	ble_gap_evt_adv_report_t report;
+	memset(&report, 0, sizeof(report));
+	report.rssi = -60;
+	auto start = std::chrono::steady_clock::now();
+	for (const bench_addr_s &addr : reports)
+	{
+		memcpy(report.peer_addr.addr, addr.addr, 6);
+		Bluefruit.Scanner.rxCb(&report);
+	}
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / reports.size();
+}
+
+/**
+ * @brief Host time in ns per report of the reference table
+ */
+static double timeFlat(const std::vector<bench_addr_s> &reports)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (const bench_addr_s &addr : reports)
+	{
+		flatInsert(addr.addr, -60, millis() / 1000);
+	}
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / reports.size();
+}
+
+int main(void)
+{
+	simSeed(1);
+	initEncounter();
+
+	// ENC_WAYS addresses for each bucket fill the table
+	std::vector<bench_addr_s> resident;
+	uint8_t ways[ENC_BUCKETS] = {0};
+	while (resident.size() < BENCH_CAPACITY)
+	{
+		bench_addr_s addr = randomAddr();
+		uint8_t bucket = bucketOf(addr.addr);
+		if (ways[bucket] < ENC_WAYS)
+		{
+			ways[bucket]++;
+			resident.push_back(addr);
+		}
+	}
+	std::vector<bench_addr_s> hits(BENCH_REPORTS);
+	std::vector<bench_addr_s> misses(BENCH_REPORTS);
+	for (uint32_t idx = 0; idx < BENCH_REPORTS; idx++)
+	{
+		hits[idx] = resident[simRandomRange(BENCH_CAPACITY)];
+		misses[idx] = randomAddr();
+	}
+
+	bool ok = true;
+	timeFirmware(resident);
+	timeFlat(resident);
+	ok = ok && (encStats.inserts == BENCH_CAPACITY) && (encStats.evicted == 0);
+
+	enc_stats_s before = encStats;
+	double hitNs = timeFirmware(hits);
+	double flatHitNs = timeFlat(hits);
+	ok = ok && (encStats.updates - before.updates == BENCH_REPORTS) && (encStats.inserts == before.inserts);
+
+	before = encStats;
+	double missNs = timeFirmware(misses);
+	double flatMissNs = timeFlat(misses);
+	// The table stays full, every new address evicts an entry
+	uint32_t missInserts = encStats.inserts - before.inserts;
+	ok = ok && (encStats.evicted - before.evicted == missInserts) && (missInserts + encStats.updates - before.updates ==
+																	  BENCH_REPORTS);
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t idx = 0; idx < BENCH_REPORTS / 100; idx++)
+	{
+		encCheck();
+	}
+	double checkNs =
+		std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (BENCH_REPORTS / 100);
+
+	// Close all encounters and send them in batches
+	simRun(ENC_CLOSE_TIME + 1000);
+	uint8_t frame[ENC_FRAME_LEN];
+	uint32_t frames = 0;
+	uint32_t bytes = 0;
+	uint32_t sentBefore = encStats.sent;
+	uint8_t len;
+	while ((len = encGetFrame(frame)) != 0)
+	{
+		frames++;
+		bytes += len;
+		encMarkSent();
+	}
+	uint32_t encounters = encStats.sent - sentBefore;
+	ok = ok && (encounters == BENCH_CAPACITY);
+
+	printf("%-28s %10s %10s\n", "operation", "host ns", "flat ns");
+	printf("%-28s %10.1f %10.1f\n", "lookup, address in table", hitNs, flatHitNs);
+	printf("%-28s %10.1f %10.1f\n", "insert at capacity, evict", missNs, flatMissNs);
+	printf("%-28s %10.1f %10s\n", "encCheck() full table", checkNs, "-");
+	printf("table %u entries in %u x %u buckets, %u bytes of RAM\n", BENCH_CAPACITY, ENC_BUCKETS, ENC_WAYS,
+		   (uint32_t)sizeof(enc_entry_s) * BENCH_CAPACITY);
+	printf("%u encounters in %u frames, %u bytes, %.1f bytes per encounter, entry in RAM %u bytes\n", encounters,
+		   frames, bytes, encounters != 0 ? (double)bytes / encounters : 0.0, (uint32_t)sizeof(enc_entry_s));
+	return !ok;
+}
@@ -0,0 +1,136 @@
+/**
+ * @file benchFrag.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Throughput and RAM of the fragmented data block decoder vs block size and loss rate
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The decoder time per fragment is on the virtual clock and
+ * includes the flash writes and erases of the file system model. Host CPU
+ * is the time of the parity matrix and XOR work on the PC, use it only
+ * to compare the rows.
+ */
+#include "sim.h"
+#include "fragEnc.h"
+#include "main.h"
+#include <chrono>
+
+/** Fragment size of the benchmark, fits into DR3 of AS923 */
+#define BENCH_FRAG_SIZE 48
+
+void fragBlockReceived(uint32_t descriptor, const char *fileName, uint32_t size)
+{
+	(void)descriptor;
+	(void)fileName;
+	(void)size;
+}
+
+/**
+ * @brief RAM of the decoder, the static buffers of fragRx.cpp, the queue and the task stack
+ * @note The block itself is in the flash, the RAM does not depend on the block size
+ */
+static uint32_t decoderRam(void)
+{
+	uint32_t ram = FRAG_MAX_MISSING * sizeof(uint16_t);
+	ram += FRAG_MAX_MISSING * FRAG_MAX_MISSING / 8 + FRAG_MAX_MISSING / 8;
+	ram += FRAG_MAX_NB / 8;
+	ram += 2 * FRAG_MAX_SIZE + FRAG_ANSWER_LEN + sizeof(frag_session_s);
+	// Queue items, command, index and data
+	ram += 4 * (4 + FRAG_MAX_SIZE);
+	// Task stack in words
+	ram += 512 * 4;
+	return ram;
+}
+
+/**
+ * @brief Pass a fragment to the receiver and wait until the decoder task processed it
+ *
+ * @return uint64_t Decoder time in us on the virtual clock
+ */
+static uint64_t fragment(std::vector<uint8_t> frame)
+{
+	uint16_t received = fragSession.received;
+	uint64_t start = simNowUs();
+	fragDownlink(frame.data(), frame.size());
+	simRunFor([received]() { return fragSession.received != received; }, 10000);
+	return simNowUs() - start;
+}
+
+static void transfer(uint16_t nbFrag, uint32_t lossPercent)
+{
+	std::vector<uint8_t> block(nbFrag * BENCH_FRAG_SIZE);
+	for (auto &byte : block)
+	{
+		byte = simRandomRange(256);
+	}
+	std::vector<uint8_t> setup = fragEncSetup(0, nbFrag, BENCH_FRAG_SIZE, 0, 0, 1);
+	fragDownlink(setup.data(), setup.size());
+	simRun(500);
+	uint8_t answer[FRAG_ANSWER_LEN];
+	fragGetAnswer(answer);
+
+	uint64_t flashStart = simFsBytesWritten();
+	uint64_t decoderUs = 0;
+	uint64_t maxUs = 0;
+	uint32_t fragments = 0;
+	uint32_t lost = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (uint16_t index = 1; (index <= nbFrag) && (fragSession.status == FRAG_STATUS_ONGOING); index++)
+	{
+		if (simRandomRange(100) < lossPercent)
+		{
+			lost++;
+			continue;
+		}
+		uint64_t us = fragment(fragEncFragment(block, nbFrag, BENCH_FRAG_SIZE, 0, index));
+		decoderUs += us;
+		maxUs = us > maxUs ? us : maxUs;
+		fragments++;
+	}
+	uint16_t coded = 0;
+	while ((fragSession.status == FRAG_STATUS_ONGOING) && (coded < 2 * FRAG_MAX_MISSING))
+	{
+		coded++;
+		uint64_t us = fragment(fragEncFragment(block, nbFrag, BENCH_FRAG_SIZE, 0, nbFrag + coded));
+		decoderUs += us;
+		maxUs = us > maxUs ? us : maxUs;
+		fragments++;
+	}
+	double hostUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	fragGetAnswer(answer);
+
+	if (fragSession.status != FRAG_STATUS_DONE)
+	{
+		// The session stops at the first data fragment that does not fit into the missing list
+		printf("%6u %5u %%  %5u      -  no memory\n", nbFrag * BENCH_FRAG_SIZE, lossPercent, lost);
+		return;
+	}
+	bool ok = simFsRead("/frag.bin") == std::string(block.begin(), block.end());
+	printf("%6u %5u %%  %5u  %5u  %-9s %7.1f  %7.1f  %6.2f  %8.1f  %7.1f\n", nbFrag * BENCH_FRAG_SIZE, lossPercent,
+		   lost, coded, ok ? "done" : "corrupt", decoderUs / 1000.0 / fragments, maxUs / 1000.0,
+		   (double)(simFsBytesWritten() - flashStart) / block.size(), block.size() / (decoderUs / 1e6) / 1024.0,
+		   hostUs / fragments);
+}
+
+int main(void)
+{
+	loopEnable = xSemaphoreCreateBinary();
+	initFrag();
+	simSeed(38);
+
+	printf("Decoder RAM %u bytes for up to %u fragments of %u bytes and %u lost fragments\n", decoderRam(),
+		   FRAG_MAX_NB, FRAG_MAX_SIZE, FRAG_MAX_MISSING);
+	printf(" Block  Loss   Lost  Coded  Result    ms/frag   max ms  flash/B  kB/s dec  host us\n");
+	const uint16_t sizes[] = {50, 200, 1000};
+	const uint32_t losses[] = {0, 2, 5, 10, 20};
+	for (uint16_t nbFrag : sizes)
+	{
+		for (uint32_t loss : losses)
+		{
+			transfer(nbFrag, loss);
+		}
+	}
+	return 0;
+}
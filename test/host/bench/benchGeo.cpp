@@ -0,0 +1,113 @@
+/**
+ * @file benchGeo.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Fixed point coordinates against the old double conversion
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The old code converted the coordinates with TinyGPSLocation::lat()
+ * and lng() (degrees plus billionths as double) and multiplied them by
+ * 100000 for the payload, the debug output used printf("%.4f").
+ * geoFromRaw() and geoFormat() use only the integers TinyGPS++ parsed.
+ * The host has a double FPU, the nRF52840 has a single precision FPU and
+ * runs double arithmetic and the float printf in software, so the host
+ * times only show the direction. Mismatches are payload values that
+ * differ from the exact value of the NMEA digits.
+ */
+#include "sim.h"
+#include "main.h"
+#include <chrono>
+#include <vector>
+
+/** Coordinates per run */
+#define BENCH_COORDS 1000000
+
+/**
+ * @brief Old conversion, TinyGPSLocation::lat() and the payload scale
+ */
+static int32_t doubleFromRaw(const RawDegrees &raw)
+{
+	double value = raw.deg + raw.billionths / 1000000000.0;
+	if (raw.negative)
+	{
+		value = -value;
+	}
+	int64_t payload = value * 100000;
+	return (int32_t)payload;
+}
+
+/**
+ * @brief Host time in ns per call of a function over all coordinates
+ */
+template <typename FN>
+static double timeNs(FN fn)
+{
+	auto start = std::chrono::steady_clock::now();
+	fn();
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_COORDS;
+}
+
+int main(void)
+{
+	simSeed(1);
+	std::vector<RawDegrees> coords(BENCH_COORDS);
+	for (RawDegrees &raw : coords)
+	{
+		raw.deg = simRandomRange(180);
+		// NMEA minutes with 5 decimals, as billionths of a degree
+		raw.billionths = (uint64_t)simRandomRange(6000000) * 1000000000ULL / 6000000;
+		raw.negative = simRandomRange(2) != 0;
+	}
+
+	volatile int64_t sink = 0;
+	double doubleNs = timeNs([&]() {
+		for (const RawDegrees &raw : coords)
+		{
+			sink = sink + doubleFromRaw(raw);
+		}
+	});
+	double fixedNs = timeNs([&]() {
+		for (const RawDegrees &raw : coords)
+		{
+			sink = sink + geoFromRaw(raw) / (GEO_SCALE / GEO_PAYLOAD_SCALE);
+		}
+	});
+
+	char buffer[20];
+	double printfNs = timeNs([&]() {
+		for (const RawDegrees &raw : coords)
+		{
+			snprintf(buffer, sizeof(buffer), "%.4f", doubleFromRaw(raw) / 100000.0);
+			sink = sink + buffer[0];
+		}
+	});
+	double formatNs = timeNs([&]() {
+		for (const RawDegrees &raw : coords)
+		{
+			geoFormat(buffer, geoFromRaw(raw), GEO_SCALE, 4);
+			sink = sink + buffer[0];
+		}
+	});
+
+	// Payload against the exact value of the digits
+	uint32_t doubleWrong = 0;
+	uint32_t fixedWrong = 0;
+	for (const RawDegrees &raw : coords)
+	{
+		int64_t exact = (int64_t)raw.deg * 100000 + raw.billionths / 10000;
+		exact = raw.negative ? -exact : exact;
+		doubleWrong += doubleFromRaw(raw) != exact;
+		fixedWrong += geoFromRaw(raw) / (GEO_SCALE / GEO_PAYLOAD_SCALE) != exact;
+	}
+
+	printf("%-22s %10s %12s\n", "path", "host ns", "mismatches");
+	printf("%-22s %10.1f %12u\n", "double lat() * 1e5", doubleNs, doubleWrong);
+	printf("%-22s %10.1f %12u\n", "geoFromRaw()", fixedNs, fixedWrong);
+	printf("%-22s %10.1f %12s\n", "printf(\"%.4f\")", printfNs, "-");
+	printf("%-22s %10.1f %12s\n", "geoFormat()", formatNs, "-");
+	printf("%u coordinates, speed up conversion %.1fx, formatting %.1fx\n", BENCH_COORDS, doubleNs / fixedNs,
+		   printfNs / formatNs);
+	return fixedWrong != 0;
+}
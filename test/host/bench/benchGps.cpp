@@ -0,0 +1,647 @@
+/**
+ * @file benchGps.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Parser CPU and UART bytes per fix with and without the GPS output configuration
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The module output is recorded from the MAX-7Q model, first with
+ * the default sentences, then after initGPSConfig() sent its UBX
+ * commands. The recordings are replayed through TinyGPS++ alone, like
+ * the old pollGPS() did, and through the sentence filter in gpsPollStep().
+ * CPU is host time, use it only to compare the variants.
+ *
+ * The acquisition part records NMEA captures of the module model in
+ * open sky, urban and indoor conditions, 20 acquisitions each, the first
+ * one a cold start. Every capture is replayed on the virtual clock
+ * through the old pollGPS() logic (first complete fix or 10 s) and
+ * through gpsPollStart(), gpsPollStep() and gpsPollFinish() with the
+ * acquisition controller, and the GPS on time per fix is compared.
+ *
+ * The satellite statistics part records the default output with 12 GPS
+ * and 12 GLONASS satellites in view, 6 GSV and a GSA per fix, and times
+ * each sentence type through a TinyGPS++ instance without custom fields
+ * and through myGPS with the fields of initSatStats() and
+ * satStatsProcess(), like gpsPollStep() does.
+ */
+#include "sim.h"
+#include "main.h"
+#include <chrono>
+#include <vector>
+
+/** Length of a recording in s, one fix per second */
+#define RECORD_TIME 600
+/** Replays per variant, the fastest one counts */
+#define REPLAYS 20
+/** Acquisitions per condition */
+#define ACQ_COUNT 20
+/** Length of a capture in ms, longer than the extended cold start budget */
+#define ACQ_CAPTURE_MS 70000
+/** Time between two acquisitions in ms, keeps the warm start */
+#define ACQ_GAP_MS 300000
+/** Timeout of the old pollGPS() in ms */
+#define ACQ_OLD_TIMEOUT 10000
+
+/**
+ * @brief Driving north with 15 GPS and GLONASS satellites in view
+ */
+static sim_gps_state_s driving(uint32_t ms)
+{
+	sim_gps_state_s state;
+	memset(&state, 0, sizeof(state));
+	state.fix = true;
+	state.lat = 35.6895 + ms * 1e-8;
+	state.lng = 139.6917;
+	state.alt = 40.0;
+	state.speedKn = 21.6;
+	state.course = 0.0;
+	state.hdop = 90;
+	state.satsUsed = 9;
+	state.inView[0] = 9;
+	state.inView[1] = 6;
+	state.cn0 = 38;
+	state.unixTime = 1600560000 + ms / 1000;
+	return state;
+}
+
+/**
+ * @brief Record the module output
+ */
+static std::string record(uint32_t seconds)
+{
+	std::string output;
+	for (uint32_t idx = 0; idx < seconds * 100; idx++)
+	{
+		simRun(10);
+		while (Serial1.available() > 0)
+		{
+			output += (char)Serial1.read();
+		}
+	}
+	return output;
+}
+
+/**
+ * @brief Parked under open sky with 12 GPS and 12 GLONASS satellites in view
+ */
+static sim_gps_state_s fullSky(uint32_t ms)
+{
+	sim_gps_state_s state = driving(ms);
+	state.speedKn = 0.0;
+	state.satsUsed = 12;
+	state.inView[0] = 12;
+	state.inView[1] = 12;
+	state.cn0 = 44;
+	return state;
+}
+
+/** Result of a replay */
+struct replay_s
+{
+	double nsPerFix;
+	uint32_t fixes;
+	uint32_t bytesParsed;
+	/** pollGPS profiling site of the fastest replay */
+	prof_site_s prof;
+};
+
+/**
+ * @brief Every byte into TinyGPS++, like pollGPS() before the filter
+ * @note A fix when position, altitude, speed and HDOP were read, reading
+ * the values clears their updated flags
+ */
+static replay_s replayUnfiltered(const std::string &output)
+{
+	replay_s result;
+	memset(&result, 0, sizeof(result));
+	result.nsPerFix = 1e12;
+	for (int run = 0; run < REPLAYS; run++)
+	{
+		uint32_t fixes = 0;
+		bool hasPos = false;
+		bool hasAlt = false;
+		bool hasSpeed = false;
+		bool hasHdop = false;
+		volatile int32_t sink = 0;
+		double ns = 0.0;
+		size_t pos = 0;
+		while (pos < output.size())
+		{
+			pos += simSerial1Rx(&output[pos], output.size() - pos < 64 ? output.size() - pos : 64);
+			auto start = std::chrono::steady_clock::now();
+			while (Serial1.available() > 0)
+			{
+				if (!myGPS.encode(Serial1.read()))
+				{
+					continue;
+				}
+				if (myGPS.location.isUpdated() && myGPS.location.isValid())
+				{
+					hasPos = true;
+					sink = geoFromRaw(myGPS.location.rawLat()) + geoFromRaw(myGPS.location.rawLng());
+				}
+				if (myGPS.altitude.isUpdated() && myGPS.altitude.isValid())
+				{
+					hasAlt = true;
+					sink = myGPS.altitude.value();
+				}
+				if (myGPS.speed.isUpdated() && myGPS.speed.isValid())
+				{
+					hasSpeed = true;
+					sink = myGPS.speed.value();
+				}
+				if (myGPS.hdop.isUpdated() && myGPS.hdop.isValid())
+				{
+					hasHdop = true;
+					sink = myGPS.hdop.value();
+				}
+				if (hasPos && hasAlt && hasSpeed && hasHdop)
+				{
+					fixes++;
+					hasPos = hasAlt = hasSpeed = hasHdop = false;
+				}
+			}
+			ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		}
+		(void)sink;
+		result.fixes = fixes;
+		result.bytesParsed = output.size();
+		result.nsPerFix = ns / fixes < result.nsPerFix ? ns / fixes : result.nsPerFix;
+	}
+	return result;
+}
+
+/**
+ * @brief Through Serial1 and gpsPollStep(), a fix each time the acquisition ends
+ */
+static replay_s replayFirmware(const std::string &output)
+{
+	replay_s result;
+	memset(&result, 0, sizeof(result));
+	result.nsPerFix = 1e12;
+	for (int run = 0; run < REPLAYS; run++)
+	{
+		uint32_t fixes = 0;
+		double ns = 0.0;
+		memset(&gpsStats, 0, sizeof(gpsStats));
+		profReset();
+		gpsPollStart();
+		size_t pos = 0;
+		while (pos < output.size())
+		{
+			pos += simSerial1Rx(&output[pos], output.size() - pos < 64 ? output.size() - pos : 64);
+			auto start = std::chrono::steady_clock::now();
+			while (Serial1.available() > 0)
+			{
+				if (gpsPollStep())
+				{
+					fixes++;
+					gpsPollStart();
+				}
+			}
+			ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		}
+		result.fixes = fixes;
+		result.bytesParsed = gpsStats.bytesParsed;
+		if (ns / fixes < result.nsPerFix)
+		{
+			result.nsPerFix = ns / fixes;
+			profGetSite(PROF_POLL_GPS, &result.prof);
+		}
+	}
+	return result;
+}
+
+static void print(const char *name, const std::string &output, const replay_s &result)
+{
+	printf("%-30s %5u fixes  %6.0f bytes/fix received  %6.0f parsed  %7.0f ns/fix\n", name, result.fixes,
+		   (double)output.size() / result.fixes, (double)result.bytesParsed / result.fixes, result.nsPerFix);
+}
+
+/**
+ * @brief The pollGPS profiling site of a replay, cycles of the host cycle counter
+ */
+static void printProf(const char *name, const replay_s &result)
+{
+	double nsPerCycle = 1e9 / SystemCoreClock;
+	const prof_site_s &prof = result.prof;
+	printf("%-30s %5u calls  mean %5.1f us  max %6.1f us  %7.0f ns/fix, buckets", name, prof.count,
+		   prof.count == 0 ? 0.0 : prof.total * nsPerCycle / prof.count / 1000.0, prof.max * nsPerCycle / 1000.0,
+		   prof.total * nsPerCycle / result.fixes);
+	for (int bucket = 0; bucket < PROF_BUCKETS; bucket++)
+	{
+		if (prof.bucket[bucket] != 0)
+		{
+			printf(" >=%.0fns:%u", ((uint32_t)1 << bucket) * nsPerCycle, prof.bucket[bucket]);
+		}
+	}
+	printf("\n");
+}
+
+/** Sky of one acquisition, times from the start of the capture */
+struct acq_sky_s
+{
+	/** Time to first fix in ms, 0xFFFFFFFF for no fix */
+	uint32_t ttff;
+	/** HDOP x100 at the first fix and after improveMs */
+	uint16_t hdopFix;
+	uint16_t hdopFinal;
+	uint32_t improveMs;
+	uint8_t inView[2];
+	uint8_t cn0;
+};
+
+/** Sky of the capture that is recorded */
+static acq_sky_s sky;
+static uint32_t captureStart = 0;
+
+/**
+ * @brief Module state for the sky of the current capture
+ */
+static sim_gps_state_s acqModel(uint32_t ms)
+{
+	sim_gps_state_s state = driving(ms);
+	uint32_t elapsed = ms - captureStart;
+	state.speedKn = 0.0;
+	state.fix = elapsed >= sky.ttff;
+	state.inView[0] = sky.inView[0];
+	state.inView[1] = sky.inView[1];
+	state.cn0 = sky.cn0;
+	state.satsUsed = 0;
+	state.hdop = 9999;
+	if (state.fix)
+	{
+		uint32_t since = elapsed - sky.ttff;
+		state.hdop = since >= sky.improveMs
+						 ? sky.hdopFinal
+						 : sky.hdopFix - (int32_t)(sky.hdopFix - sky.hdopFinal) * (int32_t)since / (int32_t)sky.improveMs;
+		state.satsUsed = sky.inView[0] + sky.inView[1] < 12 ? sky.inView[0] + sky.inView[1] : 12;
+	}
+	return state;
+}
+
+/**
+ * @brief Sky of acquisition idx in a condition
+ *
+ * @param condition 0 open sky, 1 urban, 2 indoor
+ */
+static acq_sky_s acqSky(uint8_t condition, uint32_t idx)
+{
+	acq_sky_s result;
+	switch (condition)
+	{
+	case 0:
+		// All satellites, fast warm starts, the HDOP settles in a few seconds
+		result = {idx == 0 ? 28000 : 1000 + simRandomRange(2000), (uint16_t)(120 + simRandomRange(80)),
+				  (uint16_t)(80 + simRandomRange(20)), 4000, {9, 6}, 42};
+		break;
+	case 1:
+		// Street canyons, slow and spread warm starts, the HDOP stays above the target
+		result = {idx == 0 ? 45000 : 3000 + simRandomRange(12000), (uint16_t)(350 + simRandomRange(150)),
+				  (uint16_t)(180 + simRandomRange(70)), 10000, {5, 3}, 30};
+		break;
+	default:
+		// Weak signals, a poor fix near a window in every third acquisition
+		if ((idx % 3) == 2)
+		{
+			result = {8000 + simRandomRange(12000), (uint16_t)(600 + simRandomRange(300)), 500, 10000, {3, 1}, 22};
+		}
+		else
+		{
+			result = {0xFFFFFFFF, 9999, 9999, 1, {3, 1}, 16};
+		}
+		break;
+	}
+	return result;
+}
+
+/**
+ * @brief Record a capture in 10 ms chunks
+ */
+static std::vector<std::string> recordCapture(void)
+{
+	std::vector<std::string> chunks;
+	captureStart = millis();
+	for (uint32_t idx = 0; idx < ACQ_CAPTURE_MS / 10; idx++)
+	{
+		simRun(10);
+		std::string chunk;
+		while (Serial1.available() > 0)
+		{
+			chunk += (char)Serial1.read();
+		}
+		chunks.push_back(chunk);
+	}
+	return chunks;
+}
+
+/** Result of the acquisitions of one logic */
+struct acq_result_s
+{
+	uint64_t onMs;
+	uint32_t fixes;
+	uint64_t hdopSum;
+};
+
+/**
+ * @brief Old pollGPS(), first sentence with position, altitude, speed and HDOP or 10 s
+ */
+static void acqOld(const std::vector<std::string> &chunks, acq_result_s *result)
+{
+	bool hasPos = false;
+	bool hasAlt = false;
+	bool hasSpeed = false;
+	bool hasHdop = false;
+	uint32_t start = millis();
+	for (const std::string &chunk : chunks)
+	{
+		if ((millis() - start) >= ACQ_OLD_TIMEOUT)
+		{
+			break;
+		}
+		simSerial1Rx(chunk.data(), chunk.size());
+		while (!(hasPos && hasAlt && hasSpeed && hasHdop) && (Serial1.available() > 0))
+		{
+			if (!myGPS.encode(Serial1.read()))
+			{
+				continue;
+			}
+			if (myGPS.location.isUpdated() && myGPS.location.isValid())
+			{
+				hasPos = true;
+				myGPS.location.lat();
+			}
+			else if (myGPS.altitude.isUpdated() && myGPS.altitude.isValid())
+			{
+				hasAlt = true;
+				myGPS.altitude.meters();
+			}
+			else if (myGPS.speed.isUpdated() && myGPS.speed.isValid())
+			{
+				hasSpeed = true;
+				myGPS.speed.mps();
+			}
+			else if (myGPS.hdop.isUpdated() && myGPS.hdop.isValid())
+			{
+				hasHdop = true;
+				myGPS.hdop.hdop();
+			}
+		}
+		if (hasPos && hasAlt && hasSpeed && hasHdop)
+		{
+			break;
+		}
+		simRun(10);
+	}
+	result->onMs += millis() - start;
+	if (hasPos)
+	{
+		result->fixes++;
+		result->hdopSum += myGPS.hdop.value();
+	}
+}
+
+/**
+ * @brief Acquisition controller of the firmware
+ */
+static void acqNew(const std::vector<std::string> &chunks, acq_result_s *result)
+{
+	uint32_t start = millis();
+	gpsPollStart();
+	for (const std::string &chunk : chunks)
+	{
+		simSerial1Rx(chunk.data(), chunk.size());
+		if (gpsPollStep())
+		{
+			break;
+		}
+		simRun(10);
+	}
+	result->onMs += millis() - start;
+	if (gpsPollFinish())
+	{
+		result->fixes++;
+		result->hdopSum += myGPS.hdop.value();
+	}
+}
+
+/**
+ * @brief Drop the rest of a capture and wait for the next acquisition
+ */
+static void acqGap(void)
+{
+	while (Serial1.available() > 0)
+	{
+		Serial1.read();
+	}
+	simRun(ACQ_GAP_MS);
+}
+
+static void printAcq(const char *name, const char *logic, const acq_result_s &result)
+{
+	char perFix[16] = "-";
+	char hdop[16] = "-";
+	if (result.fixes != 0)
+	{
+		snprintf(perFix, sizeof(perFix), "%.1f", result.onMs / 1000.0 / result.fixes);
+		snprintf(hdop, sizeof(hdop), "%.2f", result.hdopSum / 100.0 / result.fixes);
+	}
+	printf("%-9s %-11s %5u %8.1f %9.1f %9s %6s\n", name, logic, result.fixes, result.onMs / 1000.0,
+		   result.onMs / 1000.0 / ACQ_COUNT, perFix, hdop);
+}
+
+/**
+ * @brief Replay the captures of the three conditions through both logics
+ *
+ * @return true if the controller got at least the fixes of the old logic everywhere
+ */
+static bool benchAcquisition(void)
+{
+	const char *conditions[] = {"open sky", "urban", "indoor"};
+	std::vector<std::vector<std::string>> captures[3];
+	// gpsPollFinish() reads the accelerometer for the motion vector
+	initI2C();
+	simGpsModel(acqModel);
+	for (uint8_t condition = 0; condition < 3; condition++)
+	{
+		for (uint32_t idx = 0; idx < ACQ_COUNT; idx++)
+		{
+			sky = acqSky(condition, idx);
+			captures[condition].push_back(recordCapture());
+		}
+	}
+	// The module output is not received anymore, only the captures
+	Serial1.end();
+
+	bool ok = true;
+	printf("\n%-9s %-11s %5s %8s %9s %9s %6s\n", "condition", "logic", "fixes", "GPS s", "s/acq", "s/fix", "HDOP");
+	for (uint8_t condition = 0; condition < 3; condition++)
+	{
+		acq_result_s old = {0, 0, 0};
+		for (const std::vector<std::string> &chunks : captures[condition])
+		{
+			acqOld(chunks, &old);
+			acqGap();
+		}
+		// Every condition starts with a cold start, the history is older than GPS_ACQ_WARM_AGE
+		simRun(GPS_ACQ_WARM_AGE + 1000);
+		gps_acq_stats_s before = gpsAcqStats;
+		acq_result_s controller = {0, 0, 0};
+		for (const std::vector<std::string> &chunks : captures[condition])
+		{
+			acqNew(chunks, &controller);
+			acqGap();
+		}
+		simRun(GPS_ACQ_WARM_AGE + 1000);
+		printAcq(conditions[condition], "fixed 10 s", old);
+		printAcq(conditions[condition], "controller", controller);
+		printf("%-9s end reasons:", "");
+		for (uint8_t reason = GPS_END_ACCURATE; reason <= GPS_END_ALARM; reason++)
+		{
+			if (gpsAcqStats.endCount[reason] != before.endCount[reason])
+			{
+				printf(" %s %u", acqReasonName(reason), gpsAcqStats.endCount[reason] - before.endCount[reason]);
+			}
+		}
+		printf("\n");
+		ok = ok && (controller.fixes >= old.fixes);
+	}
+	return ok;
+}
+
+/**
+ * @brief Host time per sentence of a sentence type
+ *
+ * @param sentences Sentences of the type
+ * @param collect true to parse with myGPS and collect the satellite statistics
+ * @return double Fastest of REPLAYS runs in ns per sentence
+ */
+static double sentenceNs(const std::vector<std::string> &sentences, bool collect)
+{
+	static TinyGPSPlus plain;
+	double best = 1e12;
+	for (int run = 0; run < REPLAYS; run++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (const std::string &sentence : sentences)
+		{
+			for (char c : sentence)
+			{
+				if (collect)
+				{
+					if (myGPS.encode(c))
+					{
+						satStatsProcess();
+					}
+				}
+				else
+				{
+					plain.encode(c);
+				}
+			}
+		}
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+					sentences.size();
+		best = ns < best ? ns : best;
+	}
+	return best;
+}
+
+/**
+ * @brief Parsing time added by the satellite statistics per sentence type
+ *
+ * @param output Module output with all sentences
+ * @return true if GSV and GSA were found and counted
+ */
+static bool benchSatStats(const std::string &output)
+{
+	const char *types[] = {"GSV", "GSA", "GGA", "RMC", "GLL", "VTG"};
+	std::vector<std::string> sentences[6];
+	size_t pos = 0;
+	while ((pos = output.find('$', pos)) != std::string::npos)
+	{
+		size_t end = output.find('\n', pos);
+		if (end == std::string::npos)
+		{
+			break;
+		}
+		std::string sentence = output.substr(pos, end + 1 - pos);
+		for (int type = 0; type < 6; type++)
+		{
+			if (sentence.compare(3, 3, types[type]) == 0)
+			{
+				sentences[type].push_back(sentence);
+			}
+		}
+		pos = end;
+	}
+
+	memset(&satStats, 0, sizeof(satStats));
+	printf("\n%-5s %9s %9s %12s %9s %9s\n", "type", "sentences", "per fix", "TinyGPS ns", "+stats ns", "added ns");
+	double plainTotal = 0.0;
+	double statsTotal = 0.0;
+	double configuredAdded = 0.0;
+	uint32_t fixes = sentences[2].size();
+	for (int type = 0; type < 6; type++)
+	{
+		if (sentences[type].empty())
+		{
+			continue;
+		}
+		double plainNs = sentenceNs(sentences[type], false);
+		double statsNs = sentenceNs(sentences[type], true);
+		double perFix = (double)sentences[type].size() / fixes;
+		plainTotal += plainNs * perFix;
+		statsTotal += statsNs * perFix;
+		// initGPSConfig() reduces GSV and GSA to every SAT_STATS_RATE fixes
+		configuredAdded += (statsNs - plainNs) * perFix / (type < 2 ? SAT_STATS_RATE : 1);
+		printf("%-5s %9u %9.1f %12.0f %9.0f %9.0f\n", types[type], (unsigned)sentences[type].size(), perFix, plainNs,
+			   statsNs, statsNs - plainNs);
+	}
+	printf("Per fix %.0f ns without, %.0f ns with the satellite statistics (+%.0f %%), %.0f ns added with GSV and GSA every %u fixes\n",
+		   plainTotal, statsTotal, plainTotal > 0.0 ? (statsTotal - plainTotal) * 100.0 / plainTotal : 0.0,
+		   configuredAdded, SAT_STATS_RATE);
+	return !sentences[0].empty() && !sentences[1].empty() && (satStats.inView[SAT_GPS] == 12) &&
+		   (satStats.inView[SAT_GLONASS] == 12) && (satStats.maxCn0[SAT_GPS] == 44);
+}
+
+int main(void)
+{
+	simGpsModel(driving);
+	Serial1.begin(9600);
+	initSatStats();
+	initProf();
+	simGpsStart();
+	std::string defaultOutput = record(RECORD_TIME);
+	simGpsModel(fullSky);
+	std::string fullSkyOutput = record(60);
+	simGpsModel(driving);
+
+	initGPSConfig();
+	// Sentences of the epochs that were on the way when the commands arrived
+	record(2);
+	std::string configuredOutput = record(RECORD_TIME);
+	printf("Module output default %u bytes, configured %u bytes, %u UBX commands, %u bytes lost while the commands were sent\n",
+		   (unsigned)defaultOutput.size(), (unsigned)configuredOutput.size(), simGpsStats.ubxCommands,
+		   simGpsStats.overruns);
+
+	replay_s before = replayUnfiltered(defaultOutput);
+	replay_s filtered = replayFirmware(defaultOutput);
+	replay_s after = replayFirmware(configuredOutput);
+	print("Default output, no filter", defaultOutput, before);
+	print("Default output, filter", defaultOutput, filtered);
+	print("Configured output, filter", configuredOutput, after);
+	printf("PROF_SCOPE(PROF_POLL_GPS) in gpsPollStep(), per call of a 64 byte UART chunk:\n");
+	printProf("Default output, filter", filtered);
+	printProf("Configured output, filter", after);
+	printf("Bytes per fix %.0f %%, CPU per fix %.0f %% of the default output without filter\n",
+		   100.0 * configuredOutput.size() / after.fixes / ((double)defaultOutput.size() / before.fixes),
+		   100.0 * after.nsPerFix / before.nsPerFix);
+	bool ok = (after.fixes >= RECORD_TIME - 2) && (configuredOutput.size() < defaultOutput.size());
+
+	ok = benchAcquisition() && ok;
+	ok = benchSatStats(fullSkyOutput) && ok;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+/**
+ * @file benchNs.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Throughput of the virtual radio and the network server, uplink and downlink latency
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Frames/s is host time, every frame is encrypted, MIC checked and
+ * decrypted on both sides. The latencies are on the virtual clock.
+ */
+#include "ns.h"
+#include <LoRaWan-RAK4630.h>
+#include <chrono>
+
+static uint8_t devEui[8] = {0x00, 0x0D, 0x75, 0xE6, 0x56, 0x4D, 0xC1, 0xF3};
+static uint8_t appEui[8] = {0x70, 0xB3, 0xD5, 0x7E, 0xD0, 0x02, 0x01, 0xE1};
+static uint8_t appKey[16] = {0x2B, 0x84, 0xE0, 0xB0, 0x9B, 0x68, 0xE5, 0xCB,
+							 0x42, 0x17, 0x6F, 0xE7, 0x53, 0xDC, 0xEE, 0x79};
+
+static bool joined = false;
+static uint32_t finished = 0;
+static uint32_t received = 0;
+
+static void rxHandler(lmh_app_data_t *data)
+{
+	(void)data;
+	received++;
+}
+
+static void joinedHandler(void)
+{
+	joined = true;
+}
+
+static void classHandler(DeviceClass_t devClass)
+{
+	(void)devClass;
+}
+
+static void unconfHandler(void)
+{
+	finished++;
+}
+
+static void confHandler(bool result)
+{
+	(void)result;
+	finished++;
+}
+
+static lmh_callback_t callbacks = {NULL, BoardGetUniqueId, BoardGetRandomSeed, rxHandler, joinedHandler,
+								   classHandler, NULL, unconfHandler, confHandler};
+
+/** Min, average and max of a latency in ms */
+struct latency_s
+{
+	double min = 1e12;
+	double max = 0.0;
+	double sum = 0.0;
+	uint32_t count = 0;
+	void add(double ms)
+	{
+		min = ms < min ? ms : min;
+		max = ms > max ? ms : max;
+		sum += ms;
+		count++;
+	}
+	void print(const char *name)
+	{
+		printf("%-28s %6u  min %8.1f  avg %8.1f  max %8.1f ms\n", name, count, count ? min : 0.0,
+			   count ? sum / count : 0.0, max);
+	}
+};
+
+static double hostSeconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Send uplinks every interval, queue a downlink before every 10th uplink
+ */
+static void exchange(uint32_t count, uint32_t intervalMs, latency_s *downLatency)
+{
+	uint8_t buffer[32] = {0};
+	lmh_app_data_t data = {buffer, LORAWAN_APP_PORT, sizeof(buffer), 0, 0};
+	const uint8_t down[] = {0x01, 0x02, 0x03, 0x04};
+	uint64_t queued = 0;
+	for (uint32_t idx = 0; idx < count; idx++)
+	{
+		uint64_t next = simNowUs() + (uint64_t)intervalMs * 1000;
+		if (((idx % 10) == 0) && (queued == 0))
+		{
+			queued = simNowUs();
+			nsQueueDownlink(LORAWAN_APP_PORT, down, sizeof(down));
+		}
+		uint32_t done = finished;
+		uint32_t rx = received;
+		lmh_send(&data, (idx % 4) == 0 ? LMH_CONFIRMED_MSG : LMH_UNCONFIRMED_MSG);
+		simRunFor([done]() { return finished != done; }, 60000);
+		if ((received != rx) && (queued != 0))
+		{
+			downLatency->add((simNowUs() - queued) / 1000.0);
+			queued = 0;
+		}
+		else if (nsQueued() == 0)
+		{
+			// Sent by the server, but lost on the way
+			queued = 0;
+		}
+		if (simNowUs() < next)
+		{
+			simRunUntil(next);
+		}
+	}
+}
+
+int main(void)
+{
+	simSeed(40);
+	nsAddOtaa(devEui, appEui, appKey);
+	lmh_setDevEui(devEui);
+	lmh_setAppEui(appEui);
+	lmh_setAppKey(appKey);
+	lmh_param_t params = {LORAWAN_ADR_OFF, DR_3, LORAWAN_PUBLIC_NETWORK, 8, TX_POWER_15, LORAWAN_DUTYCYCLE_OFF};
+	lmh_init(&callbacks, params, true, CLASS_A, LORAMAC_REGION_AS923);
+
+	latency_s join;
+	latency_s upLatency;
+	latency_s downA;
+	latency_s downC;
+	uint64_t joinStart = simNowUs();
+	lmh_join();
+	simRunFor([]() { return joined; }, 60000);
+	join.add((simNowUs() - joinStart) / 1000.0);
+
+	// Uplink latency, TX start on the device to the delivery by the server
+	nsOnUplink([&upLatency](const ns_uplink_s &uplink) { upLatency.add((simNowUs() - uplink.txStartUs) / 1000.0); });
+
+	simLoraCfg.upLoss = 0.05;
+	simLoraCfg.downLoss = 0.05;
+	uint32_t frames = simLoraStats.uplinks + simLoraStats.downlinks;
+	uint64_t virtualStart = simNowUs();
+	auto start = std::chrono::steady_clock::now();
+	exchange(5000, 60000, &downA);
+	double seconds = hostSeconds(start);
+	frames = simLoraStats.uplinks + simLoraStats.downlinks - frames;
+	printf("Class A, 5 %% loss: %u frames in %.2f s host time, %.0f frames/s, %.0fx real time\n", frames, seconds,
+		   frames / seconds, (simNowUs() - virtualStart) / 1e6 / seconds);
+
+	// Class C, downlinks without uplinks
+	simLoraCfg.upLoss = 0.0;
+	simLoraCfg.downLoss = 0.0;
+	const uint8_t toC[] = {2};
+	nsQueueDownlink(3, toC, sizeof(toC));
+	exchange(2, 1000, &downA);
+	lmh_class_request(CLASS_C);
+	exchange(1, 1000, &downA);
+	const uint8_t down[] = {0x42};
+	start = std::chrono::steady_clock::now();
+	uint32_t downlinks = simLoraStats.downlinks;
+	for (int idx = 0; idx < 5000; idx++)
+	{
+		uint32_t rx = received;
+		uint64_t queued = simNowUs();
+		nsQueueDownlink(LORAWAN_APP_PORT, down, sizeof(down));
+		if (simRunFor([rx]() { return received != rx; }, 5000))
+		{
+			downC.add((simNowUs() - queued) / 1000.0);
+		}
+		simRun(1000);
+	}
+	seconds = hostSeconds(start);
+	downlinks = simLoraStats.downlinks - downlinks;
+	printf("Class C: %u downlinks in %.2f s host time, %.0f frames/s\n", downlinks, seconds, downlinks / seconds);
+
+	join.print("Join");
+	upLatency.print("Uplink TX start to server");
+	downA.print("Downlink class A, uplink 60 s");
+	downC.print("Downlink class C");
+	printf("Server: %u uplinks, %u retransmissions, %u MIC failures, %u FCnt rejects, %u downlinks, %u acks\n",
+		   nsStats.uplinks, nsStats.retransmissions, nsStats.micFailures, nsStats.fCntRejects, nsStats.downlinks,
+		   nsStats.acks);
+	printf("Device: %u uplinks, %u lost, %u downlinks, %u dropped, airtime %.1f s\n", simLoraStats.uplinks,
+		   simLoraStats.lost, simLoraStats.downlinks, simLoraStats.rxDropped, simLoraStats.airtimeUs / 1e6);
+	return (nsStats.micFailures == 0) && (nsStats.fCntRejects == 0) ? 0 : 1;
+}
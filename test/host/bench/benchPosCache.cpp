@@ -0,0 +1,75 @@
+/**
+ * @file benchPosCache.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief GPS acquisition time saved per day by the last known position cache
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Every trace is one day of firmware time through the replay, once
+ * with the cache and once with the cache kept invalid. The measured
+ * saving is the difference of the acquisition time from gpsAcqStats.
+ * The firmware estimate is posCache.gpsSavedMs, the acquisition time of
+ * the cached fix as a warm start for every report from the cache. The
+ * bench fails if the estimate is off by more than BENCH_TOLERANCE.
+ */
+#include "replay.h"
+
+/** Firmware time of a trace in ms */
+#define BENCH_DURATION 86400000
+/** Max difference of the estimate to the measured saving in % */
+#define BENCH_TOLERANCE 35
+
+/**
+ * @brief Drive for some minutes
+ */
+static void drive(replay_trace_s *trace, uint32_t startMin, uint32_t minutes, uint16_t course)
+{
+	trace->events.push_back({REPLAY_MOTION, startMin * 60000, minutes * 60000, 1500, course});
+}
+
+int main(void)
+{
+	const char *names[] = {"parked", "commuter", "delivery"};
+	replay_trace_s traces[3];
+	for (replay_trace_s &trace : traces)
+	{
+		trace.seed = 1;
+		trace.durationMs = BENCH_DURATION;
+	}
+	// Commuter: 40 min to work and back
+	drive(&traces[1], 7 * 60 + 30, 40, 900);
+	drive(&traces[1], 17 * 60 + 30, 40, 2700);
+	// Delivery: 8 h of 15 min drives with 10 min stops
+	for (uint32_t minute = 8 * 60; minute < 16 * 60; minute += 25)
+	{
+		drive(&traces[2], minute, 15, (minute * 7) % 3600);
+	}
+
+	printf("%-9s %19s %19s %6s %28s\n", "", "with cache", "without cache", "", "saved s/day");
+	printf("%-9s %8s %10s %8s %10s %6s %10s %8s %8s %8s\n", "trace", "acq/day", "GPS s/day", "acq/day", "GPS s/day",
+		   "hits", "measured", "%", "estimate", "error");
+	bool ok = true;
+	for (uint8_t idx = 0; idx < 3; idx++)
+	{
+		replay_result_s cached = replayRun(traces[idx]);
+		traces[idx].noPosCache = true;
+		replay_result_s uncached = replayRun(traces[idx]);
+		ok = ok && cached.ok && uncached.ok;
+		double onS = cached.gpsOnMs / 1000.0;
+		double withoutS = uncached.gpsOnMs / 1000.0;
+		double savedS = withoutS - onS;
+		double estimateS = cached.gpsSavedMs / 1000.0;
+		double error = savedS > 0.0 ? (estimateS - savedS) * 100.0 / savedS : 0.0;
+		printf("%-9s %8u %10.1f %8u %10.1f %6u %10.1f %7.1f%% %8.1f %7.1f%%\n", names[idx], cached.gpsAcquisitions,
+			   onS, uncached.gpsAcquisitions, withoutS, cached.cacheHits, savedS,
+			   withoutS > 0.0 ? savedS * 100.0 / withoutS : 0.0, estimateS, error);
+		if ((error > BENCH_TOLERANCE) || (error < -BENCH_TOLERANCE))
+		{
+			printf("%s: estimate off by more than %d %%\n", names[idx], BENCH_TOLERANCE);
+			ok = false;
+		}
+	}
+	return !ok;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file benchPower.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Sleep residency and wake ups of the idle model per scenario and policy level
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Every row is one hour of firmware time through the replay. The
+ * sleep time is measured by the firmware in power.cpp with the
+ * traceLOW_POWER_IDLE_BEGIN/END hooks of the simulated tickless idle.
+ * Slept/exp is the sleep time against the time the scheduler expected
+ * to sleep, interrupts like the GPS UART end the sleeps early. The MCU
+ * sleeps while the GPS acquires and the radio is busy, the device
+ * residency counts the GPS acquisitions, the time on air and the receive
+ * windows, the class B ping slots and the class C receive as awake.
+ */
+#include "replay.h"
+
+/** Firmware time of a scenario in ms */
+#define BENCH_DURATION 3600000
+
+/** Battery voltages inside the policy levels */
+static const uint16_t levelMv[POLICY_NUM_LEVELS] = {4100, 3800, 3700, 3550};
+static const char *levelNames[POLICY_NUM_LEVELS] = {"full", "medium", "low", "critical"};
+static const char *wakeNames[WAKE_NUM_SOURCES] = {"none", "acc", "periodic", "delayed", "lora", "ble"};
+
+/**
+ * @brief Scenario of the table
+ */
+static replay_trace_s scenario(uint8_t type, uint16_t battMv)
+{
+	replay_trace_s trace;
+	trace.seed = 1;
+	trace.durationMs = BENCH_DURATION;
+	trace.battMv = battMv;
+	switch (type)
+	{
+	case 1:
+		// Driving, 50 min after the first 5 min
+		trace.events.push_back({REPLAY_MOTION, 300000, 3000000, 1500, 900});
+		break;
+	case 2:
+		trace.events.push_back({REPLAY_BLE, 300000, 3000000, 0, 0});
+		break;
+	case 3:
+		// A shock every 10 min
+		for (uint32_t time = 300000; time < BENCH_DURATION; time += 600000)
+		{
+			trace.events.push_back({REPLAY_SHOCK, time, 0, 0, 0});
+		}
+		break;
+	}
+	return trace;
+}
+
+int main(void)
+{
+	const char *scenarioNames[] = {"parked", "driving", "BLE", "shocks"};
+	printf("%-8s %-8s %5s %7s %7s %7s %9s %9s", "scenario", "policy", "level", "MCU", "device", "sleeps", "avg ms",
+		   "slept/exp");
+	for (uint8_t source = WAKE_ACC; source < WAKE_NUM_SOURCES; source++)
+	{
+		printf(" %8s", wakeNames[source]);
+	}
+	printf(" %7s\n", "uplinks");
+	bool ok = true;
+	for (uint8_t type = 0; type < 4; type++)
+	{
+		for (uint8_t level = 0; level < POLICY_NUM_LEVELS; level++)
+		{
+			replay_result_s result = replayRun(scenario(type, levelMv[level]));
+			ok = ok && result.ok;
+			printf("%-8s %-8s %5u %6.1f%% %6.1f%% %7u %9.0f %8.1f%%", scenarioNames[type], levelNames[level],
+				   result.policyLevel, result.residency / 10.0, result.deviceResidency / 10.0, result.sleeps,
+				   result.sleeps ? (double)result.sleepTicks / result.sleeps : 0.0,
+				   result.expectedTicks ? result.sleepTicks * 100.0 / result.expectedTicks : 0.0);
+			for (uint8_t source = WAKE_ACC; source < WAKE_NUM_SOURCES; source++)
+			{
+				printf(" %8u", result.wakeCount[source]);
+			}
+			printf(" %7u\n", result.uplinks);
+		}
+	}
+	return !ok;
+}
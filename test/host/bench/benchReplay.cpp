@@ -0,0 +1,150 @@
+/**
+ * @file benchReplay.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Randomized traces against the scheduler: wake to uplink and interrupt to TX latency, missed and duplicate reports, timer re-arms, report pipeline latencies
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Every scenario is one hour of firmware time with a random trace.
+ * The number of scenarios is the first argument. A sample of the
+ * scenarios is run a second time and has to give the same hash.
+ */
+#include "replay.h"
+#include <chrono>
+#include <stdlib.h>
+
+/** Firmware time of a scenario in ms */
+#define BENCH_DURATION 3600000
+
+/** Names of the pipeline stages, same order as PIPE_xxx */
+static const char *stageNames[PIPE_NUM_STAGES] = {"acquisition", "encoding", "transmission", "reporting"};
+
+/**
+ * @brief Add the pipeline latencies of a scenario to the total
+ */
+static void addPipe(pipe_latency_s *total, const pipe_latency_s &latency)
+{
+	total->count += latency.count;
+	total->totalMs += latency.totalMs;
+	if (latency.maxMs > total->maxMs)
+	{
+		total->maxMs = latency.maxMs;
+	}
+}
+
+/**
+ * @brief Print a pipeline latency row
+ */
+static void printPipe(const char *name, const pipe_latency_s &latency)
+{
+	printf("%-12s %8u %10.0f %10u\n", name, latency.count,
+		   latency.count ? (double)latency.totalMs / latency.count : 0.0, latency.maxMs);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t scenarios = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000;
+	replay_result_s total;
+	memset(&total, 0, sizeof(total));
+	uint32_t failed = 0;
+	uint32_t withMissed = 0;
+	uint32_t withDuplicates = 0;
+	uint64_t worstSeed[REPLAY_NUM_EVENTS] = {0};
+	uint32_t mismatch = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t seed = 1; seed <= scenarios; seed++)
+	{
+		replay_trace_s trace = replayRandomTrace(seed, BENCH_DURATION);
+		replay_result_s result = replayRun(trace);
+		if (!result.ok)
+		{
+			printf("seed %u failed\n", seed);
+			failed++;
+			continue;
+		}
+		for (uint8_t type = 0; type < REPLAY_NUM_EVENTS; type++)
+		{
+			total.events[type] += result.events[type];
+			total.latency[type].count += result.latency[type].count;
+			total.latency[type].totalMs += result.latency[type].totalMs;
+			if (result.latency[type].maxMs > total.latency[type].maxMs)
+			{
+				total.latency[type].maxMs = result.latency[type].maxMs;
+				worstSeed[type] = seed;
+			}
+		}
+		total.uplinks += result.uplinks;
+		total.sendErrors += result.sendErrors;
+		total.lost += result.lost;
+		total.relayed += result.relayed;
+		total.missedReports += result.missedReports;
+		total.duplicates += result.duplicates;
+		total.reports += result.reports;
+		total.skipped += result.skipped;
+		total.rearms += result.rearms;
+		total.alarmUplinks += result.alarmUplinks;
+		total.alarmsRaised += result.alarmsRaised;
+		total.alarmsFailed += result.alarmsFailed;
+		total.alarmNoAck += result.alarmNoAck;
+		if (result.alarmMaxLatency > total.alarmMaxLatency)
+		{
+			total.alarmMaxLatency = result.alarmMaxLatency;
+		}
+		total.rearmToReport.count += result.rearmToReport.count;
+		total.rearmToReport.totalMs += result.rearmToReport.totalMs;
+		if (result.rearmToReport.maxMs > total.rearmToReport.maxMs)
+		{
+			total.rearmToReport.maxMs = result.rearmToReport.maxMs;
+		}
+		for (uint8_t stage = 0; stage < PIPE_NUM_STAGES; stage++)
+		{
+			addPipe(&total.pipe.stage[stage], result.pipe.stage[stage]);
+		}
+		addPipe(&total.pipe.endToEnd, result.pipe.endToEnd);
+		total.pipe.overlapped += result.pipe.overlapped;
+		total.pipe.merged += result.pipe.merged;
+		withMissed += result.missedReports != 0;
+		withDuplicates += result.duplicates != 0;
+		// Reproducibility, every 50th scenario again
+		if ((seed % 50) == 0)
+		{
+			mismatch += replayRun(trace).hash != result.hash;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("%u scenarios of %u min, %.0f scenarios per minute, %u failed, %u not reproducible\n", scenarios,
+		   BENCH_DURATION / 60000, (scenarios + scenarios / 50) / seconds * 60.0, failed, mismatch);
+	printf("%-12s %8s %8s %10s %10s %10s\n", "event", "count", "closed", "avg ms", "max ms", "worst seed");
+	for (uint8_t type = 0; type < REPLAY_NUM_EVENTS; type++)
+	{
+		const replay_latency_s &latency = total.latency[type];
+		printf("%-12s %8u %8u %10.0f %10u %10llu\n", replayEventNames[type], total.events[type], latency.count,
+			   latency.count ? (double)latency.totalMs / latency.count : 0.0, latency.maxMs,
+			   (unsigned long long)worstSeed[type]);
+	}
+	printf("uplinks %u, send errors %u, lost %u, BLE relay %u\n", total.uplinks, total.sendErrors, total.lost,
+		   total.relayed);
+	printf("report decisions %u, skipped by dead reckoning %u\n", total.reports, total.skipped);
+	printf("missed reports %u in %u scenarios, duplicates %u in %u scenarios\n", total.missedReports, withMissed,
+		   total.duplicates, withDuplicates);
+	printf("timer re-arms %u, re-arm to report avg %.0f ms, max %u ms\n", total.rearms,
+		   total.rearmToReport.count ? (double)total.rearmToReport.totalMs / total.rearmToReport.count : 0.0,
+		   total.rearmToReport.maxMs);
+	printf("alarms %u, uplinks %u, failed %u, without ACK %u, max latency reported by the firmware %u ms\n",
+		   total.alarmsRaised, total.alarmUplinks, total.alarmsFailed, total.alarmNoAck, total.alarmMaxLatency);
+	printf("%-12s %8s %10s %10s\n", "pipeline", "reports", "mean ms", "max ms");
+	for (uint8_t stage = 0; stage < PIPE_NUM_STAGES; stage++)
+	{
+		printPipe(stageNames[stage], total.pipe.stage[stage]);
+	}
+	printPipe("end to end", total.pipe.endToEnd);
+	uint32_t runs = scenarios - failed;
+	printf("%.1f reports per hour, overlapped %u, merged into a running acquisition %u\n",
+		   runs ? total.pipe.endToEnd.count * 3600000.0 / ((double)runs * BENCH_DURATION) : 0.0,
+		   total.pipe.overlapped, total.pipe.merged);
+	return (failed != 0) || (mismatch != 0);
+}
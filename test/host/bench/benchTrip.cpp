@@ -0,0 +1,125 @@
+/**
+ * @file benchTrip.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Uplinks and airtime per day of the trip mode against the periodic positions
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Every trace is one day of firmware time through the replay. The
+ * Makefile builds this file twice, build/benchTrip with the periodic
+ * position uplinks and build/benchTripMode with -DTRIP_MODE=1. The trip
+ * mode binary prints one line of raw results per trace, benchTrip runs it
+ * and prints both modes. Uplinks are all frames the LoRaMac accepted,
+ * including health, policy and alarm frames, the airtime covers all
+ * transmissions with the retries.
+ */
+#include "replay.h"
+#include <string>
+
+/** Firmware time of a trace in ms */
+#define BENCH_DURATION 86400000
+/** Number of traces */
+#define BENCH_TRACES 3
+
+/**
+ * @brief Drive for some minutes
+ */
+static void drive(replay_trace_s *trace, uint32_t startMin, uint32_t minutes, uint16_t course)
+{
+	trace->events.push_back({REPLAY_MOTION, startMin * 60000, minutes * 60000, 1500, course});
+}
+
+/**
+ * @brief Parked, commuter and delivery day
+ */
+static void buildTraces(replay_trace_s *traces)
+{
+	for (uint8_t idx = 0; idx < BENCH_TRACES; idx++)
+	{
+		traces[idx].seed = 1;
+		traces[idx].durationMs = BENCH_DURATION;
+	}
+	// Commuter: 40 min to work and back
+	drive(&traces[1], 7 * 60 + 30, 40, 900);
+	drive(&traces[1], 17 * 60 + 30, 40, 2700);
+	// Delivery: 8 h of 15 min drives with 10 min stops, each one a trip
+	for (uint32_t minute = 8 * 60; minute < 16 * 60; minute += 25)
+	{
+		drive(&traces[2], minute, 15, (minute * 7) % 3600);
+	}
+}
+
+#if TRIP_MODE
+int main(void)
+{
+	replay_trace_s traces[BENCH_TRACES];
+	buildTraces(traces);
+	for (uint8_t idx = 0; idx < BENCH_TRACES; idx++)
+	{
+		replay_result_s result = replayRun(traces[idx]);
+		printf("%u %u %llu %u %u\n", result.ok, result.uplinks, (unsigned long long)result.airtimeUs, result.trips,
+			   result.tripUplinks);
+	}
+	return 0;
+}
+#else
+int main(int argc, char **argv)
+{
+	(void)argc;
+	replay_trace_s traces[BENCH_TRACES];
+	buildTraces(traces);
+	const char *names[BENCH_TRACES] = {"parked", "commuter", "delivery"};
+
+	// Trip mode in its own build
+	replay_result_s trip[BENCH_TRACES];
+	memset(trip, 0, sizeof(trip));
+	std::string command = std::string(argv[0]) + "Mode";
+	FILE *pipe = popen(command.c_str(), "r");
+	bool ok = pipe != NULL;
+	for (uint8_t idx = 0; ok && (idx < BENCH_TRACES); idx++)
+	{
+		unsigned int tripOk;
+		unsigned long long airtimeUs;
+		ok = fscanf(pipe, "%u %u %llu %u %u", &tripOk, &trip[idx].uplinks, &airtimeUs, &trip[idx].trips,
+					&trip[idx].tripUplinks) == 5;
+		trip[idx].ok = tripOk != 0;
+		trip[idx].airtimeUs = airtimeUs;
+	}
+	if (pipe != NULL)
+	{
+		ok = (pclose(pipe) == 0) && ok;
+	}
+	if (!ok)
+	{
+		printf("%s failed\n", command.c_str());
+		return 1;
+	}
+
+	printf("%-9s %7s %19s %27s\n", "", "", "periodic", "trip mode");
+	printf("%-9s %7s %8s %10s %6s %9s %10s %8s\n", "trace", "drives", "uplinks", "airtime s", "trips", "summaries",
+		   "airtime s", "uplinks");
+	for (uint8_t idx = 0; idx < BENCH_TRACES; idx++)
+	{
+		replay_result_s periodic = replayRun(traces[idx]);
+		ok = ok && periodic.ok && trip[idx].ok;
+		printf("%-9s %7u %8u %10.1f %6u %9u %10.1f %8u\n", names[idx], (uint32_t)traces[idx].events.size(),
+			   periodic.uplinks, periodic.airtimeUs / 1000000.0, trip[idx].trips, trip[idx].tripUplinks,
+			   trip[idx].airtimeUs / 1000000.0, trip[idx].uplinks);
+		// One summary per drive, the periodic mode sends no summaries
+		if ((trip[idx].trips != traces[idx].events.size()) || (trip[idx].tripUplinks != trip[idx].trips) ||
+			(periodic.tripUplinks != 0))
+		{
+			printf("%s: %u trips and %u summaries for %u drives\n", names[idx], trip[idx].trips, trip[idx].tripUplinks,
+				   (uint32_t)traces[idx].events.size());
+			ok = false;
+		}
+		if ((periodic.uplinks != 0) && (trip[idx].uplinks > periodic.uplinks))
+		{
+			ok = false;
+		}
+	}
+	return !ok;
+}
+#endif
@@ -0,0 +1,276 @@
+/**
+ * @file aes.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief AES-128 and AES-CMAC for the LoRaWan frames of the simulation
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Byte oriented implementation, speed is not important here.
+ */
+#include "aes.h"
+#include <string.h>
+
+static const uint8_t sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16};
+
+static uint8_t invSbox[256];
+static bool invSboxReady = false;
+
+/**
+ * @brief Multiply by x in GF(2^8)
+ */
+static uint8_t xtime(uint8_t a)
+{
+	return (uint8_t)((a << 1) ^ ((a & 0x80) ? 0x1b : 0x00));
+}
+
+/**
+ * @brief Multiply two elements of GF(2^8)
+ */
+static uint8_t gmul(uint8_t a, uint8_t b)
+{
+	uint8_t result = 0;
+	while (b != 0)
+	{
+		if (b & 1)
+		{
+			result ^= a;
+		}
+		a = xtime(a);
+		b >>= 1;
+	}
+	return result;
+}
+
+/**
+ * @brief Expand the key into the 11 round keys
+ */
+static void expandKey(const uint8_t key[16], uint8_t roundKeys[176])
+{
+	uint8_t rcon = 0x01;
+	memcpy(roundKeys, key, 16);
+	for (int idx = 16; idx < 176; idx += 4)
+	{
+		uint8_t temp[4];
+		memcpy(temp, &roundKeys[idx - 4], 4);
+		if ((idx % 16) == 0)
+		{
+			uint8_t first = temp[0];
+			temp[0] = sbox[temp[1]] ^ rcon;
+			temp[1] = sbox[temp[2]];
+			temp[2] = sbox[temp[3]];
+			temp[3] = sbox[first];
+			rcon = xtime(rcon);
+		}
+		for (int byte = 0; byte < 4; byte++)
+		{
+			roundKeys[idx + byte] = roundKeys[idx - 16 + byte] ^ temp[byte];
+		}
+	}
+}
+
+static void addRoundKey(uint8_t state[16], const uint8_t *roundKey)
+{
+	for (int idx = 0; idx < 16; idx++)
+	{
+		state[idx] ^= roundKey[idx];
+	}
+}
+
+void aesEncrypt(const uint8_t key[16], const uint8_t in[16], uint8_t out[16])
+{
+	uint8_t roundKeys[176];
+	uint8_t state[16];
+	expandKey(key, roundKeys);
+	memcpy(state, in, 16);
+	addRoundKey(state, roundKeys);
+	for (int round = 1; round <= 10; round++)
+	{
+		uint8_t temp[16];
+		// SubBytes and ShiftRows, the state is column major
+		for (int col = 0; col < 4; col++)
+		{
+			for (int row = 0; row < 4; row++)
+			{
+				temp[col * 4 + row] = sbox[state[((col + row) % 4) * 4 + row]];
+			}
+		}
+		if (round != 10)
+		{
+			// MixColumns
+			for (int col = 0; col < 4; col++)
+			{
+				uint8_t *c = &temp[col * 4];
+				uint8_t a0 = c[0], a1 = c[1], a2 = c[2], a3 = c[3];
+				c[0] = xtime(a0) ^ (xtime(a1) ^ a1) ^ a2 ^ a3;
+				c[1] = a0 ^ xtime(a1) ^ (xtime(a2) ^ a2) ^ a3;
+				c[2] = a0 ^ a1 ^ xtime(a2) ^ (xtime(a3) ^ a3);
+				c[3] = (xtime(a0) ^ a0) ^ a1 ^ a2 ^ xtime(a3);
+			}
+		}
+		memcpy(state, temp, 16);
+		addRoundKey(state, &roundKeys[round * 16]);
+	}
+	memcpy(out, state, 16);
+}
+
+void aesDecrypt(const uint8_t key[16], const uint8_t in[16], uint8_t out[16])
+{
+	if (!invSboxReady)
+	{
+		for (int idx = 0; idx < 256; idx++)
+		{
+			invSbox[sbox[idx]] = (uint8_t)idx;
+		}
+		invSboxReady = true;
+	}
+	uint8_t roundKeys[176];
+	uint8_t state[16];
+	expandKey(key, roundKeys);
+	memcpy(state, in, 16);
+	addRoundKey(state, &roundKeys[160]);
+	for (int round = 9; round >= 0; round--)
+	{
+		uint8_t temp[16];
+		// InvShiftRows and InvSubBytes
+		for (int col = 0; col < 4; col++)
+		{
+			for (int row = 0; row < 4; row++)
+			{
+				temp[((col + row) % 4) * 4 + row] = invSbox[state[col * 4 + row]];
+			}
+		}
+		addRoundKey(temp, &roundKeys[round * 16]);
+		if (round != 0)
+		{
+			// InvMixColumns
+			for (int col = 0; col < 4; col++)
+			{
+				uint8_t *c = &temp[col * 4];
+				uint8_t a0 = c[0], a1 = c[1], a2 = c[2], a3 = c[3];
+				c[0] = gmul(a0, 14) ^ gmul(a1, 11) ^ gmul(a2, 13) ^ gmul(a3, 9);
+				c[1] = gmul(a0, 9) ^ gmul(a1, 14) ^ gmul(a2, 11) ^ gmul(a3, 13);
+				c[2] = gmul(a0, 13) ^ gmul(a1, 9) ^ gmul(a2, 14) ^ gmul(a3, 11);
+				c[3] = gmul(a0, 11) ^ gmul(a1, 13) ^ gmul(a2, 9) ^ gmul(a3, 14);
+			}
+		}
+		memcpy(state, temp, 16);
+	}
+	memcpy(out, state, 16);
+}
+
+/**
+ * @brief Shift a block left by one bit, xor Rb if the MSB was set
+ */
+static void cmacSubkey(const uint8_t in[16], uint8_t out[16])
+{
+	uint8_t carry = 0;
+	for (int idx = 15; idx >= 0; idx--)
+	{
+		uint8_t next = in[idx] >> 7;
+		out[idx] = (uint8_t)((in[idx] << 1) | carry);
+		carry = next;
+	}
+	if (carry)
+	{
+		out[15] ^= 0x87;
+	}
+}
+
+void aesCmac(const uint8_t key[16], const uint8_t *data, size_t len, uint8_t mac[16])
+{
+	uint8_t zero[16] = {0};
+	uint8_t l[16];
+	uint8_t k1[16];
+	uint8_t k2[16];
+	aesEncrypt(key, zero, l);
+	cmacSubkey(l, k1);
+	cmacSubkey(k1, k2);
+
+	size_t blocks = (len + 15) / 16;
+	bool complete = (len != 0) && ((len % 16) == 0);
+	if (blocks == 0)
+	{
+		blocks = 1;
+	}
+
+	uint8_t x[16] = {0};
+	for (size_t block = 0; block < blocks; block++)
+	{
+		uint8_t y[16];
+		for (int idx = 0; idx < 16; idx++)
+		{
+			size_t pos = block * 16 + idx;
+			uint8_t byte;
+			if (block != blocks - 1)
+			{
+				byte = data[pos];
+			}
+			else if (complete)
+			{
+				byte = data[pos] ^ k1[idx];
+			}
+			else
+			{
+				byte = (pos < len ? data[pos] : (pos == len ? 0x80 : 0x00)) ^ k2[idx];
+			}
+			y[idx] = x[idx] ^ byte;
+		}
+		aesEncrypt(key, y, x);
+	}
+	memcpy(mac, x, 16);
+}
+
+void loraPayloadCrypt(const uint8_t key[16], uint8_t dir, uint32_t devAddr, uint32_t fCnt, uint8_t *data, size_t len)
+{
+	uint8_t a[16] = {0x01, 0, 0, 0, 0, dir, (uint8_t)devAddr, (uint8_t)(devAddr >> 8), (uint8_t)(devAddr >> 16),
+					 (uint8_t)(devAddr >> 24), (uint8_t)fCnt, (uint8_t)(fCnt >> 8), (uint8_t)(fCnt >> 16),
+					 (uint8_t)(fCnt >> 24), 0, 0};
+	uint8_t s[16];
+	for (size_t pos = 0; pos < len; pos += 16)
+	{
+		a[15] = (uint8_t)(pos / 16 + 1);
+		aesEncrypt(key, a, s);
+		for (size_t idx = 0; (idx < 16) && (pos + idx < len); idx++)
+		{
+			data[pos + idx] ^= s[idx];
+		}
+	}
+}
+
+uint32_t loraDataMic(const uint8_t key[16], uint8_t dir, uint32_t devAddr, uint32_t fCnt, const uint8_t *msg, size_t len)
+{
+	uint8_t block[16 + 256];
+	uint8_t b0[16] = {0x49, 0, 0, 0, 0, dir, (uint8_t)devAddr, (uint8_t)(devAddr >> 8), (uint8_t)(devAddr >> 16),
+					  (uint8_t)(devAddr >> 24), (uint8_t)fCnt, (uint8_t)(fCnt >> 8), (uint8_t)(fCnt >> 16),
+					  (uint8_t)(fCnt >> 24), 0, (uint8_t)len};
+	memcpy(block, b0, 16);
+	memcpy(&block[16], msg, len);
+	uint8_t mac[16];
+	aesCmac(key, block, 16 + len, mac);
+	return mac[0] | (mac[1] << 8) | (mac[2] << 16) | ((uint32_t)mac[3] << 24);
+}
+
+uint32_t loraJoinMic(const uint8_t key[16], const uint8_t *msg, size_t len)
+{
+	uint8_t mac[16];
+	aesCmac(key, msg, len, mac);
+	return mac[0] | (mac[1] << 8) | (mac[2] << 16) | ((uint32_t)mac[3] << 24);
+}
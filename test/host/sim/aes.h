@@ -0,0 +1,34 @@
+/**
+ * @file aes.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief AES-128 and AES-CMAC for the LoRaWan frames of the simulation
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note FIPS-197 and RFC 4493 and the frame security of LoRaWan 1.0.3,
+ * used by the device MAC and the network server stand-in.
+ */
+#ifndef SIM_AES_H
+#define SIM_AES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Encrypt one 16 byte block */
+void aesEncrypt(const uint8_t key[16], const uint8_t in[16], uint8_t out[16]);
+/** Decrypt one 16 byte block */
+void aesDecrypt(const uint8_t key[16], const uint8_t in[16], uint8_t out[16]);
+/** AES-CMAC of a message */
+void aesCmac(const uint8_t key[16], const uint8_t *data, size_t len, uint8_t mac[16]);
+
+// LoRaWan 1.0.3 frame security, dir 0 = uplink, 1 = downlink
+/** Encrypt or decrypt a FRMPayload in place */
+void loraPayloadCrypt(const uint8_t key[16], uint8_t dir, uint32_t devAddr, uint32_t fCnt, uint8_t *data, size_t len);
+/** MIC of a data frame, msg is MHDR up to the end of FRMPayload */
+uint32_t loraDataMic(const uint8_t key[16], uint8_t dir, uint32_t devAddr, uint32_t fCnt, const uint8_t *msg, size_t len);
+/** MIC of a join request or join accept */
+uint32_t loraJoinMic(const uint8_t key[16], const uint8_t *msg, size_t len);
+
+#endif
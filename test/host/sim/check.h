@@ -0,0 +1,72 @@
+/**
+ * @file check.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Checks of the host tests
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Every test is its own program, a failed check is printed and
+ * checkResult() returns the exit code for main().
+ */
+#ifndef SIM_CHECK_H
+#define SIM_CHECK_H
+
+#include <stdio.h>
+
+static int checkFailures = 0;
+static int checkCount = 0;
+
+#define CHECK(cond)                                                        \
+	do                                                                     \
+	{                                                                      \
+		checkCount++;                                                      \
+		if (!(cond))                                                       \
+		{                                                                  \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			checkFailures++;                                               \
+		}                                                                  \
+	} while (0)
+
+#define CHECK_EQ(a, b)                                                                  \
+	do                                                                                  \
+	{                                                                                   \
+		checkCount++;                                                                   \
+		long long checkA = (long long)(a);                                              \
+		long long checkB = (long long)(b);                                              \
+		if (checkA != checkB)                                                           \
+		{                                                                               \
+			printf("%s:%d: CHECK_EQ(%s, %s) failed, %lld != %lld\n", __FILE__, __LINE__, \
+				   #a, #b, checkA, checkB);                                             \
+			checkFailures++;                                                            \
+		}                                                                               \
+	} while (0)
+
+#define CHECK_NEAR(a, b, tolerance)                                                           \
+	do                                                                                        \
+	{                                                                                         \
+		checkCount++;                                                                         \
+		double checkA = (double)(a);                                                          \
+		double checkB = (double)(b);                                                          \
+		if ((checkA - checkB > (tolerance)) || (checkB - checkA > (tolerance)))               \
+		{                                                                                     \
+			printf("%s:%d: CHECK_NEAR(%s, %s) failed, %g != %g\n", __FILE__, __LINE__, #a, #b, \
+				   checkA, checkB);                                                           \
+			checkFailures++;                                                                  \
+		}                                                                                     \
+	} while (0)
+
+/**
+ * @brief Print the summary of a test
+ *
+ * @param name Name of the test
+ * @return int Exit code, 1 if a check failed
+ */
+static int checkResult(const char *name)
+{
+	printf("%s: %d checks, %d failed\n", name, checkCount, checkFailures);
+	return checkFailures == 0 ? 0 : 1;
+}
+
+#endif
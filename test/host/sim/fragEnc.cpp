@@ -0,0 +1,101 @@
+/**
+ * @file fragEnc.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Server side of the fragmented data block transport
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Written from the TS004 reference code, independent of the
+ * decoder in fragRx.cpp.
+ */
+#include "fragEnc.h"
+
+/**
+ * @brief Pseudo random generator of the parity matrix
+ */
+static int32_t prbs23(int32_t value)
+{
+	int32_t b0 = value & 0x01;
+	int32_t b1 = (value & 0x20) >> 5;
+	return (value >> 1) + ((b0 ^ b1) << 22);
+}
+
+/**
+ * @brief Line n of the parity matrix for m data fragments
+ */
+static std::vector<bool> parityLine(uint16_t n, uint16_t m)
+{
+	std::vector<bool> line(m, false);
+	int32_t mTemp = ((m & (m - 1)) == 0) ? 1 : 0;
+	int32_t x = 1 + 1001 * (int32_t)n;
+	for (int nbCoeff = 0; nbCoeff < m / 2; nbCoeff++)
+	{
+		int32_t r = 1 << 16;
+		while (r >= m)
+		{
+			x = prbs23(x);
+			r = x % (m + mTemp);
+		}
+		line[r] = true;
+	}
+	return line;
+}
+
+std::vector<uint8_t> fragEncSetup(uint8_t fragIndex, uint16_t nbFrag, uint8_t fragSize, uint8_t matrix,
+								  uint8_t padding, uint32_t descriptor)
+{
+	std::vector<uint8_t> frame;
+	frame.push_back(0x02);
+	// FragIndex and McGroupBitMask, group 0
+	frame.push_back((fragIndex << 4) | 0x01);
+	frame.push_back(nbFrag);
+	frame.push_back(nbFrag >> 8);
+	frame.push_back(fragSize);
+	// FragmentationMatrix and BlockAckDelay
+	frame.push_back(matrix << 3);
+	frame.push_back(padding);
+	for (int idx = 0; idx < 4; idx++)
+	{
+		frame.push_back(descriptor >> (8 * idx));
+	}
+	return frame;
+}
+
+std::vector<uint8_t> fragEncFragment(const std::vector<uint8_t> &block, uint16_t nbFrag, uint8_t fragSize,
+									 uint8_t fragIndex, uint16_t index)
+{
+	std::vector<uint8_t> data(fragSize, 0);
+	if (index <= nbFrag)
+	{
+		for (uint8_t pos = 0; pos < fragSize; pos++)
+		{
+			size_t src = (size_t)(index - 1) * fragSize + pos;
+			data[pos] = src < block.size() ? block[src] : 0;
+		}
+	}
+	else
+	{
+		std::vector<bool> line = parityLine(index - nbFrag, nbFrag);
+		for (uint16_t frag = 0; frag < nbFrag; frag++)
+		{
+			if (!line[frag])
+			{
+				continue;
+			}
+			for (uint8_t pos = 0; pos < fragSize; pos++)
+			{
+				size_t src = (size_t)frag * fragSize + pos;
+				data[pos] ^= src < block.size() ? block[src] : 0;
+			}
+		}
+	}
+	std::vector<uint8_t> frame;
+	frame.push_back(0x08);
+	uint16_t indexAndN = (index & 0x3FFF) | (fragIndex << 14);
+	frame.push_back(indexAndN);
+	frame.push_back(indexAndN >> 8);
+	frame.insert(frame.end(), data.begin(), data.end());
+	return frame;
+}
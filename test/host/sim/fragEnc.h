@@ -0,0 +1,27 @@
+/**
+ * @file fragEnc.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Server side of the fragmented data block transport
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Builds the FRAG_PORT downlinks of TS004 v1.0, the coded
+ * fragments use the parity matrix of TS004 chapter 12.
+ */
+#ifndef SIM_FRAG_ENC_H
+#define SIM_FRAG_ENC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/** FragSessionSetupReq downlink */
+std::vector<uint8_t> fragEncSetup(uint8_t fragIndex, uint16_t nbFrag, uint8_t fragSize, uint8_t matrix,
+								  uint8_t padding, uint32_t descriptor);
+/** DataFragment downlink, index is 1 based, indices above nbFrag are coded fragments */
+std::vector<uint8_t> fragEncFragment(const std::vector<uint8_t> &block, uint16_t nbFrag, uint8_t fragSize,
+									 uint8_t fragIndex, uint16_t index);
+
+#endif
@@ -0,0 +1,116 @@
+/**
+ * @file ns.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Virtual LoRa radio and network server stand-in
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The device MAC in simLora.cpp sends real LoRaWan 1.0.3 frames.
+ * The network server in simNs.cpp verifies the join requests, derives
+ * the session keys, checks MIC and frame counters, decrypts the
+ * FRMPayload and schedules downlinks into RX1 of the uplink, into the
+ * ping slots of a class B device or immediately for a class C device.
+ */
+#ifndef SIM_NS_H
+#define SIM_NS_H
+
+#include "sim.h"
+#include <vector>
+
+// Virtual radio
+/** Time on air of a LoRa frame with 125 kHz bandwidth, CR 4/5 and 8 preamble symbols */
+uint32_t simLoraToaUs(uint8_t sf, uint16_t len, bool crc);
+/** Spreading factor of a data rate */
+uint8_t simLoraSf(uint8_t dr);
+/** Downlink from the network server, starts at startUs */
+void simRadioDownlink(const uint8_t *frame, uint8_t len, uint8_t dr, uint64_t startUs);
+
+/** Radio conditions */
+struct sim_lora_cfg_s
+{
+	/** Probability that an uplink or a downlink is lost */
+	double upLoss;
+	double downLoss;
+	/** RSSI and SNR of the downlinks */
+	int16_t rssi;
+	int8_t snr;
+	/** Flag if the gateways send class B beacons */
+	bool beacon;
+};
+extern sim_lora_cfg_s simLoraCfg;
+
+/** Device MAC counters */
+struct sim_lora_stats_s
+{
+	uint32_t joinRequests;
+	uint32_t uplinks;
+	uint32_t retransmissions;
+	uint32_t lost;
+	uint64_t airtimeUs;
+	uint32_t rxWindows;
+	uint32_t downlinks;
+	uint32_t rxDropped;
+	uint32_t busy;
+	/** Time of the last TX start and end */
+	uint64_t lastTxStart;
+	uint64_t lastTxEnd;
+};
+extern sim_lora_stats_s simLoraStats;
+/** Called for every lmh_send() of the firmware with its result, also for the ones that fail */
+void simLoraOnSend(std::function<void(uint8_t port, const uint8_t *data, uint8_t len, bool confirmed, int8_t result)> callback);
+
+// Network server
+/** Uplink received by the network server */
+struct ns_uplink_s
+{
+	uint32_t devAddr;
+	uint32_t fCnt;
+	uint8_t port;
+	bool confirmed;
+	bool classB;
+	/** Retransmission of a confirmed uplink with the same frame counter */
+	bool retransmission;
+	std::vector<uint8_t> payload;
+	uint64_t txStartUs;
+	uint64_t txEndUs;
+};
+
+struct ns_stats_s
+{
+	uint32_t joinRequests;
+	uint32_t joinAccepts;
+	uint32_t devNonceReuse;
+	uint32_t uplinks;
+	uint32_t micFailures;
+	uint32_t fCntRejects;
+	uint32_t retransmissions;
+	uint32_t unknownDevices;
+	uint32_t downlinks;
+	uint32_t acks;
+	uint32_t classSwitches;
+	uint32_t pingSlotInfo;
+};
+extern ns_stats_s nsStats;
+
+/** Provision a device for OTAA */
+void nsAddOtaa(const uint8_t devEui[8], const uint8_t appEui[8], const uint8_t appKey[16]);
+/** Provision a device for ABP */
+void nsAddAbp(uint32_t devAddr, const uint8_t nwkSKey[16], const uint8_t appSKey[16]);
+/** Queue a downlink for the device, sent with the next chance the device class allows */
+void nsQueueDownlink(uint8_t port, const uint8_t *data, uint8_t len, bool confirmed = false);
+/** Class of the device as known by the server */
+uint8_t nsDeviceClass(void);
+/** Ping slot periodicity announced by the device, 0xFF if none */
+uint8_t nsPingPeriodicity(void);
+/** Downlinks waiting in the queue */
+size_t nsQueued(void);
+/** Uplinks received, in order */
+std::vector<ns_uplink_s> &nsUplinks(void);
+/** Called for every accepted uplink */
+void nsOnUplink(std::function<void(const ns_uplink_s &uplink)> callback);
+/** Uplink from the virtual radio, called at the end of the transmission */
+void nsReceive(const uint8_t *frame, uint8_t len, uint8_t dr, uint64_t txStartUs, uint64_t txEndUs);
+
+#endif
@@ -0,0 +1,520 @@
+/**
+ * @file replay.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Replay of event traces against the firmware on the virtual clock
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The scheduler is observed through schedStats, the uplinks through
+ * the virtual radio and the network server. Nothing in the firmware is
+ * changed for the replay.
+ */
+#include "replay.h"
+#include "ns.h"
+#include <LoRaWan-RAK4630.h>
+#include <math.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern uint8_t nodeDeviceEUI[8];
+extern uint8_t nodeAppEUI[8];
+extern uint8_t nodeAppKey[16];
+extern BLECharacteristic relayUpChar;
+
+const char *replayEventNames[REPLAY_NUM_EVENTS] = {"motion", "join delay", "send fail", "BLE connect", "shock"};
+
+/** Time to first fix of the GPS model in ms */
+#define REPLAY_TTFF 25000
+/** Interval of the accelerometer interrupts during a motion burst in ms */
+#define REPLAY_ACC_INT 2000
+/** Class A receive window without a downlink in ms, as CLASSB_PING_WINDOW */
+#define REPLAY_RX_WINDOW 30
+/** Start position of the traces */
+#define REPLAY_LAT 35.6895
+#define REPLAY_LNG 139.6917
+
+/**
+ * @brief Random numbers of the trace generator, SplitMix64
+ */
+static uint64_t traceRandom(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/**
+ * @brief Uniform random number min..max
+ */
+static uint32_t traceRange(uint64_t *state, uint32_t min, uint32_t max)
+{
+	return min + (uint32_t)(traceRandom(state) % (max - min + 1));
+}
+
+/**
+ * @brief Add events of one type with random gaps and durations
+ */
+static void traceAdd(replay_trace_s *trace, uint64_t *state, uint8_t type, uint32_t from, uint32_t minGap,
+					 uint32_t maxGap, uint32_t minDuration, uint32_t maxDuration)
+{
+	uint32_t time = from + traceRange(state, minGap, maxGap);
+	while (time < trace->durationMs)
+	{
+		replay_event_s event;
+		event.type = type;
+		event.startMs = time;
+		event.durationMs = traceRange(state, minDuration, maxDuration);
+		event.speed = traceRange(state, 300, 3000);
+		event.course = traceRange(state, 0, 3599);
+		trace->events.push_back(event);
+		time += event.durationMs + traceRange(state, minGap, maxGap);
+	}
+}
+
+replay_trace_s replayRandomTrace(uint64_t seed, uint32_t durationMs)
+{
+	replay_trace_s trace;
+	trace.seed = seed;
+	trace.durationMs = durationMs;
+	uint64_t state = seed;
+	uint32_t joinEnd = 0;
+	if (traceRange(&state, 0, 9) < 3)
+	{
+		replay_event_s event = {REPLAY_JOIN_DELAY, 0, traceRange(&state, 10000, 300000), 0, 0};
+		trace.events.push_back(event);
+		joinEnd = event.durationMs;
+	}
+	traceAdd(&trace, &state, REPLAY_MOTION, 0, 120000, 1200000, 30000, 600000);
+	// Outages do not overlap with the join delay, both use the uplink loss
+	traceAdd(&trace, &state, REPLAY_SEND_FAIL, joinEnd, 300000, 2400000, 20000, 300000);
+	traceAdd(&trace, &state, REPLAY_BLE, 0, 600000, 3600000, 10000, 600000);
+	traceAdd(&trace, &state, REPLAY_SHOCK, 0, 600000, 3600000, 0, 0);
+	std::stable_sort(trace.events.begin(), trace.events.end(),
+					 [](const replay_event_s &a, const replay_event_s &b) { return a.startMs < b.startMs; });
+	return trace;
+}
+
+/** State of the run in the child process */
+static const replay_trace_s *runTrace;
+static replay_result_s *runResult;
+/** Open latency measurements, start time in ms per event type, 0xFFFFFFFF = none */
+static std::vector<uint32_t> pending[REPLAY_NUM_EVENTS];
+static uint32_t lastReportSend = 0xFFFFFFFF;
+
+/**
+ * @brief FNV-1a over data
+ */
+static void hashAdd(const void *data, size_t len)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (size_t idx = 0; idx < len; idx++)
+	{
+		runResult->hash ^= bytes[idx];
+		runResult->hash *= 0x100000001B3ULL;
+	}
+}
+
+static void latencyAdd(replay_latency_s *latency, uint32_t ms)
+{
+	latency->count++;
+	latency->totalMs += ms;
+	if (ms > latency->maxMs)
+	{
+		latency->maxMs = ms;
+	}
+}
+
+/**
+ * @brief Close the open measurements of an event type at a time in ms
+ */
+static void latencyCloseAt(uint8_t type, uint32_t now)
+{
+	for (uint32_t start : pending[type])
+	{
+		latencyAdd(&runResult->latency[type], now - start);
+	}
+	pending[type].clear();
+}
+
+/**
+ * @brief Close the open measurements of an event type that started before now
+ */
+static void latencyClose(uint8_t type)
+{
+	latencyCloseAt(type, simNowUs() / 1000);
+}
+
+static bool reportPort(uint8_t port, uint8_t len)
+{
+	return (len != 0) && ((port == LORAWAN_APP_PORT) || (port == POS_HEARTBEAT_PORT) || (port == TRIP_PORT));
+}
+
+/**
+ * @brief A report left the tracker, over LoRaWan or the BLE relay
+ */
+static void reportSent(uint32_t ms)
+{
+	if ((lastReportSend != 0xFFFFFFFF) && ((ms - lastReportSend) < SCHED_MIN_REPORT_GAP))
+	{
+		runResult->duplicates++;
+	}
+	lastReportSend = ms;
+	latencyClose(REPLAY_MOTION);
+	latencyClose(REPLAY_BLE);
+}
+
+/**
+ * @brief Position of the tracker, the motion bursts of the trace added up
+ */
+static sim_gps_state_s replayGps(uint32_t ms)
+{
+	sim_gps_state_s state;
+	memset(&state, 0, sizeof(state));
+	double north = 0.0;
+	double east = 0.0;
+	for (const replay_event_s &event : runTrace->events)
+	{
+		if ((event.type != REPLAY_MOTION) || (event.startMs >= ms))
+		{
+			continue;
+		}
+		uint32_t end = event.startMs + event.durationMs;
+		double meters = event.speed / 100.0 * ((ms < end ? ms : end) - event.startMs) / 1000.0;
+		double course = event.course / 10.0 * M_PI / 180.0;
+		north += meters * cos(course);
+		east += meters * sin(course);
+		if (ms < end)
+		{
+			state.speedKn = event.speed / 100.0 * 1.943844;
+			state.course = event.course / 10.0;
+		}
+	}
+	state.fix = ms >= REPLAY_TTFF;
+	state.lat = REPLAY_LAT + north / 111320.0;
+	state.lng = REPLAY_LNG + east / (111320.0 * cos(REPLAY_LAT * M_PI / 180.0));
+	state.alt = 40.0;
+	state.hdop = state.fix ? 90 : 9999;
+	state.satsUsed = state.fix ? 9 : 0;
+	state.inView[0] = 9;
+	state.inView[1] = 6;
+	state.cn0 = 38;
+	state.unixTime = 1600560000 + ms / 1000;
+	return state;
+}
+
+/**
+ * @brief Put the events of the trace on the virtual clock
+ */
+static void scheduleEvents(void)
+{
+	for (const replay_event_s &event : runTrace->events)
+	{
+		uint64_t start = (uint64_t)event.startMs * 1000;
+		uint64_t end = start + (uint64_t)event.durationMs * 1000;
+		uint8_t type = event.type;
+		runResult->events[type]++;
+		switch (type)
+		{
+		case REPLAY_MOTION:
+			simAt(start, [type]() {
+				pending[type].push_back(simNowUs() / 1000);
+				simAccSet(0.35, 0.2, 1.1);
+			});
+			for (uint64_t time = start; time < end; time += REPLAY_ACC_INT * 1000ULL)
+			{
+				simAt(time, []() { simAccMotion(); });
+			}
+			simAt(end, []() { simAccSet(0.0, 0.0, 1.0); });
+			break;
+		case REPLAY_JOIN_DELAY:
+			simLoraCfg.upLoss = 1.0;
+			simAt(end, [type]() {
+				simLoraCfg.upLoss = 0.0;
+				pending[type].push_back(simNowUs() / 1000);
+			});
+			break;
+		case REPLAY_SEND_FAIL:
+			simAt(start, []() { simLoraCfg.upLoss = 1.0; });
+			simAt(end, [type]() {
+				simLoraCfg.upLoss = 0.0;
+				pending[type].push_back(simNowUs() / 1000);
+			});
+			break;
+		case REPLAY_BLE:
+			simAt(start, [type]() {
+				pending[type].push_back(simNowUs() / 1000);
+				simBleConnect(247);
+			});
+			simAt(end, []() { simBleDisconnect(); });
+			break;
+		case REPLAY_SHOCK:
+			simAt(start, [type]() {
+				pending[type].push_back(simNowUs() / 1000);
+				simAccShock();
+			});
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Number of finished GPS acquisitions
+ */
+static uint32_t acquisitions(void)
+{
+	uint32_t count = 0;
+	for (uint8_t reason = 0; reason < GPS_END_NUM; reason++)
+	{
+		count += gpsAcqStats.endCount[reason];
+	}
+	return count;
+}
+
+/**
+ * @brief Run the trace, called in the child process
+ */
+static void replayChild(void)
+{
+	simSeed(runTrace->seed);
+	simBattMv(runTrace->battMv);
+	simGpsModel(replayGps);
+	nsAddOtaa(nodeDeviceEUI, nodeAppEUI, nodeAppKey);
+
+	simLoraOnSend([](uint8_t port, const uint8_t *data, uint8_t len, bool confirmed, int8_t result) {
+		uint64_t now = simNowUs();
+		hashAdd(&now, sizeof(now));
+		hashAdd(&port, 1);
+		hashAdd(data, len);
+		hashAdd(&result, 1);
+		if (result != LMH_SUCCESS)
+		{
+			runResult->sendErrors++;
+			return;
+		}
+		runResult->uplinks++;
+		latencyClose(REPLAY_JOIN_DELAY);
+		if (port == TRIP_PORT)
+		{
+			runResult->tripUplinks++;
+		}
+		if (port == ALARM_PORT)
+		{
+			// Interrupt to TX, the radio starts after its setup time
+			runResult->alarmUplinks++;
+			latencyCloseAt(REPLAY_SHOCK, simLoraStats.lastTxStart / 1000);
+			return;
+		}
+		if (!reportPort(port, len))
+		{
+			return;
+		}
+		reportSent(now / 1000);
+	});
+	nsOnUplink([](const ns_uplink_s &uplink) {
+		hashAdd(&uplink.fCnt, sizeof(uplink.fCnt));
+		if (reportPort(uplink.port, uplink.payload.size()))
+		{
+			latencyClose(REPLAY_SEND_FAIL);
+		}
+	});
+
+	scheduleEvents();
+	simGpsStart();
+	simStartFirmware();
+
+	uint64_t endUs = (uint64_t)runTrace->durationMs * 1000;
+	uint16_t reports = 0;
+	uint16_t rearms = 0;
+	uint32_t relayed = 0;
+	uint32_t acqs = 0;
+	bool joined = false;
+	uint32_t lastDecision = 0xFFFFFFFF;
+	uint32_t lastRearm = 0xFFFFFFFF;
+	// An alarm owns the loop and the radio until it is delivered or failed, its time does not count as missed
+	bool alarmHeld = false;
+	uint32_t alarmStart = 0;
+	uint32_t alarmMs = 0;
+	uint8_t devClass = currentClass;
+	uint32_t classStart = 0;
+	while (simNowUs() < endUs)
+	{
+		uint32_t remaining = (endUs - simNowUs() + 999) / 1000;
+		simRunFor([&]() { return (schedStats.actions[SCHED_REPORT] != reports) || (schedStats.rearms != rearms) ||
+								 (relayUpChar.notifyCount != relayed) || (acquisitions() != acqs) ||
+								 (runTrace->noPosCache && posCache.valid) || (accAlarmPending != alarmHeld) ||
+								 (currentClass != devClass) || (!joined && lmhJoined()); },
+				  remaining);
+		uint32_t now = simNowUs() / 1000;
+		// Report interval of the battery policy
+		uint32_t interval = xTimerGetPeriod(periodicSending.getHandle()) * 1000 / configTICK_RATE_HZ;
+		uint32_t allowed = interval + SCHED_MIN_REPORT_GAP + REPLAY_REPORT_SLACK;
+		if (!joined && lmhJoined())
+		{
+			joined = true;
+			runResult->joinMs = now;
+		}
+		if (runTrace->noPosCache)
+		{
+			posCache.valid = false;
+		}
+		if (currentClass != devClass)
+		{
+			runResult->classMs[devClass] += now - classStart;
+			devClass = currentClass;
+			classStart = now;
+		}
+		if (accAlarmPending != alarmHeld)
+		{
+			alarmHeld = accAlarmPending;
+			if (alarmHeld)
+			{
+				alarmStart = now;
+			}
+			else
+			{
+				alarmMs += now - alarmStart;
+			}
+		}
+		uint32_t held = alarmMs + (alarmHeld ? now - alarmStart : 0);
+		if (acquisitions() != acqs)
+		{
+			runResult->gpsAcquisitions += acquisitions() - acqs;
+			acqs = acquisitions();
+			runResult->gpsOnMs += gpsAcqStats.lastDuration;
+		}
+		if (relayUpChar.notifyCount != relayed)
+		{
+			// While a central is connected the reports go over the BLE relay, first byte is the port
+			relayed = relayUpChar.notifyCount;
+			runResult->relayed++;
+			hashAdd(&now, sizeof(now));
+			hashAdd(relayUpChar.lastNotify, relayUpChar.lastNotifyLen);
+			if (relayUpChar.lastNotify[0] == ALARM_PORT)
+			{
+				runResult->alarmUplinks++;
+				latencyClose(REPLAY_SHOCK);
+			}
+			else if (reportPort(relayUpChar.lastNotify[0], relayUpChar.lastNotifyLen - 1))
+			{
+				reportSent(now);
+			}
+		}
+		if (schedStats.rearms != rearms)
+		{
+			rearms = schedStats.rearms;
+			lastRearm = lastRearm == 0xFFFFFFFF ? now : lastRearm;
+		}
+		if (schedStats.actions[SCHED_REPORT] != reports)
+		{
+			reports = schedStats.actions[SCHED_REPORT];
+			if ((lastDecision != 0xFFFFFFFF) && ((now - lastDecision - held) > allowed))
+			{
+				runResult->missedReports +=
+					(now - lastDecision - held - SCHED_MIN_REPORT_GAP - REPLAY_REPORT_SLACK) / interval;
+			}
+			lastDecision = now;
+			alarmMs = 0;
+			alarmStart = now;
+			if (lastRearm != 0xFFFFFFFF)
+			{
+				latencyAdd(&runResult->rearmToReport, now - lastRearm);
+				lastRearm = 0xFFFFFFFF;
+			}
+		}
+		else if ((simNowUs() >= endUs) && (lastDecision != 0xFFFFFFFF) && ((now - lastDecision - held) > allowed))
+		{
+			// No report until the end of the trace
+			runResult->missedReports +=
+				(now - lastDecision - held - SCHED_MIN_REPORT_GAP - REPLAY_REPORT_SLACK) / interval;
+		}
+	}
+
+	runResult->classMs[devClass] += simNowUs() / 1000 - classStart;
+	runResult->lost = simLoraStats.lost;
+	runResult->airtimeUs = simLoraStats.airtimeUs;
+	runResult->rxWindows = simLoraStats.rxWindows;
+	runResult->devClass = currentClass;
+	runResult->duplicates += nsStats.fCntRejects;
+	runResult->reports = schedStats.actions[SCHED_REPORT];
+	runResult->skipped = motionStats.skipped;
+	runResult->rearms = schedStats.rearms;
+	memcpy(runResult->actions, schedStats.actions, sizeof(runResult->actions));
+	for (uint8_t type = 0; type < ALARM_NUM_TYPES; type++)
+	{
+		runResult->alarmsRaised += alarmStats.count[type];
+	}
+	runResult->alarmsFailed = alarmStats.failed;
+	runResult->alarmNoAck = alarmStats.noAck;
+	runResult->alarmMaxLatency = alarmStats.maxLatency;
+	runResult->sleepTicks = powerStats.sleepTicks;
+	runResult->expectedTicks = powerStats.expectedTicks;
+	runResult->sleeps = powerStats.sleeps;
+	runResult->idleEntries = powerStats.idleEntries;
+	memcpy(runResult->wakeCount, powerStats.wakeCount, sizeof(runResult->wakeCount));
+	runResult->residency = (uint64_t)powerStats.sleepTicks * 1000 / xTaskGetTickCount();
+	// The MCU sleeps while the GPS acquires and the radio transmits or receives, the device does not
+	uint64_t totalMs = simNowUs() / 1000;
+	uint64_t busyMs = runResult->gpsOnMs + simLoraStats.airtimeUs / 1000 +
+					  (uint64_t)simLoraStats.rxWindows * REPLAY_RX_WINDOW + runResult->classMs[CLASS_C] +
+					  (uint64_t)runResult->classMs[CLASS_B] * CLASSB_PING_WINDOW / (1000 << CLASSB_PING_PERIODICITY) +
+					  (uint64_t)runResult->classMs[CLASS_B] * CLASSB_BEACON_WINDOW / CLASSB_BEACON_PERIOD;
+	uint64_t sleepMs = (uint64_t)powerStats.sleepTicks * portTICK_PERIOD_MS;
+	runResult->deviceResidency = sleepMs > busyMs ? (sleepMs - busyMs) * 1000 / totalMs : 0;
+	runResult->policyLevel = policyLevel;
+	hashAdd(&powerStats, sizeof(powerStats));
+	runResult->cacheHits = posCache.hits;
+	runResult->gpsSavedMs = posCache.gpsSavedMs;
+	runResult->pipe = pipeStats;
+	runResult->trips = tripStats.trips;
+	hashAdd(&pipeStats, sizeof(pipeStats));
+	hashAdd(runResult->actions, sizeof(runResult->actions));
+	hashAdd(&runResult->rearms, sizeof(runResult->rearms));
+}
+
+replay_result_s replayRun(const replay_trace_s &trace)
+{
+	replay_result_s result;
+	memset(&result, 0, sizeof(result));
+	int fds[2];
+	if (pipe(fds) != 0)
+	{
+		return result;
+	}
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		close(fds[0]);
+		runTrace = &trace;
+		runResult = &result;
+		result.hash = 0xCBF29CE484222325ULL;
+		replayChild();
+		result.ok = true;
+		ssize_t written = write(fds[1], &result, sizeof(result));
+		_exit(written == sizeof(result) ? 0 : 1);
+	}
+	close(fds[1]);
+	replay_result_s child;
+	size_t got = 0;
+	while (got < sizeof(child))
+	{
+		ssize_t len = read(fds[0], (uint8_t *)&child + got, sizeof(child) - got);
+		if (len <= 0)
+		{
+			break;
+		}
+		got += len;
+	}
+	close(fds[0]);
+	int status = 0;
+	waitpid(pid, &status, 0);
+	if ((got == sizeof(child)) && WIFEXITED(status) && (WEXITSTATUS(status) == 0))
+	{
+		result = child;
+	}
+	return result;
+}
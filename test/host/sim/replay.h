@@ -0,0 +1,143 @@
+/**
+ * @file replay.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Replay of event traces against the firmware on the virtual clock
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Every trace runs the complete firmware from setup() in a forked
+ * process, the firmware statics start fresh for each run. The result
+ * comes back through a pipe. A trace with the same seed gives the same
+ * result and the same hash, bit for bit.
+ */
+#ifndef SIM_REPLAY_H
+#define SIM_REPLAY_H
+
+#include "sim.h"
+#include "main.h"
+#include <vector>
+
+/** Event types of a trace */
+/** Motion burst, the tracker drives with speed (cm/s) and course (0.1 deg) for duration ms */
+#define REPLAY_MOTION 0
+/** No gateway receives the uplinks, the join is delayed for duration ms */
+#define REPLAY_JOIN_DELAY 1
+/** No gateway receives the uplinks for duration ms */
+#define REPLAY_SEND_FAIL 2
+/** A BLE central is connected for duration ms */
+#define REPLAY_BLE 3
+/** Shock on the accelerometer, raises an alarm */
+#define REPLAY_SHOCK 4
+#define REPLAY_NUM_EVENTS 5
+
+/** Slack of the periodic report on top of the report interval and the report gap in ms */
+#define REPLAY_REPORT_SLACK 5000
+
+struct replay_event_s
+{
+	uint8_t type;
+	uint32_t startMs;
+	uint32_t durationMs;
+	uint16_t speed;
+	uint16_t course;
+};
+
+struct replay_trace_s
+{
+	uint64_t seed;
+	uint32_t durationMs;
+	/** Battery voltage, selects the policy level */
+	uint16_t battMv = 4100;
+	/** Keep the position cache invalid, every report acquires a fix, for a run without the cache to compare with */
+	bool noPosCache = false;
+	std::vector<replay_event_s> events;
+};
+
+/** Latency of an event type in ms */
+struct replay_latency_s
+{
+	uint32_t count;
+	uint32_t maxMs;
+	uint64_t totalMs;
+};
+
+/** Result of a run, plain data that goes through the pipe */
+struct replay_result_s
+{
+	/** false if the run crashed or timed out */
+	bool ok;
+	/** Hash over all uplinks with time, port, payload and result and the final counters */
+	uint64_t hash;
+	uint32_t events[REPLAY_NUM_EVENTS];
+	/** Motion: burst start to the first report uplink
+	 * Join delay: end of the outage to the first uplink
+	 * Send fail: end of the outage to the first report received by the server
+	 * BLE: connect to the first report, uplink or BLE relay
+	 * Shock: interrupt to the radio TX start of the first alarm uplink or the BLE relay */
+	replay_latency_s latency[REPLAY_NUM_EVENTS];
+	/** Uplinks handed to the LoRaMac, per result */
+	uint32_t uplinks;
+	uint32_t sendErrors;
+	/** Frames sent over the BLE relay while a central is connected */
+	uint32_t relayed;
+	/** Uplinks the gateways did not receive */
+	uint32_t lost;
+	/** Report intervals without a report decision of the scheduler, the time an alarm holds the loop not counted */
+	uint32_t missedReports;
+	/** Report uplinks closer than SCHED_MIN_REPORT_GAP and frame counters the server rejected */
+	uint32_t duplicates;
+	/** Report decisions, reports skipped by the dead reckoning */
+	uint32_t reports;
+	uint32_t skipped;
+	/** Restarts of the delayed timer, time from a restart to the next report decision */
+	uint32_t rearms;
+	replay_latency_s rearmToReport;
+	uint16_t actions[SCHED_NUM_ACTIONS];
+	/** Alarm uplinks including the retries, from alarmStats: alarms raised, failed, without ACK and the max latency */
+	uint32_t alarmUplinks;
+	uint32_t alarmsRaised;
+	uint32_t alarmsFailed;
+	uint32_t alarmNoAck;
+	uint32_t alarmMaxLatency;
+	/** Time from the start to the join */
+	uint32_t joinMs;
+	/** Idle model: powerStats of the firmware, sleep residency in 0.1 % and the policy level at the end */
+	uint32_t sleepTicks;
+	uint32_t expectedTicks;
+	uint32_t sleeps;
+	uint32_t idleEntries;
+	uint16_t wakeCount[WAKE_NUM_SOURCES];
+	uint16_t residency;
+	uint8_t policyLevel;
+	/** GPS acquisitions and their time, reports from the position cache and the acquisition time the firmware
+	 * counts as saved, the duration of the last acquisition per report */
+	uint32_t gpsAcquisitions;
+	uint64_t gpsOnMs;
+	uint32_t cacheHits;
+	uint32_t gpsSavedMs;
+	/** Radio: time on air of all transmissions, receive windows of class A and the device class at the end */
+	uint64_t airtimeUs;
+	uint32_t rxWindows;
+	uint8_t devClass;
+	/** Time in class A, B and C in ms */
+	uint32_t classMs[3];
+	/** Sleep residency of the device in 0.1 %, the MCU sleeps and neither the GPS acquires nor the radio transmits or
+	 * receives */
+	uint16_t deviceResidency;
+	/** Report pipeline: pipeStats of the firmware, latency per stage and end to end, overlapped and merged reports */
+	pipe_stats_s pipe;
+	/** Trips the firmware finished and trip summary uplinks */
+	uint32_t trips;
+	uint32_t tripUplinks;
+};
+
+/** Random trace, the same seed gives the same trace */
+replay_trace_s replayRandomTrace(uint64_t seed, uint32_t durationMs);
+/** Run a trace in a forked process */
+replay_result_s replayRun(const replay_trace_s &trace);
+/** Names of the event types */
+extern const char *replayEventNames[REPLAY_NUM_EVENTS];
+
+#endif
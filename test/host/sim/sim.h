@@ -0,0 +1,167 @@
+/**
+ * @file sim.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Host simulation of the tracker hardware
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The firmware in src is compiled unchanged against the headers
+ * in test/host/stubs and runs on a virtual clock.
+ * 	Tasks are coroutines. They switch only when they block, so a run is
+ * 	bit for bit reproducible for the same seed.
+ * 	Interrupts (accelerometer pins, GPS UART, radio) are events on the
+ * 	virtual clock, they run between two task switches.
+ * 	When no task is ready, the idle model jumps to the next event and
+ * 	calls traceLOW_POWER_IDLE_BEGIN()/END() like tasks.c, power.cpp
+ * 	measures the simulated sleep.
+ * Blocking calls from the host (a test calling delay() or a firmware
+ * function that waits) run the simulation until they return.
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#include <Arduino.h>
+#include <functional>
+#include <string>
+
+// Virtual clock and scheduler
+/** Current time of the virtual clock in us */
+uint64_t simNowUs(void);
+/** Keep the CPU busy, the clock advances without a task switch */
+void simBusy(uint32_t us);
+/** Run an action in interrupt context at a time, actions of the same time run in order */
+void simAt(uint64_t us, std::function<void()> action);
+/** Run an action in interrupt context after a delay in us */
+void simAfter(uint64_t us, std::function<void()> action);
+/** Timer driven action at a time in us, counts for the expected idle time like a FreeRTOS timer */
+void simKernelAt(uint64_t us, std::function<void()> action);
+/** Run the simulation for ms */
+void simRun(uint32_t ms);
+/** Run the simulation until a time in us */
+void simRunUntil(uint64_t us);
+/** Run until a condition is true or maxMs passed, returns the condition */
+bool simRunFor(std::function<bool()> condition, uint32_t maxMs);
+/** Create the Arduino loop task, it runs setup() and then loop() */
+void simStartFirmware(void);
+/** true while an interrupt action runs */
+bool simInIsr(void);
+/** Number of task switches since start */
+uint64_t simSwitches(void);
+
+/** System tasks of the nRF52 core and the libraries */
+#define SIM_WORKER_TIMER 0
+#define SIM_WORKER_BLE 1
+#define SIM_WORKER_LORA 2
+#define SIM_NUM_WORKERS 3
+/** Run a function in a system task, the callbacks of the timers, the SoftDevice and the LoRaMac */
+void simPost(uint8_t worker, std::function<void()> fn);
+
+// Deterministic random numbers
+void simSeed(uint64_t seed);
+uint32_t simRandom(void);
+/** Uniform random number 0..range-1 */
+uint32_t simRandomRange(uint32_t range);
+/** Random number 0.0..1.0 */
+double simRandomUnit(void);
+
+// Serial output
+/** Set where Serial and the BLE UART output goes, default is stdout with SIM_SERIAL=1 or nowhere */
+void simSerialSink(std::function<void(const char *text, size_t len)> sink);
+/** Bytes printed on Serial */
+uint64_t simSerialBytes(void);
+
+// Pins
+/** Fire the interrupt attached to a pin */
+void simPinInterrupt(uint32_t pin);
+/** Level of an output pin */
+int simPinLevel(uint32_t pin);
+
+// Battery
+/** Battery voltage in mV */
+void simBattMv(float mv);
+
+// Accelerometer
+/** Acceleration in g */
+void simAccSet(float x, float y, float z);
+/** Motion above the wake threshold, latches INT1_SRC and fires INT1 */
+void simAccMotion(void);
+/** Free fall, latches INT2_SRC and fires INT2 */
+void simAccFreeFall(void);
+/** Shock, latches CLICK_SRC and fires INT2 */
+void simAccShock(void);
+
+// GPS module
+struct sim_gps_state_s
+{
+	/** Flag if the module has a fix */
+	bool fix;
+	/** Position in degrees */
+	double lat;
+	double lng;
+	/** Altitude in m */
+	double alt;
+	/** Speed in knots */
+	double speedKn;
+	/** Course in degrees */
+	double course;
+	/** HDOP x100 */
+	uint16_t hdop;
+	/** Satellites used for the fix */
+	uint8_t satsUsed;
+	/** Satellites in view per constellation, GPS and GLONASS */
+	uint8_t inView[2];
+	/** C/N0 of the satellites in view in dBHz */
+	uint8_t cn0;
+	/** UTC time as Unix time */
+	uint32_t unixTime;
+};
+/** Function that returns the state of the module for a time in ms */
+void simGpsModel(std::function<sim_gps_state_s(uint32_t ms)> model);
+/** Module output, counters */
+struct sim_gps_stats_s
+{
+	uint32_t sentences;
+	uint32_t bytes;
+	uint32_t overruns;
+	uint32_t ubxCommands;
+};
+extern sim_gps_stats_s simGpsStats;
+/** Start the 1 Hz NMEA output with the u-blox default sentences */
+void simGpsStart(void);
+/** Build a NMEA sentence with checksum and CR LF from the body between $ and * */
+std::string simNmea(const char *body);
+/** Feed bytes into the Serial1 receive buffer, returns the number of bytes that fit */
+size_t simSerial1Rx(const char *data, size_t len);
+
+// BLE central
+/** Connect a central with a MTU, the central enables all notifications */
+void simBleConnect(uint16_t mtu);
+/** Disconnect the central */
+void simBleDisconnect(void);
+/** Send a command to the BLE UART */
+void simBleUart(const char *text);
+/** Enable or disable the notifications of all characteristics */
+void simBleNotify(bool enable);
+/** Advertising report for the scanner, dropped if no scan is running */
+void simBleAdv(const uint8_t *addr, int8_t rssi);
+/** Text received by the central over the BLE UART */
+std::string &simBleUartRx(void);
+
+// Flash file system
+/** Content of a file, empty if it does not exist */
+std::string simFsRead(const char *path);
+/** Bytes written to the flash and pages erased */
+uint64_t simFsBytesWritten(void);
+
+// Used by the stubs
+[[noreturn]] void simFail(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void simSerialOut(const char *text, size_t len);
+/** Serial1 receive buffer of the GPS module */
+int simSerial1Available(void);
+int simSerial1Read(bool remove);
+/** Bytes written to the GPS module, UBX commands */
+void simSerial1Tx(const uint8_t *data, size_t len);
+
+#endif
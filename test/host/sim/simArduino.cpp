@@ -0,0 +1,459 @@
+/**
+ * @file simArduino.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Arduino core, pins, ADC, I2C bus and LIS3DH of the simulation
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note I2C transfers keep the CPU busy for the time they take on a
+ * 400 kHz bus (9 clocks per byte), like the blocking TWIM driver, or
+ * block the calling task in DMA mode, see Wire.h.
+ */
+#include "sim.h"
+#include <Wire.h>
+#include <SparkFunLIS3DH.h>
+#include <nRF_SSD1306Wire.h>
+
+/** I2C clocks per byte, 8 data bits and ACK */
+#define SIM_I2C_CLOCKS_PER_BYTE 9
+/** Address of the LIS3DH */
+#define SIM_LIS3DH_ADDR 0x18
+/** Latched interrupt sources of the LIS3DH */
+#define SIM_LIS3DH_INT1_SRC 0x31
+#define SIM_LIS3DH_INT2_SRC 0x35
+#define SIM_LIS3DH_CLICK_SRC 0x39
+
+Uart Serial(0);
+Uart Serial1(1);
+TwoWire Wire;
+
+/** The font is not used on the host, the display draws nothing */
+const uint8_t ArialMT_Plain_10[] = {0x0A, 0x0D, 0x20, 0xE0};
+
+static std::function<void(const char *text, size_t len)> serialSink;
+static bool serialSinkSet = false;
+static uint64_t serialBytes = 0;
+
+static uint8_t pinLevel[NUM_PINS] = {0};
+static void (*pinHandler[NUM_PINS])(void) = {NULL};
+
+static float battMv = 4000.0;
+
+/** I2C time that is not yet a full us, in ns */
+static uint32_t i2cRestNs = 0;
+
+/** LIS3DH registers and acceleration */
+static uint8_t accRegs[128] = {0};
+static float accValue[3] = {0.0, 0.0, 1.0};
+
+// Print
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+	size_t n = 0;
+	while (size--)
+	{
+		n += write(*buffer++);
+	}
+	return n;
+}
+
+size_t Print::print(long value, int base)
+{
+	char text[40];
+	if (base == HEX)
+	{
+		snprintf(text, sizeof(text), "%lX", (unsigned long)value);
+	}
+	else
+	{
+		snprintf(text, sizeof(text), "%ld", value);
+	}
+	return write(text);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+	char text[40];
+	snprintf(text, sizeof(text), base == HEX ? "%lX" : "%lu", value);
+	return write(text);
+}
+
+size_t Print::print(double value, int digits)
+{
+	char text[64];
+	snprintf(text, sizeof(text), "%.*f", digits, value);
+	return write(text);
+}
+
+size_t Print::printf(const char *format, ...)
+{
+	char text[256];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	if (len < 0)
+	{
+		return 0;
+	}
+	return write((const uint8_t *)text, (size_t)len < sizeof(text) ? (size_t)len : sizeof(text) - 1);
+}
+
+// Serial output
+
+void simSerialSink(std::function<void(const char *text, size_t len)> sink)
+{
+	serialSink = sink;
+	serialSinkSet = true;
+}
+
+uint64_t simSerialBytes(void)
+{
+	return serialBytes;
+}
+
+void simSerialOut(const char *text, size_t len)
+{
+	if (serialSinkSet)
+	{
+		if (serialSink)
+		{
+			serialSink(text, len);
+		}
+		return;
+	}
+	const char *env = getenv("SIM_SERIAL");
+	if ((env != NULL) && (env[0] == '1'))
+	{
+		fwrite(text, 1, len, stdout);
+	}
+}
+
+int Uart::available(void)
+{
+	return _index == 1 ? simSerial1Available() : 0;
+}
+
+int Uart::read(void)
+{
+	return _index == 1 ? simSerial1Read(true) : -1;
+}
+
+int Uart::peek(void)
+{
+	return _index == 1 ? simSerial1Read(false) : -1;
+}
+
+size_t Uart::write(const uint8_t *buffer, size_t size)
+{
+	if (_index == 1)
+	{
+		simSerial1Tx(buffer, size);
+	}
+	else
+	{
+		serialBytes += size;
+		simSerialOut((const char *)buffer, size);
+	}
+	return size;
+}
+
+// Pins
+
+void pinMode(uint32_t pin, uint32_t mode)
+{
+	(void)pin;
+	(void)mode;
+}
+
+void digitalWrite(uint32_t pin, uint32_t value)
+{
+	if (pin < NUM_PINS)
+	{
+		pinLevel[pin] = value ? HIGH : LOW;
+	}
+}
+
+int digitalRead(uint32_t pin)
+{
+	return pin < NUM_PINS ? pinLevel[pin] : LOW;
+}
+
+void digitalToggle(uint32_t pin)
+{
+	digitalWrite(pin, !digitalRead(pin));
+}
+
+void attachInterrupt(uint32_t pin, void (*handler)(void), uint32_t mode)
+{
+	(void)mode;
+	if (pin < NUM_PINS)
+	{
+		pinHandler[pin] = handler;
+	}
+}
+
+void detachInterrupt(uint32_t pin)
+{
+	if (pin < NUM_PINS)
+	{
+		pinHandler[pin] = NULL;
+	}
+}
+
+void simPinInterrupt(uint32_t pin)
+{
+	simAt(simNowUs(), [pin]() {
+		if ((pin < NUM_PINS) && (pinHandler[pin] != NULL))
+		{
+			pinHandler[pin]();
+		}
+	});
+}
+
+int simPinLevel(uint32_t pin)
+{
+	return digitalRead(pin);
+}
+
+// ADC
+
+void simBattMv(float mv)
+{
+	battMv = mv;
+}
+
+uint32_t analogRead(uint32_t pin)
+{
+	if (pin != A0)
+	{
+		return 0;
+	}
+	// 12 bit, 3.0 V reference, 1.5M + 1M divider
+	float raw = battMv / (1.73F * 0.73242188F);
+	return raw > 4095 ? 4095 : (uint32_t)raw;
+}
+
+void analogReference(uint8_t type)
+{
+	(void)type;
+}
+
+void analogReadResolution(uint8_t bits)
+{
+	(void)bits;
+}
+
+int dbgHeapFree(void)
+{
+	return 24 * 1024;
+}
+
+int dbgHeapTotal(void)
+{
+	return 40 * 1024;
+}
+
+// Cycle counter
+
+uint32_t SystemCoreClock = 64000000;
+HostDwt hostDwt = {0, HostCycleCounter()};
+HostCoreDebug hostCoreDebug = {0};
+
+/**
+ * @brief Host monotonic time in ns
+ */
+static uint64_t monotonicNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+HostCycleCounter::operator uint32_t() const
+{
+	if ((hostDwt.CTRL & DWT_CTRL_CYCCNTENA_Msk) == 0)
+	{
+		return _base;
+	}
+	// Wraps like the 32 bit counter
+	return _base + (uint32_t)((monotonicNs() - _startNs) * (SystemCoreClock / 1000000) / 1000);
+}
+
+HostCycleCounter &HostCycleCounter::operator=(uint32_t value)
+{
+	_base = value;
+	_startNs = monotonicNs();
+	return *this;
+}
+
+// I2C
+
+/**
+ * @brief Run a transfer on the bus
+ * @note Keeps the CPU busy for the bus time of the bytes, or blocks the
+ * calling task until the completion interrupt in DMA mode
+ *
+ * @param read true for a read
+ * @param bytes Bytes on the bus with the address byte
+ */
+void TwoWire::transfer(bool read, uint32_t bytes)
+{
+	sim_i2c_xfer_s xfer = {_address, read, (uint16_t)bytes, simNowUs(), 0};
+	if (_onBus != 0)
+	{
+		_overlaps++;
+	}
+	_onBus++;
+	uint64_t ns = (uint64_t)bytes * SIM_I2C_CLOCKS_PER_BYTE * 1000000000ULL / _clock + i2cRestNs;
+	i2cRestNs = ns % 1000;
+	uint32_t us = (uint32_t)(ns / 1000);
+	if (_dma && !simInIsr())
+	{
+		SemaphoreHandle_t done = xSemaphoreCreateBinary();
+		simAfter(us, [done]() { xSemaphoreGiveFromISR(done, NULL); });
+		xSemaphoreTake(done, portMAX_DELAY);
+		vSemaphoreDelete(done);
+	}
+	else
+	{
+		simBusy(us);
+	}
+	_onBus--;
+	_bytes += bytes;
+	xfer.endUs = simNowUs();
+	if (_sink)
+	{
+		_sink(xfer);
+	}
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+	_address = address;
+	_pending = 1;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+	(void)data;
+	_pending++;
+	return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity)
+{
+	(void)data;
+	_pending += quantity;
+	return quantity;
+}
+
+uint8_t TwoWire::endTransmission(bool stop)
+{
+	(void)stop;
+	uint32_t bytes = _pending;
+	_pending = 0;
+	transfer(false, bytes);
+	return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, bool stop)
+{
+	(void)stop;
+	_address = address;
+	transfer(true, quantity + 1);
+	return quantity;
+}
+
+// LIS3DH
+
+status_t LIS3DH::begin(void)
+{
+	// WHO_AM_I
+	accRegs[0x0F] = 0x33;
+	return IMU_SUCCESS;
+}
+
+status_t LIS3DH::readRegister(uint8_t *output, uint8_t offset)
+{
+	Wire.beginTransmission(_address);
+	Wire.write(offset);
+	Wire.endTransmission(false);
+	Wire.requestFrom(_address, 1);
+	offset &= 0x7F;
+	*output = accRegs[offset];
+	// Latched sources are cleared by reading them
+	if ((offset == SIM_LIS3DH_INT1_SRC) || (offset == SIM_LIS3DH_INT2_SRC) || (offset == SIM_LIS3DH_CLICK_SRC))
+	{
+		accRegs[offset] = 0;
+	}
+	return IMU_SUCCESS;
+}
+
+status_t LIS3DH::writeRegister(uint8_t offset, uint8_t dataToWrite)
+{
+	Wire.beginTransmission(_address);
+	Wire.write(offset);
+	Wire.write(dataToWrite);
+	Wire.endTransmission();
+	accRegs[offset & 0x7F] = dataToWrite;
+	return IMU_SUCCESS;
+}
+
+/**
+ * @brief Read one axis, 6 bytes are read for the three axes
+ */
+static float accRead(uint8_t address, uint8_t axis)
+{
+	Wire.beginTransmission(address);
+	Wire.write(0x28 + 2 * axis);
+	Wire.endTransmission(false);
+	Wire.requestFrom(address, 2);
+	return accValue[axis];
+}
+
+float LIS3DH::readFloatAccelX(void)
+{
+	return accRead(_address, 0);
+}
+
+float LIS3DH::readFloatAccelY(void)
+{
+	return accRead(_address, 1);
+}
+
+float LIS3DH::readFloatAccelZ(void)
+{
+	return accRead(_address, 2);
+}
+
+void simAccSet(float x, float y, float z)
+{
+	accValue[0] = x;
+	accValue[1] = y;
+	accValue[2] = z;
+}
+
+void simAccMotion(void)
+{
+	// IA and the high events of X, Y and Z
+	accRegs[SIM_LIS3DH_INT1_SRC] = 0x40 | 0x2A;
+	simPinInterrupt(21);
+}
+
+void simAccFreeFall(void)
+{
+	// IA and the low events of X, Y and Z
+	accRegs[SIM_LIS3DH_INT2_SRC] = 0x40 | 0x15;
+	simPinInterrupt(4);
+}
+
+void simAccShock(void)
+{
+	// IA and single click on X
+	accRegs[SIM_LIS3DH_CLICK_SRC] = 0x40 | 0x10 | 0x01;
+	simPinInterrupt(4);
+}
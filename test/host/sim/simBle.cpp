@@ -0,0 +1,353 @@
+/**
+ * @file simBle.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Bluefruit and SoftDevice model with one central
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Notifications go into the HVN TX queue of the SoftDevice
+ * (hvnQueueSize packets). The queue is emptied on the connection
+ * events, as many packets as fit into the event length on the 2M PHY.
+ * notify() blocks while the queue is full like in the Bluefruit
+ * library. All SoftDevice callbacks run in the BLE task.
+ */
+#include "sim.h"
+#include <bluefruit.h>
+#include <deque>
+
+/** Air time of a packet on the 2M PHY in us, 14 bytes overhead, IFS and the empty ACK */
+#define SIM_BLE_PKT_US(len) (((len) + 14) * 4 + 150 + 44 + 150)
+
+AdafruitBluefruit Bluefruit;
+
+static BLEConnection connection;
+static BLECharacteristic *charList = NULL;
+static SemaphoreHandle_t hvnFree = NULL;
+/** Packets waiting in the TX queue, only the size is needed */
+static std::deque<uint16_t> hvnQueue;
+static bool connEventPending = false;
+static uint64_t connStart = 0;
+static std::string uartRx;
+static bool uartNotify = true;
+
+/**
+ * @brief Create the TX queue with the size from configPrphConn()
+ */
+static void hvnInit(void)
+{
+	if (hvnFree == NULL)
+	{
+		hvnFree = xSemaphoreCreateCounting(Bluefruit.hvnQueueSize, Bluefruit.hvnQueueSize);
+	}
+}
+
+/**
+ * @brief Connection event, sends the queued packets that fit into the event
+ */
+static void connEvent(void)
+{
+	connEventPending = false;
+	if (!connection._connected)
+	{
+		return;
+	}
+	uint32_t budget = Bluefruit.eventLen * 1250;
+	uint32_t used = 0;
+	while (!hvnQueue.empty())
+	{
+		uint32_t air = SIM_BLE_PKT_US(hvnQueue.front());
+		if ((used != 0) && (used + air > budget))
+		{
+			break;
+		}
+		used += air;
+		hvnQueue.pop_front();
+		xSemaphoreGiveFromISR(hvnFree, NULL);
+	}
+	if (!hvnQueue.empty())
+	{
+		uint64_t interval = (uint64_t)Bluefruit.Periph.minInterval * 1250;
+		uint64_t next = connStart + ((simNowUs() - connStart) / interval + 1) * interval;
+		connEventPending = true;
+		simAt(next, connEvent);
+	}
+}
+
+/**
+ * @brief Put a packet into the TX queue, waits while the queue is full
+ */
+static bool hvnSend(uint16_t len)
+{
+	hvnInit();
+	if (simInIsr())
+	{
+		simFail("notify() in interrupt context");
+	}
+	if (xSemaphoreTake(hvnFree, portMAX_DELAY) != pdTRUE)
+	{
+		return false;
+	}
+	if (!connection._connected)
+	{
+		xSemaphoreGive(hvnFree);
+		return false;
+	}
+	hvnQueue.push_back(len);
+	if (!connEventPending)
+	{
+		uint64_t interval = (uint64_t)Bluefruit.Periph.minInterval * 1250;
+		uint64_t next = connStart + ((simNowUs() - connStart) / interval + 1) * interval;
+		connEventPending = true;
+		simAt(next, connEvent);
+	}
+	return true;
+}
+
+uint32_t BLECharacteristic::begin(void)
+{
+	nextChar = charList;
+	charList = this;
+	return 0;
+}
+
+uint16_t BLECharacteristic::write(const void *data, uint16_t len)
+{
+	if (len > sizeof(value))
+	{
+		len = sizeof(value);
+	}
+	memcpy(value, data, len);
+	valueLen = len;
+	return len;
+}
+
+bool BLECharacteristic::notifyEnabled(void)
+{
+	return connection._connected && cccdNotify;
+}
+
+bool BLECharacteristic::notifyEnabled(uint16_t conn_hdl)
+{
+	return (conn_hdl == 0) && notifyEnabled();
+}
+
+bool BLECharacteristic::notify(const void *data, uint16_t len)
+{
+	write(data, len);
+	if (!notifyEnabled())
+	{
+		return false;
+	}
+	if (len > connection._mtu - 3)
+	{
+		len = connection._mtu - 3;
+	}
+	if (!hvnSend(len))
+	{
+		return false;
+	}
+	memcpy(lastNotify, data, len);
+	lastNotifyLen = len;
+	notifyCount++;
+	notifyBytes += len;
+	return true;
+}
+
+bool BLECharacteristic::notify(uint16_t conn_hdl, const void *data, uint16_t len)
+{
+	return (conn_hdl == 0) && notify(data, len);
+}
+
+void BLECharacteristic::centralWrite(const uint8_t *data, uint16_t len)
+{
+	std::string copy((const char *)data, len);
+	simPost(SIM_WORKER_BLE, [this, copy]() {
+		write(copy.data(), copy.size());
+		if (_writeCb != NULL)
+		{
+			_writeCb(0, this, value, valueLen);
+		}
+	});
+}
+
+bool BLEBas::notify(uint8_t level)
+{
+	_level = level;
+	return connection._connected;
+}
+
+int BLEUart::read(uint8_t *buffer, size_t size)
+{
+	size_t len = 0;
+	while ((len < size) && (_rxPos < _rxLen))
+	{
+		buffer[len++] = _rx[_rxPos++];
+	}
+	return (int)len;
+}
+
+int BLEUart::read(void)
+{
+	return _rxPos < _rxLen ? _rx[_rxPos++] : -1;
+}
+
+int BLEUart::peek(void)
+{
+	return _rxPos < _rxLen ? _rx[_rxPos] : -1;
+}
+
+int BLEUart::available(void)
+{
+	return _rxLen - _rxPos;
+}
+
+size_t BLEUart::write(const uint8_t *buffer, size_t size)
+{
+	if (!connection._connected || !uartNotify)
+	{
+		return 0;
+	}
+	txBytes += size;
+	uartRx.append((const char *)buffer, size);
+	return size;
+}
+
+void BLEUart::centralSend(const char *text)
+{
+	std::string copy(text);
+	simPost(SIM_WORKER_BLE, [this, copy]() {
+		_rxLen = copy.size() < sizeof(_rx) ? copy.size() : sizeof(_rx);
+		memcpy(_rx, copy.data(), _rxLen);
+		_rxPos = 0;
+		if (_rxCb != NULL)
+		{
+			_rxCb(0);
+		}
+	});
+}
+
+bool BLEConnection::requestMtuExchange(uint16_t mtu)
+{
+	uint16_t newMtu = mtu < _centralMtu ? mtu : _centralMtu;
+	_mtu = newMtu < Bluefruit.maxMtu ? newMtu : Bluefruit.maxMtu;
+	return true;
+}
+
+bool BLEScanner::start(uint16_t timeout)
+{
+	running = true;
+	scans++;
+	if (timeout != 0)
+	{
+		uint32_t scan = scans;
+		uint64_t startTime = simNowUs();
+		simAfter((uint64_t)timeout * 10000, [this, scan, startTime]() {
+			if (running && (scans == scan))
+			{
+				running = false;
+				scanMs += (simNowUs() - startTime) / 1000;
+			}
+		});
+	}
+	return true;
+}
+
+bool BLEScanner::stop(void)
+{
+	running = false;
+	return true;
+}
+
+uint16_t AdafruitBluefruit::connHandle(void)
+{
+	return connection._connected ? 0 : BLE_CONN_HANDLE_INVALID;
+}
+
+BLEConnection *AdafruitBluefruit::Connection(uint16_t conn_hdl)
+{
+	return ((conn_hdl == 0) && connection._connected) ? &connection : NULL;
+}
+
+bool AdafruitBluefruit::connected(void)
+{
+	return connection._connected;
+}
+
+void simBleConnect(uint16_t mtu)
+{
+	simPost(SIM_WORKER_BLE, [mtu]() {
+		hvnInit();
+		connection._connected = true;
+		connection._centralMtu = mtu;
+		connection._mtu = 23;
+		connStart = simNowUs();
+		Bluefruit.Advertising.running = false;
+		for (BLECharacteristic *chr = charList; chr != NULL; chr = chr->nextChar)
+		{
+			chr->cccdNotify = true;
+		}
+		uartNotify = true;
+		if (Bluefruit.Periph.connectCb != NULL)
+		{
+			Bluefruit.Periph.connectCb(0);
+		}
+	});
+}
+
+void simBleDisconnect(void)
+{
+	simPost(SIM_WORKER_BLE, []() {
+		connection._connected = false;
+		// Queued packets are dropped, blocked notify() calls return false
+		while (!hvnQueue.empty())
+		{
+			hvnQueue.pop_front();
+			xSemaphoreGive(hvnFree);
+		}
+		for (BLECharacteristic *chr = charList; chr != NULL; chr = chr->nextChar)
+		{
+			chr->cccdNotify = false;
+		}
+		Bluefruit.Advertising.running = true;
+		if (Bluefruit.Periph.disconnectCb != NULL)
+		{
+			Bluefruit.Periph.disconnectCb(0, 0x13);
+		}
+	});
+}
+
+void simBleNotify(bool enable)
+{
+	for (BLECharacteristic *chr = charList; chr != NULL; chr = chr->nextChar)
+	{
+		chr->cccdNotify = enable;
+	}
+	uartNotify = enable;
+}
+
+void simBleAdv(const uint8_t *addr, int8_t rssi)
+{
+	if (!Bluefruit.Scanner.running || (Bluefruit.Scanner.rxCb == NULL))
+	{
+		return;
+	}
+	ble_gap_evt_adv_report_t report;
+	memset(&report, 0, sizeof(report));
+	memcpy(report.peer_addr.addr, addr, 6);
+	report.rssi = rssi;
+	simPost(SIM_WORKER_BLE, [report]() mutable { Bluefruit.Scanner.rxCb(&report); });
+}
+
+void simBleUart(const char *text)
+{
+	// BLE UART service of the firmware
+	extern BLEUart bleuart;
+	bleuart.centralSend(text);
+}
+
+std::string &simBleUartRx(void)
+{
+	return uartRx;
+}
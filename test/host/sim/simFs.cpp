@@ -0,0 +1,156 @@
+/**
+ * @file simFs.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief In memory LittleFS of the simulation
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Files are kept in memory. Writes keep the CPU busy like the
+ * nRF52 NVMC: 41 us per 32 bit word and 85 ms for every 4 kB block the
+ * file system has to erase. LittleFS is copy on write, the first write
+ * into a block after opening the file erases a new block.
+ */
+#include "sim.h"
+#include <InternalFileSystem.h>
+#include <map>
+#include <set>
+
+/** Erase block of the internal flash */
+#define SIM_FLASH_BLOCK 4096
+#define SIM_FLASH_WORD_US 41
+#define SIM_FLASH_ERASE_US 85000
+
+InternalFileSystem InternalFS;
+
+static std::map<std::string, std::string> files;
+/** Blocks already written since the file was opened, per file */
+static std::map<std::string, std::set<uint32_t>> dirtyBlocks;
+static uint64_t bytesWritten = 0;
+
+std::string simFsRead(const char *path)
+{
+	auto it = files.find(path);
+	return it == files.end() ? std::string() : it->second;
+}
+
+uint64_t simFsBytesWritten(void)
+{
+	return bytesWritten;
+}
+
+bool Adafruit_LittleFS::exists(const char *path)
+{
+	return files.count(path) != 0;
+}
+
+bool Adafruit_LittleFS::remove(const char *path)
+{
+	dirtyBlocks.erase(path);
+	return files.erase(path) != 0;
+}
+
+bool Adafruit_LittleFS::format(void)
+{
+	files.clear();
+	dirtyBlocks.clear();
+	return true;
+}
+
+namespace Adafruit_LittleFS_Namespace
+{
+	bool File::open(const char *path, uint8_t mode)
+	{
+		snprintf(_path, sizeof(_path), "%s", path);
+		_mode = mode;
+		if (files.count(_path) == 0)
+		{
+			if (mode != FILE_O_WRITE)
+			{
+				_open = false;
+				return false;
+			}
+			files[_path] = std::string();
+		}
+		dirtyBlocks[_path].clear();
+		// Files opened for writing are positioned at the end like in the Adafruit library
+		_pos = mode == FILE_O_WRITE ? files[_path].size() : 0;
+		_open = true;
+		return true;
+	}
+
+	size_t File::write(const uint8_t *buf, size_t size)
+	{
+		if (!_open || (_mode != FILE_O_WRITE))
+		{
+			return 0;
+		}
+		std::string &data = files[_path];
+		if (data.size() < _pos + size)
+		{
+			data.resize(_pos + size, '\0');
+		}
+		memcpy(&data[_pos], buf, size);
+		std::set<uint32_t> &dirty = dirtyBlocks[_path];
+		for (uint32_t block = _pos / SIM_FLASH_BLOCK; block <= (_pos + size - 1) / SIM_FLASH_BLOCK && size != 0; block++)
+		{
+			if (dirty.insert(block).second)
+			{
+				simBusy(SIM_FLASH_ERASE_US);
+			}
+		}
+		simBusy((uint32_t)((size + 3) / 4) * SIM_FLASH_WORD_US);
+		bytesWritten += size;
+		_pos += size;
+		return size;
+	}
+
+	int File::read(void)
+	{
+		uint8_t c;
+		return read(&c, 1) == 1 ? c : -1;
+	}
+
+	int File::read(void *buf, uint16_t nbyte)
+	{
+		if (!_open)
+		{
+			return -1;
+		}
+		const std::string &data = files[_path];
+		if (_pos >= data.size())
+		{
+			return 0;
+		}
+		uint16_t len = data.size() - _pos < nbyte ? (uint16_t)(data.size() - _pos) : nbyte;
+		memcpy(buf, &data[_pos], len);
+		_pos += len;
+		return len;
+	}
+
+	bool File::seek(uint32_t pos)
+	{
+		if (!_open)
+		{
+			return false;
+		}
+		_pos = pos;
+		return true;
+	}
+
+	uint32_t File::size(void)
+	{
+		return _open ? (uint32_t)files[_path].size() : 0;
+	}
+
+	bool File::truncate(uint32_t pos)
+	{
+		if (!_open || (_mode != FILE_O_WRITE))
+		{
+			return false;
+		}
+		files[_path].resize(pos, '\0');
+		return true;
+	}
+}
@@ -0,0 +1,355 @@
+/**
+ * @file simGps.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief u-blox MAX-7Q model on Serial1
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note After power up the module sends GGA, GLL, GSA, GSV, RMC and VTG
+ * once per navigation solution at 9600 baud. UBX-CFG-MSG, UBX-CFG-RATE
+ * and UBX-CFG-PRT commands written to Serial1 change the output like
+ * on the module. The bytes arrive with the timing of the UART, every
+ * sentence is put into the 256 byte receive buffer of Serial1 at the
+ * time its last byte arrives.
+ */
+#include "sim.h"
+#include <deque>
+
+/** Receive buffer of Serial1 in the nRF52 core */
+#define SIM_SERIAL1_RX_SIZE 256
+/** NMEA sentences of UBX-CFG-MSG, class 0xF0 */
+#define SIM_NMEA_NUM 6
+#define SIM_NMEA_GGA 0
+#define SIM_NMEA_GLL 1
+#define SIM_NMEA_GSA 2
+#define SIM_NMEA_GSV 3
+#define SIM_NMEA_RMC 4
+#define SIM_NMEA_VTG 5
+
+sim_gps_stats_s simGpsStats;
+
+static std::function<sim_gps_state_s(uint32_t ms)> gpsModel;
+static std::deque<uint8_t> rxBuffer;
+
+/** Module configuration */
+static uint8_t nmeaRate[SIM_NMEA_NUM] = {1, 1, 1, 1, 1, 1};
+static uint16_t measRate = 1000;
+static uint32_t moduleBaud = 9600;
+static uint32_t epoch = 0;
+static bool started = false;
+/** Time the UART is busy until, sentences are sent back to back */
+static uint64_t txBusyUntil = 0;
+
+/** UBX receiver state */
+static uint8_t ubxBuf[64];
+static uint16_t ubxLen = 0;
+
+/**
+ * @brief Default model, no fix, 2020-09-20 00:00:00 at start
+ */
+static sim_gps_state_s noFixModel(uint32_t ms)
+{
+	sim_gps_state_s state;
+	memset(&state, 0, sizeof(state));
+	state.hdop = 9999;
+	state.unixTime = 1600560000 + ms / 1000;
+	return state;
+}
+
+void simGpsModel(std::function<sim_gps_state_s(uint32_t ms)> model)
+{
+	gpsModel = model;
+}
+
+std::string simNmea(const char *body)
+{
+	uint8_t checksum = 0;
+	for (const char *c = body; *c != 0; c++)
+	{
+		checksum ^= (uint8_t)*c;
+	}
+	char tail[8];
+	snprintf(tail, sizeof(tail), "*%02X\r\n", checksum);
+	return std::string("$") + body + tail;
+}
+
+size_t simSerial1Rx(const char *data, size_t len)
+{
+	size_t fit = 0;
+	for (size_t idx = 0; idx < len; idx++)
+	{
+		if (rxBuffer.size() >= SIM_SERIAL1_RX_SIZE)
+		{
+			simGpsStats.overruns++;
+			continue;
+		}
+		rxBuffer.push_back((uint8_t)data[idx]);
+		fit++;
+	}
+	return fit;
+}
+
+int simSerial1Available(void)
+{
+	return (int)rxBuffer.size();
+}
+
+int simSerial1Read(bool remove)
+{
+	if (rxBuffer.empty())
+	{
+		return -1;
+	}
+	int c = rxBuffer.front();
+	if (remove)
+	{
+		rxBuffer.pop_front();
+	}
+	return c;
+}
+
+/**
+ * @brief Handle a complete UBX command
+ */
+static void ubxCommand(uint8_t msgClass, uint8_t msgId, const uint8_t *payload, uint16_t len)
+{
+	if (msgClass != 0x06)
+	{
+		return;
+	}
+	simGpsStats.ubxCommands++;
+	switch (msgId)
+	{
+	case 0x01: // CFG-MSG
+		if ((len >= 3) && (payload[0] == 0xF0) && (payload[1] < SIM_NMEA_NUM))
+		{
+			// 3 bytes: rate of the current port, 8 bytes: rate per port, UART1 is port 1
+			nmeaRate[payload[1]] = len == 3 ? payload[2] : payload[3];
+		}
+		break;
+	case 0x08: // CFG-RATE
+		if ((len >= 2) && ((payload[0] | (payload[1] << 8)) >= 100))
+		{
+			measRate = payload[0] | (payload[1] << 8);
+		}
+		break;
+	case 0x00: // CFG-PRT
+		if ((len >= 12) && (payload[0] == 0x01))
+		{
+			// The module switches after the acknowledge
+			moduleBaud = payload[8] | (payload[9] << 8) | (payload[10] << 16) | ((uint32_t)payload[11] << 24);
+		}
+		break;
+	}
+}
+
+void simSerial1Tx(const uint8_t *data, size_t len)
+{
+	for (size_t idx = 0; idx < len; idx++)
+	{
+		uint8_t c = data[idx];
+		if (Serial1.baud() != moduleBaud)
+		{
+			// Wrong baud rate, the module sees framing errors
+			ubxLen = 0;
+			continue;
+		}
+		if ((ubxLen == 0 && c != 0xB5) || (ubxLen == 1 && c != 0x62))
+		{
+			ubxLen = 0;
+			continue;
+		}
+		if (ubxLen < sizeof(ubxBuf))
+		{
+			ubxBuf[ubxLen] = c;
+		}
+		ubxLen++;
+		if (ubxLen < 6)
+		{
+			continue;
+		}
+		uint16_t payloadLen = ubxBuf[4] | (ubxBuf[5] << 8);
+		if (payloadLen + 8 > (int)sizeof(ubxBuf))
+		{
+			ubxLen = 0;
+			continue;
+		}
+		if (ubxLen < payloadLen + 8)
+		{
+			continue;
+		}
+		uint8_t ckA = 0;
+		uint8_t ckB = 0;
+		for (int pos = 2; pos < payloadLen + 6; pos++)
+		{
+			ckA += ubxBuf[pos];
+			ckB += ckA;
+		}
+		if ((ckA == ubxBuf[payloadLen + 6]) && (ckB == ubxBuf[payloadLen + 7]))
+		{
+			ubxCommand(ubxBuf[2], ubxBuf[3], &ubxBuf[6], payloadLen);
+		}
+		ubxLen = 0;
+	}
+}
+
+/**
+ * @brief Format a coordinate as NMEA ddmm.mmmmm
+ */
+static void nmeaCoord(char *out, size_t size, double value, bool isLat)
+{
+	double absValue = fabs(value);
+	int deg = (int)absValue;
+	double minutes = (absValue - deg) * 60.0;
+	if (isLat)
+	{
+		snprintf(out, size, "%02d%08.5f,%c", deg, minutes, value < 0 ? 'S' : 'N');
+	}
+	else
+	{
+		snprintf(out, size, "%03d%08.5f,%c", deg, minutes, value < 0 ? 'W' : 'E');
+	}
+}
+
+/**
+ * @brief Send a sentence, it arrives after the UART time of its bytes
+ */
+static void gpsSend(const std::string &sentence)
+{
+	uint64_t start = txBusyUntil > simNowUs() ? txBusyUntil : simNowUs();
+	// 10 bits per byte with start and stop bit
+	uint64_t end = start + (uint64_t)sentence.size() * 10 * 1000000 / moduleBaud;
+	txBusyUntil = end;
+	simGpsStats.sentences++;
+	simGpsStats.bytes += sentence.size();
+	uint32_t baud = moduleBaud;
+	simAt(end, [sentence, baud]() {
+		if (!Serial1 || (Serial1.baud() != baud))
+		{
+			return;
+		}
+		simSerial1Rx(sentence.data(), sentence.size());
+	});
+}
+
+/**
+ * @brief Output of one navigation solution
+ */
+static void gpsEpoch(void)
+{
+	uint32_t ms = millis();
+	sim_gps_state_s state = gpsModel ? gpsModel(ms) : noFixModel(ms);
+	time_t unixTime = state.unixTime;
+	struct tm utc;
+	gmtime_r(&unixTime, &utc);
+	char timeText[16];
+	snprintf(timeText, sizeof(timeText), "%02d%02d%02d.00", utc.tm_hour, utc.tm_min, utc.tm_sec);
+	char lat[20] = ",";
+	char lng[20] = ",";
+	if (state.fix)
+	{
+		nmeaCoord(lat, sizeof(lat), state.lat, true);
+		nmeaCoord(lng, sizeof(lng), state.lng, false);
+	}
+	char body[128];
+
+	for (int type = 0; type < SIM_NMEA_NUM; type++)
+	{
+		if ((nmeaRate[type] == 0) || ((epoch % nmeaRate[type]) != 0))
+		{
+			continue;
+		}
+		switch (type)
+		{
+		case SIM_NMEA_GGA:
+			if (state.fix)
+			{
+				snprintf(body, sizeof(body), "GPGGA,%s,%s,%s,1,%02d,%.2f,%.1f,M,0.0,M,,", timeText, lat, lng,
+						 state.satsUsed, state.hdop / 100.0, state.alt);
+			}
+			else
+			{
+				snprintf(body, sizeof(body), "GPGGA,%s,,,,,0,%02d,99.99,,,,,,", timeText, state.satsUsed);
+			}
+			gpsSend(simNmea(body));
+			break;
+		case SIM_NMEA_GLL:
+			snprintf(body, sizeof(body), "GPGLL,%s,%s,%s,%c,%c", lat, lng, timeText, state.fix ? 'A' : 'V',
+					 state.fix ? 'A' : 'N');
+			gpsSend(simNmea(body));
+			break;
+		case SIM_NMEA_GSA:
+		{
+			int len = snprintf(body, sizeof(body), "GPGSA,A,%d", state.fix ? 3 : 1);
+			for (int sat = 0; sat < 12; sat++)
+			{
+				len += snprintf(&body[len], sizeof(body) - len, sat < state.satsUsed ? ",%02d" : ",", sat + 1);
+			}
+			snprintf(&body[len], sizeof(body) - len, ",%.2f,%.2f,%.2f", state.hdop * 1.4 / 100.0, state.hdop / 100.0,
+					 state.hdop * 1.6 / 100.0);
+			gpsSend(simNmea(body));
+			break;
+		}
+		case SIM_NMEA_GSV:
+			for (int constellation = 0; constellation < 2; constellation++)
+			{
+				uint8_t inView = state.inView[constellation];
+				if ((inView == 0) && (constellation != 0))
+				{
+					continue;
+				}
+				int msgs = inView == 0 ? 1 : (inView + 3) / 4;
+				for (int msg = 0; msg < msgs; msg++)
+				{
+					int len = snprintf(body, sizeof(body), "%sGSV,%d,%d,%02d", constellation == 0 ? "GP" : "GL", msgs,
+									   msg + 1, inView);
+					for (int sat = msg * 4; (sat < msg * 4 + 4) && (sat < inView); sat++)
+					{
+						len += snprintf(&body[len], sizeof(body) - len, ",%02d,%02d,%03d,%02d",
+										(constellation == 0 ? 1 : 65) + sat, 20 + (sat * 7) % 60, (sat * 37) % 360,
+										state.cn0);
+					}
+					gpsSend(simNmea(body));
+				}
+			}
+			break;
+		case SIM_NMEA_RMC:
+			snprintf(body, sizeof(body), "GPRMC,%s,%c,%s,%s,%.3f,%.2f,%02d%02d%02d,,,%c", timeText, state.fix ? 'A' : 'V',
+					 lat, lng, state.speedKn, state.course, utc.tm_mday, utc.tm_mon + 1, utc.tm_year % 100,
+					 state.fix ? 'A' : 'N');
+			gpsSend(simNmea(body));
+			break;
+		case SIM_NMEA_VTG:
+			snprintf(body, sizeof(body), "GPVTG,%.2f,T,,M,%.3f,N,%.3f,K,%c", state.course, state.speedKn,
+					 state.speedKn * 1.852, state.fix ? 'A' : 'N');
+			gpsSend(simNmea(body));
+			break;
+		}
+	}
+	epoch++;
+}
+
+/**
+ * @brief Schedule the next navigation solution, aligned to measRate
+ */
+static void gpsSchedule(void)
+{
+	uint64_t period = (uint64_t)measRate * 1000;
+	uint64_t next = (simNowUs() / period + 1) * period;
+	simAt(next, []() {
+		gpsEpoch();
+		gpsSchedule();
+	});
+}
+
+void simGpsStart(void)
+{
+	if (started)
+	{
+		return;
+	}
+	started = true;
+	gpsSchedule();
+}
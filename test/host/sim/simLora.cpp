@@ -0,0 +1,725 @@
+/**
+ * @file simLora.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief LoRaWan device MAC with the SX126x-Arduino API on a virtual radio
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Builds LoRaWan 1.0.3 join requests and data frames with MIC and
+ * encrypted FRMPayload. After the transmission RX1 and RX2 are opened
+ * 1 s and 2 s (5 s and 6 s for a join) after the end of the TX.
+ * A confirmed uplink is retransmitted with the same frame counter until
+ * it is acknowledged or nb_trials transmissions are done. While an
+ * exchange runs lmh_send() returns LMH_BUSY. The callbacks run in the
+ * LoRa task like in the library.
+ * Class B: LoRaMacMlmeRequest(MLME_BEACON_ACQUISITION) searches the
+ * beacon, beacons are sent every 128 s. MIB_DEVICE_CLASS CLASS_B only
+ * succeeds after the beacon is locked.
+ */
+#include "ns.h"
+#include "aes.h"
+#include <LoRaWan-RAK4630.h>
+
+/** Radio wake up and setup before the TX starts */
+#define SIM_LORA_TX_SETUP_US 1000
+/** Receive window, a downlink that starts inside is received */
+#define SIM_LORA_WIN_BEFORE_US 5000
+#define SIM_LORA_WIN_AFTER_US 30000
+/** RX2 data rate of AS923 */
+#define SIM_LORA_RX2_DR DR_2
+/** Beacon period of class B */
+#define SIM_LORA_BEACON_US 128000000ULL
+/** Beacons the search waits for before it gives up */
+#define SIM_LORA_BEACON_TRIES 2
+
+sim_lora_cfg_s simLoraCfg = {0.0, 0.0, -80, 8, true};
+sim_lora_stats_s simLoraStats;
+
+/** Called for every lmh_send() with its result */
+static std::function<void(uint8_t port, const uint8_t *data, uint8_t len, bool confirmed, int8_t result)> sendCb;
+
+/** Maximum FRMPayload per data rate, AS923 without dwell time limit */
+static const uint8_t maxPayload[8] = {51, 51, 51, 115, 242, 242, 242, 242};
+
+/** State of the MAC */
+#define MAC_IDLE 0
+#define MAC_JOIN 1
+#define MAC_DATA 2
+
+static lmh_callback_t *callbacks = NULL;
+static lmh_param_t params;
+static bool useOtaa = true;
+static DeviceClass_t devClass = CLASS_A;
+
+static uint8_t devEui[8];
+static uint8_t appEui[8];
+static uint8_t appKey[16];
+static uint8_t nwkSKey[16];
+static uint8_t appSKey[16];
+static uint32_t devAddr = 0;
+static bool joined = false;
+static uint16_t devNonce = 0;
+static uint32_t fCntUp = 0;
+static uint32_t fCntDown = 0;
+static bool anyDownlink = false;
+/** A confirmed downlink was received, the next uplink carries the ACK */
+static bool ackPending = false;
+/** MAC commands for the next uplink */
+static uint8_t fOpts[15];
+static uint8_t fOptsLen = 0;
+
+/** Running exchange */
+static uint8_t macState = MAC_IDLE;
+static bool exchConfirmed = false;
+static uint8_t exchFrame[256];
+static uint8_t exchLen = 0;
+static uint8_t exchTrials = 0;
+static bool exchDone = false;
+static uint64_t exchGen = 0;
+static uint64_t winStart[2] = {0, 0};
+static bool transmitting = false;
+static bool receiving = false;
+
+/** Class B beacon */
+static bool beaconSearching = false;
+static bool beaconLocked = false;
+
+static void macStartTx(void);
+static void macFinish(bool success);
+
+uint32_t simLoraToaUs(uint8_t sf, uint16_t len, bool crc)
+{
+	double tSym = (double)(1 << sf) / 125000.0;
+	int de = sf >= 11 ? 1 : 0;
+	double tPreamble = (8 + 4.25) * tSym;
+	double num = 8.0 * len - 4.0 * sf + 28 + (crc ? 16 : 0);
+	double symbols = ceil(num / (4.0 * (sf - 2 * de))) * 5;
+	if (symbols < 0)
+	{
+		symbols = 0;
+	}
+	return (uint32_t)((tPreamble + (8 + symbols) * tSym) * 1000000.0);
+}
+
+uint8_t simLoraSf(uint8_t dr)
+{
+	return dr <= 5 ? 12 - dr : 7;
+}
+
+uint32_t lora_rak4630_init(void)
+{
+	return 0;
+}
+
+void BoardGetUniqueId(uint8_t *id)
+{
+	for (int idx = 0; idx < 8; idx++)
+	{
+		id[idx] = (uint8_t)(0xA0 + idx);
+	}
+}
+
+uint32_t BoardGetRandomSeed(void)
+{
+	return simRandom();
+}
+
+lmh_error_status lmh_init(lmh_callback_t *cbs, lmh_param_t lora_param, bool otaa, DeviceClass_t nodeClass,
+						  LoRaMacRegion_t region, bool region_change)
+{
+	(void)region;
+	(void)region_change;
+	callbacks = cbs;
+	params = lora_param;
+	useOtaa = otaa;
+	devClass = nodeClass;
+	return LMH_SUCCESS;
+}
+
+bool lmh_setSubBandChannels(uint8_t subBand)
+{
+	return (subBand >= 1) && (subBand <= 9);
+}
+
+void lmh_setSingleChannelGateway(uint8_t userSingleChannel, int8_t userDatarate)
+{
+	(void)userSingleChannel;
+	params.tx_data_rate = userDatarate;
+}
+
+void lmh_setDevEui(uint8_t *userDevEui)
+{
+	memcpy(devEui, userDevEui, 8);
+}
+
+void lmh_setAppEui(uint8_t *userAppEui)
+{
+	memcpy(appEui, userAppEui, 8);
+}
+
+void lmh_setAppKey(uint8_t *userAppKey)
+{
+	memcpy(appKey, userAppKey, 16);
+}
+
+void lmh_setNwkSKey(uint8_t *userNwkSKey)
+{
+	memcpy(nwkSKey, userNwkSKey, 16);
+}
+
+void lmh_setAppSKey(uint8_t *userAppSKey)
+{
+	memcpy(appSKey, userAppSKey, 16);
+}
+
+void lmh_setDevAddr(uint32_t userDevAddr)
+{
+	devAddr = userDevAddr;
+}
+
+uint32_t lmh_getDevAddr(void)
+{
+	return devAddr;
+}
+
+lmh_join_status lmh_join_status_get(void)
+{
+	return joined ? LMH_SET : LMH_RESET;
+}
+
+/**
+ * @brief Build the join request with a new DevNonce
+ */
+static void buildJoinRequest(void)
+{
+	devNonce = (uint16_t)simRandom();
+	exchFrame[0] = 0x00;
+	// EUIs are sent LSB first
+	for (int idx = 0; idx < 8; idx++)
+	{
+		exchFrame[1 + idx] = appEui[7 - idx];
+		exchFrame[9 + idx] = devEui[7 - idx];
+	}
+	exchFrame[17] = (uint8_t)devNonce;
+	exchFrame[18] = (uint8_t)(devNonce >> 8);
+	uint32_t mic = loraJoinMic(appKey, exchFrame, 19);
+	memcpy(&exchFrame[19], &mic, 4);
+	exchLen = 23;
+}
+
+void lmh_join(void)
+{
+	if (!useOtaa)
+	{
+		joined = true;
+		fCntUp = 0;
+		simPost(SIM_WORKER_LORA, []() {
+			if (callbacks->lmh_has_joined != NULL)
+			{
+				callbacks->lmh_has_joined();
+			}
+		});
+		return;
+	}
+	if (macState != MAC_IDLE)
+	{
+		return;
+	}
+	joined = false;
+	macState = MAC_JOIN;
+	exchTrials = 0;
+	buildJoinRequest();
+	macStartTx();
+}
+
+/**
+ * @brief Build the data frame and start the exchange
+ */
+static lmh_error_status macSend(lmh_app_data_t *app_data, lmh_confirm is_tx_confirmed)
+{
+	if (!joined)
+	{
+		return LMH_ERROR;
+	}
+	if (macState != MAC_IDLE)
+	{
+		simLoraStats.busy++;
+		return LMH_BUSY;
+	}
+	if (app_data->buffsize > maxPayload[params.tx_data_rate & 0x07])
+	{
+		return LMH_ERROR;
+	}
+	exchConfirmed = is_tx_confirmed == LMH_CONFIRMED_MSG;
+	uint8_t pos = 0;
+	exchFrame[pos++] = exchConfirmed ? 0x80 : 0x40;
+	memcpy(&exchFrame[pos], &devAddr, 4);
+	pos += 4;
+	uint8_t fCtrl = fOptsLen;
+	if (params.adr_enable)
+	{
+		fCtrl |= 0x80;
+	}
+	if (ackPending)
+	{
+		fCtrl |= 0x20;
+		ackPending = false;
+	}
+	if (devClass == CLASS_B)
+	{
+		fCtrl |= 0x10;
+	}
+	exchFrame[pos++] = fCtrl;
+	exchFrame[pos++] = (uint8_t)fCntUp;
+	exchFrame[pos++] = (uint8_t)(fCntUp >> 8);
+	memcpy(&exchFrame[pos], fOpts, fOptsLen);
+	pos += fOptsLen;
+	fOptsLen = 0;
+	if ((app_data->buffsize != 0) || (app_data->port != 0))
+	{
+		exchFrame[pos++] = app_data->port;
+		memcpy(&exchFrame[pos], app_data->buffer, app_data->buffsize);
+		loraPayloadCrypt(app_data->port == 0 ? nwkSKey : appSKey, 0, devAddr, fCntUp, &exchFrame[pos],
+						 app_data->buffsize);
+		pos += app_data->buffsize;
+	}
+	uint32_t mic = loraDataMic(nwkSKey, 0, devAddr, fCntUp, exchFrame, pos);
+	memcpy(&exchFrame[pos], &mic, 4);
+	exchLen = pos + 4;
+
+	macState = MAC_DATA;
+	exchTrials = 0;
+	macStartTx();
+	return LMH_SUCCESS;
+}
+
+lmh_error_status lmh_send(lmh_app_data_t *app_data, lmh_confirm is_tx_confirmed)
+{
+	lmh_error_status result = macSend(app_data, is_tx_confirmed);
+	if (sendCb)
+	{
+		sendCb(app_data->port, app_data->buffer, app_data->buffsize, is_tx_confirmed == LMH_CONFIRMED_MSG, result);
+	}
+	return result;
+}
+
+void simLoraOnSend(std::function<void(uint8_t port, const uint8_t *data, uint8_t len, bool confirmed, int8_t result)> callback)
+{
+	sendCb = callback;
+}
+
+/**
+ * @brief Check if the radio receives a frame that starts at a time
+ */
+static bool macListening(uint64_t startUs)
+{
+	if (transmitting || receiving)
+	{
+		return false;
+	}
+	if (macState != MAC_IDLE)
+	{
+		for (int win = 0; win < 2; win++)
+		{
+			if ((winStart[win] != 0) && (startUs + SIM_LORA_WIN_BEFORE_US >= winStart[win]) &&
+				(startUs <= winStart[win] + SIM_LORA_WIN_AFTER_US))
+			{
+				return true;
+			}
+		}
+	}
+	if (!joined)
+	{
+		return false;
+	}
+	// Class C receives continuously on RX2, class B in the ping slots the server uses
+	return (devClass == CLASS_C) || ((devClass == CLASS_B) && beaconLocked);
+}
+
+/**
+ * @brief End of a receive window without a downlink
+ */
+static void macWindowEnd(uint64_t gen, int win)
+{
+	if ((gen != exchGen) || exchDone || receiving)
+	{
+		return;
+	}
+	if (win == 0)
+	{
+		// Wait for RX2
+		return;
+	}
+	macFinish(false);
+}
+
+/**
+ * @brief Start the transmission of the current exchange
+ */
+static void macStartTx(void)
+{
+	uint64_t gen = ++exchGen;
+	exchDone = false;
+	winStart[0] = winStart[1] = 0;
+	transmitting = true;
+	uint8_t dr = params.tx_data_rate & 0x07;
+	uint64_t txStart = simNowUs() + SIM_LORA_TX_SETUP_US;
+	uint64_t txEnd = txStart + simLoraToaUs(simLoraSf(dr), exchLen, true);
+	simLoraStats.lastTxStart = txStart;
+	simLoraStats.lastTxEnd = txEnd;
+	simLoraStats.airtimeUs += txEnd - txStart;
+	if (macState == MAC_JOIN)
+	{
+		simLoraStats.joinRequests++;
+	}
+	else if (exchTrials == 0)
+	{
+		simLoraStats.uplinks++;
+	}
+	else
+	{
+		simLoraStats.retransmissions++;
+	}
+	std::vector<uint8_t> frame(exchFrame, exchFrame + exchLen);
+	bool join = macState == MAC_JOIN;
+	// TX done interrupt of the radio
+	simAt(txEnd, [frame, dr, txStart, txEnd, gen, join]() {
+		transmitting = false;
+		if (simRandomUnit() < simLoraCfg.upLoss)
+		{
+			simLoraStats.lost++;
+		}
+		else
+		{
+			nsReceive(frame.data(), (uint8_t)frame.size(), dr, txStart, txEnd);
+		}
+		uint64_t rx1 = txEnd + (join ? 5000000 : 1000000);
+		winStart[0] = rx1;
+		winStart[1] = rx1 + 1000000;
+		simLoraStats.rxWindows += 2;
+		// RX window timers of the MAC
+		simKernelAt(winStart[0] + SIM_LORA_WIN_AFTER_US, [gen]() { macWindowEnd(gen, 0); });
+		simKernelAt(winStart[1] + SIM_LORA_WIN_AFTER_US, [gen]() { macWindowEnd(gen, 1); });
+	});
+}
+
+/**
+ * @brief End of an exchange, retry or report the result
+ *
+ * @param success Join accepted or uplink acknowledged / sent
+ */
+static void macFinish(bool success)
+{
+	exchDone = true;
+	winStart[0] = winStart[1] = 0;
+	uint8_t trials = params.nb_trials == 0 ? 1 : params.nb_trials;
+	if (macState == MAC_JOIN)
+	{
+		if (success)
+		{
+			macState = MAC_IDLE;
+			simPost(SIM_WORKER_LORA, []() { callbacks->lmh_has_joined(); });
+			return;
+		}
+		if (++exchTrials < trials)
+		{
+			// Next join request after a random delay
+			uint64_t gen = exchGen;
+			simKernelAt(simNowUs() + 1000000 + simRandomRange(2000000), [gen]() {
+				if ((gen == exchGen) && (macState == MAC_JOIN))
+				{
+					buildJoinRequest();
+					macStartTx();
+				}
+			});
+			return;
+		}
+		macState = MAC_IDLE;
+		simPost(SIM_WORKER_LORA, []() {
+			if (callbacks->lmh_has_joined_failed != NULL)
+			{
+				callbacks->lmh_has_joined_failed();
+			}
+		});
+		return;
+	}
+
+	if (exchConfirmed && !success && (++exchTrials < trials))
+	{
+		// ACK_TIMEOUT 2 s +- 1 s, same frame counter
+		uint64_t gen = exchGen;
+		simKernelAt(simNowUs() + 1000000 + simRandomRange(2000000), [gen]() {
+			if ((gen == exchGen) && (macState == MAC_DATA))
+			{
+				macStartTx();
+			}
+		});
+		return;
+	}
+	fCntUp++;
+	macState = MAC_IDLE;
+	if (exchConfirmed)
+	{
+		simPost(SIM_WORKER_LORA, [success]() {
+			if (callbacks->lmh_conf_finished != NULL)
+			{
+				callbacks->lmh_conf_finished(success);
+			}
+		});
+	}
+	else
+	{
+		simPost(SIM_WORKER_LORA, []() {
+			if (callbacks->lmh_unconf_finished != NULL)
+			{
+				callbacks->lmh_unconf_finished();
+			}
+		});
+	}
+}
+
+/**
+ * @brief Handle a join accept
+ *
+ * @return true if the accept is valid
+ */
+static bool macJoinAccept(const uint8_t *frame, uint8_t len)
+{
+	if ((macState != MAC_JOIN) || ((len != 17) && (len != 33)))
+	{
+		return false;
+	}
+	uint8_t plain[33];
+	plain[0] = frame[0];
+	for (int pos = 1; pos < len; pos += 16)
+	{
+		// The server encrypts with AES decrypt, the device decrypts with AES encrypt
+		aesEncrypt(appKey, &frame[pos], &plain[pos]);
+	}
+	uint32_t mic;
+	memcpy(&mic, &plain[len - 4], 4);
+	if (mic != loraJoinMic(appKey, plain, len - 4))
+	{
+		return false;
+	}
+	uint8_t block[16] = {0};
+	memcpy(&block[1], &plain[1], 6);
+	block[7] = (uint8_t)devNonce;
+	block[8] = (uint8_t)(devNonce >> 8);
+	block[0] = 0x01;
+	aesEncrypt(appKey, block, nwkSKey);
+	block[0] = 0x02;
+	aesEncrypt(appKey, block, appSKey);
+	memcpy(&devAddr, &plain[7], 4);
+	joined = true;
+	fCntUp = 0;
+	fCntDown = 0;
+	anyDownlink = false;
+	ackPending = false;
+	fOptsLen = 0;
+	return true;
+}
+
+/**
+ * @brief Handle a data downlink
+ *
+ * @return true if the downlink is valid
+ */
+static bool macDataDown(const uint8_t *frame, uint8_t len)
+{
+	if (!joined || (len < 12))
+	{
+		return false;
+	}
+	uint32_t addr;
+	memcpy(&addr, &frame[1], 4);
+	if (addr != devAddr)
+	{
+		return false;
+	}
+	uint8_t fCtrl = frame[5];
+	uint8_t optsLen = fCtrl & 0x0F;
+	uint32_t fCnt = (fCntDown & 0xFFFF0000) | frame[6] | (frame[7] << 8);
+	if (anyDownlink && (fCnt < fCntDown))
+	{
+		fCnt += 0x10000;
+	}
+	uint32_t mic;
+	memcpy(&mic, &frame[len - 4], 4);
+	if (mic != loraDataMic(nwkSKey, 1, devAddr, fCnt, frame, len - 4))
+	{
+		return false;
+	}
+	if (anyDownlink && (fCnt <= fCntDown))
+	{
+		return false;
+	}
+	fCntDown = fCnt;
+	anyDownlink = true;
+	bool confirmed = (frame[0] >> 5) == 5;
+	if (confirmed)
+	{
+		ackPending = true;
+	}
+	bool ack = (fCtrl & 0x20) != 0;
+	if (ack && (macState == MAC_DATA) && exchConfirmed)
+	{
+		exchDone = true;
+	}
+	uint8_t pos = 8 + optsLen;
+	if (pos < len - 4)
+	{
+		uint8_t port = frame[pos++];
+		uint8_t size = len - 4 - pos;
+		std::vector<uint8_t> payload(&frame[pos], &frame[pos] + size);
+		loraPayloadCrypt(port == 0 ? nwkSKey : appSKey, 1, devAddr, fCnt, payload.data(), size);
+		if (port != 0)
+		{
+			simLoraStats.downlinks++;
+			int16_t rssi = simLoraCfg.rssi;
+			int8_t snr = simLoraCfg.snr;
+			simPost(SIM_WORKER_LORA, [payload, port, rssi, snr]() {
+				static uint8_t rxBuffer[256];
+				memcpy(rxBuffer, payload.data(), payload.size());
+				lmh_app_data_t appData = {rxBuffer, port, (uint8_t)payload.size(), rssi, snr};
+				if (callbacks->lmh_RxData != NULL)
+				{
+					callbacks->lmh_RxData(&appData);
+				}
+			});
+		}
+	}
+	return ack || !exchConfirmed;
+}
+
+void simRadioDownlink(const uint8_t *frame, uint8_t len, uint8_t dr, uint64_t startUs)
+{
+	std::vector<uint8_t> copy(frame, frame + len);
+	simAt(startUs, [copy, dr, startUs]() {
+		if (!macListening(startUs) || (simRandomUnit() < simLoraCfg.downLoss))
+		{
+			simLoraStats.rxDropped++;
+			return;
+		}
+		receiving = true;
+		uint64_t gen = exchGen;
+		// RX done interrupt of the radio
+		simAt(startUs + simLoraToaUs(simLoraSf(dr), copy.size(), false), [copy, gen]() {
+			receiving = false;
+			bool inExchange = (macState != MAC_IDLE) && (gen == exchGen) && !exchDone;
+			uint8_t type = copy[0] >> 5;
+			bool valid = false;
+			if (type == 1)
+			{
+				valid = macJoinAccept(copy.data(), copy.size());
+			}
+			else if ((type == 3) || (type == 5))
+			{
+				valid = macDataDown(copy.data(), copy.size());
+			}
+			if (!inExchange)
+			{
+				return;
+			}
+			if (valid || (winStart[1] != 0 && simNowUs() > winStart[1]))
+			{
+				// A downlink in RX1 ends the exchange, an invalid one in RX2 too
+				macFinish(valid);
+			}
+		});
+	});
+}
+
+lmh_error_status lmh_class_request(DeviceClass_t newClass)
+{
+	if (newClass == CLASS_B)
+	{
+		// Class B is entered with the MIB after the beacon is locked
+		return LMH_ERROR;
+	}
+	devClass = newClass;
+	if (callbacks->lmh_ConfirmClass != NULL)
+	{
+		callbacks->lmh_ConfirmClass(newClass);
+	}
+	return LMH_SUCCESS;
+}
+
+LoRaMacStatus_t LoRaMacMibSetRequestConfirm(MibRequestConfirm_t *mibSet)
+{
+	switch (mibSet->Type)
+	{
+	case MIB_DEVICE_CLASS:
+		if ((mibSet->Param.Class == CLASS_B) && !beaconLocked)
+		{
+			return LORAMAC_STATUS_BEACON_NOT_LOCKED;
+		}
+		devClass = mibSet->Param.Class;
+		return LORAMAC_STATUS_OK;
+	case MIB_NETWORK_JOINED:
+		joined = mibSet->Param.IsNetworkJoined;
+		return LORAMAC_STATUS_OK;
+	}
+	return LORAMAC_STATUS_SERVICE_UNKNOWN;
+}
+
+/**
+ * @brief Wait for the next beacon
+ */
+static void beaconWait(uint8_t tries)
+{
+	uint64_t next = (simNowUs() / SIM_LORA_BEACON_US + 1) * SIM_LORA_BEACON_US;
+	simKernelAt(next, [tries]() {
+		if (!beaconSearching)
+		{
+			return;
+		}
+		if (simLoraCfg.beacon && (simRandomUnit() >= simLoraCfg.downLoss))
+		{
+			beaconSearching = false;
+			beaconLocked = true;
+			return;
+		}
+		if (tries + 1 < SIM_LORA_BEACON_TRIES)
+		{
+			beaconWait(tries + 1);
+		}
+		else
+		{
+			beaconSearching = false;
+		}
+	});
+}
+
+LoRaMacStatus_t LoRaMacMlmeRequest(MlmeReq_t *mlmeRequest)
+{
+	switch (mlmeRequest->Type)
+	{
+	case MLME_PING_SLOT_INFO:
+		if (!joined)
+		{
+			return LORAMAC_STATUS_NO_NETWORK_JOINED;
+		}
+		fOpts[fOptsLen++] = 0x10;
+		fOpts[fOptsLen++] = mlmeRequest->Req.PingSlotInfo.PingSlot.Value;
+		return LORAMAC_STATUS_OK;
+	case MLME_BEACON_ACQUISITION:
+		if (!joined)
+		{
+			return LORAMAC_STATUS_NO_NETWORK_JOINED;
+		}
+		if (beaconSearching)
+		{
+			return LORAMAC_STATUS_BUSY;
+		}
+		beaconSearching = true;
+		beaconLocked = false;
+		beaconWait(0);
+		return LORAMAC_STATUS_OK;
+	default:
+		break;
+	}
+	return LORAMAC_STATUS_SERVICE_UNKNOWN;
+}
@@ -0,0 +1,437 @@
+/**
+ * @file simNs.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Network server stand-in for one device
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Checks join requests and data uplinks like a LoRaWan 1.0.3
+ * network server. Queued downlinks go into RX1 of the next uplink,
+ * a class C device gets them right away and a class B device in its
+ * next ping slot. A port 3 downlink switches the class the server uses
+ * after the next uplink of the device, the class B bit in FCtrl
+ * switches to class B.
+ */
+#include "ns.h"
+#include "aes.h"
+#include <deque>
+#include <set>
+
+/** Processing time of the server before a class B or C downlink */
+#define NS_PROCESSING_US 50000
+/** RX2 data rate of AS923, used for class B and C downlinks */
+#define NS_RX2_DR 2
+/** Port of the class switch command of the firmware */
+#define NS_CLASS_PORT 3
+
+ns_stats_s nsStats;
+
+struct ns_downlink_s
+{
+	uint8_t port;
+	std::vector<uint8_t> data;
+	bool confirmed;
+	/** A confirmed downlink stays queued until the device sends the ACK */
+	bool sent;
+};
+
+static bool provisioned = false;
+static bool otaa = true;
+static uint8_t devEui[8];
+static uint8_t appEui[8];
+static uint8_t appKey[16];
+static uint8_t nwkSKey[16];
+static uint8_t appSKey[16];
+static uint32_t devAddr = 0;
+static bool session = false;
+static std::set<uint16_t> devNonces;
+static uint32_t appNonce = 0;
+static uint32_t fCntUp = 0;
+static bool anyUplink = false;
+static uint32_t fCntDown = 0;
+static uint8_t devClass = 0;
+static uint8_t pendingClass = 0xFF;
+static uint8_t pingPeriodicity = 0xFF;
+static std::deque<ns_downlink_s> queue;
+static std::vector<ns_uplink_s> uplinks;
+static std::function<void(const ns_uplink_s &uplink)> uplinkCb;
+/** A downlink is scheduled but not yet sent */
+static bool downlinkScheduled = false;
+
+void nsAddOtaa(const uint8_t eui[8], const uint8_t app[8], const uint8_t key[16])
+{
+	provisioned = true;
+	otaa = true;
+	session = false;
+	memcpy(devEui, eui, 8);
+	memcpy(appEui, app, 8);
+	memcpy(appKey, key, 16);
+}
+
+void nsAddAbp(uint32_t addr, const uint8_t nwk[16], const uint8_t app[16])
+{
+	provisioned = true;
+	otaa = false;
+	session = true;
+	devAddr = addr;
+	memcpy(nwkSKey, nwk, 16);
+	memcpy(appSKey, app, 16);
+	fCntUp = 0;
+	anyUplink = false;
+	fCntDown = 0;
+}
+
+uint8_t nsDeviceClass(void)
+{
+	return devClass;
+}
+
+uint8_t nsPingPeriodicity(void)
+{
+	return pingPeriodicity;
+}
+
+size_t nsQueued(void)
+{
+	return queue.size();
+}
+
+std::vector<ns_uplink_s> &nsUplinks(void)
+{
+	return uplinks;
+}
+
+void nsOnUplink(std::function<void(const ns_uplink_s &uplink)> callback)
+{
+	uplinkCb = callback;
+}
+
+/**
+ * @brief Build a data downlink with the head of the queue and schedule it
+ *
+ * @param startUs Start of the transmission
+ * @param dr Data rate
+ * @param ack Flag if the uplink is acknowledged
+ * @param fOpts MAC command answers
+ * @param fOptsLen Length of the MAC command answers
+ */
+static void sendDownlink(uint64_t startUs, uint8_t dr, bool ack, const uint8_t *fOpts, uint8_t fOptsLen)
+{
+	ns_downlink_s *down = NULL;
+	for (auto &entry : queue)
+	{
+		down = &entry;
+		break;
+	}
+	uint8_t frame[256];
+	uint8_t pos = 0;
+	frame[pos++] = (down != NULL) && down->confirmed ? 0xA0 : 0x60;
+	memcpy(&frame[pos], &devAddr, 4);
+	pos += 4;
+	uint8_t fCtrl = fOptsLen;
+	if (ack)
+	{
+		fCtrl |= 0x20;
+		nsStats.acks++;
+	}
+	if (queue.size() > 1)
+	{
+		// FPending
+		fCtrl |= 0x10;
+	}
+	frame[pos++] = fCtrl;
+	frame[pos++] = (uint8_t)fCntDown;
+	frame[pos++] = (uint8_t)(fCntDown >> 8);
+	memcpy(&frame[pos], fOpts, fOptsLen);
+	pos += fOptsLen;
+	if (down != NULL)
+	{
+		frame[pos++] = down->port;
+		memcpy(&frame[pos], down->data.data(), down->data.size());
+		loraPayloadCrypt(down->port == 0 ? nwkSKey : appSKey, 1, devAddr, fCntDown, &frame[pos], down->data.size());
+		pos += down->data.size();
+		if ((down->port == NS_CLASS_PORT) && !down->data.empty() && (down->data[0] != 1))
+		{
+			// Applied with the next uplink, the device confirms the switch with it
+			pendingClass = down->data[0];
+		}
+		if (down->confirmed)
+		{
+			down->sent = true;
+		}
+		else
+		{
+			queue.pop_front();
+		}
+	}
+	uint32_t mic = loraDataMic(nwkSKey, 1, devAddr, fCntDown, frame, pos);
+	memcpy(&frame[pos], &mic, 4);
+	pos += 4;
+	fCntDown++;
+	nsStats.downlinks++;
+	simRadioDownlink(frame, pos, dr, startUs);
+}
+
+/**
+ * @brief Schedule the downlinks of a class B or C device
+ */
+static void scheduleDownlink(void)
+{
+	if (downlinkScheduled || queue.empty() || !session)
+	{
+		return;
+	}
+	uint64_t start = simNowUs() + NS_PROCESSING_US;
+	if (devClass == 2)
+	{
+		// Class C, right away on RX2
+	}
+	else if ((devClass == 1) && (pingPeriodicity != 0xFF))
+	{
+		// Class B, next ping slot, one slot every 2^periodicity seconds
+		uint64_t period = (1ULL << pingPeriodicity) * 1000000ULL;
+		start = (start / period + 1) * period;
+	}
+	else
+	{
+		// Class A, waits for the next uplink
+		return;
+	}
+	downlinkScheduled = true;
+	simAt(start, []() {
+		downlinkScheduled = false;
+		if (queue.empty() || (devClass == 0))
+		{
+			return;
+		}
+		sendDownlink(simNowUs(), NS_RX2_DR, false, NULL, 0);
+		scheduleDownlink();
+	});
+}
+
+void nsQueueDownlink(uint8_t port, const uint8_t *data, uint8_t len, bool confirmed)
+{
+	ns_downlink_s down;
+	down.port = port;
+	down.data.assign(data, data + len);
+	down.confirmed = confirmed;
+	down.sent = false;
+	queue.push_back(down);
+	scheduleDownlink();
+}
+
+/**
+ * @brief Handle a join request
+ */
+static void joinRequest(const uint8_t *frame, uint8_t len, uint8_t dr, uint64_t txEndUs)
+{
+	nsStats.joinRequests++;
+	if (!otaa || (len != 23))
+	{
+		return;
+	}
+	for (int idx = 0; idx < 8; idx++)
+	{
+		if ((frame[1 + idx] != appEui[7 - idx]) || (frame[9 + idx] != devEui[7 - idx]))
+		{
+			nsStats.unknownDevices++;
+			return;
+		}
+	}
+	uint32_t mic;
+	memcpy(&mic, &frame[19], 4);
+	if (mic != loraJoinMic(appKey, frame, 19))
+	{
+		nsStats.micFailures++;
+		return;
+	}
+	uint16_t nonce = frame[17] | (frame[18] << 8);
+	if (!devNonces.insert(nonce).second)
+	{
+		nsStats.devNonceReuse++;
+		return;
+	}
+
+	appNonce++;
+	uint8_t plain[17];
+	plain[0] = 0x20;
+	plain[1] = (uint8_t)appNonce;
+	plain[2] = (uint8_t)(appNonce >> 8);
+	plain[3] = (uint8_t)(appNonce >> 16);
+	// NetID 0x000013
+	plain[4] = 0x13;
+	plain[5] = 0x00;
+	plain[6] = 0x00;
+	devAddr = 0x26000000 | ((appNonce * 0x9E3779B1) & 0x00FFFFFF);
+	memcpy(&plain[7], &devAddr, 4);
+	// DLSettings RX1DRoffset 0 RX2 DR2, RxDelay 1 s
+	plain[11] = NS_RX2_DR;
+	plain[12] = 1;
+	mic = loraJoinMic(appKey, plain, 13);
+	memcpy(&plain[13], &mic, 4);
+
+	uint8_t block[16] = {0};
+	memcpy(&block[1], &plain[1], 6);
+	block[7] = (uint8_t)nonce;
+	block[8] = (uint8_t)(nonce >> 8);
+	block[0] = 0x01;
+	aesEncrypt(appKey, block, nwkSKey);
+	block[0] = 0x02;
+	aesEncrypt(appKey, block, appSKey);
+	session = true;
+	fCntUp = 0;
+	anyUplink = false;
+	fCntDown = 0;
+	devClass = 0;
+	pendingClass = 0xFF;
+	pingPeriodicity = 0xFF;
+
+	uint8_t accept[17];
+	accept[0] = plain[0];
+	aesDecrypt(appKey, &plain[1], &accept[1]);
+	nsStats.joinAccepts++;
+	simRadioDownlink(accept, sizeof(accept), dr, txEndUs + 5000000);
+}
+
+void nsReceive(const uint8_t *frame, uint8_t len, uint8_t dr, uint64_t txStartUs, uint64_t txEndUs)
+{
+	if (!provisioned || (len < 1))
+	{
+		return;
+	}
+	uint8_t type = frame[0] >> 5;
+	if (type == 0)
+	{
+		joinRequest(frame, len, dr, txEndUs);
+		return;
+	}
+	if (((type != 2) && (type != 4)) || (len < 12))
+	{
+		return;
+	}
+	uint32_t addr;
+	memcpy(&addr, &frame[1], 4);
+	if (!session || (addr != devAddr))
+	{
+		nsStats.unknownDevices++;
+		return;
+	}
+	bool confirmed = type == 4;
+	uint8_t fCtrl = frame[5];
+	uint8_t optsLen = fCtrl & 0x0F;
+	uint32_t fCnt = (fCntUp & 0xFFFF0000) | frame[6] | (frame[7] << 8);
+	if (anyUplink && (fCnt < fCntUp))
+	{
+		fCnt += 0x10000;
+	}
+	uint32_t mic;
+	memcpy(&mic, &frame[len - 4], 4);
+	if (mic != loraDataMic(nwkSKey, 0, devAddr, fCnt, frame, len - 4))
+	{
+		nsStats.micFailures++;
+		return;
+	}
+	bool retransmission = false;
+	if (anyUplink && (fCnt == fCntUp))
+	{
+		if (!confirmed)
+		{
+			nsStats.fCntRejects++;
+			return;
+		}
+		// Retransmission, the ACK got lost, acknowledge again but do not deliver
+		retransmission = true;
+		nsStats.retransmissions++;
+	}
+	else if (anyUplink && (fCnt < fCntUp))
+	{
+		nsStats.fCntRejects++;
+		return;
+	}
+	fCntUp = fCnt;
+	anyUplink = true;
+
+	// ACK of a confirmed downlink
+	if ((fCtrl & 0x20) && !queue.empty() && queue.front().confirmed && queue.front().sent)
+	{
+		queue.pop_front();
+	}
+	// Class of the device
+	if (fCtrl & 0x10)
+	{
+		if (devClass != 1)
+		{
+			devClass = 1;
+			nsStats.classSwitches++;
+		}
+	}
+	else if (devClass == 1)
+	{
+		devClass = 0;
+		nsStats.classSwitches++;
+	}
+	if (pendingClass != 0xFF)
+	{
+		if (pendingClass != devClass)
+		{
+			devClass = pendingClass;
+			nsStats.classSwitches++;
+		}
+		pendingClass = 0xFF;
+	}
+
+	// MAC commands
+	uint8_t answers[15];
+	uint8_t answersLen = 0;
+	for (uint8_t pos = 8; pos < 8 + optsLen;)
+	{
+		uint8_t cid = frame[pos++];
+		if (cid == 0x10)
+		{
+			// PingSlotInfoReq, answered with PingSlotInfoAns
+			pingPeriodicity = frame[pos++] & 0x07;
+			nsStats.pingSlotInfo++;
+			answers[answersLen++] = 0x10;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (!retransmission)
+	{
+		ns_uplink_s uplink;
+		uplink.devAddr = devAddr;
+		uplink.fCnt = fCnt;
+		uplink.port = 0;
+		uplink.confirmed = confirmed;
+		uplink.classB = (fCtrl & 0x10) != 0;
+		uplink.retransmission = false;
+		uplink.txStartUs = txStartUs;
+		uplink.txEndUs = txEndUs;
+		uint8_t pos = 8 + optsLen;
+		if (pos < len - 4)
+		{
+			uplink.port = frame[pos++];
+			uplink.payload.assign(&frame[pos], &frame[len - 4]);
+			loraPayloadCrypt(uplink.port == 0 ? nwkSKey : appSKey, 0, devAddr, fCnt, uplink.payload.data(),
+							 uplink.payload.size());
+		}
+		nsStats.uplinks++;
+		uplinks.push_back(uplink);
+		if (uplinkCb)
+		{
+			uplinkCb(uplinks.back());
+		}
+	}
+
+	// RX1 with the same data rate
+	if (confirmed || !queue.empty() || (answersLen != 0))
+	{
+		sendDownlink(txEndUs + 1000000, dr, confirmed, answers, answersLen);
+	}
+	scheduleDownlink();
+}
@@ -0,0 +1,1059 @@
+/**
+ * @file simRtos.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Virtual clock, coroutine tasks, queues and timers
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Tasks run on their own stack (ucontext) and switch back to the
+ * scheduler when they block. The scheduler always runs the oldest ready
+ * task of the highest priority. A task that readies a task with a
+ * higher priority is switched out immediately, like the preemptive
+ * FreeRTOS scheduler would do.
+ * Events are kept in two queues: kernel events (task timeouts and timer
+ * expiries) define the expected idle time of the tickless idle, external
+ * events (interrupts) wake the MCU before that time.
+ */
+#include "sim.h"
+#include <deque>
+#include <queue>
+#include <vector>
+#include <ucontext.h>
+
+extern "C" void rtos_idle_callback(void);
+extern "C" void powerSleepBegin(TickType_t expectedIdle);
+extern "C" void powerSleepEnd(void);
+
+/** Stack of a task on the host, the firmware stack size is only reported */
+#define SIM_STACK_SIZE (128 * 1024)
+/** Task switches without time passing before a livelock is reported */
+#define SIM_LIVELOCK_SWITCHES 2000000
+/** Priority of the timer task */
+#define SIM_TIMER_PRIO TASK_PRIO_HIGH
+
+struct SimTask
+{
+	char name[configMAX_TASK_NAME_LEN + 1];
+	ucontext_t ctx;
+	uint8_t *stack;
+	uint32_t stackDepth;
+	UBaseType_t prio;
+	TaskFunction_t code;
+	void *params;
+	eTaskState state;
+	uint32_t number;
+	/** Incremented on every block, stale timeouts are ignored */
+	uint64_t waitGen;
+	bool timedOut;
+	SimQueue *waitQueue;
+};
+
+struct SimQueue
+{
+	UBaseType_t length;
+	UBaseType_t itemSize;
+	std::deque<std::vector<uint8_t>> items;
+	UBaseType_t count;
+	bool isMutex;
+	SimTask *owner;
+	std::deque<SimTask *> waitReceive;
+	std::deque<SimTask *> waitSend;
+};
+
+struct SimTimer
+{
+	char name[configMAX_TASK_NAME_LEN + 1];
+	TickType_t period;
+	bool autoReload;
+	void *id;
+	TimerCallbackFunction_t callback;
+	bool active;
+	uint64_t expiry;
+	uint64_t gen;
+};
+
+struct sim_event_s
+{
+	uint64_t time;
+	uint64_t seq;
+	std::function<void()> action;
+};
+
+struct sim_event_later
+{
+	bool operator()(const sim_event_s &a, const sim_event_s &b) const
+	{
+		return (a.time != b.time) ? (a.time > b.time) : (a.seq > b.seq);
+	}
+};
+
+typedef std::priority_queue<sim_event_s, std::vector<sim_event_s>, sim_event_later> sim_event_queue;
+
+/** Virtual clock in us */
+static uint64_t simNow = 0;
+/** Event queues */
+static sim_event_queue kernelEvents;
+static sim_event_queue externalEvents;
+static uint64_t eventSeq = 0;
+/** Ready tasks per priority */
+static std::deque<SimTask *> readyList[configMAX_PRIORITIES];
+/** All tasks, in creation order */
+static std::vector<SimTask *> allTasks;
+/** Running task, NULL in the scheduler or the host */
+static SimTask *current = NULL;
+/** Context of the scheduler */
+static ucontext_t schedCtx;
+/** Flag if an interrupt action runs */
+static bool inIsr = false;
+/** Flag if the MCU is in tickless sleep, the sleep ends with the next event */
+static bool sleeping = false;
+static uint64_t switches = 0;
+static uint64_t switchesAtLastTime = 0;
+static uint64_t lastSwitchTime = 0;
+static uint32_t taskNumber = 0;
+
+/** System tasks */
+struct sim_worker_s
+{
+	SimTask *task;
+	SemaphoreHandle_t wake;
+	std::deque<std::function<void()>> jobs;
+};
+static sim_worker_s workers[SIM_NUM_WORKERS];
+static const char *workerNames[SIM_NUM_WORKERS] = {"Tmr Svc", "BLE", "LORA"};
+
+/** Deterministic random numbers, xorshift64* */
+static uint64_t randomState = 0x9E3779B97F4A7C15ULL;
+
+[[noreturn]] void simFail(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	fprintf(stderr, "SIM FAIL at %llu us: ", (unsigned long long)simNow);
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+	exit(2);
+}
+
+uint64_t simNowUs(void)
+{
+	return simNow;
+}
+
+bool simInIsr(void)
+{
+	return inIsr;
+}
+
+uint64_t simSwitches(void)
+{
+	return switches;
+}
+
+void simSeed(uint64_t seed)
+{
+	randomState = seed * 0x9E3779B97F4A7C15ULL + 0x2545F4914F6CDD1DULL;
+	if (randomState == 0)
+	{
+		randomState = 1;
+	}
+}
+
+uint32_t simRandom(void)
+{
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+	return (uint32_t)((randomState * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+uint32_t simRandomRange(uint32_t range)
+{
+	return range == 0 ? 0 : (uint32_t)(((uint64_t)simRandom() * range) >> 32);
+}
+
+double simRandomUnit(void)
+{
+	return simRandom() / 4294967296.0;
+}
+
+static void pushEvent(sim_event_queue &queue, uint64_t us, std::function<void()> action)
+{
+	queue.push({us < simNow ? simNow : us, eventSeq++, std::move(action)});
+}
+
+void simAt(uint64_t us, std::function<void()> action)
+{
+	pushEvent(externalEvents, us, std::move(action));
+}
+
+void simAfter(uint64_t us, std::function<void()> action)
+{
+	pushEvent(externalEvents, simNow + us, std::move(action));
+}
+
+void simKernelAt(uint64_t us, std::function<void()> action)
+{
+	pushEvent(kernelEvents, us, std::move(action));
+}
+
+void simBusy(uint32_t us)
+{
+	simNow += us;
+}
+
+/**
+ * @brief Put a task into the ready list
+ *
+ * @param task Task
+ * @param front true to run it before the other tasks of its priority
+ */
+static void makeReady(SimTask *task, bool front = false)
+{
+	task->state = eReady;
+	if (front)
+	{
+		readyList[task->prio].push_front(task);
+	}
+	else
+	{
+		readyList[task->prio].push_back(task);
+	}
+}
+
+/**
+ * @brief Switch from the running task back to the scheduler
+ */
+static void switchToScheduler(void)
+{
+	SimTask *task = current;
+	swapcontext(&task->ctx, &schedCtx);
+}
+
+/**
+ * @brief Switch to a task that got ready if it has a higher priority
+ */
+static void preemptCheck(SimTask *woken)
+{
+	if ((current != NULL) && !inIsr && (woken->prio > current->prio))
+	{
+		makeReady(current, true);
+		switchToScheduler();
+	}
+}
+
+/**
+ * @brief Wake a task blocked on a queue
+ *
+ * @param waiters Waiting tasks
+ * @return SimTask* Woken task or NULL
+ */
+static SimTask *wakeWaiter(std::deque<SimTask *> &waiters)
+{
+	if (waiters.empty())
+	{
+		return NULL;
+	}
+	// Highest priority first, FIFO within a priority
+	auto best = waiters.begin();
+	for (auto it = waiters.begin(); it != waiters.end(); it++)
+	{
+		if ((*it)->prio > (*best)->prio)
+		{
+			best = it;
+		}
+	}
+	SimTask *task = *best;
+	waiters.erase(best);
+	task->waitQueue = NULL;
+	makeReady(task);
+	return task;
+}
+
+static void removeWaiter(std::deque<SimTask *> &waiters, SimTask *task)
+{
+	for (auto it = waiters.begin(); it != waiters.end(); it++)
+	{
+		if (*it == task)
+		{
+			waiters.erase(it);
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Block the running task
+ *
+ * @param queue Queue to wait for, NULL for a delay
+ * @param send true to wait for space, false to wait for an item
+ * @param ticks Timeout
+ * @return true if woken by the queue
+ * @return false on timeout
+ */
+static bool taskBlock(SimQueue *queue, bool send, TickType_t ticks)
+{
+	SimTask *task = current;
+	task->state = eBlocked;
+	task->waitGen++;
+	task->timedOut = false;
+	task->waitQueue = queue;
+	if (queue != NULL)
+	{
+		(send ? queue->waitSend : queue->waitReceive).push_back(task);
+	}
+	if (ticks != portMAX_DELAY)
+	{
+		uint64_t gen = task->waitGen;
+		pushEvent(kernelEvents, simNow + (uint64_t)ticks * (1000000 / configTICK_RATE_HZ), [task, gen, send]() {
+			if ((task->state == eBlocked) && (task->waitGen == gen))
+			{
+				if (task->waitQueue != NULL)
+				{
+					removeWaiter(send ? task->waitQueue->waitSend : task->waitQueue->waitReceive, task);
+					task->waitQueue = NULL;
+				}
+				task->timedOut = true;
+				makeReady(task);
+			}
+		});
+	}
+	switchToScheduler();
+	return !task->timedOut;
+}
+
+/**
+ * @brief Leave the tickless sleep
+ */
+static void wakeUp(void)
+{
+	if (sleeping)
+	{
+		sleeping = false;
+		traceLOW_POWER_IDLE_END();
+	}
+}
+
+/**
+ * @brief Idle until a time
+ * @note The expected idle time is the time to the next kernel event,
+ * an external event ends the sleep earlier
+ *
+ * @param until End of the idle time
+ */
+static void idleUntil(uint64_t until)
+{
+	if (until <= simNow)
+	{
+		return;
+	}
+	if (!sleeping)
+	{
+		rtos_idle_callback();
+		uint64_t nextKernel = kernelEvents.empty() ? UINT64_MAX : kernelEvents.top().time;
+		TickType_t xExpectedIdleTime = 0;
+		if (nextKernel == UINT64_MAX)
+		{
+			xExpectedIdleTime = portMAX_DELAY;
+		}
+		else if (nextKernel > simNow)
+		{
+			xExpectedIdleTime = (TickType_t)(nextKernel / 1000 - simNow / 1000);
+		}
+		if (xExpectedIdleTime >= configEXPECTED_IDLE_TIME_BEFORE_SLEEP)
+		{
+			(void)xExpectedIdleTime;
+			traceLOW_POWER_IDLE_BEGIN();
+			sleeping = true;
+		}
+	}
+	simNow = until;
+}
+
+/**
+ * @brief Run a task until it blocks
+ */
+static void runTask(SimTask *task)
+{
+	wakeUp();
+	current = task;
+	switches++;
+	if (simNow != lastSwitchTime)
+	{
+		lastSwitchTime = simNow;
+		switchesAtLastTime = switches;
+	}
+	else if (switches - switchesAtLastTime > SIM_LIVELOCK_SWITCHES)
+	{
+		simFail("livelock, task %s runs without time passing", task->name);
+	}
+	swapcontext(&schedCtx, &task->ctx);
+	current = NULL;
+}
+
+/**
+ * @brief One step of the scheduler
+ *
+ * @param limit Time limit
+ * @return true if a task or an event ran
+ * @return false if nothing is due before the limit, the clock is at the limit
+ */
+static bool simStep(uint64_t limit)
+{
+	for (int prio = configMAX_PRIORITIES - 1; prio >= 0; prio--)
+	{
+		if (!readyList[prio].empty())
+		{
+			SimTask *task = readyList[prio].front();
+			readyList[prio].pop_front();
+			runTask(task);
+			return true;
+		}
+	}
+	sim_event_queue *queue = NULL;
+	if (!kernelEvents.empty())
+	{
+		queue = &kernelEvents;
+	}
+	if (!externalEvents.empty())
+	{
+		if ((queue == NULL) || sim_event_later()(kernelEvents.top(), externalEvents.top()))
+		{
+			queue = &externalEvents;
+		}
+	}
+	if ((queue == NULL) || (queue->top().time > limit))
+	{
+		idleUntil(limit);
+		return false;
+	}
+	idleUntil(queue->top().time);
+	wakeUp();
+	sim_event_s event = queue->top();
+	queue->pop();
+	inIsr = true;
+	event.action();
+	inIsr = false;
+	return true;
+}
+
+void simRunUntil(uint64_t us)
+{
+	if (current != NULL)
+	{
+		simFail("simRunUntil() called from task %s", current->name);
+	}
+	while (simStep(us))
+	{
+	}
+}
+
+void simRun(uint32_t ms)
+{
+	simRunUntil(simNow + (uint64_t)ms * 1000);
+}
+
+bool simRunFor(std::function<bool()> condition, uint32_t maxMs)
+{
+	uint64_t limit = simNow + (uint64_t)maxMs * 1000;
+	while (!condition())
+	{
+		if (!simStep(limit))
+		{
+			return condition();
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Block the host until a condition is true or the time is over
+ * @note Used for blocking calls that are not made from a task
+ */
+static bool hostWait(std::function<bool()> condition, TickType_t ticks)
+{
+	if (inIsr)
+	{
+		simFail("blocking call in interrupt context");
+	}
+	uint64_t limit = (ticks == portMAX_DELAY) ? UINT64_MAX : simNow + (uint64_t)ticks * (1000000 / configTICK_RATE_HZ);
+	while (!condition())
+	{
+		if (!simStep(limit))
+		{
+			return condition();
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Entry of a task coroutine
+ */
+static void taskEntry(uint32_t low, uint32_t high)
+{
+	SimTask *task = (SimTask *)(((uintptr_t)high << 32) | low);
+	task->code(task->params);
+	// Returning from a task is not allowed in FreeRTOS, treat it like vTaskDelete(NULL)
+	task->state = eDeleted;
+	switchToScheduler();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *params,
+					   UBaseType_t priority, TaskHandle_t *handle)
+{
+	SimTask *task = new SimTask();
+	snprintf(task->name, sizeof(task->name), "%s", name);
+	task->stack = (uint8_t *)malloc(SIM_STACK_SIZE);
+	task->stackDepth = stackDepth;
+	task->prio = priority >= configMAX_PRIORITIES ? configMAX_PRIORITIES - 1 : priority;
+	task->code = code;
+	task->params = params;
+	task->number = ++taskNumber;
+	getcontext(&task->ctx);
+	task->ctx.uc_stack.ss_sp = task->stack;
+	task->ctx.uc_stack.ss_size = SIM_STACK_SIZE;
+	task->ctx.uc_link = NULL;
+	uintptr_t ptr = (uintptr_t)task;
+	makecontext(&task->ctx, (void (*)(void))taskEntry, 2, (uint32_t)ptr, (uint32_t)(ptr >> 32));
+	allTasks.push_back(task);
+	if (handle != NULL)
+	{
+		*handle = task;
+	}
+	makeReady(task);
+	preemptCheck(task);
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+	if ((task == NULL) || (task == current))
+	{
+		current->state = eDeleted;
+		switchToScheduler();
+		return;
+	}
+	for (int prio = 0; prio < configMAX_PRIORITIES; prio++)
+	{
+		removeWaiter(readyList[prio], task);
+	}
+	task->state = eDeleted;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	if (current == NULL)
+	{
+		hostWait([]() { return false; }, ticks);
+		return;
+	}
+	if (ticks == 0)
+	{
+		taskYIELD();
+		return;
+	}
+	taskBlock(NULL, false, ticks);
+}
+
+void vTaskSuspend(TaskHandle_t task)
+{
+	if ((task == NULL) || (task == current))
+	{
+		current->state = eSuspended;
+		switchToScheduler();
+		return;
+	}
+	for (int prio = 0; prio < configMAX_PRIORITIES; prio++)
+	{
+		removeWaiter(readyList[prio], task);
+	}
+	task->state = eSuspended;
+}
+
+void vTaskResume(TaskHandle_t task)
+{
+	if (task->state == eSuspended)
+	{
+		makeReady(task);
+		preemptCheck(task);
+	}
+}
+
+void taskYIELD(void)
+{
+	if ((current == NULL) || inIsr)
+	{
+		return;
+	}
+	makeReady(current);
+	switchToScheduler();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t)(simNow / (1000000 / configTICK_RATE_HZ));
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+	return xTaskGetTickCount();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return current;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+	UBaseType_t count = 1; // IDLE
+	for (SimTask *task : allTasks)
+	{
+		if (task->state != eDeleted)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *status, UBaseType_t size, uint32_t *totalRunTime)
+{
+	if (totalRunTime != NULL)
+	{
+		*totalRunTime = 0;
+	}
+	if (size < uxTaskGetNumberOfTasks())
+	{
+		return 0;
+	}
+	UBaseType_t count = 0;
+	for (SimTask *task : allTasks)
+	{
+		if (task->state == eDeleted)
+		{
+			continue;
+		}
+		TaskStatus_t &entry = status[count++];
+		memset(&entry, 0, sizeof(entry));
+		entry.xHandle = task;
+		entry.pcTaskName = task->name;
+		entry.xTaskNumber = task->number;
+		entry.eCurrentState = task == current ? eRunning : task->state;
+		entry.uxCurrentPriority = task->prio;
+		entry.uxBasePriority = task->prio;
+		// The host stack usage says nothing about the nRF52, the stack is reported unused
+		entry.usStackHighWaterMark = task->stackDepth;
+	}
+	TaskStatus_t &idle = status[count++];
+	memset(&idle, 0, sizeof(idle));
+	idle.pcTaskName = "IDLE";
+	idle.eCurrentState = eReady;
+	idle.usStackHighWaterMark = 256;
+	return count;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+	return task == NULL ? current->stackDepth : task->stackDepth;
+}
+
+// Queues and semaphores
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+	SimQueue *queue = new SimQueue();
+	queue->length = length;
+	queue->itemSize = itemSize;
+	queue->count = 0;
+	queue->isMutex = false;
+	queue->owner = NULL;
+	return queue;
+}
+
+/**
+ * @brief Add an item if there is space
+ */
+static bool queuePut(SimQueue *queue, const void *item)
+{
+	if (queue->count >= queue->length)
+	{
+		return false;
+	}
+	if (queue->itemSize != 0)
+	{
+		const uint8_t *data = (const uint8_t *)item;
+		queue->items.emplace_back(data, data + queue->itemSize);
+	}
+	queue->count++;
+	if (queue->isMutex)
+	{
+		queue->owner = NULL;
+	}
+	SimTask *woken = wakeWaiter(queue->waitReceive);
+	if (woken != NULL)
+	{
+		preemptCheck(woken);
+	}
+	return true;
+}
+
+/**
+ * @brief Take an item if there is one
+ */
+static bool queueGet(SimQueue *queue, void *item)
+{
+	if (queue->count == 0)
+	{
+		return false;
+	}
+	if (queue->itemSize != 0)
+	{
+		memcpy(item, queue->items.front().data(), queue->itemSize);
+		queue->items.pop_front();
+	}
+	queue->count--;
+	if (queue->isMutex)
+	{
+		queue->owner = current;
+	}
+	SimTask *woken = wakeWaiter(queue->waitSend);
+	if (woken != NULL)
+	{
+		preemptCheck(woken);
+	}
+	return true;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+	while (!queuePut(queue, item))
+	{
+		if (wait == 0)
+		{
+			return errQUEUE_FULL;
+		}
+		if (current == NULL)
+		{
+			if (!hostWait([queue]() { return queue->count < queue->length; }, wait))
+			{
+				return errQUEUE_FULL;
+			}
+			continue;
+		}
+		if (!taskBlock(queue, true, wait))
+		{
+			return errQUEUE_FULL;
+		}
+	}
+	return pdPASS;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+	return xQueueSend(queue, item, wait);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+{
+	if (woken != NULL)
+	{
+		*woken = pdFALSE;
+	}
+	return queuePut(queue, item) ? pdPASS : errQUEUE_FULL;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+	while (!queueGet(queue, item))
+	{
+		if (wait == 0)
+		{
+			return pdFALSE;
+		}
+		if (current == NULL)
+		{
+			if (!hostWait([queue]() { return queue->count != 0; }, wait))
+			{
+				return pdFALSE;
+			}
+			continue;
+		}
+		if (!taskBlock(queue, false, wait))
+		{
+			return pdFALSE;
+		}
+	}
+	return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+	return queue->count;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+	delete queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+	SimQueue *queue = xQueueCreate(max, 0);
+	queue->count = initial;
+	return queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	SimQueue *queue = xQueueCreate(1, 0);
+	queue->isMutex = true;
+	queue->count = 1;
+	return queue;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait)
+{
+	return xQueueReceive(sem, NULL, wait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+	return queuePut(sem, NULL) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken)
+{
+	return xQueueSendFromISR(sem, NULL, woken);
+}
+
+BaseType_t xSemaphoreTakeFromISR(SemaphoreHandle_t sem, BaseType_t *woken)
+{
+	if (woken != NULL)
+	{
+		*woken = pdFALSE;
+	}
+	return queueGet(sem, NULL) ? pdTRUE : pdFALSE;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem)
+{
+	return sem->count;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+	delete sem;
+}
+
+// System tasks
+
+/**
+ * @brief Body of a system task, runs the posted jobs in order
+ */
+static void workerTask(void *params)
+{
+	sim_worker_s *worker = (sim_worker_s *)params;
+	while (true)
+	{
+		xSemaphoreTake(worker->wake, portMAX_DELAY);
+		while (!worker->jobs.empty())
+		{
+			std::function<void()> job = std::move(worker->jobs.front());
+			worker->jobs.pop_front();
+			job();
+		}
+	}
+}
+
+void simPost(uint8_t worker, std::function<void()> fn)
+{
+	sim_worker_s *entry = &workers[worker];
+	if (entry->task == NULL)
+	{
+		entry->wake = xSemaphoreCreateBinary();
+		// Created without a switch, the job runs when the scheduler runs next
+		SimTask *saved = current;
+		current = NULL;
+		xTaskCreate(workerTask, workerNames[worker], 256, entry, worker == SIM_WORKER_TIMER ? SIM_TIMER_PRIO : TASK_PRIO_HIGH,
+					&entry->task);
+		current = saved;
+	}
+	entry->jobs.push_back(std::move(fn));
+	SimTask *saved = current;
+	bool savedIsr = inIsr;
+	// Posting never switches, the job runs after the caller blocks or from the scheduler
+	inIsr = true;
+	xSemaphoreGive(entry->wake);
+	inIsr = savedIsr;
+	current = saved;
+}
+
+// Timers
+
+/**
+ * @brief Schedule the expiry of a timer
+ */
+static void timerArm(SimTimer *timer, uint64_t expiry)
+{
+	timer->active = true;
+	timer->expiry = expiry;
+	uint64_t gen = ++timer->gen;
+	pushEvent(kernelEvents, expiry, [timer, gen]() {
+		if (!timer->active || (timer->gen != gen))
+		{
+			return;
+		}
+		if (timer->autoReload)
+		{
+			timerArm(timer, timer->expiry + (uint64_t)timer->period * (1000000 / configTICK_RATE_HZ));
+		}
+		else
+		{
+			timer->active = false;
+		}
+		simPost(SIM_WORKER_TIMER, [timer]() { timer->callback(timer); });
+	});
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t autoReload, void *id,
+						   TimerCallbackFunction_t callback)
+{
+	SimTimer *timer = new SimTimer();
+	snprintf(timer->name, sizeof(timer->name), "%s", name == NULL ? "" : name);
+	timer->period = period == 0 ? 1 : period;
+	timer->autoReload = autoReload != 0;
+	timer->id = id;
+	timer->callback = callback;
+	timer->active = false;
+	timer->gen = 0;
+	return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait)
+{
+	(void)wait;
+	if (timer == NULL)
+	{
+		return pdFAIL;
+	}
+	timerArm(timer, simNow + (uint64_t)timer->period * (1000000 / configTICK_RATE_HZ));
+	return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+	(void)wait;
+	if (timer == NULL)
+	{
+		return pdFAIL;
+	}
+	timer->active = false;
+	timer->gen++;
+	return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait)
+{
+	return xTimerStart(timer, wait);
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait)
+{
+	if (timer == NULL)
+	{
+		return pdFAIL;
+	}
+	timer->period = period == 0 ? 1 : period;
+	return xTimerStart(timer, wait);
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+	return timer->active ? pdTRUE : pdFALSE;
+}
+
+TickType_t xTimerGetPeriod(TimerHandle_t timer)
+{
+	return timer->period;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+	return timer->id;
+}
+
+void SoftwareTimer::begin(uint32_t ms, TimerCallbackFunction_t callback, void *timerID, bool repeating)
+{
+	_handle = xTimerCreate(NULL, pdMS_TO_TICKS(ms), repeating ? 1 : 0, timerID, callback);
+}
+
+void SoftwareTimer::setID(void *id)
+{
+	_handle->id = id;
+}
+
+void *SoftwareTimer::getID(void)
+{
+	return _handle->id;
+}
+
+// Arduino time functions
+
+uint32_t millis(void)
+{
+	return (uint32_t)(simNow / 1000);
+}
+
+uint32_t micros(void)
+{
+	return (uint32_t)simNow;
+}
+
+void delay(uint32_t ms)
+{
+	vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+void delayMicroseconds(uint32_t us)
+{
+	simBusy(us);
+}
+
+void yield(void)
+{
+	taskYIELD();
+}
+
+// Arduino main task of the nRF52 core
+
+void setup(void);
+void loop(void);
+
+/**
+ * @brief Loop task, setup() once and then loop() forever
+ */
+static void loopTask(void *params)
+{
+	(void)params;
+	setup();
+	while (true)
+	{
+		loop();
+		yield();
+	}
+}
+
+void simStartFirmware(void)
+{
+	xTaskCreate(loopTask, "loop", 1024, NULL, TASK_PRIO_LOW, NULL);
+}
@@ -0,0 +1,460 @@
+/**
+ * @file tinyGps.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief NMEA parser with the TinyGPS++ API for the host build
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Follows the parser of TinyGPS++ 1.0 by Mikal Hart, so the parse
+ * cost per byte and the update rules are the ones of the firmware.
+ */
+#include <TinyGPS++.h>
+#include <ctype.h>
+
+#define _GPRMCterm "GPRMC"
+#define _GPGGAterm "GPGGA"
+#define _GNRMCterm "GNRMC"
+#define _GNGGAterm "GNGGA"
+
+/**
+ * @brief Parse a decimal number with two decimals, 12.34 -> 1234
+ */
+static int32_t parseDecimal(const char *term)
+{
+	bool negative = *term == '-';
+	if (negative)
+	{
+		++term;
+	}
+	int32_t ret = 100 * (int32_t)atol(term);
+	while (isdigit(*term))
+	{
+		++term;
+	}
+	if (*term == '.' && isdigit(term[1]))
+	{
+		ret += 10 * (term[1] - '0');
+		if (isdigit(term[2]))
+		{
+			ret += term[2] - '0';
+		}
+	}
+	return negative ? -ret : ret;
+}
+
+/**
+ * @brief Parse ddmm.mmmm into degrees and billionths
+ */
+static void parseDegrees(const char *term, RawDegrees &deg)
+{
+	uint32_t leftOfDecimal = (uint32_t)atol(term);
+	uint16_t minutes = (uint16_t)(leftOfDecimal % 100);
+	uint32_t multiplier = 10000000UL;
+	uint32_t tenMillionthsOfMinutes = minutes * multiplier;
+
+	deg.deg = (int16_t)(leftOfDecimal / 100);
+
+	while (isdigit(*term))
+	{
+		++term;
+	}
+
+	if (*term == '.')
+	{
+		while (isdigit(*++term))
+		{
+			multiplier /= 10;
+			tenMillionthsOfMinutes += (*term - '0') * multiplier;
+		}
+	}
+
+	deg.billionths = (5 * tenMillionthsOfMinutes + 1) / 3;
+	deg.negative = false;
+}
+
+TinyGPSPlus::TinyGPSPlus()
+	: parity(0), isChecksumTerm(false), curSentenceType(GPS_SENTENCE_OTHER), curTermNumber(0), curTermOffset(0),
+	  sentenceHasFix(false), customElts(0), customCandidates(0), encodedCharCount(0), sentencesWithFixCount(0),
+	  failedChecksumCount(0), passedChecksumCount(0)
+{
+	term[0] = '\0';
+}
+
+bool TinyGPSPlus::encode(char c)
+{
+	++encodedCharCount;
+
+	switch (c)
+	{
+	case ',': // term terminators
+		parity ^= (uint8_t)c;
+		// fall through
+	case '\r':
+	case '\n':
+	case '*':
+	{
+		bool isValidSentence = false;
+		if (curTermOffset < sizeof(term))
+		{
+			term[curTermOffset] = 0;
+			isValidSentence = endOfTermHandler();
+		}
+		++curTermNumber;
+		curTermOffset = 0;
+		isChecksumTerm = c == '*';
+		return isValidSentence;
+	}
+
+	case '$': // sentence begin
+		curTermNumber = curTermOffset = 0;
+		parity = 0;
+		curSentenceType = GPS_SENTENCE_OTHER;
+		isChecksumTerm = false;
+		sentenceHasFix = false;
+		return false;
+
+	default: // ordinary characters
+		if (curTermOffset < sizeof(term) - 1)
+		{
+			term[curTermOffset++] = c;
+		}
+		if (!isChecksumTerm)
+		{
+			parity ^= c;
+		}
+		return false;
+	}
+
+	return false;
+}
+
+int TinyGPSPlus::fromHex(char a)
+{
+	if (a >= 'A' && a <= 'F')
+	{
+		return a - 'A' + 10;
+	}
+	else if (a >= 'a' && a <= 'f')
+	{
+		return a - 'a' + 10;
+	}
+	else
+	{
+		return a - '0';
+	}
+}
+
+bool TinyGPSPlus::endOfTermHandler()
+{
+	// If it's the checksum term, and the checksum checks out, commit
+	if (isChecksumTerm)
+	{
+		uint8_t checksum = 16 * fromHex(term[0]) + fromHex(term[1]);
+		if (checksum == parity)
+		{
+			passedChecksumCount++;
+			if (sentenceHasFix)
+			{
+				++sentencesWithFixCount;
+			}
+
+			switch (curSentenceType)
+			{
+			case GPS_SENTENCE_RMC:
+				date.commit();
+				time.commit();
+				if (sentenceHasFix)
+				{
+					location.commit();
+					speed.commit();
+					course.commit();
+				}
+				break;
+			case GPS_SENTENCE_GGA:
+				time.commit();
+				if (sentenceHasFix)
+				{
+					location.commit();
+					altitude.commit();
+				}
+				satellites.commit();
+				hdop.commit();
+				break;
+			}
+
+			// Commit all custom listeners of this sentence type
+			for (TinyGPSCustom *p = customCandidates; p != NULL && strcmp(p->sentenceName, customCandidates->sentenceName) == 0;
+				 p = p->next)
+			{
+				p->commit();
+			}
+			return true;
+		}
+		else
+		{
+			++failedChecksumCount;
+		}
+
+		return false;
+	}
+
+	// the first term determines the sentence type
+	if (curTermNumber == 0)
+	{
+		if (!strcmp(term, _GPRMCterm) || !strcmp(term, _GNRMCterm))
+		{
+			curSentenceType = GPS_SENTENCE_RMC;
+		}
+		else if (!strcmp(term, _GPGGAterm) || !strcmp(term, _GNGGAterm))
+		{
+			curSentenceType = GPS_SENTENCE_GGA;
+		}
+		else
+		{
+			curSentenceType = GPS_SENTENCE_OTHER;
+		}
+
+		// Any custom candidates of this sentence type?
+		for (customCandidates = customElts; customCandidates != NULL && strcmp(customCandidates->sentenceName, term) < 0;
+			 customCandidates = customCandidates->next)
+		{
+		}
+		if (customCandidates != NULL && strcmp(customCandidates->sentenceName, term) > 0)
+		{
+			customCandidates = NULL;
+		}
+
+		return false;
+	}
+
+	if (curSentenceType != GPS_SENTENCE_OTHER && term[0])
+	{
+		switch (curSentenceType == GPS_SENTENCE_RMC ? 100 + curTermNumber : 200 + curTermNumber)
+		{
+		case 101: // Time in both sentences
+		case 201:
+			time.setTime(term);
+			break;
+		case 102: // RMC validity
+			sentenceHasFix = term[0] == 'A';
+			break;
+		case 103: // Latitude
+		case 202:
+			location.setLatitude(term);
+			break;
+		case 104: // N/S
+		case 203:
+			location.rawNewLatData.negative = term[0] == 'S';
+			break;
+		case 105: // Longitude
+		case 204:
+			location.setLongitude(term);
+			break;
+		case 106: // E/W
+		case 205:
+			location.rawNewLngData.negative = term[0] == 'W';
+			break;
+		case 107: // Speed (RMC)
+			speed.set(term);
+			break;
+		case 108: // Course (RMC)
+			course.set(term);
+			break;
+		case 109: // Date (RMC)
+			date.setDate(term);
+			break;
+		case 206: // Fix data (GGA)
+			sentenceHasFix = term[0] > '0';
+			break;
+		case 207: // Satellites used (GGA)
+			satellites.set(term);
+			break;
+		case 208: // HDOP
+			hdop.set(term);
+			break;
+		case 209: // Altitude (GGA)
+			altitude.set(term);
+			break;
+		}
+	}
+
+	// Set custom values as needed
+	for (TinyGPSCustom *p = customCandidates;
+		 p != NULL && strcmp(p->sentenceName, customCandidates->sentenceName) == 0 && p->termNumber <= curTermNumber;
+		 p = p->next)
+	{
+		if (p->termNumber == curTermNumber)
+		{
+			p->set(term);
+		}
+	}
+
+	return false;
+}
+
+void TinyGPSPlus::insertCustom(TinyGPSCustom *pElt, const char *sentenceName, int termNumber)
+{
+	TinyGPSCustom **ppelt;
+
+	for (ppelt = &this->customElts; *ppelt != NULL; ppelt = &(*ppelt)->next)
+	{
+		int cmp = strcmp(sentenceName, (*ppelt)->sentenceName);
+		if (cmp < 0 || (cmp == 0 && termNumber < (*ppelt)->termNumber))
+		{
+			break;
+		}
+	}
+
+	pElt->next = *ppelt;
+	*ppelt = pElt;
+}
+
+void TinyGPSLocation::commit()
+{
+	rawLatData = rawNewLatData;
+	rawLngData = rawNewLngData;
+	lastCommitTime = millis();
+	valid = updated = true;
+}
+
+void TinyGPSLocation::setLatitude(const char *term)
+{
+	parseDegrees(term, rawNewLatData);
+}
+
+void TinyGPSLocation::setLongitude(const char *term)
+{
+	parseDegrees(term, rawNewLngData);
+}
+
+double TinyGPSLocation::lat()
+{
+	updated = false;
+	double ret = rawLatData.deg + rawLatData.billionths / 1000000000.0;
+	return rawLatData.negative ? -ret : ret;
+}
+
+double TinyGPSLocation::lng()
+{
+	updated = false;
+	double ret = rawLngData.deg + rawLngData.billionths / 1000000000.0;
+	return rawLngData.negative ? -ret : ret;
+}
+
+void TinyGPSDate::commit()
+{
+	date = newDate;
+	lastCommitTime = millis();
+	valid = updated = true;
+}
+
+void TinyGPSTime::commit()
+{
+	time = newTime;
+	lastCommitTime = millis();
+	valid = updated = true;
+}
+
+void TinyGPSTime::setTime(const char *term)
+{
+	newTime = (uint32_t)parseDecimal(term);
+}
+
+void TinyGPSDate::setDate(const char *term)
+{
+	newDate = (uint32_t)atol(term);
+}
+
+uint16_t TinyGPSDate::year()
+{
+	updated = false;
+	uint16_t year = date % 100;
+	return year + 2000;
+}
+
+uint8_t TinyGPSDate::month()
+{
+	updated = false;
+	return (date / 100) % 100;
+}
+
+uint8_t TinyGPSDate::day()
+{
+	updated = false;
+	return date / 10000;
+}
+
+uint8_t TinyGPSTime::hour()
+{
+	updated = false;
+	return time / 1000000;
+}
+
+uint8_t TinyGPSTime::minute()
+{
+	updated = false;
+	return (time / 10000) % 100;
+}
+
+uint8_t TinyGPSTime::second()
+{
+	updated = false;
+	return (time / 100) % 100;
+}
+
+uint8_t TinyGPSTime::centisecond()
+{
+	updated = false;
+	return time % 100;
+}
+
+void TinyGPSDecimal::commit()
+{
+	val = newval;
+	lastCommitTime = millis();
+	valid = updated = true;
+}
+
+void TinyGPSDecimal::set(const char *term)
+{
+	newval = parseDecimal(term);
+}
+
+void TinyGPSInteger::commit()
+{
+	val = newval;
+	lastCommitTime = millis();
+	valid = updated = true;
+}
+
+void TinyGPSInteger::set(const char *term)
+{
+	newval = (uint32_t)atol(term);
+}
+
+void TinyGPSCustom::begin(TinyGPSPlus &gps, const char *_sentenceName, int _termNumber)
+{
+	lastCommitTime = 0;
+	updated = valid = false;
+	sentenceName = _sentenceName;
+	termNumber = _termNumber;
+	memset(stagingBuffer, '\0', sizeof(stagingBuffer));
+	memset(buffer, '\0', sizeof(buffer));
+
+	// Insert this item into the GPS tree
+	gps.insertCustom(this, _sentenceName, _termNumber);
+}
+
+void TinyGPSCustom::commit()
+{
+	strcpy(this->buffer, this->stagingBuffer);
+	lastCommitTime = millis();
+	valid = updated = true;
+}
+
+void TinyGPSCustom::set(const char *term)
+{
+	strncpy(this->stagingBuffer, term, sizeof(this->stagingBuffer) - 1);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file Adafruit_LittleFS.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief LittleFS of the host build
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Files are kept in RAM by sim/simFs.cpp. Writes keep the CPU
+ * busy for the time the nRF52 flash needs, 41 us per word plus
+ * 85 ms for each page that is erased.
+ */
+#ifndef HOST_ADAFRUIT_LITTLEFS_H
+#define HOST_ADAFRUIT_LITTLEFS_H
+
+#include <Arduino.h>
+
+#define FILE_O_READ 0
+#define FILE_O_WRITE 1
+
+class Adafruit_LittleFS
+{
+public:
+	bool begin(void) { return true; }
+	bool exists(const char *path);
+	bool remove(const char *path);
+	bool format(void);
+};
+
+namespace Adafruit_LittleFS_Namespace
+{
+	class File
+	{
+	public:
+		File(Adafruit_LittleFS &fs) : _fs(&fs) {}
+		File(const char *path, uint8_t mode, Adafruit_LittleFS &fs) : _fs(&fs) { open(path, mode); }
+		bool open(const char *path, uint8_t mode);
+		size_t write(uint8_t ch) { return write(&ch, 1); }
+		size_t write(const uint8_t *buf, size_t size);
+		int read(void);
+		int read(void *buf, uint16_t nbyte);
+		bool seek(uint32_t pos);
+		uint32_t position(void) { return _pos; }
+		uint32_t size(void);
+		bool truncate(uint32_t pos);
+		bool truncate(void) { return truncate(_pos); }
+		void close(void) { _open = false; }
+		operator bool() { return _open; }
+
+	private:
+		Adafruit_LittleFS *_fs;
+		char _path[32] = {0};
+		bool _open = false;
+		uint8_t _mode = FILE_O_READ;
+		uint32_t _pos = 0;
+	};
+}
+
+using namespace Adafruit_LittleFS_Namespace;
+
+#endif
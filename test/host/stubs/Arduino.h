@@ -0,0 +1,218 @@
+/**
+ * @file Arduino.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Arduino core API of the host build
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Replaces the Adafruit nRF52 core for the host tests and
+ * benchmarks in test/host. Time is the virtual clock of the
+ * simulation, pins, UARTs and the ADC are connected to the models in
+ * test/host/sim.
+ */
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <limits.h>
+
+#include "freertos.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define INPUT_PULLDOWN 3
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+// WisBlock RAK4631 pins
+#define LED_BUILTIN 35
+#define LED_CONN 36
+#define LED_GREEN LED_BUILTIN
+#define LED_BLUE LED_CONN
+#define PIN_WIRE_SDA 13
+#define PIN_WIRE_SCL 14
+#define A0 5
+#define NUM_PINS 48
+
+#define AR_INTERNAL_3_0 1
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#define DEC 10
+#define HEX 16
+
+/** Time of the virtual clock */
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield(void);
+
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t value);
+int digitalRead(uint32_t pin);
+void digitalToggle(uint32_t pin);
+void attachInterrupt(uint32_t pin, void (*handler)(void), uint32_t mode);
+void detachInterrupt(uint32_t pin);
+
+uint32_t analogRead(uint32_t pin);
+void analogReference(uint8_t type);
+void analogReadResolution(uint8_t bits);
+
+/** Free heap of the nRF52 core debug functions */
+int dbgHeapFree(void);
+int dbgHeapTotal(void);
+
+/** CPU clock of the nRF52840, the unit of the cycle counter */
+extern uint32_t SystemCoreClock;
+
+/**
+ * @brief DWT cycle counter of the Cortex-M4
+ * @note Counts the host CLOCK_MONOTONIC time in cycles of SystemCoreClock
+ * while DWT_CTRL_CYCCNTENA_Msk is set, not the virtual clock. ProfScope
+ * of the firmware reads it with -DPROFILING=1.
+ */
+class HostCycleCounter
+{
+public:
+	operator uint32_t() const;
+	HostCycleCounter &operator=(uint32_t value);
+
+private:
+	uint32_t _base = 0;
+	uint64_t _startNs = 0;
+};
+
+struct HostDwt
+{
+	volatile uint32_t CTRL;
+	HostCycleCounter CYCCNT;
+};
+
+struct HostCoreDebug
+{
+	volatile uint32_t DEMCR;
+};
+
+extern HostDwt hostDwt;
+extern HostCoreDebug hostCoreDebug;
+#define DWT (&hostDwt)
+#define CoreDebug (&hostCoreDebug)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+/**
+ * @brief Character output, base of the UARTs and the BLE UART
+ */
+class Print
+{
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t *buffer, size_t size);
+	size_t write(const char *str) { return str == NULL ? 0 : write((const uint8_t *)str, strlen(str)); }
+	size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+	virtual void flush(void) {}
+
+	size_t print(const char *str) { return write(str); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(int value, int base = DEC) { return print((long)value, base); }
+	size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+	size_t print(long value, int base = DEC);
+	size_t print(unsigned long value, int base = DEC);
+	size_t print(double value, int digits = 2);
+	size_t println(void) { return write("\r\n"); }
+	template <typename T>
+	size_t println(T value)
+	{
+		size_t len = print(value);
+		return len + println();
+	}
+	template <typename T>
+	size_t println(T value, int format)
+	{
+		size_t len = print(value, format);
+		return len + println();
+	}
+	size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+/**
+ * @brief Readable character stream
+ */
+class Stream : public Print
+{
+public:
+	virtual int available(void) = 0;
+	virtual int read(void) = 0;
+	virtual int peek(void) = 0;
+};
+
+/**
+ * @brief UART and USB CDC
+ * @note Output goes to the sink of the simulation, input comes from
+ * the models (the GPS module on Serial1)
+ */
+class Uart : public Stream
+{
+public:
+	explicit Uart(uint8_t index) : _index(index) {}
+	void begin(uint32_t baud) { _baud = baud; _open = true; }
+	void end(void) { _open = false; }
+	operator bool() { return _open; }
+	int available(void) override;
+	int read(void) override;
+	int peek(void) override;
+	size_t write(uint8_t c) override { return write(&c, 1); }
+	size_t write(const uint8_t *buffer, size_t size) override;
+	using Print::write;
+	uint32_t baud(void) { return _baud; }
+
+private:
+	uint8_t _index;
+	uint32_t _baud = 0;
+	bool _open = false;
+};
+
+extern Uart Serial;
+extern Uart Serial1;
+
+/**
+ * @brief FreeRTOS software timer wrapper of the nRF52 core
+ */
+class SoftwareTimer
+{
+public:
+	SoftwareTimer() : _handle(NULL) {}
+	virtual ~SoftwareTimer() {}
+	void begin(uint32_t ms, TimerCallbackFunction_t callback, void *timerID = NULL, bool repeating = true);
+	TimerHandle_t getHandle(void) { return _handle; }
+	void setID(void *id);
+	void *getID(void);
+	void start(void) { xTimerStart(_handle, 0); }
+	void stop(void) { xTimerStop(_handle, 0); }
+	void reset(void) { xTimerReset(_handle, 0); }
+	/** Changes the period and starts the timer, like xTimerChangePeriod() */
+	void setPeriod(uint32_t ms) { xTimerChangePeriod(_handle, pdMS_TO_TICKS(ms), 0); }
+
+private:
+	TimerHandle_t _handle;
+};
+
+#endif
@@ -0,0 +1,22 @@
+/**
+ * @file InternalFileSystem.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Internal flash file system of the host build
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef HOST_INTERNAL_FILE_SYSTEM_H
+#define HOST_INTERNAL_FILE_SYSTEM_H
+
+#include <Adafruit_LittleFS.h>
+
+class InternalFileSystem : public Adafruit_LittleFS
+{
+};
+
+extern InternalFileSystem InternalFS;
+
+#endif
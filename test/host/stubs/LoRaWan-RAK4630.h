@@ -0,0 +1,214 @@
+/**
+ * @file LoRaWan-RAK4630.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief SX126x-Arduino LoRaMac handler API of the host build
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Same API as the SX126x-Arduino 2.x library. The MAC in
+ * sim/simLora.cpp builds real LoRaWan 1.0.3 frames and sends them over
+ * the virtual radio to the network server stand-in in sim/simNs.cpp.
+ * The callbacks run in the LoRa task like in the library.
+ */
+#ifndef HOST_LORAWAN_RAK4630_H
+#define HOST_LORAWAN_RAK4630_H
+
+#include <Arduino.h>
+
+#define APP_TIMER_SCHED_EVENT_DATA_SIZE 32
+/** FPort of the application data */
+#define LORAWAN_APP_PORT 2
+
+typedef enum
+{
+	LMH_SUCCESS = 0,
+	LMH_BUSY = -1,
+	LMH_ERROR = -2,
+} lmh_error_status;
+
+typedef enum
+{
+	LMH_RESET = 0,
+	LMH_SET = 1,
+} lmh_join_status;
+
+typedef enum
+{
+	LMH_UNCONFIRMED_MSG = 0,
+	LMH_CONFIRMED_MSG = 1,
+} lmh_confirm;
+
+typedef enum eDeviceClass
+{
+	CLASS_A,
+	CLASS_B,
+	CLASS_C,
+} DeviceClass_t;
+
+typedef enum eLoRaMacRegion_t
+{
+	LORAMAC_REGION_AS923,
+	LORAMAC_REGION_AU915,
+	LORAMAC_REGION_CN470,
+	LORAMAC_REGION_CN779,
+	LORAMAC_REGION_EU433,
+	LORAMAC_REGION_EU868,
+	LORAMAC_REGION_KR920,
+	LORAMAC_REGION_IN865,
+	LORAMAC_REGION_US915,
+	LORAMAC_REGION_RU864,
+} LoRaMacRegion_t;
+
+#define LORAWAN_ADR_ON 1
+#define LORAWAN_ADR_OFF 0
+#define LORAWAN_PUBLIC_NETWORK true
+#define LORAWAN_PRIVATE_NETWORK false
+#define LORAWAN_DUTYCYCLE_ON true
+#define LORAWAN_DUTYCYCLE_OFF false
+#define LORAWAN_DEFAULT_DATARATE DR_0
+#define LORAWAN_DEFAULT_TX_POWER TX_POWER_0
+
+#define DR_0 0
+#define DR_1 1
+#define DR_2 2
+#define DR_3 3
+#define DR_4 4
+#define DR_5 5
+#define DR_6 6
+#define DR_7 7
+
+#define TX_POWER_0 0
+#define TX_POWER_1 1
+#define TX_POWER_2 2
+#define TX_POWER_3 3
+#define TX_POWER_4 4
+#define TX_POWER_5 5
+#define TX_POWER_6 6
+#define TX_POWER_7 7
+#define TX_POWER_8 8
+#define TX_POWER_9 9
+#define TX_POWER_10 10
+#define TX_POWER_11 11
+#define TX_POWER_12 12
+#define TX_POWER_13 13
+#define TX_POWER_14 14
+#define TX_POWER_15 15
+
+typedef struct
+{
+	uint8_t *buffer;
+	uint8_t port;
+	uint8_t buffsize;
+	int16_t rssi;
+	int8_t snr;
+} lmh_app_data_t;
+
+typedef struct
+{
+	bool adr_enable;
+	int8_t tx_data_rate;
+	bool enable_public_network;
+	uint8_t nb_trials;
+	int8_t tx_power;
+	bool duty_cycle;
+} lmh_param_t;
+
+typedef struct
+{
+	uint8_t (*BoardGetBatteryLevel)(void);
+	void (*BoardGetUniqueId)(uint8_t *id);
+	uint32_t (*BoardGetRandomSeed)(void);
+	void (*lmh_RxData)(lmh_app_data_t *appdata);
+	void (*lmh_has_joined)(void);
+	void (*lmh_ConfirmClass)(DeviceClass_t Class);
+	void (*lmh_has_joined_failed)(void);
+	void (*lmh_unconf_finished)(void);
+	void (*lmh_conf_finished)(bool result);
+} lmh_callback_t;
+
+uint32_t lora_rak4630_init(void);
+void BoardGetUniqueId(uint8_t *id);
+uint32_t BoardGetRandomSeed(void);
+
+lmh_error_status lmh_init(lmh_callback_t *callbacks, lmh_param_t lora_param, bool otaa,
+						  DeviceClass_t nodeClass = CLASS_A, LoRaMacRegion_t region = LORAMAC_REGION_EU868,
+						  bool region_change = false);
+void lmh_join(void);
+lmh_join_status lmh_join_status_get(void);
+lmh_error_status lmh_send(lmh_app_data_t *app_data, lmh_confirm is_tx_confirmed);
+lmh_error_status lmh_class_request(DeviceClass_t newClass);
+bool lmh_setSubBandChannels(uint8_t subBand);
+void lmh_setSingleChannelGateway(uint8_t userSingleChannel, int8_t userDatarate);
+void lmh_setDevEui(uint8_t *userDevEui);
+void lmh_setAppEui(uint8_t *userAppEui);
+void lmh_setAppKey(uint8_t *userAppKey);
+void lmh_setNwkSKey(uint8_t *userNwkSKey);
+void lmh_setAppSKey(uint8_t *userAppSKey);
+void lmh_setDevAddr(uint32_t userDevAddr);
+uint32_t lmh_getDevAddr(void);
+
+// LoRaMac MIB and MLME, only the class B part
+typedef enum eLoRaMacStatus
+{
+	LORAMAC_STATUS_OK,
+	LORAMAC_STATUS_BUSY,
+	LORAMAC_STATUS_SERVICE_UNKNOWN,
+	LORAMAC_STATUS_PARAMETER_INVALID,
+	LORAMAC_STATUS_NO_NETWORK_JOINED,
+	LORAMAC_STATUS_BEACON_NOT_LOCKED = 13,
+} LoRaMacStatus_t;
+
+typedef enum eMib
+{
+	MIB_DEVICE_CLASS,
+	MIB_NETWORK_JOINED,
+} Mib_t;
+
+typedef struct sMibRequestConfirm
+{
+	Mib_t Type;
+	union
+	{
+		DeviceClass_t Class;
+		bool IsNetworkJoined;
+	} Param;
+} MibRequestConfirm_t;
+
+typedef enum eMlme
+{
+	MLME_JOIN,
+	MLME_LINK_CHECK,
+	MLME_BEACON_ACQUISITION = 7,
+	MLME_PING_SLOT_INFO = 8,
+} Mlme_t;
+
+typedef union uPingSlotInfo
+{
+	uint8_t Value;
+	struct sInfoFields
+	{
+		uint8_t Periodicity : 3;
+		uint8_t RFU : 5;
+	} Fields;
+} PingSlotInfo_t;
+
+typedef struct sMlmeReqPingSlotInfo
+{
+	PingSlotInfo_t PingSlot;
+} MlmeReqPingSlotInfo_t;
+
+typedef struct sMlmeReq
+{
+	Mlme_t Type;
+	union uMlmeParam
+	{
+		MlmeReqPingSlotInfo_t PingSlotInfo;
+	} Req;
+} MlmeReq_t;
+
+LoRaMacStatus_t LoRaMacMibSetRequestConfirm(MibRequestConfirm_t *mibSet);
+LoRaMacStatus_t LoRaMacMlmeRequest(MlmeReq_t *mlmeRequest);
+
+#endif
@@ -0,0 +1,16 @@
+/**
+ * @file SPI.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief SPI of the host build, the radio is simulated above the SPI level
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include <Arduino.h>
+
+#endif
@@ -0,0 +1,16 @@
+/**
+ * @file SoftwareSerial.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief SoftwareSerial of the host build, not used by the tracker
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef HOST_SOFTWARE_SERIAL_H
+#define HOST_SOFTWARE_SERIAL_H
+
+#include <Arduino.h>
+
+#endif
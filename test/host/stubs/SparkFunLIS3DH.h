@@ -0,0 +1,73 @@
+/**
+ * @file SparkFunLIS3DH.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief LIS3DH accelerometer of the host build
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The registers are kept by the accelerometer model in
+ * sim/simArduino.cpp. The source registers are latched like on the
+ * sensor, reading them clears them.
+ */
+#ifndef HOST_SPARKFUN_LIS3DH_H
+#define HOST_SPARKFUN_LIS3DH_H
+
+#include <Arduino.h>
+
+#define I2C_MODE 0
+#define SPI_MODE 1
+
+typedef enum
+{
+	IMU_SUCCESS,
+	IMU_HW_ERROR,
+	IMU_NOT_SUPPORTED,
+	IMU_GENERIC_ERROR,
+	IMU_OUT_OF_BOUNDS,
+	IMU_ALL_ONES_WARNING
+} status_t;
+
+#define LIS3DH_CTRL_REG1 0x20
+#define LIS3DH_CTRL_REG2 0x21
+#define LIS3DH_CTRL_REG3 0x22
+#define LIS3DH_CTRL_REG4 0x23
+#define LIS3DH_CTRL_REG5 0x24
+#define LIS3DH_CTRL_REG6 0x25
+#define LIS3DH_INT1_CFG 0x30
+#define LIS3DH_INT1_SRC 0x31
+#define LIS3DH_INT1_THS 0x32
+#define LIS3DH_INT1_DURATION 0x33
+
+struct SensorSettings
+{
+	uint8_t adcEnabled;
+	uint8_t tempEnabled;
+	uint16_t accelSampleRate;
+	uint8_t accelRange;
+	uint8_t xAccelEnabled;
+	uint8_t yAccelEnabled;
+	uint8_t zAccelEnabled;
+	uint8_t fifoEnabled;
+	uint8_t fifoMode;
+	uint8_t fifoThreshold;
+};
+
+class LIS3DH
+{
+public:
+	LIS3DH(uint8_t busType = I2C_MODE, uint8_t address = 0x19) : _address(address) { (void)busType; }
+	status_t begin(void);
+	status_t readRegister(uint8_t *output, uint8_t offset);
+	status_t writeRegister(uint8_t offset, uint8_t dataToWrite);
+	float readFloatAccelX(void);
+	float readFloatAccelY(void);
+	float readFloatAccelZ(void);
+	SensorSettings settings;
+
+private:
+	uint8_t _address;
+};
+
+#endif
@@ -0,0 +1,281 @@
+/**
+ * @file TinyGPS++.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief NMEA parser with the TinyGPS++ API for the host build
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Same API and the same update rules as TinyGPS++ 1.0: a sentence
+ * is parsed term by term, the values are committed when the checksum
+ * is correct, reading a value clears its updated flag. GGA and RMC are
+ * accepted with the GP and GN talker. Implemented in sim/tinyGps.cpp.
+ */
+#ifndef HOST_TINY_GPS_PLUS_H
+#define HOST_TINY_GPS_PLUS_H
+
+#include <Arduino.h>
+
+#define _GPS_MAX_FIELD_SIZE 15
+
+struct RawDegrees
+{
+	uint16_t deg;
+	uint32_t billionths;
+	bool negative;
+
+public:
+	RawDegrees() : deg(0), billionths(0), negative(false) {}
+};
+
+class TinyGPSPlus;
+
+struct TinyGPSLocation
+{
+	friend class TinyGPSPlus;
+
+public:
+	bool isValid() const { return valid; }
+	bool isUpdated() const { return updated; }
+	uint32_t age() const { return valid ? millis() - lastCommitTime : (uint32_t)ULONG_MAX; }
+	const RawDegrees &rawLat()
+	{
+		updated = false;
+		return rawLatData;
+	}
+	const RawDegrees &rawLng()
+	{
+		updated = false;
+		return rawLngData;
+	}
+	double lat();
+	double lng();
+
+	TinyGPSLocation() : valid(false), updated(false), lastCommitTime(0) {}
+
+private:
+	bool valid, updated;
+	RawDegrees rawLatData, rawLngData, rawNewLatData, rawNewLngData;
+	uint32_t lastCommitTime;
+	void commit();
+	void setLatitude(const char *term);
+	void setLongitude(const char *term);
+};
+
+struct TinyGPSDate
+{
+	friend class TinyGPSPlus;
+
+public:
+	bool isValid() const { return valid; }
+	bool isUpdated() const { return updated; }
+	uint32_t age() const { return valid ? millis() - lastCommitTime : (uint32_t)ULONG_MAX; }
+	uint32_t value()
+	{
+		updated = false;
+		return date;
+	}
+	uint16_t year();
+	uint8_t month();
+	uint8_t day();
+
+	TinyGPSDate() : valid(false), updated(false), date(0), newDate(0), lastCommitTime(0) {}
+
+private:
+	bool valid, updated;
+	uint32_t date, newDate;
+	uint32_t lastCommitTime;
+	void commit();
+	void setDate(const char *term);
+};
+
+struct TinyGPSTime
+{
+	friend class TinyGPSPlus;
+
+public:
+	bool isValid() const { return valid; }
+	bool isUpdated() const { return updated; }
+	uint32_t age() const { return valid ? millis() - lastCommitTime : (uint32_t)ULONG_MAX; }
+	uint32_t value()
+	{
+		updated = false;
+		return time;
+	}
+	uint8_t hour();
+	uint8_t minute();
+	uint8_t second();
+	uint8_t centisecond();
+
+	TinyGPSTime() : valid(false), updated(false), time(0), newTime(0), lastCommitTime(0) {}
+
+private:
+	bool valid, updated;
+	uint32_t time, newTime;
+	uint32_t lastCommitTime;
+	void commit();
+	void setTime(const char *term);
+};
+
+struct TinyGPSDecimal
+{
+	friend class TinyGPSPlus;
+
+public:
+	bool isValid() const { return valid; }
+	bool isUpdated() const { return updated; }
+	uint32_t age() const { return valid ? millis() - lastCommitTime : (uint32_t)ULONG_MAX; }
+	int32_t value()
+	{
+		updated = false;
+		return val;
+	}
+
+	TinyGPSDecimal() : valid(false), updated(false), lastCommitTime(0), val(0), newval(0) {}
+
+private:
+	bool valid, updated;
+	uint32_t lastCommitTime;
+	int32_t val, newval;
+	void commit();
+	void set(const char *term);
+};
+
+struct TinyGPSInteger
+{
+	friend class TinyGPSPlus;
+
+public:
+	bool isValid() const { return valid; }
+	bool isUpdated() const { return updated; }
+	uint32_t age() const { return valid ? millis() - lastCommitTime : (uint32_t)ULONG_MAX; }
+	uint32_t value()
+	{
+		updated = false;
+		return val;
+	}
+
+	TinyGPSInteger() : valid(false), updated(false), lastCommitTime(0), val(0), newval(0) {}
+
+private:
+	bool valid, updated;
+	uint32_t lastCommitTime;
+	uint32_t val, newval;
+	void commit();
+	void set(const char *term);
+};
+
+struct TinyGPSSpeed : TinyGPSDecimal
+{
+	double knots() { return value() / 100.0; }
+	double mps() { return 0.514444 * value() / 100.0; }
+	double kmph() { return 1.852 * value() / 100.0; }
+};
+
+struct TinyGPSCourse : public TinyGPSDecimal
+{
+	double deg() { return value() / 100.0; }
+};
+
+struct TinyGPSAltitude : TinyGPSDecimal
+{
+	double meters() { return value() / 100.0; }
+};
+
+struct TinyGPSHDOP : TinyGPSDecimal
+{
+	double hdop() { return value() / 100.0; }
+};
+
+class TinyGPSCustom
+{
+public:
+	TinyGPSCustom() {}
+	TinyGPSCustom(TinyGPSPlus &gps, const char *sentenceName, int termNumber) { begin(gps, sentenceName, termNumber); }
+	void begin(TinyGPSPlus &gps, const char *sentenceName, int termNumber);
+
+	bool isUpdated() const { return updated; }
+	bool isValid() const { return valid; }
+	uint32_t age() const { return valid ? millis() - lastCommitTime : (uint32_t)ULONG_MAX; }
+	const char *value()
+	{
+		updated = false;
+		return buffer;
+	}
+
+private:
+	void commit();
+	void set(const char *term);
+
+	char stagingBuffer[_GPS_MAX_FIELD_SIZE + 1] = {0};
+	char buffer[_GPS_MAX_FIELD_SIZE + 1] = {0};
+	uint32_t lastCommitTime = 0;
+	bool valid = false;
+	bool updated = false;
+	const char *sentenceName = NULL;
+	int termNumber = 0;
+	friend class TinyGPSPlus;
+	TinyGPSCustom *next = NULL;
+};
+
+class TinyGPSPlus
+{
+public:
+	TinyGPSPlus();
+	bool encode(char c);
+	TinyGPSPlus &operator<<(char c)
+	{
+		encode(c);
+		return *this;
+	}
+
+	TinyGPSLocation location;
+	TinyGPSDate date;
+	TinyGPSTime time;
+	TinyGPSSpeed speed;
+	TinyGPSCourse course;
+	TinyGPSAltitude altitude;
+	TinyGPSInteger satellites;
+	TinyGPSHDOP hdop;
+
+	uint32_t charsProcessed() const { return encodedCharCount; }
+	uint32_t sentencesWithFix() const { return sentencesWithFixCount; }
+	uint32_t failedChecksum() const { return failedChecksumCount; }
+	uint32_t passedChecksum() const { return passedChecksumCount; }
+
+private:
+	enum
+	{
+		GPS_SENTENCE_GGA,
+		GPS_SENTENCE_RMC,
+		GPS_SENTENCE_OTHER
+	};
+
+	// parsing state variables
+	uint8_t parity;
+	bool isChecksumTerm;
+	char term[_GPS_MAX_FIELD_SIZE];
+	uint8_t curSentenceType;
+	uint8_t curTermNumber;
+	uint8_t curTermOffset;
+	bool sentenceHasFix;
+
+	// custom element support
+	friend class TinyGPSCustom;
+	void insertCustom(TinyGPSCustom *pElt, const char *sentenceName, int index);
+	TinyGPSCustom *customElts;
+	TinyGPSCustom *customCandidates;
+
+	// statistics
+	uint32_t encodedCharCount;
+	uint32_t sentencesWithFixCount;
+	uint32_t failedChecksumCount;
+	uint32_t passedChecksumCount;
+
+	// internal utilities
+	int fromHex(char a);
+	bool endOfTermHandler();
+};
+
+#endif
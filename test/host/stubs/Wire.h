@@ -0,0 +1,75 @@
+/**
+ * @file Wire.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief I2C of the host build
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Writes are only counted. Each transaction keeps the CPU busy
+ * for the time the bytes need on the bus, the I2C bus statistics of
+ * i2cBus.cpp see realistic hold times.
+ * With dma(true) the bus is a stand-in for the TWIM peripheral with
+ * EasyDMA: the calling task blocks until the completion interrupt at the
+ * end of the transfer and other tasks run meanwhile. The transfers go to
+ * a sink with their times, a transfer that starts while another one is
+ * on the bus counts as an overlap, the arbitration of i2cBus.cpp must
+ * prevent them.
+ */
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include <Arduino.h>
+#include <functional>
+
+/** Transfer on the bus */
+struct sim_i2c_xfer_s
+{
+	uint8_t address;
+	bool read;
+	/** Bytes with the address byte */
+	uint16_t bytes;
+	uint64_t startUs;
+	uint64_t endUs;
+};
+
+class TwoWire : public Stream
+{
+public:
+	void begin(void) {}
+	void setClock(uint32_t clock) { _clock = clock; }
+	void beginTransmission(uint8_t address);
+	uint8_t endTransmission(bool stop = true);
+	uint8_t requestFrom(uint8_t address, uint8_t quantity, bool stop = true);
+	size_t write(uint8_t data) override;
+	size_t write(const uint8_t *data, size_t quantity) override;
+	using Print::write;
+	int available(void) override { return 0; }
+	int read(void) override { return -1; }
+	int peek(void) override { return -1; }
+	/** Bytes written since start */
+	uint32_t bytes(void) { return _bytes; }
+	/** Block the calling task during the transfers like the EasyDMA driver */
+	void dma(bool on) { _dma = on; }
+	/** Function called at the end of each transfer */
+	void sink(std::function<void(const sim_i2c_xfer_s &xfer)> sink) { _sink = sink; }
+	/** Transfers that started while another one was on the bus */
+	uint32_t overlaps(void) { return _overlaps; }
+
+private:
+	void transfer(bool read, uint32_t bytes);
+
+	uint32_t _clock = 400000;
+	uint8_t _address = 0;
+	bool _dma = false;
+	uint8_t _onBus = 0;
+	uint32_t _overlaps = 0;
+	std::function<void(const sim_i2c_xfer_s &xfer)> _sink;
+	uint32_t _pending = 0;
+	uint32_t _bytes = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,322 @@
+/**
+ * @file bluefruit.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Bluefruit BLE API of the host build
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note One central can connect, it is driven by the simulation with
+ * simBleConnect() and friends in sim/sim.h. Callbacks of the
+ * SoftDevice run in the BLE task like on the nRF52. Notifications go
+ * into a TX queue of hvnQueueSize packets that is emptied on every
+ * connection event, notify() blocks while the queue is full.
+ * Implemented in sim/simBle.cpp.
+ */
+#ifndef HOST_BLUEFRUIT_H
+#define HOST_BLUEFRUIT_H
+
+#include <Arduino.h>
+
+#define BLE_CONN_HANDLE_INVALID 0xFFFF
+#define BANDWIDTH_AUTO 0
+#define BANDWIDTH_LOW 1
+#define BANDWIDTH_NORMAL 2
+#define BANDWIDTH_HIGH 3
+#define BANDWIDTH_MAX 4
+#define BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE 0x06
+#define BLE_GAP_PHY_2MBPS 0x02
+
+#define CHR_PROPS_BROADCAST 0x01
+#define CHR_PROPS_READ 0x02
+#define CHR_PROPS_WRITE_WO_RESP 0x04
+#define CHR_PROPS_WRITE 0x08
+#define CHR_PROPS_NOTIFY 0x10
+#define CHR_PROPS_INDICATE 0x20
+
+#define UUID16_SVC_LNS 0x1819
+#define UUID16_CHR_LN_FEATURE 0x2A6A
+#define UUID16_CHR_LOCATION_SPEED 0x2A67
+
+/** Security modes */
+enum SecureMode_t
+{
+	SECMODE_NO_ACCESS = 0,
+	SECMODE_OPEN,
+	SECMODE_ENC_NO_MITM,
+	SECMODE_ENC_WITH_MITM,
+	SECMODE_SIGNED_NO_MITM,
+	SECMODE_SIGNED_WITH_MITM
+};
+
+struct ble_gap_addr_t
+{
+	uint8_t addr_id_peer;
+	uint8_t addr_type;
+	uint8_t addr[6];
+};
+
+struct ble_gap_evt_adv_report_t
+{
+	ble_gap_addr_t peer_addr;
+	int8_t rssi;
+	uint8_t *data;
+	uint16_t len;
+};
+
+class BLEUuid
+{
+public:
+	BLEUuid(uint16_t uuid16) : _uuid16(uuid16), _uuid128(NULL) {}
+	BLEUuid(const char *uuid128) : _uuid16(0), _uuid128(uuid128) {}
+	uint16_t _uuid16;
+	const char *_uuid128;
+};
+
+class BLECharacteristic;
+typedef void (*write_cb_t)(uint16_t conn_hdl, BLECharacteristic *chr, uint8_t *data, uint16_t len);
+
+class BLECharacteristic
+{
+public:
+	BLECharacteristic(BLEUuid uuid = BLEUuid((uint16_t)0)) : uuid(uuid) {}
+	BLEUuid uuid;
+	void setProperties(uint8_t prop) { _props = prop; }
+	void setPermission(SecureMode_t read, SecureMode_t write)
+	{
+		(void)read;
+		(void)write;
+	}
+	void setMaxLen(uint16_t max_len) { _maxLen = max_len; }
+	void setFixedLen(uint16_t fixed_len) { _maxLen = fixed_len; }
+	void setWriteCallback(write_cb_t fp) { _writeCb = fp; }
+	/** Registers the characteristic, the central enables the notifications of all of them */
+	uint32_t begin(void);
+
+	uint16_t write(const void *data, uint16_t len);
+	uint16_t write8(uint8_t num) { return write(&num, 1); }
+	uint16_t write16(uint16_t num) { return write(&num, 2); }
+	uint16_t write32(uint32_t num) { return write(&num, 4); }
+	bool notifyEnabled(void);
+	bool notifyEnabled(uint16_t conn_hdl);
+	bool notify(const void *data, uint16_t len);
+	bool notify(uint16_t conn_hdl, const void *data, uint16_t len);
+
+	/** Value of the characteristic, the central reads it */
+	uint8_t value[256] = {0};
+	uint16_t valueLen = 0;
+	/** Flag if the central enabled the notifications */
+	bool cccdNotify = false;
+	/** Notification statistics */
+	uint32_t notifyCount = 0;
+	uint32_t notifyBytes = 0;
+	uint8_t lastNotify[256] = {0};
+	uint16_t lastNotifyLen = 0;
+	/** Called by the central model for a write */
+	void centralWrite(const uint8_t *data, uint16_t len);
+	/** Next registered characteristic */
+	BLECharacteristic *nextChar = NULL;
+
+private:
+	uint8_t _props = 0;
+	uint16_t _maxLen = 20;
+	write_cb_t _writeCb = NULL;
+};
+
+class BLEService
+{
+public:
+	BLEService(BLEUuid uuid = BLEUuid((uint16_t)0)) : uuid(uuid) {}
+	BLEUuid uuid;
+	virtual uint32_t begin(void) { return 0; }
+	virtual ~BLEService() {}
+};
+
+class BLEDfu : public BLEService
+{
+public:
+	uint32_t begin(void) override { return 0; }
+};
+
+class BLEBas : public BLEService
+{
+public:
+	uint32_t begin(void) override { return 0; }
+	bool write(uint8_t level)
+	{
+		_level = level;
+		return true;
+	}
+	bool notify(uint8_t level);
+	uint8_t level(void) { return _level; }
+
+private:
+	uint8_t _level = 0;
+};
+
+typedef void (*rx_callback_t)(uint16_t conn_hdl);
+
+class BLEUart : public BLEService, public Stream
+{
+public:
+	uint32_t begin(void) override { return 0; }
+	void setRxCallback(rx_callback_t fp) { _rxCb = fp; }
+	int read(uint8_t *buffer, size_t size);
+	int read(void) override;
+	int peek(void) override;
+	int available(void) override;
+	size_t write(uint8_t c) override { return write(&c, 1); }
+	size_t write(const uint8_t *buffer, size_t size) override;
+	using Print::write;
+	/** Called by the central model, text sent to the tracker */
+	void centralSend(const char *text);
+	/** Bytes sent to the central */
+	uint32_t txBytes = 0;
+
+private:
+	rx_callback_t _rxCb = NULL;
+	uint8_t _rx[64];
+	uint16_t _rxLen = 0;
+	uint16_t _rxPos = 0;
+};
+
+class BLEConnection
+{
+public:
+	uint16_t getMtu(void) { return _mtu; }
+	bool connected(void) { return _connected; }
+	bool requestPHY(uint8_t phy = BLE_GAP_PHY_2MBPS)
+	{
+		(void)phy;
+		return true;
+	}
+	bool requestDataLengthUpdate(void) { return true; }
+	bool requestMtuExchange(uint16_t mtu);
+	uint16_t _mtu = 23;
+	uint16_t _centralMtu = 23;
+	bool _connected = false;
+};
+
+typedef void (*connect_callback_t)(uint16_t conn_hdl);
+typedef void (*disconnect_callback_t)(uint16_t conn_hdl, uint8_t reason);
+
+class BLEPeriph
+{
+public:
+	bool setConnInterval(uint16_t min, uint16_t max)
+	{
+		minInterval = min;
+		maxInterval = max;
+		return true;
+	}
+	void setConnectCallback(connect_callback_t fp) { connectCb = fp; }
+	void setDisconnectCallback(disconnect_callback_t fp) { disconnectCb = fp; }
+	uint16_t minInterval = 24;
+	uint16_t maxInterval = 80;
+	connect_callback_t connectCb = NULL;
+	disconnect_callback_t disconnectCb = NULL;
+};
+
+class BLEAdvertising
+{
+public:
+	bool addFlags(uint8_t flags)
+	{
+		(void)flags;
+		return true;
+	}
+	bool addTxPower(void) { return true; }
+	bool addName(void) { return true; }
+	bool addService(BLEService &service)
+	{
+		(void)service;
+		return true;
+	}
+	void restartOnDisconnect(bool enable) { (void)enable; }
+	void setInterval(uint16_t fast, uint16_t slow)
+	{
+		fastInterval = fast;
+		slowInterval = slow;
+	}
+	void setFastTimeout(uint16_t sec) { (void)sec; }
+	bool start(uint16_t timeout = 0)
+	{
+		(void)timeout;
+		running = true;
+		return true;
+	}
+	bool stop(void)
+	{
+		running = false;
+		return true;
+	}
+	uint16_t fastInterval = 32;
+	uint16_t slowInterval = 244;
+	bool running = false;
+};
+
+typedef void (*scan_rx_cb_t)(ble_gap_evt_adv_report_t *report);
+
+class BLEScanner
+{
+public:
+	void setRxCallback(scan_rx_cb_t fp) { rxCb = fp; }
+	void restartOnDisconnect(bool enable) { (void)enable; }
+	void setInterval(uint16_t interval, uint16_t window)
+	{
+		(void)interval;
+		(void)window;
+	}
+	void useActiveScan(bool enable) { (void)enable; }
+	bool start(uint16_t timeout = 0);
+	bool resume(void) { return true; }
+	bool stop(void);
+	bool isRunning(void) { return running; }
+	scan_rx_cb_t rxCb = NULL;
+	bool running = false;
+	/** Number of scans and scan time in ms */
+	uint32_t scans = 0;
+	uint32_t scanMs = 0;
+};
+
+class AdafruitBluefruit
+{
+public:
+	void configPrphBandwidth(uint8_t bw) { (void)bw; }
+	void configPrphConn(uint16_t mtu_max, uint8_t event_len, uint8_t hvn_qsize, uint8_t wrcmd_qsize)
+	{
+		maxMtu = mtu_max;
+		eventLen = event_len;
+		hvnQueueSize = hvn_qsize;
+		(void)wrcmd_qsize;
+	}
+	bool begin(uint8_t prph_count = 1, uint8_t central_count = 0)
+	{
+		(void)prph_count;
+		(void)central_count;
+		return true;
+	}
+	bool setTxPower(int8_t power)
+	{
+		txPower = power;
+		return true;
+	}
+	void setName(const char *name) { (void)name; }
+	uint16_t connHandle(void);
+	BLEConnection *Connection(uint16_t conn_hdl);
+	bool connected(void);
+
+	BLEPeriph Periph;
+	BLEAdvertising Advertising;
+	BLEScanner Scanner;
+
+	int8_t txPower = 0;
+	uint16_t maxMtu = 23;
+	uint8_t eventLen = 3;
+	uint8_t hvnQueueSize = 1;
+};
+
+extern AdafruitBluefruit Bluefruit;
+
+#endif
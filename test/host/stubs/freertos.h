@@ -0,0 +1,144 @@
+/**
+ * @file freertos.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief FreeRTOS API of the host build
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Only the part of the API the tracker uses. Tasks are
+ * coroutines of the simulation in sim/simRtos.cpp, they switch only
+ * when they block, time passes only in the idle model. The scheduler
+ * is cooperative but keeps the priorities: a give that readies a task
+ * with a higher priority switches to it immediately.
+ */
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint32_t StackType_t;
+
+struct SimTask;
+struct SimQueue;
+struct SimTimer;
+typedef SimTask *TaskHandle_t;
+typedef SimQueue *QueueHandle_t;
+typedef SimQueue *SemaphoreHandle_t;
+typedef SimTimer *TimerHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE ((BaseType_t)1)
+#define pdFALSE ((BaseType_t)0)
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define errQUEUE_FULL ((BaseType_t)0)
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFUL)
+
+#define configTICK_RATE_HZ 1000
+#define configUSE_TICKLESS_IDLE 1
+#define configUSE_TRACE_FACILITY 1
+#define configEXPECTED_IDLE_TIME_BEFORE_SLEEP 2
+#define configMAX_PRIORITIES 5
+#define configMAX_TASK_NAME_LEN 12
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+
+// Task priorities of the Adafruit nRF52 core
+#define TASK_PRIO_LOWEST 0
+#define TASK_PRIO_LOW 1
+#define TASK_PRIO_NORMAL 2
+#define TASK_PRIO_HIGH 3
+#define TASK_PRIO_HIGHEST 4
+
+typedef enum
+{
+	eRunning = 0,
+	eReady,
+	eBlocked,
+	eSuspended,
+	eDeleted,
+	eInvalid
+} eTaskState;
+
+struct TaskStatus_t
+{
+	TaskHandle_t xHandle;
+	const char *pcTaskName;
+	UBaseType_t xTaskNumber;
+	eTaskState eCurrentState;
+	UBaseType_t uxCurrentPriority;
+	UBaseType_t uxBasePriority;
+	uint32_t ulRunTimeCounter;
+	StackType_t *pxStackBase;
+	uint16_t usStackHighWaterMark;
+};
+
+// Tasks
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *params,
+					   UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+void vTaskSuspend(TaskHandle_t task);
+void vTaskResume(TaskHandle_t task);
+TickType_t xTaskGetTickCount(void);
+TickType_t xTaskGetTickCountFromISR(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+UBaseType_t uxTaskGetNumberOfTasks(void);
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *status, UBaseType_t size, uint32_t *totalRunTime);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+void taskYIELD(void);
+#define portYIELD_FROM_ISR(x) (void)(x)
+#define portEND_SWITCHING_ISR(x) (void)(x)
+
+// Critical sections, tasks never run concurrently in the simulation
+#define taskENTER_CRITICAL() \
+	do                       \
+	{                        \
+	} while (0)
+#define taskEXIT_CRITICAL() \
+	do                      \
+	{                       \
+	} while (0)
+#define taskDISABLE_INTERRUPTS() taskENTER_CRITICAL()
+#define taskENABLE_INTERRUPTS() taskEXIT_CRITICAL()
+
+// Queues and semaphores
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+void vQueueDelete(QueueHandle_t queue);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken);
+BaseType_t xSemaphoreTakeFromISR(SemaphoreHandle_t sem, BaseType_t *woken);
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+
+// Timers, callbacks run in the timer task
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t autoReload, void *id,
+						   TimerCallbackFunction_t callback);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait);
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer);
+TickType_t xTimerGetPeriod(TimerHandle_t timer);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+#define xTimerStartFromISR(timer, woken) xTimerStart(timer, 0)
+#define xTimerStopFromISR(timer, woken) xTimerStop(timer, 0)
+#define xTimerResetFromISR(timer, woken) xTimerReset(timer, 0)
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ * @file nRF_SSD1306Wire.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief SSD1306 OLED driver of the host build
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Keeps the frame buffer, drawing is not rendered. Commands go
+ * through Wire like in the driver, so they cost bus time.
+ */
+#ifndef HOST_SSD1306_WIRE_H
+#define HOST_SSD1306_WIRE_H
+
+#include <Arduino.h>
+#include <Wire.h>
+
+enum OLEDDISPLAY_GEOMETRY
+{
+	GEOMETRY_128_64 = 0,
+	GEOMETRY_128_32
+};
+
+enum OLEDDISPLAY_COLOR
+{
+	BLACK = 0,
+	WHITE = 1,
+	INVERSE = 2
+};
+
+enum OLEDDISPLAY_TEXT_ALIGNMENT
+{
+	TEXT_ALIGN_LEFT = 0,
+	TEXT_ALIGN_RIGHT,
+	TEXT_ALIGN_CENTER,
+	TEXT_ALIGN_CENTER_BOTH
+};
+
+#define COLUMNADDR 0x21
+#define PAGEADDR 0x22
+#define DISPLAYOFF 0xAE
+#define DISPLAYON 0xAF
+
+extern const uint8_t ArialMT_Plain_10[];
+
+class SSD1306Wire
+{
+public:
+	SSD1306Wire(uint8_t address, int sda, int scl, OLEDDISPLAY_GEOMETRY geometry = GEOMETRY_128_64)
+		: _address(address), _height(geometry == GEOMETRY_128_64 ? 64 : 32)
+	{
+		(void)sda;
+		(void)scl;
+		buffer = _frame;
+	}
+	virtual ~SSD1306Wire() {}
+	bool init(void)
+	{
+		Wire.begin();
+		return true;
+	}
+	void setI2cAutoInit(bool doI2cAutoInit) { (void)doI2cAutoInit; }
+	void displayOn(void) { sendCommand(DISPLAYON); }
+	void displayOff(void) { sendCommand(DISPLAYOFF); }
+	void clear(void) { memset(_frame, 0, sizeof(_frame)); }
+	void flipScreenVertically(void) {}
+	void setContrast(uint8_t contrast) { (void)contrast; }
+	void setFont(const uint8_t *font) { (void)font; }
+	void setColor(OLEDDISPLAY_COLOR color) { _color = color; }
+	void setTextAlignment(OLEDDISPLAY_TEXT_ALIGNMENT alignment) { (void)alignment; }
+	void fillRect(int16_t x, int16_t y, int16_t width, int16_t height)
+	{
+		(void)x;
+		(void)y;
+		(void)width;
+		(void)height;
+	}
+	void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1)
+	{
+		(void)x0;
+		(void)y0;
+		(void)x1;
+		(void)y1;
+	}
+	uint16_t drawString(int16_t x, int16_t y, const char *text)
+	{
+		(void)x;
+		(void)y;
+		return strlen(text);
+	}
+	void display(void) {}
+	uint16_t width(void) { return 128; }
+	uint16_t height(void) { return _height; }
+
+protected:
+	uint8_t *buffer;
+
+private:
+	void sendCommand(uint8_t command)
+	{
+		Wire.beginTransmission(_address);
+		Wire.write(0x80);
+		Wire.write(command);
+		Wire.endTransmission();
+	}
+	uint8_t _address;
+	uint16_t _height;
+	OLEDDISPLAY_COLOR _color = WHITE;
+	uint8_t _frame[128 * 64 / 8];
+};
+
+#endif
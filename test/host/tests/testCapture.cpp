@@ -0,0 +1,227 @@
+/**
+ * @file testCapture.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Round trip of the raw sensor capture with the LoRaWan events
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Built only against the firmware compiled with -DCAPTURE=1, see
+ * the capture target of the Makefile. The firmware joins, sends and gets
+ * class switch downlinks while the capture runs. The capture file is read
+ * back through captureReadBlock() like the BLE export and decoded like
+ * scripts/capture_reader.py. The MAC records must match the sends seen
+ * by the virtual radio and the downlinks of the server.
+ */
+#include "check.h"
+#include "sim.h"
+#include "ns.h"
+#include "main.h"
+#include <LoRaWan-RAK4630.h>
+#include <vector>
+
+#if !CAPTURE
+#error testCapture needs -DCAPTURE=1
+#endif
+
+extern uint8_t nodeDeviceEUI[8];
+extern uint8_t nodeAppEUI[8];
+extern uint8_t nodeAppKey[16];
+
+/** Record of the capture file */
+struct test_record_s
+{
+	uint8_t type;
+	uint32_t timeMs;
+	std::vector<uint8_t> payload;
+};
+
+/** Port and length of the sends seen by the virtual radio */
+static std::vector<std::pair<uint8_t, uint8_t>> sends;
+
+/** Parked, fix after 10 s */
+static sim_gps_state_s parkedGps(uint32_t ms)
+{
+	sim_gps_state_s state;
+	memset(&state, 0, sizeof(state));
+	state.fix = ms >= 10000;
+	state.lat = 35.6895;
+	state.lng = 139.6917;
+	state.alt = 40.0;
+	state.hdop = state.fix ? 90 : 9999;
+	state.satsUsed = state.fix ? 9 : 0;
+	state.inView[0] = 9;
+	state.inView[1] = 6;
+	state.cn0 = 38;
+	state.unixTime = 1600560000 + ms / 1000;
+	return state;
+}
+
+/**
+ * @brief Read the capture file in blocks like the BLE export
+ */
+static std::vector<uint8_t> readFile(void)
+{
+	std::vector<uint8_t> file;
+	uint8_t block[200];
+	uint32_t start = 0;
+	uint32_t next = 0;
+	uint16_t len;
+	while ((len = captureReadBlock(block, sizeof(block), start, &next)) != 0)
+	{
+		uint32_t offset;
+		memcpy(&offset, block, 4);
+		CHECK_EQ(offset, start);
+		uint16_t crc = crc16(block, len - 2);
+		CHECK_EQ(block[len - 2] | (block[len - 1] << 8), crc);
+		file.insert(file.end(), &block[4], &block[len - 2]);
+		start = next;
+	}
+	return file;
+}
+
+/**
+ * @brief Split the file into records, the times from the deltas and the CAPTURE_TIME records
+ */
+static std::vector<test_record_s> decode(const std::vector<uint8_t> &file)
+{
+	std::vector<test_record_s> records;
+	uint32_t now = 0;
+	size_t pos = 0;
+	while (pos + 4 <= file.size())
+	{
+		uint8_t len = file[pos + 1];
+		if (pos + 4 + len > file.size())
+		{
+			break;
+		}
+		test_record_s record;
+		record.type = file[pos];
+		now += file[pos + 2] | (file[pos + 3] << 8);
+		record.payload.assign(file.begin() + pos + 4, file.begin() + pos + 4 + len);
+		if (record.type == CAPTURE_TIME)
+		{
+			memcpy(&now, record.payload.data(), 4);
+		}
+		record.timeMs = now;
+		records.push_back(record);
+		pos += 4 + len;
+	}
+	CHECK_EQ(pos, file.size());
+	return records;
+}
+
+/**
+ * @brief Queue a class switch downlink and wait for the confirmation
+ */
+static void switchClass(uint8_t devClass)
+{
+	const uint8_t down[] = {devClass};
+	nsQueueDownlink(3, down, sizeof(down));
+	CHECK(simRunFor([devClass]() { return currentClass == devClass; }, 300000));
+}
+
+int main(void)
+{
+	simSeed(1);
+	simLoraCfg.rssi = -87;
+	simLoraCfg.snr = 6;
+	simGpsModel(parkedGps);
+	nsAddOtaa(nodeDeviceEUI, nodeAppEUI, nodeAppKey);
+	simLoraOnSend([](uint8_t port, const uint8_t *data, uint8_t len, bool confirmed, int8_t result) {
+		(void)data;
+		(void)confirmed;
+		(void)result;
+		if (captureActive)
+		{
+			sends.push_back({port, len});
+		}
+	});
+	simGpsStart();
+	simStartFirmware();
+
+	// Start before the join, like "capon" over the BLE UART
+	simRun(500);
+	CHECK(!lmhJoined());
+	captureStart();
+	CHECK(simRunFor([]() { return lmhJoined(); }, 120000));
+	simRun(180000);
+	switchClass(CLASS_A);
+	simRun(120000);
+	switchClass(CLASS_C);
+	simRun(60000);
+	captureStop();
+	// The writer waits CAPTURE_MIN_WRITE_GAP after the previous write
+	simRun(CAPTURE_MIN_WRITE_GAP * 2);
+	CHECK(!captureActive);
+	CHECK_EQ(captureStats.dropped, 0);
+
+	std::vector<uint8_t> file = readFile();
+	CHECK_EQ(file.size(), captureStats.fileSize);
+	std::vector<test_record_s> records = decode(file);
+	CHECK(!records.empty() && (records[0].type == CAPTURE_TIME));
+
+	uint32_t times = 0;
+	uint32_t joined = 0;
+	uint32_t gps = 0;
+	std::vector<std::pair<uint8_t, uint8_t>> tx;
+	std::vector<uint8_t> classes;
+	std::vector<test_record_s> rx;
+	uint32_t last = 0;
+	for (const test_record_s &record : records)
+	{
+		CHECK(record.timeMs >= last);
+		last = record.timeMs;
+		times += record.type == CAPTURE_TIME;
+		gps += record.type == CAPTURE_GPS;
+		if (record.type != CAPTURE_MAC)
+		{
+			continue;
+		}
+		switch (record.payload[0])
+		{
+		case CAPTURE_MAC_TX:
+			CHECK_EQ(record.payload.size(), 3);
+			tx.push_back({record.payload[1], record.payload[2]});
+			break;
+		case CAPTURE_MAC_RX:
+			CHECK_EQ(record.payload.size(), 6);
+			rx.push_back(record);
+			break;
+		case CAPTURE_MAC_JOINED:
+			CHECK_EQ(record.payload.size(), 1);
+			joined++;
+			break;
+		case CAPTURE_MAC_CLASS:
+			CHECK_EQ(record.payload.size(), 2);
+			classes.push_back(record.payload[1]);
+			break;
+		default:
+			CHECK(false);
+			break;
+		}
+	}
+	CHECK(last <= millis());
+	// The statistics do not count the CAPTURE_TIME records
+	CHECK_EQ(records.size() - times, captureStats.records);
+	CHECK_EQ(file.size() - times * 12, captureStats.bytes);
+	CHECK(gps != 0);
+	CHECK_EQ(joined, 1);
+	// Class C after the join with the default policy, then the two downlinks
+	CHECK(classes == std::vector<uint8_t>({CLASS_C, CLASS_A, CLASS_C}));
+	CHECK(!tx.empty());
+	CHECK(tx == sends);
+	CHECK_EQ(rx.size(), 2);
+	for (const test_record_s &record : rx)
+	{
+		CHECK_EQ(record.payload[1], 3);
+		CHECK_EQ(record.payload[2], 1);
+		CHECK_EQ((int16_t)(record.payload[3] | (record.payload[4] << 8)), simLoraCfg.rssi);
+		CHECK_EQ((int8_t)record.payload[5], simLoraCfg.snr);
+	}
+	printf("capture %u bytes, %u records, %u GPS, %u TX, %u RX, %u class, %u writes\n", (uint32_t)file.size(),
+		   (uint32_t)records.size(), gps, (uint32_t)tx.size(), (uint32_t)rx.size(), (uint32_t)classes.size(),
+		   captureStats.writes);
+	return checkResult("testCapture");
+}
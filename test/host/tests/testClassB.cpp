@@ -0,0 +1,174 @@
+/**
+ * @file testClassB.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the class B beacon synchronization
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The firmware runs with the medium power policy, which requests
+ * class B after the join. The simulated MAC finds the beacon at the next
+ * multiple of 128 s, the server sends class B downlinks in the next ping
+ * slot.
+ */
+#include "check.h"
+#include "sim.h"
+#include "ns.h"
+#include "main.h"
+#include <LoRaWan-RAK4630.h>
+
+extern uint8_t nodeDeviceEUI[8];
+extern uint8_t nodeAppEUI[8];
+extern uint8_t nodeAppKey[16];
+
+/** Battery voltage of the medium power policy */
+#define TEST_BATT_MV 3800
+
+/** Parked, fix after 10 s */
+static sim_gps_state_s parkedGps(uint32_t ms)
+{
+	sim_gps_state_s state;
+	memset(&state, 0, sizeof(state));
+	state.fix = ms >= 10000;
+	state.lat = 35.6895;
+	state.lng = 139.6917;
+	state.alt = 40.0;
+	state.hdop = state.fix ? 90 : 9999;
+	state.satsUsed = state.fix ? 9 : 0;
+	state.inView[0] = 9;
+	state.inView[1] = 6;
+	state.cn0 = 38;
+	state.unixTime = 1600560000 + ms / 1000;
+	return state;
+}
+
+/**
+ * @brief Run until the class B state changes
+ *
+ * @param state Expected new state
+ * @param maxMs Maximum time in ms
+ * @return uint32_t Time until the change in ms, 0xFFFFFFFF if the state was not reached
+ */
+static uint32_t waitState(uint8_t state, uint32_t maxMs)
+{
+	uint64_t start = simNowUs();
+	if (!simRunFor([state]() { return classBStats.state == state; }, maxMs))
+	{
+		return 0xFFFFFFFF;
+	}
+	return (uint32_t)((simNowUs() - start) / 1000);
+}
+
+/**
+ * @brief Lock, downlinks in the ping slots and the relock after the beacon less operation time
+ */
+static void testLock(void)
+{
+	// The policy requests class B after the join, the search starts before the next beacon
+	CHECK(simRunFor([]() { return lmhJoined(); }, 120000));
+	CHECK_EQ(policyLevel, POLICY_MEDIUM);
+	CHECK(waitState(CLASSB_LOCKED, CLASSB_BEACON_PERIOD * 3) != 0xFFFFFFFF);
+	uint64_t lockedUs = simNowUs();
+	CHECK_EQ(classBStats.searches, 1);
+	CHECK_EQ(classBStats.locks, 1);
+	CHECK_EQ(currentClass, CLASS_B);
+	// With the GPS time the search starts CLASSB_SEARCH_LEAD before the beacon
+	CHECK(classBStats.lastSearchTime <= CLASSB_SEARCH_LEAD + CLASSB_POLL_TIME);
+	// A second request does not restart the lock
+	loraClassRequest(CLASS_B);
+	CHECK_EQ(classBStats.state, CLASSB_LOCKED);
+
+	// The empty uplink after the lock tells the server, it knows the ping slot periodicity
+	CHECK(simRunFor([]() { return nsDeviceClass() == 1; }, 10000));
+	CHECK_EQ(nsPingPeriodicity(), CLASSB_PING_PERIODICITY);
+
+	// Downlinks at random times arrive in the next ping slot, without an uplink
+	uint32_t pingMs = 1000 << CLASSB_PING_PERIODICITY;
+	uint64_t totalMs = 0;
+	uint32_t maxMs = 0;
+	const uint8_t down[] = {0x42};
+	for (int idx = 0; idx < 20; idx++)
+	{
+		simRun(simRandomRange(30000));
+		uint16_t downlinks = classBStats.downlinks;
+		uint64_t start = simNowUs();
+		nsQueueDownlink(LORAWAN_APP_PORT, down, sizeof(down));
+		CHECK(simRunFor([downlinks]() { return classBStats.downlinks != downlinks; }, pingMs * 2));
+		uint32_t latency = (uint32_t)((simNowUs() - start) / 1000);
+		totalMs += latency;
+		maxMs = latency > maxMs ? latency : maxMs;
+	}
+	// The ping slot, server processing and the time on air
+	CHECK(maxMs <= pingMs + 1000);
+	CHECK(totalMs / 20 >= pingMs / 4);
+	CHECK_EQ(classBStats.downlinks, 20);
+	printf("class B downlink latency mean %u ms, max %u ms, ping slot every %u ms\n", (uint32_t)(totalMs / 20),
+		   maxMs, pingMs);
+
+	// The beacon is searched again after the beacon less operation time, before the next beacon
+	CHECK(waitState(CLASSB_SEARCH, CLASSB_RELOCK_INTERVAL + CLASSB_BEACON_PERIOD * 2) != 0xFFFFFFFF);
+	uint32_t relockMs = (uint32_t)((simNowUs() - lockedUs) / 1000);
+	CHECK(relockMs >= CLASSB_RELOCK_INTERVAL);
+	CHECK(relockMs <= CLASSB_RELOCK_INTERVAL + CLASSB_BEACON_PERIOD);
+	CHECK(waitState(CLASSB_LOCKED, CLASSB_SEARCH_TIMEOUT) != 0xFFFFFFFF);
+	CHECK_EQ(classBStats.searches, 2);
+	CHECK_EQ(classBStats.locks, 2);
+	CHECK_EQ(classBStats.failed, 0);
+}
+
+/**
+ * @brief Search timeout and the back off with doubled delays
+ */
+static void testBackoff(void)
+{
+	simLoraCfg.beacon = false;
+	loraClassRequest(CLASS_A);
+	CHECK_EQ(classBStats.state, CLASSB_OFF);
+	loraClassRequest(CLASS_B);
+
+	// The search gives up after CLASSB_SEARCH_TIMEOUT and falls back to class A
+	CHECK(waitState(CLASSB_SEARCH, CLASSB_BEACON_PERIOD * 2) != 0xFFFFFFFF);
+	uint32_t searchMs = waitState(CLASSB_BACKOFF, CLASSB_SEARCH_TIMEOUT * 2);
+	CHECK(searchMs > CLASSB_SEARCH_TIMEOUT);
+	CHECK(searchMs <= CLASSB_SEARCH_TIMEOUT + CLASSB_POLL_TIME * 2);
+	CHECK_EQ(classBStats.failed, 1);
+	CHECK(currentClass == CLASS_A);
+
+	// The delay before the next search doubles with every failed search
+	uint32_t delays[3];
+	for (int idx = 0; idx < 3; idx++)
+	{
+		delays[idx] = waitState(CLASSB_SEARCH, CLASSB_MAX_RETRY_TIME);
+		CHECK(waitState(CLASSB_BACKOFF, CLASSB_SEARCH_TIMEOUT * 2) != 0xFFFFFFFF);
+	}
+	CHECK_EQ(classBStats.failed, 4);
+	// The search waits for the next beacon after the back off
+	CHECK(delays[0] >= CLASSB_RETRY_TIME);
+	CHECK(delays[0] <= CLASSB_RETRY_TIME + CLASSB_BEACON_PERIOD);
+	CHECK(delays[1] >= CLASSB_RETRY_TIME * 2);
+	CHECK(delays[1] <= CLASSB_RETRY_TIME * 2 + CLASSB_BEACON_PERIOD);
+	CHECK(delays[2] >= CLASSB_RETRY_TIME * 4);
+	CHECK(delays[2] <= CLASSB_RETRY_TIME * 4 + CLASSB_BEACON_PERIOD);
+
+	// The beacon is back, the next search locks and resets the back off
+	simLoraCfg.beacon = true;
+	CHECK(waitState(CLASSB_LOCKED, CLASSB_RETRY_TIME * 8 + CLASSB_BEACON_PERIOD * 2) != 0xFFFFFFFF);
+	CHECK_EQ(classBStats.locks, 3);
+	printf("class B search timeout %u ms, back off %u s, %u s, %u s\n", searchMs, delays[0] / 1000,
+		   delays[1] / 1000, delays[2] / 1000);
+}
+
+int main(void)
+{
+	simSeed(1);
+	simBattMv(TEST_BATT_MV);
+	simGpsModel(parkedGps);
+	nsAddOtaa(nodeDeviceEUI, nodeAppEUI, nodeAppKey);
+	simGpsStart();
+	simStartFirmware();
+
+	testLock();
+	testBackoff();
+	return checkResult("testClassB");
+}
@@ -0,0 +1,165 @@
+/**
+ * @file testEncounter.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the BLE encounter table
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Advertising reports go through the scanner model, they only
+ * arrive while a scan runs.
+ */
+#include "check.h"
+#include "sim.h"
+#include "main.h"
+
+/**
+ * @brief Bucket of an address, FNV-1a like the table uses
+ */
+static uint8_t bucketOf(const uint8_t *addr)
+{
+	uint32_t hash = 2166136261UL;
+	for (uint8_t idx = 0; idx < 6; idx++)
+	{
+		hash ^= addr[idx];
+		hash *= 16777619UL;
+	}
+	return hash % ENC_BUCKETS;
+}
+
+/**
+ * @brief Run until the next scan is running
+ */
+static void nextScan(void)
+{
+	uint32_t scans = encStats.scans;
+	CHECK(simRunFor([scans]() { return encStats.scans != scans; }, ENC_SCAN_PERIOD + 100));
+	CHECK(Bluefruit.Scanner.isRunning());
+}
+
+/**
+ * @brief Send an advertising report and let the BLE task handle it
+ */
+static void adv(const uint8_t *addr, int8_t rssi)
+{
+	simBleAdv(addr, rssi);
+	simRun(10);
+}
+
+int main(void)
+{
+	initEncounter();
+
+	// Addresses that all fall into bucket 0
+	uint8_t same[ENC_WAYS + 1][6];
+	uint8_t found = 0;
+	for (uint32_t value = 0; found < ENC_WAYS + 1; value++)
+	{
+		uint8_t addr[6] = {0xC0, 0x11, 0x22, (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value};
+		if (bucketOf(addr) == 0)
+		{
+			memcpy(same[found++], addr, 6);
+		}
+	}
+	uint8_t other[6] = {0xD0, 0x01, 0x02, 0x03, 0x04, 0x05};
+	uint8_t far[6] = {0xD0, 0x01, 0x02, 0x03, 0x04, 0x06};
+
+	// No reports outside of a scan
+	simRun(1000);
+	adv(other, -60);
+	CHECK_EQ(encStats.reports, 0);
+
+	nextScan();
+	for (uint8_t way = 0; way < ENC_WAYS; way++)
+	{
+		adv(same[way], -70);
+	}
+	adv(other, -70);
+	adv(other, -50);
+	// Below ENC_MIN_RSSI
+	adv(far, -95);
+	CHECK_EQ(encStats.reports, ENC_WAYS + 3);
+	CHECK_EQ(encStats.inserts, ENC_WAYS + 1);
+	CHECK_EQ(encStats.updates, 1);
+	CHECK_EQ(encStats.evicted, 0);
+	// The scan stops after ENC_SCAN_TIME
+	simRun(ENC_SCAN_TIME);
+	CHECK(!Bluefruit.Scanner.isRunning());
+	CHECK_EQ(Bluefruit.Scanner.scanMs, ENC_SCAN_TIME);
+
+	// Next scan, all but the first one of the bucket are seen again,
+	// the new address evicts the one not seen for the longest time
+	nextScan();
+	for (uint8_t way = 1; way < ENC_WAYS; way++)
+	{
+		adv(same[way], -70);
+	}
+	adv(same[ENC_WAYS], -65);
+	CHECK_EQ(encStats.evicted, 1);
+	CHECK_EQ(encStats.inserts, ENC_WAYS + 2);
+	adv(same[1], -70);
+	CHECK_EQ(encStats.inserts, ENC_WAYS + 2);
+	// The evicted address is new again
+	adv(same[0], -70);
+	CHECK_EQ(encStats.inserts, ENC_WAYS + 3);
+	CHECK_EQ(encStats.evicted, 2);
+
+	// A scan is postponed while a LoRaWan uplink is in progress
+	simRunFor([]() { return !Bluefruit.Scanner.isRunning(); }, ENC_SCAN_TIME + 100);
+	simRun(ENC_SCAN_PERIOD - ENC_SCAN_TIME - 1000);
+	loraTxTime = millis();
+	simRun(1500);
+	CHECK_EQ(encStats.postponed, 1);
+	CHECK(!Bluefruit.Scanner.isRunning());
+	nextScan();
+	CHECK(millis() - loraTxTime >= ENC_LORA_GUARD);
+
+	// Nothing closed yet
+	encCheck();
+	CHECK(!encPending);
+	simRun(ENC_CLOSE_TIME);
+	encCheck();
+	CHECK(encPending);
+
+	uint8_t frame[ENC_FRAME_LEN];
+	uint8_t len = encGetFrame(frame);
+	CHECK_EQ(len, ENC_FRAME_LEN);
+	CHECK(!encPending);
+	// Uptime based, base time is the first seen of the oldest encounter
+	CHECK_EQ(frame[0], 0);
+	uint32_t base;
+	memcpy(&base, &frame[1], 4);
+	CHECK_EQ(base, ENC_SCAN_PERIOD / 1000);
+	bool foundOther = false;
+	for (uint8_t idx = 0; idx < ENC_BATCH_SIZE; idx++)
+	{
+		uint8_t *entry = &frame[5 + idx * ENC_BYTES];
+		if (memcmp(entry, other, 6) == 0)
+		{
+			foundOther = true;
+			CHECK_EQ(entry[6] | (entry[7] << 8), 0);
+			CHECK_EQ((int8_t)entry[9], -50);
+		}
+	}
+	CHECK(foundOther);
+	encMarkSent();
+	CHECK_EQ(encStats.sent, ENC_BATCH_SIZE);
+	CHECK_EQ(encGetFrame(frame), 0);
+
+	// A single encounter is sent after ENC_MAX_DELAY
+	nextScan();
+	adv(far, -60);
+	simRun(ENC_CLOSE_TIME);
+	encCheck();
+	CHECK(!encPending);
+	simRun(ENC_MAX_DELAY);
+	encCheck();
+	CHECK(encPending);
+	CHECK_EQ(encGetFrame(frame), 5 + ENC_BYTES);
+	CHECK(memcmp(&frame[5], far, 6) == 0);
+	encMarkSent();
+	CHECK_EQ(encStats.sent, ENC_BATCH_SIZE + 1);
+
+	return checkResult("testEncounter");
+}
@@ -0,0 +1,126 @@
+/**
+ * @file testExport.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the track log export blocks
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The blocks are decoded like the central does and compared with
+ * the track log.
+ */
+#include "check.h"
+#include "sim.h"
+#include "main.h"
+
+static int32_t getVarint(const uint8_t *buffer, uint16_t *pos)
+{
+	uint32_t zigzag = 0;
+	uint8_t shift = 0;
+	uint8_t byte;
+	do
+	{
+		byte = buffer[(*pos)++];
+		zigzag |= (uint32_t)(byte & 0x7F) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	return (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+}
+
+/**
+ * @brief Decode a block and compare it with the track log
+ *
+ * @return uint8_t Number of entries in the block
+ */
+static uint8_t checkBlock(const uint8_t *block, uint16_t len, uint32_t expectedStart)
+{
+	uint16_t crc = block[len - 2] | (block[len - 1] << 8);
+	CHECK_EQ(crc16(block, len - 2), crc);
+	uint32_t start;
+	memcpy(&start, block, 4);
+	CHECK_EQ(start, expectedStart);
+	uint8_t count = block[4];
+	track_entry_s entry;
+	memcpy(&entry, &block[5], sizeof(entry));
+	uint16_t pos = 5 + sizeof(entry);
+	bool same = true;
+	for (uint8_t idx = 0; idx < count; idx++)
+	{
+		if (idx != 0)
+		{
+			entry.time += getVarint(block, &pos);
+			entry.lat += getVarint(block, &pos);
+			entry.lng += getVarint(block, &pos);
+			entry.alt += getVarint(block, &pos);
+			entry.speed = block[pos++];
+			entry.hdop = block[pos++];
+		}
+		track_entry_s ref;
+		CHECK(trackLogGet(start + idx, &ref));
+		same = same && (memcmp(&ref, &entry, sizeof(entry)) == 0);
+	}
+	CHECK(same);
+	CHECK_EQ(pos + 2, len);
+	return count;
+}
+
+int main(void)
+{
+	uint8_t block[300];
+	uint32_t next;
+
+	// CRC-16/CCITT-FALSE check value
+	CHECK_EQ(crc16((const uint8_t *)"123456789", 9), 0x29B1);
+
+	// Empty log
+	CHECK_EQ(exportEncodeBlock(block, 244, 0, &next), 0);
+
+	simSeed(32);
+	geo_coord_s position = {356895000, 1396917000};
+	int16_t alt = 40;
+	for (int idx = 0; idx < TRACK_LOG_SIZE + 88; idx++)
+	{
+		simRun(1000 + simRandomRange(60000));
+		position.lat += (int32_t)simRandomRange(20000) - 10000;
+		position.lng += (int32_t)simRandomRange(20000) - 10000;
+		alt += (int16_t)simRandomRange(11) - 5;
+		// Now and then a jump that needs the long varints
+		if (simRandomRange(50) == 0)
+		{
+			position.lat -= 200000000;
+		}
+		trackLogAdd(position, alt, simRandomRange(40), simRandomRange(255));
+	}
+	CHECK_EQ(trackLogFirst(), 88);
+
+	// Not even the first entry fits into a notification with the default MTU
+	CHECK_EQ(exportEncodeBlock(block, 20, 100, &next), 0);
+	CHECK_EQ(next, 100);
+	// Exactly the first entry
+	uint16_t len = exportEncodeBlock(block, 23, 100, &next);
+	CHECK_EQ(len, 23);
+	CHECK_EQ(checkBlock(block, len, 100), 1);
+	CHECK_EQ(next, 101);
+
+	// Entries that were overwritten are skipped
+	uint32_t index = 0;
+	uint32_t blocks = 0;
+	uint32_t bytes = 0;
+	uint32_t entries = 0;
+	while ((len = exportEncodeBlock(block, 244, index, &next)) != 0)
+	{
+		CHECK(len <= 244);
+		entries += checkBlock(block, len, index < trackLogFirst() ? trackLogFirst() : index);
+		bytes += len;
+		blocks++;
+		index = next;
+	}
+	CHECK_EQ(entries, TRACK_LOG_SIZE);
+	CHECK_EQ(index, trackLogEnd());
+	printf("%u entries in %u blocks, %.1f bytes per entry, uncompressed %u\n", entries, blocks,
+		   (double)bytes / entries, (unsigned)sizeof(track_entry_s));
+	CHECK(bytes < entries * sizeof(track_entry_s));
+
+	return checkResult("testExport");
+}
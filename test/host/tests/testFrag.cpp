@@ -0,0 +1,157 @@
+/**
+ * @file testFrag.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the fragmented data block receiver
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The fragments come from the encoder in sim/fragEnc.cpp, lost
+ * data fragments are recovered from the coded fragments.
+ */
+#include "check.h"
+#include "sim.h"
+#include "fragEnc.h"
+#include "main.h"
+
+/** Last block handed to the subsystem */
+static uint32_t blockDescriptor = 0;
+static uint32_t blockSize = 0;
+static uint32_t blockCount = 0;
+
+void fragBlockReceived(uint32_t descriptor, const char *fileName, uint32_t size)
+{
+	(void)fileName;
+	blockDescriptor = descriptor;
+	blockSize = size;
+	blockCount++;
+}
+
+/**
+ * @brief Pass a downlink to the receiver and let the decoder task handle it
+ */
+static void downlink(std::vector<uint8_t> frame)
+{
+	fragDownlink(frame.data(), frame.size());
+	simRun(200);
+}
+
+static std::vector<uint8_t> answer(void)
+{
+	uint8_t buffer[FRAG_ANSWER_LEN];
+	uint8_t len = fragGetAnswer(buffer);
+	return std::vector<uint8_t>(buffer, buffer + len);
+}
+
+/**
+ * @brief Transfer a block, the data fragments in lost are not sent
+ *
+ * @return uint16_t Number of coded fragments that were needed
+ */
+static uint16_t transfer(const std::vector<uint8_t> &block, uint16_t nbFrag, uint8_t fragSize, uint8_t padding,
+						 const std::vector<bool> &lost)
+{
+	downlink(fragEncSetup(0, nbFrag, fragSize, 0, padding, 0x12345678));
+	CHECK(answer() == std::vector<uint8_t>({0x02, 0x00}));
+	for (uint16_t index = 1; index <= nbFrag; index++)
+	{
+		if (!lost[index - 1])
+		{
+			downlink(fragEncFragment(block, nbFrag, fragSize, 0, index));
+		}
+	}
+	uint16_t coded = 0;
+	while ((fragSession.status == FRAG_STATUS_ONGOING) && (coded < 2 * FRAG_MAX_MISSING))
+	{
+		coded++;
+		downlink(fragEncFragment(block, nbFrag, fragSize, 0, nbFrag + coded));
+	}
+	return coded;
+}
+
+int main(void)
+{
+	loopEnable = xSemaphoreCreateBinary();
+	initFrag();
+
+	// PackageVersionReq
+	downlink({0x00});
+	CHECK(answer() == std::vector<uint8_t>({0x00, 0x03, 0x01}));
+
+	// Setup answers, FragIndex 1, too many fragments, other matrix
+	downlink(fragEncSetup(1, 10, 20, 0, 0, 0));
+	CHECK(answer() == std::vector<uint8_t>({0x02, 0x44}));
+	downlink(fragEncSetup(0, FRAG_MAX_NB + 1, 20, 0, 0, 0));
+	CHECK(answer() == std::vector<uint8_t>({0x02, 0x02}));
+	downlink(fragEncSetup(0, 10, FRAG_MAX_SIZE + 1, 0, 0, 0));
+	CHECK(answer() == std::vector<uint8_t>({0x02, 0x02}));
+	downlink(fragEncSetup(0, 10, 20, 1, 0, 0));
+	CHECK(answer() == std::vector<uint8_t>({0x02, 0x01}));
+	CHECK(!fragSession.active);
+
+	// Block without losses
+	simSeed(38);
+	std::vector<uint8_t> block(100 * 48 - 7);
+	for (auto &byte : block)
+	{
+		byte = simRandomRange(256);
+	}
+	std::vector<bool> lost(100, false);
+	CHECK_EQ(transfer(block, 100, 48, 7, lost), 0);
+	CHECK_EQ(fragSession.status, FRAG_STATUS_DONE);
+	CHECK_EQ(blockCount, 1);
+	CHECK_EQ(blockDescriptor, 0x12345678);
+	CHECK_EQ(blockSize, block.size());
+	CHECK(simFsRead("/frag.bin") == std::string(block.begin(), block.end()));
+	// FragSessionStatusAns, all received, none needed, no memory error
+	CHECK(answer() == std::vector<uint8_t>({0x01, 100, 0x00, 0x00, 0x00}));
+
+	// Status request is only answered by participants still missing fragments unless bit 0 is set
+	downlink({0x01, 0x00});
+	CHECK_EQ(answer().size(), 0);
+	downlink({0x01, 0x01});
+	CHECK_EQ(answer().size(), 5);
+
+	// 20 % lost, recovered with the coded fragments
+	for (auto &byte : block)
+	{
+		byte = simRandomRange(256);
+	}
+	uint16_t lostCount = 0;
+	for (uint16_t idx = 0; idx < lost.size(); idx++)
+	{
+		lost[idx] = simRandomRange(5) == 0;
+		lostCount += lost[idx] ? 1 : 0;
+	}
+	uint16_t coded = transfer(block, 100, 48, 7, lost);
+	printf("%d of 100 lost, recovered with %d coded fragments\n", lostCount, coded);
+	CHECK_EQ(fragSession.status, FRAG_STATUS_DONE);
+	CHECK(coded >= lostCount);
+	CHECK(coded < lostCount + 10);
+	CHECK_EQ(blockCount, 2);
+	CHECK(simFsRead("/frag.bin") == std::string(block.begin(), block.end()));
+	answer();
+
+	// More lost than the decoder can hold
+	std::vector<uint8_t> large(200 * 20);
+	std::vector<bool> lostLarge(200, false);
+	for (uint16_t idx = 0; idx <= FRAG_MAX_MISSING; idx++)
+	{
+		lostLarge[idx * 4] = true;
+	}
+	transfer(large, 200, 20, 0, lostLarge);
+	CHECK_EQ(fragSession.status, FRAG_STATUS_NO_MEMORY);
+	CHECK_EQ(blockCount, 2);
+	std::vector<uint8_t> status = answer();
+	CHECK_EQ(status.size(), 5);
+	CHECK_EQ(status[4], 0x01);
+
+	// FragSessionDeleteReq, the second one has no session to delete
+	downlink({0x03, 0x00});
+	CHECK(answer() == std::vector<uint8_t>({0x03, 0x00}));
+	downlink({0x03, 0x00});
+	CHECK(answer() == std::vector<uint8_t>({0x03, 0x04}));
+
+	return checkResult("testFrag");
+}
@@ -0,0 +1,172 @@
+/**
+ * @file testGeo.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the fixed point geo functions against double math
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Prints the max error of distance, bearing and atan2 compared
+ * to the double implementation on the host.
+ */
+#include "check.h"
+#include "sim.h"
+#include "main.h"
+#include <math.h>
+
+/** Earth radius of the haversine reference in m */
+#define EARTH_RADIUS 6371008.8
+
+static double toRad(double deg)
+{
+	return deg * M_PI / 180.0;
+}
+
+/**
+ * @brief Reference distance with the haversine formula
+ */
+static double refDistance(const geo_coord_s &from, const geo_coord_s &to)
+{
+	double lat1 = toRad(from.lat / 1e7);
+	double lat2 = toRad(to.lat / 1e7);
+	double dLat = lat2 - lat1;
+	double dLng = toRad((to.lng - from.lng) / 1e7);
+	double a = sin(dLat / 2) * sin(dLat / 2) + cos(lat1) * cos(lat2) * sin(dLng / 2) * sin(dLng / 2);
+	return 2 * EARTH_RADIUS * atan2(sqrt(a), sqrt(1 - a));
+}
+
+/**
+ * @brief Reference bearing in degree
+ */
+static double refBearing(const geo_coord_s &from, const geo_coord_s &to)
+{
+	double lat1 = toRad(from.lat / 1e7);
+	double lat2 = toRad(to.lat / 1e7);
+	double dLng = toRad((to.lng - from.lng) / 1e7);
+	double y = sin(dLng) * cos(lat2);
+	double x = cos(lat1) * sin(lat2) - sin(lat1) * cos(lat2) * cos(dLng);
+	double bearing = atan2(y, x) * 180.0 / M_PI;
+	return bearing < 0 ? bearing + 360.0 : bearing;
+}
+
+static double angleDiff(double a, double b)
+{
+	double diff = fabs(a - b);
+	return diff > 180.0 ? 360.0 - diff : diff;
+}
+
+static void testRaw(void)
+{
+	RawDegrees raw;
+	raw.deg = 35;
+	raw.billionths = 689512345;
+	CHECK_EQ(geoFromRaw(raw), 356895123);
+	raw.negative = true;
+	raw.deg = 122;
+	raw.billionths = 5;
+	CHECK_EQ(geoFromRaw(raw), -1220000000);
+}
+
+static void testFormat(void)
+{
+	char buffer[16];
+	CHECK(strcmp(geoFormat(buffer, -356895000, GEO_SCALE, 5), "-35.68950") == 0);
+	CHECK(strcmp(geoFormat(buffer, 5, GEO_PAYLOAD_SCALE, 5), "0.00005") == 0);
+	CHECK(strcmp(geoFormat(buffer, 123, 1, 2), "123.00") == 0);
+	CHECK(strcmp(geoFormat(buffer, 1799999999, GEO_SCALE, 0), "179") == 0);
+	CHECK(strcmp(geoFormat(buffer, 0, 100, 1), "0.0") == 0);
+}
+
+static void testTrig(void)
+{
+	int32_t maxError = 0;
+	for (int32_t angle = -3600; angle <= 7200; angle += 7)
+	{
+		int32_t cosRef = (int32_t)lround(cos(toRad(angle / 10.0)) * 32768.0);
+		int32_t sinRef = (int32_t)lround(sin(toRad(angle / 10.0)) * 32768.0);
+		int32_t error = abs(geoCosDeg10(angle) - cosRef);
+		maxError = error > maxError ? error : maxError;
+		error = abs(geoSinDeg10(angle) - sinRef);
+		maxError = error > maxError ? error : maxError;
+	}
+	// Table with 1 degree steps and linear interpolation
+	CHECK(maxError < 4);
+
+	double maxAtan = 0.0;
+	for (int step = 0; step < 3600; step++)
+	{
+		double angle = toRad(step / 10.0 + 0.05);
+		int64_t y = (int64_t)(cos(angle) * 1000000.0);
+		int64_t x = (int64_t)(sin(angle) * 1000000.0);
+		double error = angleDiff(geoAtan2(y, x) / 10.0, step / 10.0 + 0.05);
+		maxAtan = error > maxAtan ? error : maxAtan;
+	}
+	CHECK(maxAtan < 0.35);
+	CHECK_EQ(geoAtan2(0, 0), 0);
+	CHECK_EQ(geoAtan2(100, 0), 0);
+	CHECK_EQ(geoAtan2(0, 100), 900);
+	CHECK_EQ(geoAtan2(-100, 0), 1800);
+	CHECK_EQ(geoAtan2(0, -100), 2700);
+	printf("max error cos/sin %d/32768, atan2 %.3f deg\n", maxError, maxAtan);
+}
+
+static void testDistance(void)
+{
+	simSeed(28);
+	double maxRel = 0.0;
+	double maxBearing = 0.0;
+	for (int run = 0; run < 20000; run++)
+	{
+		geo_coord_s from;
+		from.lat = (int32_t)simRandomRange(1400000000) - 700000000;
+		from.lng = (int32_t)simRandomRange(3599999999UL) - 1799999999;
+		// Up to 10 km between two fixes
+		geo_coord_s to;
+		to.lat = from.lat + (int32_t)simRandomRange(1800000) - 900000;
+		to.lng = from.lng + (int32_t)simRandomRange(1800000) - 900000;
+		double ref = refDistance(from, to);
+		uint32_t distance = geoDistance(from, to);
+		double rel = fabs(distance - ref) / (ref + 1.0);
+		if ((fabs(distance - ref) > 1.0) && (rel > maxRel))
+		{
+			maxRel = rel;
+		}
+		if (ref > 100.0)
+		{
+			double error = angleDiff(geoBearing(from, to) / 10.0, refBearing(from, to));
+			maxBearing = error > maxBearing ? error : maxBearing;
+		}
+	}
+	printf("max error distance %.3f %%, bearing %.3f deg\n", maxRel * 100.0, maxBearing);
+	CHECK(maxRel < 0.003);
+	CHECK(maxBearing < 0.5);
+
+	// Across the date line
+	geo_coord_s west = {0, 1799999000};
+	geo_coord_s east = {0, -1799999000};
+	CHECK_EQ(geoDistance(west, east), 22);
+	CHECK_EQ(geoBearing(west, east), 900);
+}
+
+static void testMove(void)
+{
+	geo_coord_s start = {356895000, 1396917000};
+	geo_coord_s moved = geoMove(start, 1000000, -500000);
+	int64_t north;
+	int64_t east;
+	geoOffset(start, moved, &north, &east);
+	CHECK(llabs(north - 1000000) < 20);
+	CHECK(llabs(east + 500000) < 20);
+	CHECK_EQ(geoDistance(start, moved), 1118);
+}
+
+int main(void)
+{
+	testRaw();
+	testFormat();
+	testTrig();
+	testDistance();
+	testMove();
+	return checkResult("testGeo");
+}
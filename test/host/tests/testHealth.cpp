@@ -0,0 +1,173 @@
+/**
+ * @file testHealth.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the bit packed health frame
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The frame is unpacked with the layout from README.md.
+ */
+#include "check.h"
+#include "sim.h"
+#include "main.h"
+#include <LoRaWan-RAK4630.h>
+
+/** Bit reader for the health frame, MSB first */
+struct bit_reader_s
+{
+	const uint8_t *buffer;
+	uint16_t bitPos;
+};
+
+static uint32_t getBits(bit_reader_s *reader, uint8_t bits)
+{
+	uint32_t value = 0;
+	for (uint8_t bit = 0; bit < bits; bit++)
+	{
+		uint8_t byte = reader->buffer[reader->bitPos >> 3];
+		value = (value << 1) | ((byte >> (7 - (reader->bitPos & 7))) & 1);
+		reader->bitPos++;
+	}
+	return value;
+}
+
+/** Unpacked health frame */
+struct health_frame_s
+{
+	uint32_t version;
+	uint32_t joinTry;
+	uint32_t joined;
+	uint32_t sendOk;
+	uint32_t sendErr;
+	uint32_t lastError;
+	uint32_t noFix;
+	uint32_t noFixStreak;
+	uint32_t accWake;
+	uint32_t bleConnect;
+	uint32_t downlink;
+	uint32_t acc[HEALTH_NUM_ACCS][3];
+	uint32_t uptime;
+	uint32_t cn0;
+	uint32_t inView;
+	uint32_t fixType;
+	uint16_t bits;
+};
+
+static health_frame_s unpack(const uint8_t *buffer)
+{
+	health_frame_s frame;
+	bit_reader_s reader = {buffer, 0};
+	frame.version = getBits(&reader, 4);
+	frame.joinTry = getBits(&reader, 8);
+	frame.joined = getBits(&reader, 8);
+	frame.sendOk = getBits(&reader, 12);
+	frame.sendErr = getBits(&reader, 12);
+	frame.lastError = getBits(&reader, 4);
+	frame.noFix = getBits(&reader, 12);
+	frame.noFixStreak = getBits(&reader, 8);
+	frame.accWake = getBits(&reader, 12);
+	frame.bleConnect = getBits(&reader, 8);
+	frame.downlink = getBits(&reader, 8);
+	const uint8_t accBits[HEALTH_NUM_ACCS] = {8, 8, 7};
+	for (uint8_t acc = 0; acc < HEALTH_NUM_ACCS; acc++)
+	{
+		for (uint8_t value = 0; value < 3; value++)
+		{
+			frame.acc[acc][value] = getBits(&reader, accBits[acc]);
+		}
+	}
+	frame.uptime = getBits(&reader, 12);
+	frame.cn0 = getBits(&reader, 6);
+	frame.inView = getBits(&reader, 6);
+	frame.fixType = getBits(&reader, 2);
+	frame.bits = reader.bitPos;
+	return frame;
+}
+
+int main(void)
+{
+	uint8_t buffer[HEALTH_FRAME_LEN];
+	healthReset();
+
+	// Empty interval
+	uint8_t len = healthGetFrame(buffer);
+	CHECK(len <= HEALTH_FRAME_LEN);
+	health_frame_s frame = unpack(buffer);
+	CHECK_EQ((frame.bits + 7) / 8, len);
+	CHECK_EQ(frame.version, HEALTH_FRAME_VERSION);
+	CHECK_EQ(frame.sendOk, 0);
+	CHECK_EQ(frame.acc[HEALTH_ACC_TTFF][1], 0);
+
+	simRun(2 * 3600000 + 1000);
+	healthInc(HEALTH_JOIN_TRY);
+	healthInc(HEALTH_JOIN_TRY);
+	healthInc(HEALTH_JOINED);
+	healthMarkWake();
+	simRun(1500);
+	healthSendResult(0);
+	healthSendResult(0);
+	healthSendResult(LMH_BUSY);
+	healthGpsResult(true, 12000);
+	healthGpsResult(true, 30000);
+	healthGpsResult(false, 60000);
+	healthGpsResult(false, 60000);
+	healthInc(HEALTH_BLE_CONNECT);
+	healthAdd(HEALTH_ACC_BATT, 80);
+	healthAdd(HEALTH_ACC_BATT, 90);
+	// More than the 12 bits of the field
+	for (int idx = 0; idx < 5000; idx++)
+	{
+		healthInc(HEALTH_ACC_WAKE);
+	}
+
+	len = healthGetFrame(buffer);
+	frame = unpack(buffer);
+	CHECK_EQ(frame.joinTry, 2);
+	CHECK_EQ(frame.joined, 1);
+	CHECK_EQ(frame.sendOk, 2);
+	CHECK_EQ(frame.sendErr, 1);
+	CHECK_EQ(frame.lastError, 1);
+	CHECK_EQ(frame.noFix, 2);
+	CHECK_EQ(frame.noFixStreak, 2);
+	CHECK_EQ(frame.accWake, 4095);
+	CHECK_EQ(frame.bleConnect, 1);
+	CHECK_EQ(frame.downlink, 0);
+	// TTFF in s
+	CHECK_EQ(frame.acc[HEALTH_ACC_TTFF][0], 12);
+	CHECK_EQ(frame.acc[HEALTH_ACC_TTFF][1], 30);
+	CHECK_EQ(frame.acc[HEALTH_ACC_TTFF][2], 21);
+	// Wake to uplink in 100 ms
+	CHECK_EQ(frame.acc[HEALTH_ACC_WAKE_TO_UP][0], 15);
+	CHECK_EQ(frame.acc[HEALTH_ACC_WAKE_TO_UP][2], 15);
+	CHECK_EQ(frame.acc[HEALTH_ACC_BATT][0], 80);
+	CHECK_EQ(frame.acc[HEALTH_ACC_BATT][1], 90);
+	CHECK_EQ(frame.acc[HEALTH_ACC_BATT][2], 85);
+	CHECK_EQ(frame.uptime, 2);
+
+	// The next interval starts from 0, the running no fix streak is kept
+	healthReset();
+	healthGpsResult(false, 60000);
+	healthGetFrame(buffer);
+	frame = unpack(buffer);
+	CHECK_EQ(frame.joinTry, 0);
+	CHECK_EQ(frame.sendOk, 0);
+	CHECK_EQ(frame.accWake, 0);
+	CHECK_EQ(frame.noFix, 1);
+	CHECK_EQ(frame.noFixStreak, 3);
+	CHECK_EQ(frame.acc[HEALTH_ACC_TTFF][1], 0);
+	CHECK_EQ(frame.acc[HEALTH_ACC_BATT][0], 0);
+
+	// A fix ends the streak, the max of the interval stays
+	healthGpsResult(true, 5000);
+	healthGetFrame(buffer);
+	frame = unpack(buffer);
+	CHECK_EQ(frame.noFixStreak, 3);
+	healthReset();
+	healthGetFrame(buffer);
+	frame = unpack(buffer);
+	CHECK_EQ(frame.noFixStreak, 0);
+
+	return checkResult("testHealth");
+}
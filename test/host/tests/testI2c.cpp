@@ -0,0 +1,214 @@
+/**
+ * @file testI2c.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the shared I2C bus arbitration
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Wire runs in DMA mode, the tasks block during the transfers like
+ * with the TWIM EasyDMA driver and the next task gets the CPU. All tasks
+ * have the same priority, so the order of the transactions comes from
+ * i2cAcquire() and not from the scheduler.
+ */
+#include "check.h"
+#include "sim.h"
+#include "main.h"
+#include <vector>
+
+/** Address of the LIS3DH */
+#define TEST_ACC_ADDR 0x18
+/** Transfers of a display page, 6 commands and 8 data blocks */
+#define TEST_PAGE_XFERS 14
+
+/** Transfers seen on the bus */
+static std::vector<sim_i2c_xfer_s> xfers;
+
+/** Client that takes the bus once */
+struct test_client_s
+{
+	uint8_t client;
+	/** Time of the request in ms */
+	uint32_t startMs;
+	/** Time the client keeps the bus in ms */
+	uint32_t holdMs;
+	/** Flag if the client skips i2cAcquire() */
+	bool bypass;
+};
+
+/** Clients in the order they got the bus */
+static std::vector<uint8_t> order;
+
+/**
+ * @brief Task of a client, one transaction and the task ends
+ */
+static void clientTask(void *param)
+{
+	test_client_s *client = (test_client_s *)param;
+	delay(client->startMs);
+	if (!client->bypass)
+	{
+		i2cAcquire(client->client);
+	}
+	order.push_back(client->client);
+	Wire.beginTransmission(client->client == I2C_CLIENT_ACC ? TEST_ACC_ADDR : OLED_ADDRESS);
+	Wire.write((uint8_t)0x00);
+	Wire.endTransmission();
+	if (client->holdMs != 0)
+	{
+		delay(client->holdMs);
+	}
+	if (!client->bypass)
+	{
+		i2cRelease(client->client);
+	}
+	vTaskDelete(NULL);
+}
+
+/**
+ * @brief Start the clients and return the order they got the bus
+ */
+static std::vector<uint8_t> runClients(test_client_s *clients, uint8_t count)
+{
+	order.clear();
+	for (uint8_t idx = 0; idx < count; idx++)
+	{
+		xTaskCreate(clientTask, "client", 256, &clients[idx], TASK_PRIO_LOW, NULL);
+	}
+	simRun(50);
+	return order;
+}
+
+/** Request of the accelerometer task */
+static SemaphoreHandle_t accRequest;
+/** Time of the request and of the end of clearAccInt() in us */
+static uint64_t accRequestUs = 0;
+static uint64_t accDoneUs = 0;
+
+/**
+ * @brief Accelerometer task, clears the interrupt like after a wake up
+ */
+static void accTask(void *param)
+{
+	(void)param;
+	while (true)
+	{
+		xSemaphoreTake(accRequest, portMAX_DELAY);
+		accRequestUs = simNowUs();
+		clearAccInt();
+		accDoneUs = simNowUs();
+	}
+}
+
+/** Request of the display task */
+static SemaphoreHandle_t dispRequest;
+
+/**
+ * @brief Display task, sends the frame buffer
+ */
+static void dispTask(void *param)
+{
+	(void)param;
+	while (true)
+	{
+		xSemaphoreTake(dispRequest, portMAX_DELAY);
+		dispShow();
+	}
+}
+
+/**
+ * @brief Accelerometer read during a frame buffer transfer
+ * @note The read waits only for the end of the current page
+ */
+static void testPaged(void)
+{
+	accRequest = xSemaphoreCreateBinary();
+	dispRequest = xSemaphoreCreateBinary();
+	xTaskCreate(accTask, "acc", 256, NULL, TASK_PRIO_LOW, NULL);
+	xTaskCreate(dispTask, "disp", 256, NULL, TASK_PRIO_LOW, NULL);
+	simRun(10);
+
+	xfers.clear();
+	i2cReset();
+	uint64_t start = simNowUs();
+	simAfter(0, []() { xSemaphoreGiveFromISR(dispRequest, NULL); });
+	// In the middle of the third page
+	simAfter(9000, []() { xSemaphoreGiveFromISR(accRequest, NULL); });
+	simRun(100);
+
+	uint32_t oled = 0;
+	uint32_t accAt = 0;
+	uint32_t acc = 0;
+	uint64_t pageUs = 0;
+	for (const sim_i2c_xfer_s &xfer : xfers)
+	{
+		if (xfer.address == TEST_ACC_ADDR)
+		{
+			accAt = acc++ == 0 ? oled : accAt;
+		}
+		else
+		{
+			if (oled == TEST_PAGE_XFERS - 1)
+			{
+				pageUs = xfer.endUs - start;
+			}
+			oled++;
+		}
+	}
+	CHECK_EQ(oled, TEST_PAGE_XFERS * OLED_HEIGHT / 8);
+	// INT1_SRC address and read
+	CHECK_EQ(acc, 2);
+	// Between two pages, after the page that was on the bus
+	CHECK_EQ(accAt % TEST_PAGE_XFERS, 0);
+	CHECK_EQ(accAt, 3 * TEST_PAGE_XFERS);
+	CHECK(accDoneUs - accRequestUs < pageUs);
+	CHECK_EQ(i2cStats.client[I2C_CLIENT_ACC].transactions, 1);
+	CHECK(i2cStats.client[I2C_CLIENT_ACC].maxWaitUs < pageUs);
+	CHECK_EQ(i2cStats.client[I2C_CLIENT_DISPLAY].transactions, OLED_HEIGHT / 8);
+	printf("page %u us, accelerometer wait %u us, read %u us after the request\n", (uint32_t)pageUs,
+		   i2cStats.client[I2C_CLIENT_ACC].maxWaitUs, (uint32_t)(accDoneUs - accRequestUs));
+}
+
+int main(void)
+{
+	initI2C();
+	initDisplay();
+	Wire.dma(true);
+	Wire.sink([](const sim_i2c_xfer_s &xfer) { xfers.push_back(xfer); });
+
+	// The accelerometer goes before a display client that waits longer
+	test_client_s holdDisplay[] = {
+		{I2C_CLIENT_DISPLAY, 0, 5, false},
+		{I2C_CLIENT_DISPLAY, 1, 0, false},
+		{I2C_CLIENT_ACC, 2, 0, false},
+	};
+	std::vector<uint8_t> got = runClients(holdDisplay, 3);
+	CHECK_EQ(got.size(), 3);
+	CHECK(got == std::vector<uint8_t>({I2C_CLIENT_DISPLAY, I2C_CLIENT_ACC, I2C_CLIENT_DISPLAY}));
+
+	// Waiting accelerometer reads first, the display clients in the order of their requests
+	test_client_s holdAcc[] = {
+		{I2C_CLIENT_ACC, 0, 5, false},
+		{I2C_CLIENT_DISPLAY, 1, 0, false},
+		{I2C_CLIENT_ACC, 2, 0, false},
+		{I2C_CLIENT_DISPLAY, 3, 0, false},
+	};
+	got = runClients(holdAcc, 4);
+	CHECK_EQ(got.size(), 4);
+	CHECK(got == std::vector<uint8_t>({I2C_CLIENT_ACC, I2C_CLIENT_ACC, I2C_CLIENT_DISPLAY, I2C_CLIENT_DISPLAY}));
+	CHECK_EQ(Wire.overlaps(), 0);
+
+	testPaged();
+	CHECK_EQ(Wire.overlaps(), 0);
+
+	// Without the arbitration the transfers of two clients collide
+	test_client_s bypass[] = {
+		{I2C_CLIENT_DISPLAY, 0, 0, true},
+		{I2C_CLIENT_ACC, 0, 0, true},
+	};
+	runClients(bypass, 2);
+	CHECK(Wire.overlaps() != 0);
+
+	return checkResult("testI2c");
+}
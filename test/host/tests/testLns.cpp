@@ -0,0 +1,125 @@
+/**
+ * @file testLns.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the Location and Speed encoding
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The notification is parsed like a GATT client does, the
+ * fields that follow the flags depend on the flag bits.
+ */
+#include "check.h"
+#include "sim.h"
+#include "main.h"
+
+extern BLECharacteristic lnsLocationChar;
+extern BLECharacteristic lnsFeatureChar;
+
+/** Location and Speed fields a client reads */
+struct lns_fields_s
+{
+	uint16_t flags;
+	uint16_t speed;
+	int32_t lat;
+	int32_t lng;
+	int32_t elevation;
+	uint8_t len;
+};
+
+/**
+ * @brief Parse a Location and Speed value, optional fields in the order of the specification
+ */
+static lns_fields_s parse(const uint8_t *data)
+{
+	lns_fields_s fields = {0, 0, 0, 0, 0, 0};
+	uint8_t pos = 0;
+	fields.flags = data[pos] | (data[pos + 1] << 8);
+	pos += 2;
+	if (fields.flags & 0x0001)
+	{
+		fields.speed = data[pos] | (data[pos + 1] << 8);
+		pos += 2;
+	}
+	if (fields.flags & 0x0002)
+	{
+		// Total distance, uint24
+		pos += 3;
+	}
+	if (fields.flags & 0x0004)
+	{
+		memcpy(&fields.lat, &data[pos], 4);
+		memcpy(&fields.lng, &data[pos + 4], 4);
+		pos += 8;
+	}
+	if (fields.flags & 0x0008)
+	{
+		// sint24
+		fields.elevation = data[pos] | (data[pos + 1] << 8) | ((int8_t)data[pos + 2] << 16);
+		pos += 3;
+	}
+	if (fields.flags & 0x0010)
+	{
+		// Heading
+		pos += 2;
+	}
+	if (fields.flags & 0x0020)
+	{
+		// Rolling time
+		pos += 1;
+	}
+	if (fields.flags & 0x0040)
+	{
+		// UTC time
+		pos += 7;
+	}
+	fields.len = pos;
+	return fields;
+}
+
+int main(void)
+{
+	uint8_t buffer[LNS_LOCATION_LEN + 8];
+	geo_coord_s position = {-336895123, 1516917456};
+	uint8_t len = lnsEncode(buffer, position, -1234, 2777);
+	CHECK_EQ(len, LNS_LOCATION_LEN);
+	lns_fields_s fields = parse(buffer);
+	// All fields present in the flags are in the value and nothing else
+	CHECK_EQ(fields.len, len);
+	CHECK_EQ(fields.flags & 0x0020, 0);
+	// Position status bits 7..8, 1 = position ok
+	CHECK_EQ((fields.flags >> 7) & 0x03, 1);
+	CHECK_EQ(fields.speed, 2777);
+	CHECK_EQ(fields.lat, position.lat);
+	CHECK_EQ(fields.lng, position.lng);
+	CHECK_EQ(fields.elevation, -1234);
+
+	len = lnsEncode(buffer, position, 884800, 0);
+	CHECK_EQ(parse(buffer).elevation, 884800);
+
+	// Rate limit of the notifications
+	initBLELns();
+	uint32_t features;
+	memcpy(&features, lnsFeatureChar.value, 4);
+	CHECK_EQ(features & 0x0D, 0x0D);
+	lnsUpdate(position, 100, 0);
+	CHECK_EQ(lnsLocationChar.notifyCount, 0);
+	simBleConnect(23);
+	simRun(1000);
+	lnsUpdate(position, 100, 0);
+	lnsUpdate(position, 100, 0);
+	CHECK_EQ(lnsLocationChar.notifyCount, 1);
+	// The 15 bytes fit into a notification with the default MTU
+	CHECK_EQ(lnsLocationChar.lastNotifyLen, LNS_LOCATION_LEN);
+	simRun(BLE_LNS_NOTIFY_INTERVAL);
+	lnsUpdate(position, 100, 0);
+	CHECK_EQ(lnsLocationChar.notifyCount, 2);
+	lnsSetInterval(0);
+	lnsUpdate(position, 100, 0);
+	lnsUpdate(position, 100, 0);
+	CHECK_EQ(lnsLocationChar.notifyCount, 4);
+	CHECK_EQ(lnsNotifyInterval, 0);
+
+	return checkResult("testLns");
+}
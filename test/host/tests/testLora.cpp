@@ -0,0 +1,261 @@
+/**
+ * @file testLora.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the AES code, the virtual radio and the network server
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note Uses the LoRaMac handler API directly, without the firmware.
+ */
+#include "check.h"
+#include "ns.h"
+#include "aes.h"
+#include <LoRaWan-RAK4630.h>
+
+static uint8_t devEui[8] = {0x00, 0x0D, 0x75, 0xE6, 0x56, 0x4D, 0xC1, 0xF3};
+static uint8_t appEui[8] = {0x70, 0xB3, 0xD5, 0x7E, 0xD0, 0x02, 0x01, 0xE1};
+static uint8_t appKey[16] = {0x2B, 0x84, 0xE0, 0xB0, 0x9B, 0x68, 0xE5, 0xCB,
+							 0x42, 0x17, 0x6F, 0xE7, 0x53, 0xDC, 0xEE, 0x79};
+
+static bool joined = false;
+static uint32_t joinFailed = 0;
+static uint32_t unconfFinished = 0;
+static uint32_t confFinished = 0;
+static bool confResult = false;
+static uint32_t rxCount = 0;
+static uint8_t rxPort = 0;
+static std::string rxData;
+static uint32_t classConfirmed = 0;
+
+static void rxHandler(lmh_app_data_t *data)
+{
+	rxCount++;
+	rxPort = data->port;
+	rxData.assign((const char *)data->buffer, data->buffsize);
+}
+
+static void joinedHandler(void)
+{
+	joined = true;
+}
+
+static void joinFailedHandler(void)
+{
+	joinFailed++;
+}
+
+static void classHandler(DeviceClass_t devClass)
+{
+	(void)devClass;
+	classConfirmed++;
+}
+
+static void unconfHandler(void)
+{
+	unconfFinished++;
+}
+
+static void confHandler(bool result)
+{
+	confFinished++;
+	confResult = result;
+}
+
+static lmh_callback_t callbacks = {NULL, BoardGetUniqueId, BoardGetRandomSeed, rxHandler, joinedHandler,
+								   classHandler, joinFailedHandler, unconfHandler, confHandler};
+
+static std::string hex(const uint8_t *data, size_t len)
+{
+	std::string text;
+	char digits[3];
+	for (size_t idx = 0; idx < len; idx++)
+	{
+		snprintf(digits, sizeof(digits), "%02x", data[idx]);
+		text += digits;
+	}
+	return text;
+}
+
+static void testAes(void)
+{
+	// FIPS-197 appendix C.1
+	uint8_t key[16];
+	uint8_t plain[16];
+	for (int idx = 0; idx < 16; idx++)
+	{
+		key[idx] = idx;
+		plain[idx] = idx * 0x11;
+	}
+	uint8_t cipher[16];
+	uint8_t back[16];
+	aesEncrypt(key, plain, cipher);
+	CHECK(hex(cipher, 16) == "69c4e0d86a7b0430d8cdb78070b4c55a");
+	aesDecrypt(key, cipher, back);
+	CHECK(memcmp(back, plain, 16) == 0);
+
+	// RFC 4493 examples 1 and 2
+	uint8_t cmacKey[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+						   0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+	uint8_t msg[16] = {0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+					   0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a};
+	uint8_t mac[16];
+	aesCmac(cmacKey, NULL, 0, mac);
+	CHECK(hex(mac, 16) == "bb1d6929e95937287fa37d129b756746");
+	aesCmac(cmacKey, msg, 16, mac);
+	CHECK(hex(mac, 16) == "070a16b46b4d4144f79bdd9dd04a287c");
+
+	// FRMPayload encryption is its own inverse
+	uint8_t data[40];
+	for (int idx = 0; idx < 40; idx++)
+	{
+		data[idx] = idx;
+	}
+	loraPayloadCrypt(key, 0, 0x26011234, 7, data, sizeof(data));
+	CHECK(data[5] != 5);
+	loraPayloadCrypt(key, 0, 0x26011234, 7, data, sizeof(data));
+	CHECK(data[5] == 5 && data[39] == 39);
+}
+
+static void testToa(void)
+{
+	// Semtech LoRa calculator, 125 kHz, CR 4/5, 8 symbols preamble, explicit header
+	CHECK_EQ(simLoraToaUs(7, 23, true) / 100, 616);
+	CHECK_EQ(simLoraToaUs(12, 51, true) / 1000, 2465);
+	CHECK_EQ(simLoraSf(DR_0), 12);
+	CHECK_EQ(simLoraSf(DR_5), 7);
+}
+
+static void testJoin(void)
+{
+	nsAddOtaa(devEui, appEui, appKey);
+	lmh_setDevEui(devEui);
+	lmh_setAppEui(appEui);
+	lmh_setAppKey(appKey);
+	lmh_param_t params = {LORAWAN_ADR_OFF, DR_3, LORAWAN_PUBLIC_NETWORK, 8, TX_POWER_15, LORAWAN_DUTYCYCLE_OFF};
+	CHECK_EQ(lmh_init(&callbacks, params, true, CLASS_A, LORAMAC_REGION_AS923), LMH_SUCCESS);
+
+	// The first join request is lost, the second one is accepted
+	simLoraCfg.upLoss = 1.0;
+	lmh_join();
+	simRun(7000);
+	CHECK(!joined);
+	CHECK_EQ(nsStats.joinRequests, 0);
+	simLoraCfg.upLoss = 0.0;
+	CHECK(simRunFor([]() { return joined; }, 20000));
+	CHECK_EQ(nsStats.joinRequests, 1);
+	CHECK_EQ(nsStats.joinAccepts, 1);
+	CHECK_EQ(simLoraStats.joinRequests, 2);
+	CHECK_EQ(lmh_join_status_get(), LMH_SET);
+	CHECK_EQ(lmh_getDevAddr() >> 24, 0x26);
+	CHECK_EQ(joinFailed, 0);
+}
+
+static void testUplinks(void)
+{
+	uint8_t buffer[64] = "hello";
+	lmh_app_data_t data = {buffer, LORAWAN_APP_PORT, 5, 0, 0};
+	CHECK_EQ(lmh_send(&data, LMH_UNCONFIRMED_MSG), LMH_SUCCESS);
+	CHECK_EQ(lmh_send(&data, LMH_UNCONFIRMED_MSG), LMH_BUSY);
+	CHECK(simRunFor([]() { return unconfFinished == 1; }, 5000));
+	CHECK_EQ(nsUplinks().size(), 1);
+	CHECK(std::string(nsUplinks()[0].payload.begin(), nsUplinks()[0].payload.end()) == "hello");
+	CHECK_EQ(nsUplinks()[0].port, LORAWAN_APP_PORT);
+	CHECK_EQ(nsUplinks()[0].fCnt, 0);
+
+	// Payload over the DR3 limit
+	data.buffsize = 116;
+	CHECK_EQ(lmh_send(&data, LMH_UNCONFIRMED_MSG), LMH_ERROR);
+
+	// Confirmed, acknowledged in RX1
+	data.buffsize = 5;
+	CHECK_EQ(lmh_send(&data, LMH_CONFIRMED_MSG), LMH_SUCCESS);
+	CHECK(simRunFor([]() { return confFinished == 1; }, 5000));
+	CHECK(confResult);
+	CHECK_EQ(nsStats.acks, 1);
+	CHECK_EQ(nsUplinks().back().fCnt, 1);
+
+	// The ACKs get lost, the device retransmits with the same frame counter
+	simLoraCfg.downLoss = 1.0;
+	CHECK_EQ(lmh_send(&data, LMH_CONFIRMED_MSG), LMH_SUCCESS);
+	CHECK(simRunFor([]() { return confFinished == 2; }, 60000));
+	CHECK(!confResult);
+	CHECK_EQ(nsStats.retransmissions, 7);
+	CHECK_EQ(nsStats.uplinks, 3);
+	simLoraCfg.downLoss = 0.0;
+
+	// The next uplink has a new frame counter
+	CHECK_EQ(lmh_send(&data, LMH_UNCONFIRMED_MSG), LMH_SUCCESS);
+	CHECK(simRunFor([]() { return unconfFinished == 2; }, 5000));
+	CHECK_EQ(nsUplinks().back().fCnt, 3);
+	CHECK_EQ(nsStats.fCntRejects, 0);
+}
+
+static void testDownlinks(void)
+{
+	uint8_t buffer[64] = "up";
+	lmh_app_data_t data = {buffer, LORAWAN_APP_PORT, 2, 0, 0};
+	const uint8_t down[] = {0x11, 0x22, 0x33};
+	nsQueueDownlink(LORAWAN_APP_PORT, down, sizeof(down), true);
+	CHECK_EQ(lmh_send(&data, LMH_UNCONFIRMED_MSG), LMH_SUCCESS);
+	CHECK(simRunFor([]() { return rxCount == 1; }, 5000));
+	CHECK_EQ(rxPort, LORAWAN_APP_PORT);
+	CHECK(rxData == std::string("\x11\x22\x33"));
+	// Confirmed downlink stays queued until the ACK
+	CHECK_EQ(nsQueued(), 1);
+	simRunFor([]() { return unconfFinished == 3; }, 5000);
+	CHECK_EQ(lmh_send(&data, LMH_UNCONFIRMED_MSG), LMH_SUCCESS);
+	CHECK(simRunFor([]() { return unconfFinished == 4; }, 5000));
+	CHECK_EQ(nsQueued(), 0);
+	CHECK_EQ(rxCount, 1);
+
+	// A frame with a bad MIC is dropped by the server
+	uint8_t frame[16] = {0x40};
+	uint32_t addr = lmh_getDevAddr();
+	memcpy(&frame[1], &addr, 4);
+	frame[6] = 10;
+	uint32_t micFailures = nsStats.micFailures;
+	nsReceive(frame, sizeof(frame), DR_3, simNowUs(), simNowUs());
+	CHECK_EQ(nsStats.micFailures, micFailures + 1);
+}
+
+static void testClassC(void)
+{
+	uint8_t buffer[64];
+	lmh_app_data_t data = {buffer, LORAWAN_APP_PORT, 1, 0, 0};
+	// Class switch downlink of the application, confirmed by the next uplink
+	const uint8_t toC[] = {2};
+	nsQueueDownlink(3, toC, sizeof(toC));
+	CHECK_EQ(lmh_send(&data, LMH_UNCONFIRMED_MSG), LMH_SUCCESS);
+	CHECK(simRunFor([]() { return rxCount == 2; }, 5000));
+	CHECK_EQ(rxPort, 3);
+	CHECK_EQ(lmh_class_request(CLASS_C), LMH_SUCCESS);
+	CHECK_EQ(classConfirmed, 1);
+	simRunFor([]() { return unconfFinished == 5; }, 5000);
+	CHECK_EQ(lmh_send(&data, LMH_UNCONFIRMED_MSG), LMH_SUCCESS);
+	CHECK(simRunFor([]() { return unconfFinished == 6; }, 5000));
+	CHECK_EQ(nsDeviceClass(), 2);
+
+	// Class C gets the downlink without an uplink
+	const uint8_t down[] = {0x42};
+	uint32_t uplinks = nsStats.uplinks;
+	uint64_t start = simNowUs();
+	nsQueueDownlink(LORAWAN_APP_PORT, down, sizeof(down));
+	CHECK(simRunFor([]() { return rxCount == 3; }, 1000));
+	// Server processing and the time on air on DR2
+	CHECK(simNowUs() - start < 500000);
+	CHECK_EQ(nsStats.uplinks, uplinks);
+}
+
+int main(void)
+{
+	simSeed(1);
+	testAes();
+	testToa();
+	testJoin();
+	testUplinks();
+	testDownlinks();
+	testClassC();
+	return checkResult("testLora");
+}
@@ -0,0 +1,111 @@
+/**
+ * @file testMotion.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the motion vector and the dead reckoning decision
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The accelerometer model reports motion through INT1.
+ */
+#include "check.h"
+#include "sim.h"
+#include "main.h"
+
+/** Start position, speed 10 m/s */
+static const geo_coord_s start = {356895000, 1396917000};
+#define SPEED 1000
+
+static void testPredict(void)
+{
+	motion_state_s state;
+	state.position = start;
+	state.time = 0;
+	state.heading = 900;
+	state.speed = SPEED;
+	state.accel = 0;
+	geo_coord_s pos = motionPredict(state, 10000);
+	CHECK_NEAR(geoDistance(start, pos), 100, 1);
+	CHECK_NEAR(geoBearing(start, pos), 900, 2);
+
+	// Braking with 2 m/s^2 stops after 5 s and 25 m
+	state.accel = -200;
+	CHECK_NEAR(geoDistance(start, motionPredict(state, 5000)), 25, 1);
+	CHECK_NEAR(geoDistance(start, motionPredict(state, 20000)), 25, 1);
+
+	// Speeding up with 1 m/s^2, 100 m + 50 m
+	state.accel = 100;
+	CHECK_NEAR(geoDistance(start, motionPredict(state, 10000)), 150, 1);
+}
+
+/**
+ * @brief Drive for a time and report a fix every second
+ *
+ * @param pos Position, updated
+ * @param heading Heading in 1/10 degree
+ * @param seconds Duration
+ */
+static void drive(geo_coord_s *pos, int32_t heading, int seconds)
+{
+	for (int sec = 0; sec < seconds; sec++)
+	{
+		simAccMotion();
+		simRun(1000);
+		// 10 m per second
+		*pos = geoMove(*pos, ((int64_t)10000 * geoCosDeg10(heading)) >> 15, ((int64_t)10000 * geoSinDeg10(heading)) >> 15);
+		motionUpdate(*pos, SPEED);
+	}
+}
+
+static void testDeadReckoning(void)
+{
+	initI2C();
+	CHECK(initACC());
+	simAccSet(0.0F, 0.0F, 1.0F);
+	simRun(1000);
+
+	geo_coord_s pos = start;
+	drive(&pos, 900, 5);
+	CHECK(accIsMoving());
+	CHECK_NEAR(motionNow.heading, 900, 2);
+	CHECK_EQ(motionNow.speed, SPEED);
+	CHECK_EQ(motionNow.accel, 0);
+	motionEncode();
+	CHECK_EQ(trackerData.hd_1 | (trackerData.hd_2 << 8), motionNow.heading);
+	CHECK_EQ(trackerData.spc_1 | (trackerData.spc_2 << 8), SPEED);
+	CHECK(motionShouldSend());
+	motionMarkSent();
+	CHECK_EQ(motionStats.sent, 1);
+
+	// Straight on, the backend extrapolation is good enough
+	for (int minute = 0; minute < 4; minute++)
+	{
+		drive(&pos, 900, 15);
+		CHECK(!motionShouldSend());
+	}
+	CHECK_EQ(motionStats.skipped, 4);
+
+	// A turn to the north drifts away from the extrapolation
+	drive(&pos, 0, 10);
+	CHECK(motionShouldSend());
+	CHECK((motionNow.heading <= 2) || (motionNow.heading >= 3598));
+	motionEncode();
+	motionMarkSent();
+
+	// No motion for more than ACC_MOVING_WINDOW, speed is forced to 0
+	simRun(ACC_MOVING_WINDOW + 1000);
+	CHECK(!accIsMoving());
+	motionUpdate(pos, 150);
+	CHECK_EQ(motionNow.speed, 0);
+	CHECK_EQ(motionNow.accel, 0);
+	// The backend extrapolates 10 m/s to the north, the tracker stopped
+	CHECK(motionShouldSend());
+}
+
+int main(void)
+{
+	testPredict();
+	testDeadReckoning();
+	return checkResult("testMotion");
+}
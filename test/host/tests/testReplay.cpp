@@ -0,0 +1,180 @@
+/**
+ * @file testReplay.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the trace replay
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The same trace has to give the same result bit for bit, a
+ * quiet trace and a fixed set of random traces have no missed or
+ * duplicate reports.
+ */
+#include "check.h"
+#include "replay.h"
+#include <LoRaWan-RAK4630.h>
+
+static bool sameResult(const replay_result_s &a, const replay_result_s &b)
+{
+	return (a.hash == b.hash) && (a.uplinks == b.uplinks) && (a.missedReports == b.missedReports) &&
+		   (a.duplicates == b.duplicates) && (a.rearms == b.rearms) &&
+		   (memcmp(a.latency, b.latency, sizeof(a.latency)) == 0);
+}
+
+int main(void)
+{
+	// The generator is deterministic
+	replay_trace_s trace = replayRandomTrace(7, 3600000);
+	replay_trace_s again = replayRandomTrace(7, 3600000);
+	CHECK_EQ(trace.events.size(), again.events.size());
+	CHECK(!trace.events.empty());
+	bool sorted = true;
+	for (size_t idx = 1; idx < trace.events.size(); idx++)
+	{
+		sorted = sorted && (trace.events[idx - 1].startMs <= trace.events[idx].startMs);
+	}
+	CHECK(sorted);
+
+	// Same trace, same result
+	replay_result_s first = replayRun(trace);
+	replay_result_s second = replayRun(again);
+	CHECK(first.ok);
+	CHECK(second.ok);
+	CHECK(sameResult(first, second));
+	CHECK(first.uplinks > 0);
+	CHECK(first.joinMs > 0);
+
+	// Another seed, another result
+	replay_result_s other = replayRun(replayRandomTrace(8, 3600000));
+	CHECK(other.ok);
+	CHECK(other.hash != first.hash);
+
+	// Parked, nothing happens: a report every interval and no duplicates
+	replay_trace_s quiet;
+	quiet.seed = 1;
+	quiet.durationMs = 3600000;
+	replay_result_s parked = replayRun(quiet);
+	CHECK(parked.ok);
+	CHECK_EQ(parked.missedReports, 0);
+	CHECK_EQ(parked.duplicates, 0);
+	CHECK_EQ(parked.sendErrors, 0);
+	// One report decision per minute with the full power policy
+	CHECK(parked.reports >= 58);
+	CHECK(parked.joinMs < 60000);
+
+	// Idle model: the periodic timer is the only wake up source of the policy
+	CHECK(parked.residency >= 995);
+	CHECK(parked.sleepTicks <= parked.expectedTicks);
+	CHECK(parked.wakeCount[WAKE_TIMER_PERIODIC] >= 58);
+	CHECK_EQ(parked.wakeCount[WAKE_ACC], 0);
+	CHECK_EQ(parked.policyLevel, POLICY_FULL);
+	replay_trace_s critical = quiet;
+	critical.battMv = 3550;
+	replay_result_s low = replayRun(critical);
+	CHECK(low.ok);
+	CHECK_EQ(low.policyLevel, POLICY_CRITICAL);
+	CHECK(low.wakeCount[WAKE_TIMER_PERIODIC] <= 4);
+	CHECK(low.sleeps < parked.sleeps);
+	CHECK(low.residency >= parked.residency);
+	// The class C receive keeps the device awake, class A only opens the windows after the uplinks
+	CHECK_EQ(parked.devClass, CLASS_C);
+	CHECK(parked.deviceResidency < 10);
+	CHECK_EQ(low.devClass, CLASS_A);
+	CHECK(low.deviceResidency >= 990);
+	CHECK(low.deviceResidency <= low.residency);
+
+	// A motion burst is reported, within a report interval
+	replay_trace_s drive = quiet;
+	drive.events.push_back({REPLAY_MOTION, 600000, 300000, 1500, 900});
+	replay_result_s driving = replayRun(drive);
+	CHECK(driving.ok);
+	CHECK_EQ(driving.events[REPLAY_MOTION], 1);
+	CHECK_EQ(driving.latency[REPLAY_MOTION].count, 1);
+	CHECK(driving.latency[REPLAY_MOTION].maxMs <= 60000 + SCHED_MIN_REPORT_GAP);
+	CHECK_EQ(driving.duplicates, 0);
+	CHECK_EQ(driving.missedReports, 0);
+	// The parked reports come from the position cache, while driving the GPS is used
+	CHECK(parked.cacheHits >= 55);
+	CHECK(parked.gpsSavedMs > 0);
+	CHECK(parked.gpsAcquisitions < 5);
+	CHECK(driving.gpsAcquisitions > parked.gpsAcquisitions);
+	CHECK(driving.cacheHits < parked.cacheHits);
+	// Without the cache every report acquires
+	replay_trace_s uncached = quiet;
+	uncached.noPosCache = true;
+	replay_result_s always = replayRun(uncached);
+	CHECK(always.ok);
+	CHECK_EQ(always.cacheHits, 0);
+	CHECK(always.gpsAcquisitions >= parked.reports - 1);
+	CHECK(always.gpsOnMs > parked.gpsOnMs);
+	// Reports follow the motion, not the periodic timer
+	CHECK(driving.wakeCount[WAKE_ACC] > 0);
+	CHECK(driving.wakeCount[WAKE_TIMER_PERIODIC] < parked.wakeCount[WAKE_TIMER_PERIODIC]);
+
+	// An outage: the first report after the outage reaches the server
+	replay_trace_s outage = quiet;
+	outage.events.push_back({REPLAY_SEND_FAIL, 900000, 240000, 0, 0});
+	replay_result_s failed = replayRun(outage);
+	CHECK(failed.ok);
+	CHECK(failed.lost > 0);
+	CHECK_EQ(failed.latency[REPLAY_SEND_FAIL].count, 1);
+	CHECK(failed.latency[REPLAY_SEND_FAIL].maxMs <= 60000 + SCHED_MIN_REPORT_GAP);
+
+	// A delayed join
+	replay_trace_s join = quiet;
+	join.events.push_back({REPLAY_JOIN_DELAY, 0, 120000, 0, 0});
+	replay_result_s joined = replayRun(join);
+	CHECK(joined.ok);
+	CHECK(joined.joinMs >= 120000);
+	CHECK_EQ(joined.latency[REPLAY_JOIN_DELAY].count, 1);
+
+	// A shock raises an alarm that goes out before anything else
+	replay_trace_s shock = quiet;
+	shock.events.push_back({REPLAY_SHOCK, 1200000, 0, 0, 0});
+	replay_result_s alarm = replayRun(shock);
+	CHECK(alarm.ok);
+	CHECK_EQ(alarm.alarmsRaised, 1);
+	CHECK_EQ(alarm.alarmsFailed, 0);
+	CHECK_EQ(alarm.alarmUplinks, 1);
+	CHECK_EQ(alarm.latency[REPLAY_SHOCK].count, 1);
+	CHECK(alarm.latency[REPLAY_SHOCK].maxMs < 1000);
+	// The firmware measures up to the send call, the radio starts later
+	CHECK(alarm.alarmMaxLatency <= alarm.latency[REPLAY_SHOCK].maxMs);
+
+	// Motion from the start: the wake ups during the cold start are merged into the running report
+	replay_trace_s cold = quiet;
+	cold.events.push_back({REPLAY_MOTION, 0, 600000, 1500, 900});
+	replay_result_s merged = replayRun(cold);
+	CHECK(merged.ok);
+	CHECK(merged.pipe.merged + merged.pipe.overlapped > 0);
+	// Every started report leaves the pipeline, the last one may still be in it at the end
+	CHECK(merged.reports - merged.pipe.merged - merged.pipe.endToEnd.count <= 1);
+	CHECK_EQ(merged.pipe.stage[PIPE_POST].count, merged.pipe.endToEnd.count);
+	CHECK_EQ(merged.missedReports, 0);
+
+	// Random traces: no report interval without a report, no report sent twice or lost in the pipeline
+	uint32_t missed = 0;
+	uint32_t duplicates = 0;
+	uint32_t unfinished = 0;
+	for (uint64_t seed = 1; seed <= 50; seed++)
+	{
+		replay_result_s result = replayRun(replayRandomTrace(seed, 3600000));
+		CHECK(result.ok);
+		missed += result.missedReports;
+		duplicates += result.duplicates;
+		uint32_t started = result.reports - result.pipe.merged;
+		unfinished += started - result.pipe.endToEnd.count > 1;
+	}
+	CHECK_EQ(missed, 0);
+	CHECK_EQ(duplicates, 0);
+	CHECK_EQ(unfinished, 0);
+
+	printf("merged %u, overlapped %u, ", merged.pipe.merged, merged.pipe.overlapped);
+	printf("residency MCU %.1f %%, device %.1f %%, critical MCU %.1f %%, device %.1f %%, ", parked.residency / 10.0,
+		   parked.deviceResidency / 10.0, low.residency / 10.0, low.deviceResidency / 10.0);
+	printf("shock to TX %u ms, ", alarm.latency[REPLAY_SHOCK].maxMs);
+	printf("parked %u reports, driving latency %u ms, outage %u ms, join %u ms\n", parked.reports,
+		   driving.latency[REPLAY_MOTION].maxMs, failed.latency[REPLAY_SEND_FAIL].maxMs, joined.joinMs);
+	return checkResult("testReplay");
+}
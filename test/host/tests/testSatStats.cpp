@@ -0,0 +1,82 @@
+/**
+ * @file testSatStats.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the satellite statistics collector
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The sentences are parsed by TinyGPS++ like in gpsPollStep(),
+ * satStatsProcess() runs after every complete sentence.
+ */
+#include "check.h"
+#include "sim.h"
+#include "main.h"
+
+/**
+ * @brief Parse a sentence and collect the statistics
+ */
+static void feed(const char *body)
+{
+	std::string sentence = simNmea(body);
+	for (char c : sentence)
+	{
+		if (myGPS.encode(c))
+		{
+			satStatsProcess();
+		}
+	}
+}
+
+/**
+ * @brief Sum of the C/N0 histogram of a constellation
+ */
+static uint32_t histCount(uint8_t constellation)
+{
+	uint32_t count = 0;
+	for (uint8_t bin = 0; bin < SAT_CN0_BINS; bin++)
+	{
+		count += satStats.cn0Hist[constellation][bin];
+	}
+	return count;
+}
+
+int main(void)
+{
+	initSatStats();
+	memset(&satStats, 0, sizeof(satStats));
+	satStatsStart();
+	CHECK(!satHasGsv());
+
+	// 6 satellites in two messages, the second one has only two
+	feed("GPGSV,2,1,06,01,20,000,42,02,27,037,41,03,34,074,40,04,41,111,39");
+	feed("GPGSV,2,2,06,05,48,148,38,06,55,185,37");
+	CHECK_EQ(satInView(), 6);
+	CHECK_EQ(histCount(SAT_GPS), 6);
+	CHECK_EQ(satStats.cn0Hist[SAT_GPS][4], 3);
+	CHECK_EQ(satStats.cn0Hist[SAT_GPS][3], 3);
+	CHECK_EQ(satStats.maxCn0[SAT_GPS], 42);
+	CHECK(satHasGsv());
+	CHECK(satSignalUsable());
+
+	// Weak signals, the fields 3 and 4 of the first message are not counted again
+	satStatsStart();
+	feed("GPGSV,1,1,02,01,20,000,16,02,27,037,15");
+	CHECK_EQ(satInView(), 2);
+	CHECK_EQ(histCount(SAT_GPS), 8);
+	CHECK_EQ(satStats.cn0Hist[SAT_GPS][1], 2);
+	CHECK(!satSignalUsable());
+
+	// Satellites without C/N0 are not tracked
+	feed("GLGSV,1,1,02,65,20,000,,66,27,037,25");
+	CHECK_EQ(satInView(), 4);
+	CHECK_EQ(histCount(SAT_GLONASS), 1);
+	CHECK(satSignalUsable());
+
+	// Fix type from GSA
+	feed("GPGSA,A,3,01,02,03,04,,,,,,,,,1.26,0.90,1.44");
+	CHECK_EQ(satStats.fixType, 3);
+
+	return checkResult("testSatStats");
+}
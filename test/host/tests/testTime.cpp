@@ -0,0 +1,176 @@
+/**
+ * @file testTime.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the drift estimate and the fix timestamps of the time service
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The crystal error is simulated by the millis() value passed to
+ * timeSyncGps(): the device clock runs ppm faster than the UTC time of
+ * the RMC sentence. The RMC sentences are parsed by TinyGPS++ like in
+ * gpsPollStep().
+ */
+#include "check.h"
+#include "sim.h"
+#include "main.h"
+
+/** UTC time of the first sync, 2020-09-20 00:00:00 in ms */
+#define TEST_START_MS 1600560000000ULL
+/** millis() of the first sync */
+#define TEST_START_MILLIS 1000
+
+/**
+ * @brief Device clock with a crystal error
+ *
+ * @param utcMs UTC time in ms since TEST_START_MS
+ * @param ppm Crystal error, positive if the device clock is fast
+ * @return uint32_t millis() at that time
+ */
+static uint32_t deviceMillis(uint64_t utcMs, int32_t ppm)
+{
+	return TEST_START_MILLIS + (uint32_t)(utcMs + (int64_t)utcMs * ppm / 1000000);
+}
+
+/**
+ * @brief Parse a RMC sentence of a UTC time and sync the clock
+ *
+ * @param utcMs UTC time in ms since TEST_START_MS, multiple of 10 ms
+ * @param ppm Crystal error
+ */
+static void syncAt(uint64_t utcMs, int32_t ppm)
+{
+	uint64_t epochMs = TEST_START_MS + utcMs;
+	time_t seconds = epochMs / 1000;
+	struct tm utc;
+	gmtime_r(&seconds, &utc);
+	char body[96];
+	snprintf(body, sizeof(body), "GPRMC,%02d%02d%02d.%02d,A,3541.3700,N,13941.5020,E,0.000,0.00,%02d%02d%02d,,,A",
+			 utc.tm_hour, utc.tm_min, utc.tm_sec, (int)(epochMs % 1000) / 10, utc.tm_mday, utc.tm_mon + 1,
+			 utc.tm_year % 100);
+	for (char c : simNmea(body))
+	{
+		myGPS.encode(c);
+	}
+	timeSyncGps(deviceMillis(utcMs, ppm));
+}
+
+/**
+ * @brief Reset the time service to never synced
+ */
+static void resetClock(void)
+{
+	memset(&timeStats, 0, sizeof(timeStats));
+}
+
+/**
+ * @brief Fix age while the clock is not synced, the crystal error is not corrected
+ */
+static void testFixAge(void)
+{
+	resetClock();
+	uint32_t fix = millis();
+	simRun(42000);
+	uint16_t stamp = timeEncodeFix(fix);
+	CHECK_EQ(stamp & 0x8000, 0);
+	CHECK_EQ(stamp, 42);
+	// The age saturates after 9 hours
+	simRun(0x8000 * 1000);
+	CHECK_EQ(timeEncodeFix(fix), 0x7FFF);
+	CHECK_EQ(timeNow(), 0);
+}
+
+/**
+ * @brief Drift estimate from GPS syncs at least TIME_DRIFT_MIN_INTERVAL apart
+ *
+ * @param ppm Crystal error
+ * @return uint64_t UTC time of the last sync in ms since TEST_START_MS
+ */
+static uint64_t testDrift(int32_t ppm)
+{
+	resetClock();
+	syncAt(0, ppm);
+	CHECK_EQ(timeStats.source, TIME_SRC_GPS);
+	CHECK_EQ(timeStats.syncs, 1);
+	CHECK_EQ(timeFromMillis(deviceMillis(0, ppm)), TEST_START_MS);
+
+	// Syncs less than an hour apart keep the reference and do not change the estimate
+	syncAt(1800000, ppm);
+	CHECK_EQ(timeStats.syncs, 1);
+	CHECK_EQ(timeStats.driftPpm, 0);
+	CHECK_NEAR(timeStats.lastError, (int64_t)1800000 * ppm / 1000000, 1);
+
+	// Syncs every 61 minutes, a slow clock must still count more than an hour.
+	// Each one halves the remaining error of the estimate.
+	uint64_t utcMs = 0;
+	for (int idx = 1; idx <= 10; idx++)
+	{
+		utcMs = (uint64_t)idx * (TIME_DRIFT_MIN_INTERVAL + 60000);
+		syncAt(utcMs, ppm);
+		if (idx == 1)
+		{
+			CHECK_NEAR(timeStats.driftPpm, ppm / 2, 1);
+		}
+	}
+	CHECK_EQ(timeStats.syncs, 11);
+	CHECK_NEAR(timeStats.driftPpm, ppm, 2);
+	// The residual error of the last hour is a few ms
+	CHECK_NEAR(timeStats.lastError, 0, 10);
+	return utcMs;
+}
+
+/**
+ * @brief Fix timestamps a day after the last sync, with and without the drift correction
+ */
+static void testStamp(int32_t ppm, uint64_t lastSync)
+{
+	uint64_t utcMs = lastSync + 24 * 3600000ULL + 1000;
+	uint16_t stamp = timeEncodeFix(deviceMillis(utcMs, ppm));
+	CHECK_EQ(stamp & 0x8000, 0x8000);
+	uint16_t expected = ((TEST_START_MS + utcMs) / 2000) & 0x7FFF;
+	// Within one 2 s step of the UTC time
+	CHECK_NEAR((int32_t)(stamp & 0x7FFF), (int32_t)expected, 1);
+
+	// Without the estimate the timestamp is off by the crystal error
+	int32_t drift = timeStats.driftPpm;
+	timeStats.driftPpm = 0;
+	uint16_t raw = timeEncodeFix(deviceMillis(utcMs, ppm));
+	timeStats.driftPpm = drift;
+	int32_t rawError = (int32_t)(raw & 0x7FFF) - (int32_t)expected;
+	CHECK(rawError * ppm > 0);
+	CHECK((rawError >= 2) || (rawError <= -2));
+	printf("crystal %+d ppm: estimate %+d ppm, fix after 24 h off by %d s, %d s without the estimate\n", ppm, drift,
+		   ((int32_t)(stamp & 0x7FFF) - (int32_t)expected) * 2, rawError * 2);
+}
+
+int main(void)
+{
+	testFixAge();
+
+	const int32_t crystal[] = {100, -60, 250};
+	for (int32_t ppm : crystal)
+	{
+		testStamp(ppm, testDrift(ppm));
+	}
+
+	// The estimate is limited to 500 ppm
+	resetClock();
+	for (int idx = 0; idx <= 10; idx++)
+	{
+		syncAt((uint64_t)idx * TIME_DRIFT_MIN_INTERVAL, 800);
+	}
+	CHECK_EQ(timeStats.driftPpm, 500);
+
+	// Network time does not change the estimate
+	resetClock();
+	syncAt(0, 100);
+	syncAt(TIME_DRIFT_MIN_INTERVAL, 100);
+	int32_t drift = timeStats.driftPpm;
+	CHECK(drift != 0);
+	timeStats.source = TIME_SRC_NETWORK;
+	syncAt(2 * TIME_DRIFT_MIN_INTERVAL, 100);
+	CHECK_EQ(timeStats.driftPpm, drift);
+
+	return checkResult("testTime");
+}
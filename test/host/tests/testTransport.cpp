@@ -0,0 +1,224 @@
+/**
+ * @file testTransport.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Tests of the uplink transport selection
+ * @version 0.1
+ * @date 2020-09-20
+ *
+ * @copyright Copyright (c) 2020
+ *
+ * @note The LoRaWan and BLE relay transports are replaced by stand-ins
+ * with the same transport_s entries. The backend stand-in keeps the
+ * first frame of each sequence number and drops the copies that arrive
+ * over the second path.
+ */
+#include "check.h"
+#include "sim.h"
+#include "main.h"
+#include <LoRaWan-RAK4630.h>
+#include <map>
+#include <set>
+
+/** Stand-in of one transport */
+struct stand_in_s
+{
+	bool up;
+	/** Result of the send, the frame reaches the backend even if the result is an error */
+	int8_t result;
+	bool delivers;
+	uint32_t calls;
+};
+
+static stand_in_s lora;
+static stand_in_s ble;
+
+/** Frames the backend received per sequence number, and the accepted ones */
+static std::map<uint16_t, uint32_t> received;
+static std::set<uint16_t> accepted;
+
+/**
+ * @brief Backend, accepts the first frame of a sequence number
+ */
+static void backend(uint8_t *buffer, uint8_t len)
+{
+	CHECK_EQ(len, 4);
+	uint16_t seq = buffer[0] | (buffer[1] << 8);
+	received[seq]++;
+	accepted.insert(seq);
+}
+
+static int8_t standInSend(stand_in_s *transport, uint8_t *buffer, uint8_t len)
+{
+	transport->calls++;
+	if (transport->delivers)
+	{
+		backend(buffer, len);
+	}
+	return transport->result;
+}
+
+static bool loraUp(void)
+{
+	return lora.up;
+}
+
+static int8_t loraSend(uint8_t port, uint8_t *buffer, uint8_t len)
+{
+	(void)port;
+	return standInSend(&lora, buffer, len);
+}
+
+static bool bleUp(void)
+{
+	return ble.up;
+}
+
+static int8_t bleSend(uint8_t port, uint8_t *buffer, uint8_t len)
+{
+	(void)port;
+	return standInSend(&ble, buffer, len);
+}
+
+/**
+ * @brief Reset the stand-ins, both up and delivering
+ */
+static void reset(void)
+{
+	lora = {true, 0, true, 0};
+	ble = {true, 0, true, 0};
+}
+
+/**
+ * @brief Send a frame with the next sequence number
+ */
+static int8_t sendFrame(void)
+{
+	uint8_t frame[4];
+	uint16_t seq = transportNextSeq();
+	frame[0] = seq;
+	frame[1] = seq >> 8;
+	frame[2] = 0x42;
+	frame[3] = 0x43;
+	return transportSend(LORAWAN_APP_PORT, frame, sizeof(frame));
+}
+
+static void testCheapestFirst(void)
+{
+	// BLE costs less than LoRaWan
+	reset();
+	CHECK(transportAnyUp());
+	CHECK_EQ(sendFrame(), 0);
+	CHECK_EQ(ble.calls, 1);
+	CHECK_EQ(lora.calls, 0);
+	CHECK(lastTransport == &bleRelayTransport);
+
+	// Only LoRaWan is up
+	reset();
+	ble.up = false;
+	CHECK_EQ(sendFrame(), 0);
+	CHECK_EQ(ble.calls, 0);
+	CHECK_EQ(lora.calls, 1);
+	CHECK(lastTransport == &loraTransport);
+
+	// The cost decides, not the order of the table
+	reset();
+	uint8_t bleCost = bleRelayTransport.energyCost;
+	bleRelayTransport.energyCost = loraTransport.energyCost + 1;
+	CHECK_EQ(sendFrame(), 0);
+	CHECK_EQ(lora.calls, 1);
+	CHECK_EQ(ble.calls, 0);
+	bleRelayTransport.energyCost = bleCost;
+
+	// Nothing is up
+	reset();
+	ble.up = false;
+	lora.up = false;
+	CHECK(!transportAnyUp());
+	CHECK(sendFrame() != 0);
+	CHECK_EQ(ble.calls + lora.calls, 0);
+	CHECK(lastTransport == NULL);
+}
+
+static void testFallback(void)
+{
+	// The relay fails, the frame goes out over LoRaWan
+	reset();
+	ble.result = -3;
+	ble.delivers = false;
+	CHECK_EQ(sendFrame(), 0);
+	CHECK_EQ(ble.calls, 1);
+	CHECK_EQ(lora.calls, 1);
+	CHECK(lastTransport == &loraTransport);
+
+	// Both fail, the error of the last tried transport is returned
+	reset();
+	ble.result = -3;
+	lora.result = -5;
+	ble.delivers = false;
+	lora.delivers = false;
+	CHECK_EQ(sendFrame(), -5);
+	CHECK_EQ(ble.calls, 1);
+	CHECK_EQ(lora.calls, 1);
+	CHECK(lastTransport == NULL);
+
+	// A transport is tried only once per frame
+	reset();
+	lora.up = false;
+	ble.result = -3;
+	CHECK_EQ(sendFrame(), -3);
+	CHECK_EQ(ble.calls, 1);
+}
+
+static void testDedup(void)
+{
+	received.clear();
+	accepted.clear();
+	// The relay delivers but reports a failure, the frame arrives over both paths
+	uint32_t frames = 200;
+	for (uint32_t idx = 0; idx < frames; idx++)
+	{
+		reset();
+		if (idx % 3 == 0)
+		{
+			ble.result = -3;
+		}
+		CHECK_EQ(sendFrame(), 0);
+	}
+	uint32_t copies = 0;
+	for (auto &entry : received)
+	{
+		copies += entry.second - 1;
+	}
+	CHECK_EQ(copies, (frames + 2) / 3);
+	// Every frame is accepted once
+	CHECK_EQ(accepted.size(), frames);
+
+	// The sequence number wraps, consecutive frames never share one
+	uint16_t last = transportNextSeq();
+	bool consecutive = true;
+	for (uint32_t idx = 0; idx < 0x10000; idx++)
+	{
+		uint16_t seq = transportNextSeq();
+		consecutive = consecutive && (seq == (uint16_t)(last + 1));
+		last = seq;
+	}
+	CHECK(consecutive);
+}
+
+int main(void)
+{
+	transport_s loraOrig = loraTransport;
+	transport_s bleOrig = bleRelayTransport;
+	loraTransport.isUp = loraUp;
+	loraTransport.send = loraSend;
+	bleRelayTransport.isUp = bleUp;
+	bleRelayTransport.send = bleSend;
+
+	testCheapestFirst();
+	testFallback();
+	testDedup();
+
+	loraTransport = loraOrig;
+	bleRelayTransport = bleOrig;
+	return checkResult("testTransport");
+}